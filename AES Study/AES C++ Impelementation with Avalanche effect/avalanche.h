@@ -0,0 +1,396 @@
+/*
+ * avalanche.h - AES-128 encryption rounds and the avalanche effect helpers.
+ *
+ * The block function is templated on a round observer (see NoObserver), so the
+ * tracing variants share the exact cipher code of AESEncrypt.
+ *
+ * Shared by encrypt.cpp (interactive tool), sweep.cpp (batch sweep over every bit)
+ * and sac.cpp (Strict Avalanche / Bit Independence matrices).
+ * Each program is compiled as a single translation unit, like structures.h.
+ *
+ * ParseHexKey and HexEncode are scalar copies of the ones in hexcodec.h of the other
+ * implementation, so the keyfile and hex output behave the same in both directories.
+ */
+
+#ifndef AVALANCHE_H
+#define AVALANCHE_H
+
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+
+#include "structures.h"
+
+/*
+    XORs each byte of the state with the corresponding round key byte.
+    serves as the initial round during encryption
+    AddRoundKey is simplye an XOR of a 128-bit block with the 128-bit key.
+    the AddRoundKey step is one of the four main transformations in each AES round. it ensures that the encryption is securely linked to the secret key, making brute-force attacks difficult.
+*/
+void AddRoundKey(unsigned char* state, unsigned char* roundKey)
+{
+    for(int i = 0; i < 16; i++)
+    {
+        state[i] ^= roundKey[i];
+    }
+}
+
+
+/*
+    Perform substitution to each of the 16 bytes 
+    uses S-box as lookup table
+
+*/
+
+void subBytes(unsigned char * state){
+    for(int i = 0 ; i < 16 ; i++){
+        state[i] = s[state[i]];
+    }
+}
+
+
+// Shifts rows to the left for diffusion.
+void ShiftRows(unsigned char * state){
+    unsigned char temp[16];
+
+    // first column
+    temp[0] = state[0];
+    temp[1] = state[5];
+    temp[2] = state[10];
+    temp[3] = state[15];
+
+    // second column
+    temp[4] = state[4];
+    temp[5] = state[9];
+    temp[6] = state[14];
+    temp[7] = state[3];
+    // third column
+    temp[8] = state[8];
+    temp[9] = state[13];
+    temp[10] = state[2];
+    temp[11] = state[7];
+    // fourth column
+    temp[12] = state[12];   
+    temp[13] = state[1];
+    temp[14] = state[6];
+    temp[15] = state[11];
+
+    for(int i = 0 ; i < 16 ; i++){
+        state[i] = temp[i];
+    }
+}
+
+
+/* MixColumns uses mul2, mul3 look-up tables
+  * Source of diffusion
+  */
+ void MixColumns(unsigned char * state) {
+	unsigned char tmp[16];
+
+	tmp[0] = (unsigned char) mul2[state[0]] ^ mul3[state[1]] ^ state[2] ^ state[3];
+	tmp[1] = (unsigned char) state[0] ^ mul2[state[1]] ^ mul3[state[2]] ^ state[3];
+	tmp[2] = (unsigned char) state[0] ^ state[1] ^ mul2[state[2]] ^ mul3[state[3]];
+	tmp[3] = (unsigned char) mul3[state[0]] ^ state[1] ^ state[2] ^ mul2[state[3]];
+
+	tmp[4] = (unsigned char)mul2[state[4]] ^ mul3[state[5]] ^ state[6] ^ state[7];
+	tmp[5] = (unsigned char)state[4] ^ mul2[state[5]] ^ mul3[state[6]] ^ state[7];
+	tmp[6] = (unsigned char)state[4] ^ state[5] ^ mul2[state[6]] ^ mul3[state[7]];
+	tmp[7] = (unsigned char)mul3[state[4]] ^ state[5] ^ state[6] ^ mul2[state[7]];
+
+	tmp[8] = (unsigned char)mul2[state[8]] ^ mul3[state[9]] ^ state[10] ^ state[11];
+	tmp[9] = (unsigned char)state[8] ^ mul2[state[9]] ^ mul3[state[10]] ^ state[11];
+	tmp[10] = (unsigned char)state[8] ^ state[9] ^ mul2[state[10]] ^ mul3[state[11]];
+	tmp[11] = (unsigned char)mul3[state[8]] ^ state[9] ^ state[10] ^ mul2[state[11]];
+
+	tmp[12] = (unsigned char)mul2[state[12]] ^ mul3[state[13]] ^ state[14] ^ state[15];
+	tmp[13] = (unsigned char)state[12] ^ mul2[state[13]] ^ mul3[state[14]] ^ state[15];
+	tmp[14] = (unsigned char)state[12] ^ state[13] ^ mul2[state[14]] ^ mul3[state[15]];
+	tmp[15] = (unsigned char)mul3[state[12]] ^ state[13] ^ state[14] ^ mul2[state[15]];
+
+	for (int i = 0; i < 16; i++) {
+		state[i] = tmp[i];
+	}
+}
+
+
+/*
+    Steps of a round, passed to the round observer after each one.
+*/
+enum AESStep {
+    STEP_SUB_BYTES,
+    STEP_SHIFT_ROWS,
+    STEP_MIX_COLUMNS,
+    STEP_ADD_ROUND_KEY
+};
+
+/*
+    Round observer policy used by AESEncryptObserved().
+    afterStep() is called after every step and afterRound() once a round is complete
+    (round 0 is the initial AddRoundKey, round 10 the final round).
+    The calls are resolved at compile time, so with NoObserver the empty bodies are
+    inlined away and AESEncrypt() compiles to the plain cipher.
+*/
+struct NoObserver {
+    void afterStep(int, AESStep, const unsigned char *) {}
+    void afterRound(int, const unsigned char *) {}
+};
+
+
+/* Each round operates on 128 bits at a time 
+    the number of rounds is defined in AESEncrypt()
+*/
+template <class Observer>
+void Round(unsigned char * state, unsigned char * key, int round, Observer &observer){
+    subBytes(state);
+    observer.afterStep(round, STEP_SUB_BYTES, state);
+    ShiftRows(state);
+    observer.afterStep(round, STEP_SHIFT_ROWS, state);
+    MixColumns(state);
+    observer.afterStep(round, STEP_MIX_COLUMNS, state);
+    AddRoundKey(state,key);
+    observer.afterStep(round, STEP_ADD_ROUND_KEY, state);
+    observer.afterRound(round, state);
+}
+
+void Round(unsigned char * state, unsigned char * key){
+    NoObserver observer;
+    Round(state, key, 0, observer);
+}
+
+
+// same as Round() except it doesn't mix columns
+template <class Observer>
+void FinalRound(unsigned char * state, unsigned char * key, int round, Observer &observer){
+    subBytes(state);
+    observer.afterStep(round, STEP_SUB_BYTES, state);
+    ShiftRows(state);
+    observer.afterStep(round, STEP_SHIFT_ROWS, state);
+    AddRoundKey(state,key);
+    observer.afterStep(round, STEP_ADD_ROUND_KEY, state);
+    observer.afterRound(round, state);
+}
+
+void FinalRound(unsigned char * state, unsigned char * key){
+    NoObserver observer;
+    FinalRound(state, key, 10, observer);
+}
+
+
+// The AES ecryption function organizes the confusion and diffusion steps into one function.
+// The observer sees the state after every step and round (see NoObserver).
+template <class Observer>
+void AESEncryptObserved(unsigned char * message, unsigned char * expandedKey, unsigned char * enctypedMessage, Observer &observer){
+
+    unsigned char state[16]; // stores the first 16 bytes of orginal message
+
+    for(int i =0 ; i< 16 ; i++){
+        state[i] = message[i];
+    }
+
+    int numberOfRounds = 9;
+
+    AddRoundKey(state, expandedKey); // initial round
+    observer.afterStep(0, STEP_ADD_ROUND_KEY, state);
+    observer.afterRound(0, state);
+
+    for(int i = 0 ; i< numberOfRounds; i++){
+        Round(state, expandedKey + (16 * (i+1)), i + 1, observer);
+    }
+
+    FinalRound(state , expandedKey + 160, 10, observer);
+
+    // Copy encrypted state to buffer
+    for(int i = 0 ; i< 16 ; i++){
+        enctypedMessage[i] = state[i];
+    }
+
+}
+
+void AESEncrypt(unsigned char * message, unsigned char * expandedKey, unsigned char * enctypedMessage){
+    NoObserver observer;
+    AESEncryptObserved(message, expandedKey, enctypedMessage, observer);
+}
+
+// Number of set bits in a 64-bit word (compiles to popcnt where the target has it)
+inline int popcount64(unsigned long long x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(x);
+#else
+    int count = 0;
+    while (x) {
+        x &= x - 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+// Function to count differing bits between two blocks
+int countChangedBits(unsigned char *original, unsigned char *modified, int length) {
+    int count = 0;
+    int i = 0;
+    // 8 bytes at a time with the hardware popcount, then the tail byte by byte
+    for (; i + 8 <= length; i += 8) {
+        unsigned long long a, b;
+        memcpy(&a, original + i, 8);
+        memcpy(&b, modified + i, 8);
+        count += popcount64(a ^ b);
+    }
+    for (; i < length; i++) {
+        count += popcount64((unsigned char) (original[i] ^ modified[i]));
+    }
+    return count;
+}
+
+// Function to flip a specific bit in a byte array
+void flipBit(unsigned char *data, int bitPos) {
+    int byteIndex = bitPos / 8;
+    int bitIndex = bitPos % 8;
+    data[byteIndex] ^= (1 << bitIndex);
+}
+
+// Value of a hex digit, or -1
+inline int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/*
+    Parses a 128-bit key written as hex, e.g. the "keyfile" format "54 68 61 74 ...".
+    Tokens are separated by whitespace and each must be one byte (2 hex digits), or the
+    whole key is one token of 32 hex digits; "5 468 61..." is rejected, not re-paired.
+*/
+bool ParseHexKey(const std::string &text, unsigned char key[16]) {
+    int n = 0, high = 0, tokenLength = 0;
+    for (size_t i = 0; i <= text.size(); i++) {
+        char c = i < text.size() ? text[i] : ' ';
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            // a token ends: one byte, or the whole key at once
+            if (tokenLength != 0 && tokenLength != 2 && tokenLength != 32) {
+                return false;
+            }
+            tokenLength = 0;
+            continue;
+        }
+        // a token longer than one byte has to be the whole key, so it must start at digit 0
+        int value = hexValue(c);
+        if (value < 0 || n == 32 || (tokenLength >= 2 && n != tokenLength)) {
+            return false;
+        }
+        if (n % 2 == 0) {
+            high = value;
+        } else {
+            key[n / 2] = (unsigned char) (high << 4 | value);
+        }
+        n++;
+        tokenLength++;
+    }
+    return n == 32;
+}
+
+// Lower-case hex of length bytes, two digits each (0x0a is "0a")
+std::string HexEncode(const unsigned char *in, size_t length) {
+    const char digits[] = "0123456789abcdef";
+    std::string text(2 * length, '0');
+    for (size_t i = 0; i < length; i++) {
+        text[2 * i] = digits[in[i] >> 4];
+        text[2 * i + 1] = digits[in[i] & 0x0f];
+    }
+    return text;
+}
+
+/*
+    Round observers. They only write into memory owned by the caller,
+    so tracing a block costs no allocation or formatting.
+*/
+
+// Keeps a copy of the state after every round
+struct RoundStateObserver {
+    unsigned char (*roundStates)[16];
+
+    void afterStep(int, AESStep, const unsigned char *) {}
+    void afterRound(int round, const unsigned char *state) {
+        memcpy(roundStates[round], state, 16);
+    }
+};
+
+// Keeps a copy of the state after every step, in order (1 + 9 * 4 + 3 = 40 states per block)
+struct StepStateObserver {
+    unsigned char (*stepStates)[16];
+    int stepsRecorded;
+
+    void afterStep(int, AESStep, const unsigned char *state) {
+        memcpy(stepStates[stepsRecorded++], state, 16);
+    }
+    void afterRound(int, const unsigned char *) {}
+};
+
+// Records the Hamming distance after every round between the state and a reference block
+// (a fixed block such as the plaintext, or the matching round state of another run)
+struct HammingObserver {
+    const unsigned char *reference;   // 16 bytes, or 11 x 16 bytes when perRoundReference is set
+    bool perRoundReference;
+    int *distances;                   // 11 entries
+
+    void afterStep(int, AESStep, const unsigned char *) {}
+    void afterRound(int round, const unsigned char *state) {
+        const unsigned char *ref = perRoundReference ? reference + 16 * round : reference;
+        distances[round] = countChangedBits(const_cast<unsigned char*>(ref), const_cast<unsigned char*>(state), 16);
+    }
+};
+
+// Counts how many times each step ran
+struct StepCounterObserver {
+    unsigned long long steps[4];
+    unsigned long long rounds;
+
+    void afterStep(int, AESStep step, const unsigned char *) {
+        steps[step]++;
+    }
+    void afterRound(int, const unsigned char *) {
+        rounds++;
+    }
+};
+
+
+// Modified AES Encryption function to track avalanche effect:
+// writes the bits changed against the input block after every round as "round,bits" lines
+void AESEncryptWithAvalanche(unsigned char *message, unsigned char *expandedKey, unsigned char *encryptedMessage, std::ofstream &dataFile) {
+    int distances[11];
+    HammingObserver observer = { message, false, distances };
+    AESEncryptObserved(message, expandedKey, encryptedMessage, observer);
+
+    for (int round = 0; round < 11; round++) {
+        dataFile << round << "," << distances[round] << "\n";
+    }
+}
+
+// Same rounds as AESEncryptWithAvalanche, but keeps a copy of the state after every round
+// (index 0 is the initial AddRoundKey, index 10 the final round) instead of writing to a file.
+// Comparing the states of two runs gives the per-round avalanche between them.
+void AESEncryptWithAvalanche(unsigned char *message, unsigned char *expandedKey, unsigned char *encryptedMessage, unsigned char roundStates[11][16]) {
+    RoundStateObserver observer = { roundStates };
+    AESEncryptObserved(message, expandedKey, encryptedMessage, observer);
+}
+
+/*
+    Random plaintext and key for one sample of a statistical run.
+    Every sample gets its own generator seeded from (seed, sample index),
+    so the result does not depend on the thread count or on where a run was resumed.
+*/
+void makeSample(unsigned long long seed, unsigned long long sampleIndex, unsigned char plaintext[16], unsigned char key[16]) {
+    std::seed_seq seq{ (unsigned int) seed, (unsigned int) (seed >> 32), (unsigned int) sampleIndex, (unsigned int) (sampleIndex >> 32) };
+    std::mt19937_64 rng(seq);
+
+    unsigned long long words[4];
+    for (int i = 0; i < 4; i++) {
+        words[i] = rng();
+    }
+    memcpy(plaintext, words, 16);
+    memcpy(key, words + 2, 16);
+}
+
+#endif /* AVALANCHE_H */
@@ -0,0 +1,231 @@
+/*
+ * chaining.h - Block cipher modes over whole messages, for the mode-aware avalanche analysis.
+ *
+ * ECB, CBC, CTR and GCM (NIST SP 800-38A / 38D) built on AESEncrypt() from avalanche.h,
+ * plus the inverse cipher that ECB and CBC decryption need. Messages are whole blocks
+ * (the tools pad them the way encrypt.cpp does), so no mode needs a padding rule.
+ *
+ * This directory is self-contained, so the inverse cipher is kept here as well as in the
+ * other implementation; it is the textbook one with the mul9/11/13/14 tables of structures.h.
+ */
+
+#ifndef CHAINING_H
+#define CHAINING_H
+
+#include <cstring>
+
+#include "avalanche.h"
+
+enum ChainingMode { MODE_ECB, MODE_CBC, MODE_CTR, MODE_GCM, NUM_CHAINING_MODES };
+const char * const chainingModeNames[NUM_CHAINING_MODES] = { "ECB", "CBC", "CTR", "GCM" };
+
+const int GCM_IV_BYTES = 12;
+
+
+// --------------------------------------------------------
+// Inverse cipher
+// --------------------------------------------------------
+
+void InvSubBytes(unsigned char * state) {
+    for (int i = 0; i < 16; i++) {
+        state[i] = inv_s[state[i]];
+    }
+}
+
+// Shifts rows to the right: the inverse of ShiftRows()
+void InvShiftRows(unsigned char * state) {
+    unsigned char temp[16];
+    for (int column = 0; column < 4; column++) {
+        for (int row = 0; row < 4; row++) {
+            temp[4 * ((column + row) % 4) + row] = state[4 * column + row];
+        }
+    }
+    memcpy(state, temp, 16);
+}
+
+void InvMixColumns(unsigned char * state) {
+    unsigned char tmp[16];
+    for (int c = 0; c < 16; c += 4) {
+        tmp[c]     = mul14[state[c]] ^ mul11[state[c + 1]] ^ mul13[state[c + 2]] ^ mul9[state[c + 3]];
+        tmp[c + 1] = mul9[state[c]] ^ mul14[state[c + 1]] ^ mul11[state[c + 2]] ^ mul13[state[c + 3]];
+        tmp[c + 2] = mul13[state[c]] ^ mul9[state[c + 1]] ^ mul14[state[c + 2]] ^ mul11[state[c + 3]];
+        tmp[c + 3] = mul11[state[c]] ^ mul13[state[c + 1]] ^ mul9[state[c + 2]] ^ mul14[state[c + 3]];
+    }
+    memcpy(state, tmp, 16);
+}
+
+void AESDecrypt(const unsigned char * encryptedMessage, unsigned char * expandedKey, unsigned char * decryptedMessage) {
+    unsigned char state[16];
+    memcpy(state, encryptedMessage, 16);
+
+    AddRoundKey(state, expandedKey + 160);
+    for (int round = 9; round >= 1; round--) {
+        InvShiftRows(state);
+        InvSubBytes(state);
+        AddRoundKey(state, expandedKey + 16 * round);
+        InvMixColumns(state);
+    }
+    InvShiftRows(state);
+    InvSubBytes(state);
+    AddRoundKey(state, expandedKey);
+
+    memcpy(decryptedMessage, state, 16);
+}
+
+
+// --------------------------------------------------------
+// GCM helpers
+// --------------------------------------------------------
+
+// Big-endian increment of the last 32 bits (inc32 of SP 800-38D)
+inline void incrementCounter32(unsigned char counter[16]) {
+    for (int i = 15; i >= 12; i--) {
+        if (++counter[i] != 0) break;
+    }
+}
+
+// Full 128-bit big-endian increment, as the CTR mode of SP 800-38A uses it here
+inline void incrementCounter128(unsigned char counter[16]) {
+    for (int i = 15; i >= 0; i--) {
+        if (++counter[i] != 0) break;
+    }
+}
+
+// X * Y in GF(2^128) with the GCM bit order (SP 800-38D algorithm 1), into x
+void gfMultiply(unsigned char x[16], const unsigned char y[16]) {
+    unsigned char z[16] = { 0 }, v[16];
+    memcpy(v, y, 16);
+    for (int i = 0; i < 128; i++) {
+        if ((x[i / 8] >> (7 - i % 8)) & 1) {
+            for (int k = 0; k < 16; k++) z[k] ^= v[k];
+        }
+        bool lsb = v[15] & 1;
+        for (int k = 15; k > 0; k--) {
+            v[k] = (unsigned char) ((v[k] >> 1) | (v[k - 1] << 7));
+        }
+        v[0] >>= 1;
+        if (lsb) v[0] ^= 0xe1;
+    }
+    memcpy(x, z, 16);
+}
+
+// GHASH of the ciphertext (no additional data) and the length block; h is E(0)
+void gcmTag(const unsigned char * ciphertext, int blocks, const unsigned char h[16], const unsigned char encryptedJ0[16], unsigned char tag[16]) {
+    unsigned char y[16] = { 0 };
+    for (int b = 0; b < blocks; b++) {
+        for (int k = 0; k < 16; k++) y[k] ^= ciphertext[16 * b + k];
+        gfMultiply(y, h);
+    }
+    unsigned long long bits = (unsigned long long) blocks * 128;
+    for (int k = 0; k < 8; k++) {
+        y[15 - k] ^= (unsigned char) (bits >> (8 * k));
+    }
+    gfMultiply(y, h);
+    for (int k = 0; k < 16; k++) tag[k] = y[k] ^ encryptedJ0[k];
+}
+
+
+// J0 = IV || 0^31 || 1, H = E(0) and E(J0), for a 96-bit IV
+void gcmSetup(const unsigned char * iv, unsigned char * expandedKey, unsigned char j0[16], unsigned char h[16], unsigned char encryptedJ0[16]) {
+    unsigned char zero[16] = { 0 };
+    memset(j0, 0, 16);
+    memcpy(j0, iv, GCM_IV_BYTES);
+    j0[15] = 1;
+    AESEncrypt(zero, expandedKey, h);
+    AESEncrypt(j0, expandedKey, encryptedJ0);
+}
+
+
+// --------------------------------------------------------
+// Modes
+// --------------------------------------------------------
+
+/*
+    Encrypts blocks * 16 bytes of in into out under mode. iv is 16 bytes (CBC IV, CTR initial
+    counter) or GCM_IV_BYTES (GCM); ECB ignores it. GCM also writes the 16-byte tag.
+    in and out must not overlap.
+*/
+void encryptMessage(ChainingMode mode, const unsigned char * in, int blocks, unsigned char * expandedKey,
+                    const unsigned char * iv, unsigned char * out, unsigned char tag[16]) {
+    unsigned char block[16], counter[16];
+    switch (mode) {
+    case MODE_ECB:
+        for (int b = 0; b < blocks; b++) {
+            AESEncrypt(const_cast<unsigned char*>(in + 16 * b), expandedKey, out + 16 * b);
+        }
+        break;
+    case MODE_CBC:
+        memcpy(block, iv, 16);
+        for (int b = 0; b < blocks; b++) {
+            for (int k = 0; k < 16; k++) block[k] ^= in[16 * b + k];
+            AESEncrypt(block, expandedKey, out + 16 * b);
+            memcpy(block, out + 16 * b, 16);
+        }
+        break;
+    case MODE_CTR:
+        memcpy(counter, iv, 16);
+        for (int b = 0; b < blocks; b++) {
+            AESEncrypt(counter, expandedKey, block);
+            for (int k = 0; k < 16; k++) out[16 * b + k] = in[16 * b + k] ^ block[k];
+            incrementCounter128(counter);
+        }
+        break;
+    case MODE_GCM: {
+        unsigned char j0[16], h[16], encryptedJ0[16];
+        gcmSetup(iv, expandedKey, j0, h, encryptedJ0);
+        memcpy(counter, j0, 16);
+        for (int b = 0; b < blocks; b++) {
+            incrementCounter32(counter);
+            AESEncrypt(counter, expandedKey, block);
+            for (int k = 0; k < 16; k++) out[16 * b + k] = in[16 * b + k] ^ block[k];
+        }
+        gcmTag(out, blocks, h, encryptedJ0, tag);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/*
+    The inverse of encryptMessage(). For GCM the tag is recomputed from the ciphertext and
+    the return value says whether it matches expectedTag; the plaintext is still written,
+    so the analysis can see what an unauthenticated decryption would have produced.
+*/
+bool decryptMessage(ChainingMode mode, const unsigned char * in, int blocks, unsigned char * expandedKey,
+                    const unsigned char * iv, unsigned char * out, const unsigned char expectedTag[16]) {
+    switch (mode) {
+    case MODE_ECB:
+        for (int b = 0; b < blocks; b++) {
+            AESDecrypt(in + 16 * b, expandedKey, out + 16 * b);
+        }
+        return true;
+    case MODE_CBC:
+        for (int b = 0; b < blocks; b++) {
+            const unsigned char *previous = b == 0 ? iv : in + 16 * (b - 1);
+            AESDecrypt(in + 16 * b, expandedKey, out + 16 * b);
+            for (int k = 0; k < 16; k++) out[16 * b + k] ^= previous[k];
+        }
+        return true;
+    case MODE_CTR:
+        encryptMessage(mode, in, blocks, expandedKey, iv, out, NULL);
+        return true;
+    case MODE_GCM: {
+        // the tag covers the ciphertext: check it on in, then run the keystream over it
+        unsigned char j0[16], h[16], encryptedJ0[16], tag[16], counter[16], block[16];
+        gcmSetup(iv, expandedKey, j0, h, encryptedJ0);
+        gcmTag(in, blocks, h, encryptedJ0, tag);
+        memcpy(counter, j0, 16);
+        for (int b = 0; b < blocks; b++) {
+            incrementCounter32(counter);
+            AESEncrypt(counter, expandedKey, block);
+            for (int k = 0; k < 16; k++) out[16 * b + k] = in[16 * b + k] ^ block[k];
+        }
+        return memcmp(tag, expectedTag, 16) == 0;
+    }
+    default:
+        return false;
+    }
+}
+
+#endif /* CHAINING_H */
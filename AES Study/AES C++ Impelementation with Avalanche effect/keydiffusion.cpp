@@ -0,0 +1,508 @@
+/*
+    AES-128 Key Schedule Diffusion
+
+    - For many random keys, flips every key bit (0-127) one at a time, re-expands the key
+      and measures how far the flip has spread through each of the 11 round keys: the
+      Hamming distance to the round key of the unflipped key, and which bytes changed.
+    - The 128 flipped keys of a sample are expanded together, one SIMD lane per key: the
+      schedule is stored byte-sliced (w[byte][lane]), so every XOR of the key schedule is
+      one vector operation over 16 lanes, SubWord of 16 lanes is one AESENCLAST and bits
+      are counted with PSHUFB nibble lookups. Without AES-NI/SSSE3 (or with -S 0) the same
+      layout runs with per-lane S-box lookups and a SWAR popcount, 8 lanes per 64-bit word.
+    - The lanes of the first sample are checked against KeyExpansion.
+    - Reports per-round-key mean, variance, min and max of changed bits, and the share
+      of round-key bytes touched.
+    - Writes per-bit, per-round-key results to "key_diffusion.csv" and per-byte results
+      (mean changed bits, probability that the byte changed) to "key_diffusion_bytes.csv".
+
+    Usage: keydiffusion [-n samples] [-t threads] [-s seed] [-o output file] [-b byte output file] [-S 0 (portable lanes)]
+    Build: g++ -O2 -pthread keydiffusion.cpp -o keydiffusion.exe
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include "avalanche.h"
+
+using namespace std;
+
+
+const int LANES = 128;          // one lane per flipped key bit
+const int NUM_ROUND_KEYS = 11;
+const int SCHEDULE_BYTES = 176;
+
+
+// The key schedules of the 128 flipped keys, byte-sliced: w[i][lane] is byte i of lane's schedule
+struct alignas(64) LaneSchedule {
+    unsigned char w[SCHEDULE_BYTES][LANES];
+};
+
+/*
+    Running statistics for one (flipped bit, round key) cell, as in sweep.cpp, and the
+    per-byte totals: the changed bits of each schedule byte, and how often it changed.
+*/
+struct RoundStats {
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long sumSquares;
+    int min;
+    int max;
+};
+
+struct DiffusionStats {
+    RoundStats cells[LANES][NUM_ROUND_KEYS];
+    unsigned long long byteBits[SCHEDULE_BYTES][LANES];
+    unsigned long long byteChanged[SCHEDULE_BYTES][LANES];
+};
+
+/*
+    Per-thread work area: the lane schedules, and 16-bit per-byte counters that are added
+    to DiffusionStats every PENDING_SAMPLES samples (8 bits per sample at most), so the
+    per-sample counting stays in narrow vector adds.
+*/
+const int PENDING_SAMPLES = 8000;
+
+struct alignas(64) LaneWork {
+    LaneSchedule schedule;
+    unsigned short pendingBits[SCHEDULE_BYTES][LANES];
+    unsigned short pendingChanged[SCHEDULE_BYTES][LANES];
+    int pendingSamples;
+};
+
+
+/*
+    The random key of one sample, from splitmix64 over (seed, sample index): like makeSample()
+    it depends only on those two numbers, but seeding an mt19937 per sample would cost more
+    than expanding all 128 flipped keys.
+*/
+void sampleKey(unsigned long long seed, unsigned long long sampleIndex, unsigned char key[16]) {
+    unsigned long long state = seed * 0xd1b54a32d192ed03ULL + sampleIndex;
+    for (int half = 0; half < 2; half++) {
+        unsigned long long z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        z ^= z >> 31;
+        memcpy(key + 8 * half, &z, 8);
+    }
+}
+
+// Bit count of each byte of x (SWAR)
+inline unsigned long long bytePopcounts(unsigned long long x) {
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    return (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+}
+
+// Expands key with bit lane flipped, for every lane at once (the same steps as KeyExpansion)
+void expandFlippedKeys(const unsigned char key[16], LaneSchedule &schedule) {
+    for (int i = 0; i < 16; i++) {
+        for (int lane = 0; lane < LANES; lane++) {
+            schedule.w[i][lane] = key[i] ^ (lane / 8 == i ? (unsigned char) (1 << (lane % 8)) : 0);
+        }
+    }
+
+    unsigned char core[4][LANES];
+    int rconIteration = 1;
+    for (int n = 16; n < SCHEDULE_BYTES; n += 4) {
+        const unsigned char (*temp)[LANES] = &schedule.w[n - 4];
+        if (n % 16 == 0) {
+            // RotWord, SubWord and the round constant, lane by lane
+            for (int lane = 0; lane < LANES; lane++) {
+                core[0][lane] = s[schedule.w[n - 3][lane]] ^ rcon[rconIteration];
+                core[1][lane] = s[schedule.w[n - 2][lane]];
+                core[2][lane] = s[schedule.w[n - 1][lane]];
+                core[3][lane] = s[schedule.w[n - 4][lane]];
+            }
+            rconIteration++;
+            temp = core;
+        }
+        for (int a = 0; a < 4; a++) {
+            for (int lane = 0; lane < LANES; lane++) {
+                schedule.w[n + a][lane] = schedule.w[n + a - 16][lane] ^ temp[a][lane];
+            }
+        }
+    }
+}
+
+// Hamming distance of every lane's round keys to the base ones: into distances[r][lane],
+// and into the pending per-byte counters
+void countDistances(const unsigned char base[SCHEDULE_BYTES], LaneWork &work, unsigned char distances[NUM_ROUND_KEYS][LANES]) {
+    for (int r = 0; r < NUM_ROUND_KEYS; r++) {
+        // 8 lanes per word; a distance is at most 128, so a byte holds it
+        unsigned long long distance[LANES / 8] = { 0 };
+        for (int i = 16 * r; i < 16 * r + 16; i++) {
+            unsigned long long broadcast = base[i] * 0x0101010101010101ULL;
+            unsigned char bits[LANES];
+            for (int word = 0; word < LANES / 8; word++) {
+                unsigned long long lanes;
+                memcpy(&lanes, &work.schedule.w[i][8 * word], 8);
+                unsigned long long counts = bytePopcounts(lanes ^ broadcast);
+                distance[word] += counts;
+                memcpy(&bits[8 * word], &counts, 8);
+            }
+            for (int lane = 0; lane < LANES; lane++) {
+                work.pendingBits[i][lane] += bits[lane];
+                work.pendingChanged[i][lane] += bits[lane] != 0;
+            }
+        }
+        memcpy(distances[r], distance, LANES);
+    }
+}
+
+
+/*
+    The same two steps with SSE vectors of 16 lanes. SubWord of 16 lanes is one AESENCLAST:
+    it runs ShiftRows, SubBytes and the round key XOR, so the lanes are put through the
+    inverse ShiftRows first and the round constant is given as the round key. Bits are
+    counted with a 16-entry nibble table (PSHUFB). Compiled for AES-NI and SSSE3 with a
+    target attribute and used only when the CPU has them.
+*/
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_LANE_SIMD 1
+#define LANE_SIMD_TARGET __attribute__((target("aes,ssse3")))
+
+bool laneSimdAvailable() {
+    return __builtin_cpu_supports("aes") && __builtin_cpu_supports("ssse3");
+}
+
+LANE_SIMD_TARGET void expandFlippedKeysSimd(const unsigned char key[16], LaneSchedule &schedule) {
+    const __m128i inverseShiftRows = _mm_setr_epi8(0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3);
+    for (int i = 0; i < 16; i++) {
+        __m128i keyByte = _mm_set1_epi8((char) key[i]);
+        for (int v = 0; v < LANES / 16; v++) {
+            // lanes 8i..8i+7 flip a bit of byte i: they fall in vector i / 2
+            __m128i flips = _mm_setzero_si128();
+            if (v == i / 2) {
+                flips = i % 2 == 0 ? _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0)
+                                   : _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8, 16, 32, 64, -128);
+            }
+            _mm_store_si128((__m128i *) &schedule.w[i][16 * v], _mm_xor_si128(keyByte, flips));
+        }
+    }
+
+    int rconIteration = 1;
+    for (int n = 16; n < SCHEDULE_BYTES; n += 16) {
+        __m128i roundConstant = _mm_set1_epi8((char) rcon[rconIteration++]);
+        for (int v = 0; v < LANES / 16; v++) {
+            // RotWord: the core takes bytes n-3, n-2, n-1, n-4
+            __m128i core[4];
+            for (int a = 0; a < 4; a++) {
+                __m128i in = _mm_load_si128((const __m128i *) &schedule.w[n - 4 + (a + 1) % 4][16 * v]);
+                core[a] = _mm_aesenclast_si128(_mm_shuffle_epi8(in, inverseShiftRows), a == 0 ? roundConstant : _mm_setzero_si128());
+            }
+            // the four words of the round key, each the word before it XORed with the word 16 bytes back
+            __m128i previous[4];
+            for (int a = 0; a < 4; a++) previous[a] = core[a];
+            for (int word = 0; word < 4; word++) {
+                for (int a = 0; a < 4; a++) {
+                    int i = n + 4 * word + a;
+                    previous[a] = _mm_xor_si128(previous[a], _mm_load_si128((const __m128i *) &schedule.w[i - 16][16 * v]));
+                    _mm_store_si128((__m128i *) &schedule.w[i][16 * v], previous[a]);
+                }
+            }
+        }
+    }
+}
+
+LANE_SIMD_TARGET void countDistancesSimd(const unsigned char base[SCHEDULE_BYTES], LaneWork &work, unsigned char distances[NUM_ROUND_KEYS][LANES]) {
+    const __m128i nibbleBits = _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m128i lowNibbles = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    for (int r = 0; r < NUM_ROUND_KEYS; r++) {
+        for (int v = 0; v < LANES / 16; v++) {
+            __m128i distance = zero;
+            for (int i = 16 * r; i < 16 * r + 16; i++) {
+                __m128i x = _mm_xor_si128(_mm_load_si128((const __m128i *) &work.schedule.w[i][16 * v]), _mm_set1_epi8((char) base[i]));
+                __m128i bits = _mm_add_epi8(_mm_shuffle_epi8(nibbleBits, _mm_and_si128(x, lowNibbles)),
+                                            _mm_shuffle_epi8(nibbleBits, _mm_and_si128(_mm_srli_epi16(x, 4), lowNibbles)));
+                distance = _mm_add_epi8(distance, bits);
+
+                // widen to 16 bits for the pending counters; a changed byte counts 1 (0 - (-1))
+                __m128i changed = _mm_sub_epi8(zero, _mm_cmpeq_epi8(_mm_cmpeq_epi8(x, zero), zero));
+                __m128i *pendingBits = (__m128i *) &work.pendingBits[i][16 * v];
+                __m128i *pendingChanged = (__m128i *) &work.pendingChanged[i][16 * v];
+                _mm_store_si128(pendingBits, _mm_add_epi16(_mm_load_si128(pendingBits), _mm_unpacklo_epi8(bits, zero)));
+                _mm_store_si128(pendingBits + 1, _mm_add_epi16(_mm_load_si128(pendingBits + 1), _mm_unpackhi_epi8(bits, zero)));
+                _mm_store_si128(pendingChanged, _mm_add_epi16(_mm_load_si128(pendingChanged), _mm_unpacklo_epi8(changed, zero)));
+                _mm_store_si128(pendingChanged + 1, _mm_add_epi16(_mm_load_si128(pendingChanged + 1), _mm_unpackhi_epi8(changed, zero)));
+            }
+            _mm_storeu_si128((__m128i *) &distances[r][16 * v], distance);
+        }
+    }
+}
+#endif
+
+
+void resetStats(DiffusionStats &stats) {
+    for (int b = 0; b < LANES; b++) {
+        for (int r = 0; r < NUM_ROUND_KEYS; r++) {
+            RoundStats &cell = stats.cells[b][r];
+            cell.count = 0;
+            cell.sum = 0;
+            cell.sumSquares = 0;
+            cell.min = 128;
+            cell.max = 0;
+        }
+    }
+    memset(stats.byteBits, 0, sizeof(stats.byteBits));
+    memset(stats.byteChanged, 0, sizeof(stats.byteChanged));
+}
+
+void mergeStats(DiffusionStats &into, const DiffusionStats &from) {
+    for (int b = 0; b < LANES; b++) {
+        for (int r = 0; r < NUM_ROUND_KEYS; r++) {
+            RoundStats &dst = into.cells[b][r];
+            const RoundStats &src = from.cells[b][r];
+            dst.count += src.count;
+            dst.sum += src.sum;
+            dst.sumSquares += src.sumSquares;
+            if (src.min < dst.min) dst.min = src.min;
+            if (src.max > dst.max) dst.max = src.max;
+        }
+    }
+    for (int i = 0; i < SCHEDULE_BYTES; i++) {
+        for (int lane = 0; lane < LANES; lane++) {
+            into.byteBits[i][lane] += from.byteBits[i][lane];
+            into.byteChanged[i][lane] += from.byteChanged[i][lane];
+        }
+    }
+}
+
+// Moves the pending per-byte counters into stats
+void flushPending(LaneWork &work, DiffusionStats &stats) {
+    for (int i = 0; i < SCHEDULE_BYTES; i++) {
+        for (int lane = 0; lane < LANES; lane++) {
+            stats.byteBits[i][lane] += work.pendingBits[i][lane];
+            stats.byteChanged[i][lane] += work.pendingChanged[i][lane];
+        }
+    }
+    memset(work.pendingBits, 0, sizeof(work.pendingBits));
+    memset(work.pendingChanged, 0, sizeof(work.pendingChanged));
+    work.pendingSamples = 0;
+}
+
+double statsMean(const RoundStats &cell) {
+    return cell.count ? (double) cell.sum / cell.count : 0.0;
+}
+
+double statsVariance(const RoundStats &cell) {
+    if (cell.count == 0) return 0.0;
+    double mean = statsMean(cell);
+    return (double) cell.sumSquares / cell.count - mean * mean;
+}
+
+
+void diffusionSample(unsigned long long seed, unsigned long long sampleIndex, bool simd, LaneWork &work, DiffusionStats &stats) {
+    unsigned char key[16], base[SCHEDULE_BYTES];
+    unsigned char distances[NUM_ROUND_KEYS][LANES];
+    sampleKey(seed, sampleIndex, key);
+    KeyExpansion(key, base);
+#ifdef HAVE_LANE_SIMD
+    if (simd) {
+        expandFlippedKeysSimd(key, work.schedule);
+        countDistancesSimd(base, work, distances);
+    } else
+#endif
+    {
+        expandFlippedKeys(key, work.schedule);
+        countDistances(base, work, distances);
+    }
+
+    for (int r = 0; r < NUM_ROUND_KEYS; r++) {
+        for (int lane = 0; lane < LANES; lane++) {
+            int changedBits = distances[r][lane];
+            RoundStats &cell = stats.cells[lane][r];
+            cell.count++;
+            cell.sum += changedBits;
+            cell.sumSquares += (unsigned long long) changedBits * changedBits;
+            if (changedBits < cell.min) cell.min = changedBits;
+            if (changedBits > cell.max) cell.max = changedBits;
+        }
+    }
+    if (++work.pendingSamples == PENDING_SAMPLES) {
+        flushPending(work, stats);
+    }
+}
+
+// Checks every lane of one sample against KeyExpansion of the flipped key
+bool checkLanes(unsigned long long seed, bool simd) {
+    unsigned char key[16];
+    sampleKey(seed, 0, key);
+    LaneWork *work = new LaneWork;
+#ifdef HAVE_LANE_SIMD
+    if (simd) expandFlippedKeysSimd(key, work->schedule);
+    else
+#endif
+    expandFlippedKeys(key, work->schedule);
+    bool ok = true;
+    for (int lane = 0; lane < LANES && ok; lane++) {
+        unsigned char flippedKey[16], expected[SCHEDULE_BYTES];
+        memcpy(flippedKey, key, 16);
+        flipBit(flippedKey, lane);
+        KeyExpansion(flippedKey, expected);
+        for (int i = 0; i < SCHEDULE_BYTES; i++) {
+            if (work->schedule.w[i][lane] != expected[i]) ok = false;
+        }
+    }
+    delete work;
+    return ok;
+}
+
+// Samples per second of the plain loop: KeyExpansion of every flipped key and countChangedBits per round key
+double referenceRate(unsigned long long seed) {
+    const int count = 2000;
+    unsigned long long total = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int n = 0; n < count; n++) {
+        unsigned char key[16], base[SCHEDULE_BYTES], flipped[SCHEDULE_BYTES];
+        sampleKey(seed, n, key);
+        KeyExpansion(key, base);
+        for (int bit = 0; bit < LANES; bit++) {
+            unsigned char flippedKey[16];
+            memcpy(flippedKey, key, 16);
+            flipBit(flippedKey, bit);
+            KeyExpansion(flippedKey, flipped);
+            for (int r = 0; r < NUM_ROUND_KEYS; r++) {
+                total += countChangedBits(base + 16 * r, flipped + 16 * r, 16);
+            }
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return total > 0 ? count / seconds : 0;
+}
+
+
+void writeResults(const string &path, const DiffusionStats &stats) {
+    ofstream out(path.c_str());
+    out << "Bit,RoundKey,Samples,Mean,Variance,Min,Max\n";
+    out << fixed << setprecision(4);
+    for (int b = 0; b < LANES; b++) {
+        for (int r = 0; r < NUM_ROUND_KEYS; r++) {
+            const RoundStats &cell = stats.cells[b][r];
+            out << b << "," << r << "," << cell.count << "," << statsMean(cell) << "," << statsVariance(cell)
+                << "," << cell.min << "," << cell.max << "\n";
+        }
+    }
+}
+
+void writeByteResults(const string &path, const DiffusionStats &stats, unsigned long long samples) {
+    ofstream out(path.c_str());
+    out << "Bit,RoundKey,Byte,MeanChangedBits,ChangedProbability\n";
+    out << fixed << setprecision(4);
+    for (int b = 0; b < LANES; b++) {
+        for (int i = 0; i < SCHEDULE_BYTES; i++) {
+            out << b << "," << i / 16 << "," << i % 16 << "," << (double) stats.byteBits[i][b] / samples << ","
+                << (double) stats.byteChanged[i][b] / samples << "\n";
+        }
+    }
+}
+
+// Per-round-key summary over all 128 flipped bits
+void printSummary(const DiffusionStats &stats, unsigned long long samples) {
+    cout << fixed << setprecision(3);
+    cout << "Round key   Mean  Variance  Min  Max  Bytes changed" << endl;
+    for (int r = 0; r < NUM_ROUND_KEYS; r++) {
+        RoundStats total = { 0, 0, 0, 128, 0 };
+        unsigned long long bytesChanged = 0;
+        for (int b = 0; b < LANES; b++) {
+            const RoundStats &cell = stats.cells[b][r];
+            total.count += cell.count;
+            total.sum += cell.sum;
+            total.sumSquares += cell.sumSquares;
+            if (cell.min < total.min) total.min = cell.min;
+            if (cell.max > total.max) total.max = cell.max;
+            for (int i = 16 * r; i < 16 * r + 16; i++) {
+                bytesChanged += stats.byteChanged[i][b];
+            }
+        }
+        cout << setw(9) << r << setw(7) << statsMean(total) << setw(10) << statsVariance(total)
+             << setw(5) << total.min << setw(5) << total.max
+             << setw(11) << (double) bytesChanged / (samples * LANES) << " / 16" << endl;
+    }
+    cout << endl;
+}
+
+
+int main(int argc, char *argv[]) {
+    cout << "=============================" << endl;
+    cout << " AES-128 Key Schedule Diffusion " << endl;
+    cout << "=============================" << endl;
+
+    unsigned long long numSamples = 100000;
+    unsigned long long seed = 1;
+    int numThreads = (int) thread::hardware_concurrency();
+    string outputPath = "key_diffusion.csv";
+    string byteOutputPath = "key_diffusion_bytes.csv";
+    bool useSimd = true;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-n") == 0) numSamples = strtoull(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-t") == 0) numThreads = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-s") == 0) seed = strtoull(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-o") == 0) outputPath = argv[i + 1];
+        else if (strcmp(argv[i], "-b") == 0) byteOutputPath = argv[i + 1];
+        else if (strcmp(argv[i], "-S") == 0) useSimd = atoi(argv[i + 1]) != 0;
+        else {
+            cout << "Unknown option " << argv[i] << endl;
+            return 1;
+        }
+    }
+    if (numThreads < 1) numThreads = 1;
+    if (numSamples < 1) numSamples = 1;
+
+    bool simd = false;
+#ifdef HAVE_LANE_SIMD
+    simd = useSimd && laneSimdAvailable();
+#endif
+    if (!checkLanes(seed, simd)) {
+        cout << "The lane-parallel key schedule does not match KeyExpansion" << endl;
+        return 1;
+    }
+
+    cout << "Expanding " << numSamples << " keys x 128 bit flips on " << numThreads << " threads, "
+         << (simd ? "AES-NI/SSSE3 lanes" : "portable lanes") << endl;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    vector<DiffusionStats *> partial(numThreads);
+    vector<thread> workers;
+    for (int t = 0; t < numThreads; t++) {
+        partial[t] = new DiffusionStats;
+        workers.push_back(thread([&, t]() {
+            LaneWork *work = new LaneWork;
+            resetStats(*partial[t]);
+            flushPending(*work, *partial[t]);
+            for (unsigned long long n = t; n < numSamples; n += numThreads) {
+                diffusionSample(seed, n, simd, *work, *partial[t]);
+            }
+            flushPending(*work, *partial[t]);
+            delete work;
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+    for (int t = 1; t < numThreads; t++) {
+        mergeStats(*partial[0], *partial[t]);
+        delete partial[t];
+    }
+    DiffusionStats &stats = *partial[0];
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    double reference = referenceRate(seed);
+    cout << fixed << setprecision(2);
+    cout << "Done in " << seconds << " s: " << numSamples / seconds << " keys/s (" << numSamples * LANES / seconds / 1e6
+         << " M flipped schedules/s); plain loop on one thread: " << reference << " keys/s" << endl << endl;
+
+    printSummary(stats, numSamples);
+    writeResults(outputPath, stats);
+    writeByteResults(byteOutputPath, stats, numSamples);
+    cout << "Results written to " << outputPath << " and " << byteOutputPath << endl;
+    delete partial[0];
+    return 0;
+}
@@ -0,0 +1,404 @@
+/*
+    AES Mode Avalanche (multi-block, error propagation)
+
+    - Encrypts whole multi-block messages under ECB, CBC, CTR and GCM (see chaining.h)
+      instead of one block at a time, so the effect of a flip on the other blocks shows.
+    - Per sample: a random key, IV and message, one random bit flipped in
+        plaintext   block j -> changed bits of every ciphertext block k >= j (offset k - j)
+        ciphertext  block j -> changed bits of every decrypted block k >= j (error propagation)
+        IV                  -> changed bits of every ciphertext block k (offset k); not for ECB
+      Blocks before j never depend on block j in any of the modes; the tool counts it if
+      one ever changes.
+    - GCM also reports the changed bits of the tag and how many tampered ciphertexts
+      (the ciphertext flips) the tag check rejected. There is no additional data.
+    - The samples are spread over all cores, each thread keeping its own statistics
+      (mean, variance, min, max, as in sweep.cpp) that are merged at the end.
+    - Checks the modes against SP 800-38A / the GCM spec test vectors before starting.
+    - Writes every (mode, flip, offset) cell to "mode_avalanche.csv".
+
+    Usage: modeavalanche [-n samples] [-b blocks per message] [-t threads] [-s seed] [-o output file]
+    Build: g++ -O2 -pthread modeavalanche.cpp -o modeavalanche.exe
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include "chaining.h"
+
+using namespace std;
+
+
+const int NUM_FLIPS = 3;            // what the flipped bit is in
+const char * const flipNames[NUM_FLIPS] = { "plaintext", "ciphertext", "iv" };
+const int FLIP_PLAINTEXT = 0, FLIP_CIPHERTEXT = 1, FLIP_IV = 2;
+
+const int MAX_BLOCKS = 64;
+const int TAG_CELL = MAX_BLOCKS;    // the offset column used for the GCM tag
+
+
+struct RoundStats {
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long sumSquares;
+    int min;
+    int max;
+};
+
+struct ModeStats {
+    RoundStats cells[NUM_CHAINING_MODES][NUM_FLIPS][MAX_BLOCKS + 1];
+    unsigned long long earlierChanged[NUM_CHAINING_MODES][NUM_FLIPS];
+    unsigned long long tagRejected, tagChecked;
+};
+
+
+void resetStats(ModeStats &stats) {
+    for (int m = 0; m < NUM_CHAINING_MODES; m++) {
+        for (int f = 0; f < NUM_FLIPS; f++) {
+            for (int o = 0; o <= MAX_BLOCKS; o++) {
+                RoundStats &cell = stats.cells[m][f][o];
+                cell.count = 0;
+                cell.sum = 0;
+                cell.sumSquares = 0;
+                cell.min = 128;
+                cell.max = 0;
+            }
+            stats.earlierChanged[m][f] = 0;
+        }
+    }
+    stats.tagRejected = 0;
+    stats.tagChecked = 0;
+}
+
+void addSample(RoundStats &cell, int changedBits) {
+    cell.count++;
+    cell.sum += changedBits;
+    cell.sumSquares += (unsigned long long) changedBits * changedBits;
+    if (changedBits < cell.min) cell.min = changedBits;
+    if (changedBits > cell.max) cell.max = changedBits;
+}
+
+void mergeStats(ModeStats &into, const ModeStats &from) {
+    for (int m = 0; m < NUM_CHAINING_MODES; m++) {
+        for (int f = 0; f < NUM_FLIPS; f++) {
+            for (int o = 0; o <= MAX_BLOCKS; o++) {
+                RoundStats &dst = into.cells[m][f][o];
+                const RoundStats &src = from.cells[m][f][o];
+                dst.count += src.count;
+                dst.sum += src.sum;
+                dst.sumSquares += src.sumSquares;
+                if (src.min < dst.min) dst.min = src.min;
+                if (src.max > dst.max) dst.max = src.max;
+            }
+            into.earlierChanged[m][f] += from.earlierChanged[m][f];
+        }
+    }
+    into.tagRejected += from.tagRejected;
+    into.tagChecked += from.tagChecked;
+}
+
+double statsMean(const RoundStats &cell) {
+    return cell.count ? (double) cell.sum / cell.count : 0.0;
+}
+
+// Population variance from the integer sums
+double statsVariance(const RoundStats &cell) {
+    if (cell.count == 0) return 0.0;
+    double mean = statsMean(cell);
+    return (double) cell.sumSquares / cell.count - mean * mean;
+}
+
+
+/*
+    splitmix64 over (seed, sample index), as sampleKey() in keydiffusion.cpp: a sample needs
+    a key, an IV, a whole message and the flip positions, far more than makeSample() gives.
+*/
+struct SampleRandom {
+    unsigned long long state;
+
+    SampleRandom(unsigned long long seed, unsigned long long sampleIndex)
+        : state(seed * 0xd1b54a32d192ed03ULL + sampleIndex) {}
+
+    unsigned long long next() {
+        unsigned long long z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    void fill(unsigned char *data, int length) {
+        for (int i = 0; i < length; i += 8) {
+            unsigned long long z = next();
+            memcpy(data + i, &z, length - i < 8 ? length - i : 8);
+        }
+    }
+};
+
+
+// Adds the changed bits of blocks first..blocks-1 of a and b at offsets 0, 1, ..., and
+// counts a change in any block before first
+void addBlockDistances(const unsigned char *a, const unsigned char *b, int blocks, int first,
+                       RoundStats *cells, unsigned long long &earlierChanged) {
+    for (int k = 0; k < first; k++) {
+        if (memcmp(a + 16 * k, b + 16 * k, 16) != 0) {
+            earlierChanged++;
+            break;
+        }
+    }
+    for (int k = first; k < blocks; k++) {
+        addSample(cells[k - first], countChangedBits(const_cast<unsigned char*>(a + 16 * k), const_cast<unsigned char*>(b + 16 * k), 16));
+    }
+}
+
+// Working buffers of one thread
+struct SampleBuffers {
+    vector<unsigned char> plaintext, ciphertext, flipped, result;
+    explicit SampleBuffers(int blocks)
+        : plaintext(16 * blocks), ciphertext(16 * blocks), flipped(16 * blocks), result(16 * blocks) {}
+};
+
+void modeSample(unsigned long long seed, unsigned long long sampleIndex, int blocks, SampleBuffers &buf, ModeStats &stats) {
+    SampleRandom random(seed, sampleIndex);
+    unsigned char key[16], iv[16], expandedKey[176];
+    random.fill(key, 16);
+    random.fill(iv, 16);
+    random.fill(buf.plaintext.data(), 16 * blocks);
+    KeyExpansion(key, expandedKey);
+
+    int bytes = 16 * blocks;
+    for (int m = 0; m < NUM_CHAINING_MODES; m++) {
+        ChainingMode mode = (ChainingMode) m;
+        int ivBits = mode == MODE_GCM ? 8 * GCM_IV_BYTES : 128;
+        unsigned char tag[16], flippedTag[16];
+        encryptMessage(mode, buf.plaintext.data(), blocks, expandedKey, iv, buf.ciphertext.data(), tag);
+
+        // plaintext bit: which ciphertext blocks change
+        unsigned long long r = random.next();
+        int block = (int) (r % blocks), bit = (int) ((r >> 32) % 128);
+        memcpy(buf.flipped.data(), buf.plaintext.data(), bytes);
+        flipBit(buf.flipped.data() + 16 * block, bit);
+        encryptMessage(mode, buf.flipped.data(), blocks, expandedKey, iv, buf.result.data(), flippedTag);
+        addBlockDistances(buf.ciphertext.data(), buf.result.data(), blocks, block,
+                          stats.cells[m][FLIP_PLAINTEXT], stats.earlierChanged[m][FLIP_PLAINTEXT]);
+        if (mode == MODE_GCM) addSample(stats.cells[m][FLIP_PLAINTEXT][TAG_CELL], countChangedBits(tag, flippedTag, 16));
+
+        // ciphertext bit: which decrypted blocks change, and whether GCM notices
+        r = random.next();
+        block = (int) (r % blocks);
+        bit = (int) ((r >> 32) % 128);
+        memcpy(buf.flipped.data(), buf.ciphertext.data(), bytes);
+        flipBit(buf.flipped.data() + 16 * block, bit);
+        bool accepted = decryptMessage(mode, buf.flipped.data(), blocks, expandedKey, iv, buf.result.data(), tag);
+        addBlockDistances(buf.plaintext.data(), buf.result.data(), blocks, block,
+                          stats.cells[m][FLIP_CIPHERTEXT], stats.earlierChanged[m][FLIP_CIPHERTEXT]);
+        if (mode == MODE_GCM) {
+            stats.tagChecked++;
+            if (!accepted) stats.tagRejected++;
+        }
+
+        // IV bit: every block, offsets counted from the first
+        if (mode == MODE_ECB) continue;
+        unsigned char flippedIv[16];
+        memcpy(flippedIv, iv, 16);
+        flipBit(flippedIv, (int) (random.next() % ivBits));
+        encryptMessage(mode, buf.plaintext.data(), blocks, expandedKey, flippedIv, buf.result.data(), flippedTag);
+        addBlockDistances(buf.ciphertext.data(), buf.result.data(), blocks, 0,
+                          stats.cells[m][FLIP_IV], stats.earlierChanged[m][FLIP_IV]);
+        if (mode == MODE_GCM) addSample(stats.cells[m][FLIP_IV][TAG_CELL], countChangedBits(tag, flippedTag, 16));
+    }
+}
+
+
+// Runs samples [0, numSamples) split over the worker threads and merges the results into stats
+void runSamples(unsigned long long seed, unsigned long long numSamples, int blocks, int numThreads, ModeStats &stats) {
+    vector<ModeStats*> partial(numThreads);
+    vector<thread> workers;
+
+    for (int t = 0; t < numThreads; t++) {
+        partial[t] = new ModeStats;
+        workers.push_back(thread([&, t]() {
+            resetStats(*partial[t]);
+            SampleBuffers buf(blocks);
+            for (unsigned long long n = t; n < numSamples; n += numThreads) {
+                modeSample(seed, n, blocks, buf, *partial[t]);
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+    for (int t = 0; t < numThreads; t++) {
+        mergeStats(stats, *partial[t]);
+        delete partial[t];
+    }
+}
+
+
+bool parseHex(const char *hex, unsigned char *out, int length) {
+    for (int i = 0; i < length; i++) {
+        unsigned int byte;
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1) return false;
+        out[i] = (unsigned char) byte;
+    }
+    return true;
+}
+
+bool checkVector(const char *name, ChainingMode mode, const char *keyHex, const char *ivHex, int ivBytes,
+                 const char *plainHex, const char *cipherHex, const char *tagHex) {
+    unsigned char key[16], iv[16] = { 0 }, plain[16], cipher[16], expectedTag[16];
+    unsigned char expandedKey[176], out[16], back[16], tag[16];
+    parseHex(keyHex, key, 16);
+    parseHex(ivHex, iv, ivBytes);
+    parseHex(plainHex, plain, 16);
+    parseHex(cipherHex, cipher, 16);
+    KeyExpansion(key, expandedKey);
+
+    encryptMessage(mode, plain, 1, expandedKey, iv, out, tag);
+    bool ok = memcmp(out, cipher, 16) == 0;
+    if (tagHex) {
+        parseHex(tagHex, expectedTag, 16);
+        ok = ok && memcmp(tag, expectedTag, 16) == 0;
+    }
+    ok = decryptMessage(mode, out, 1, expandedKey, iv, back, tag) && ok && memcmp(back, plain, 16) == 0;
+    cout << "  " << left << setw(28) << name << (ok ? "ok" : "FAILED") << right << endl;
+    return ok;
+}
+
+// Known answers for the modes, and a decryption round trip of a multi-block message in each
+bool selfTest() {
+    const char *key = "2b7e151628aed2a6abf7158809cf4f3c";
+    const char *plain = "6bc1bee22e409f96e93d7e117393172a";
+    const char *zero = "00000000000000000000000000000000";
+    bool ok = true;
+    ok = checkVector("ECB (SP 800-38A F.1.1)", MODE_ECB, key, zero, 16, plain, "3ad77bb40d7a3660a89ecaf32466ef97", NULL) && ok;
+    ok = checkVector("CBC (SP 800-38A F.2.1)", MODE_CBC, key, "000102030405060708090a0b0c0d0e0f", 16, plain,
+                     "7649abac8119b246cee98e9b12e9197d", NULL) && ok;
+    ok = checkVector("CTR (SP 800-38A F.5.1)", MODE_CTR, key, "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff", 16, plain,
+                     "874d6191b620e3261bef6864990db6ce", NULL) && ok;
+    ok = checkVector("GCM (test case 2)", MODE_GCM, zero, zero, GCM_IV_BYTES, zero,
+                     "0388dace60b6a392f328c2b971b2fe78", "ab6e47d42cec13bdf53a67b21257bddf") && ok;
+
+    const int blocks = 5;
+    SampleBuffers buf(blocks);
+    SampleRandom random(0, 0);
+    unsigned char expandedKey[176], keyBytes[16], iv[16], tag[16];
+    random.fill(keyBytes, 16);
+    random.fill(iv, 16);
+    random.fill(buf.plaintext.data(), 16 * blocks);
+    KeyExpansion(keyBytes, expandedKey);
+    bool roundTrip = true;
+    for (int m = 0; m < NUM_CHAINING_MODES; m++) {
+        encryptMessage((ChainingMode) m, buf.plaintext.data(), blocks, expandedKey, iv, buf.ciphertext.data(), tag);
+        roundTrip = decryptMessage((ChainingMode) m, buf.ciphertext.data(), blocks, expandedKey, iv, buf.result.data(), tag) && roundTrip;
+        roundTrip = roundTrip && buf.result == buf.plaintext;
+    }
+    cout << "  " << left << setw(28) << "Round trip, all modes" << (roundTrip ? "ok" : "FAILED") << right << endl;
+    return ok && roundTrip;
+}
+
+
+void writeResults(const string &path, const ModeStats &stats, int blocks) {
+    ofstream out(path.c_str());
+    out << "Mode,Flip,Offset,Samples,Mean,Variance,Min,Max\n";
+    out << fixed << setprecision(4);
+    for (int m = 0; m < NUM_CHAINING_MODES; m++) {
+        for (int f = 0; f < NUM_FLIPS; f++) {
+            for (int o = 0; o <= blocks; o++) {
+                int cell = o < blocks ? o : TAG_CELL;
+                const RoundStats &c = stats.cells[m][f][cell];
+                if (c.count == 0) continue;
+                out << chainingModeNames[m] << "," << flipNames[f] << ",";
+                if (cell == TAG_CELL) out << "tag";
+                else out << o;
+                out << "," << c.count << "," << statsMean(c) << "," << statsVariance(c) << "," << c.min << "," << c.max << "\n";
+            }
+        }
+    }
+}
+
+// Mean changed bits per offset, one line per mode and flip
+void printSummary(const ModeStats &stats, int blocks) {
+    int shown = blocks < 8 ? blocks : 8;
+    cout << fixed << setprecision(2);
+    cout << "Mean changed bits by block offset from the flipped block (IV: from the first block)" << endl;
+    cout << "Mode Flip       ";
+    for (int o = 0; o < shown; o++) cout << setw(7) << ("+" + to_string(o));
+    cout << "    tag  earlier" << endl;
+    for (int m = 0; m < NUM_CHAINING_MODES; m++) {
+        for (int f = 0; f < NUM_FLIPS; f++) {
+            if (stats.cells[m][f][0].count == 0) continue;
+            cout << left << setw(5) << chainingModeNames[m] << setw(11) << flipNames[f] << right;
+            for (int o = 0; o < shown; o++) cout << setw(7) << statsMean(stats.cells[m][f][o]);
+            const RoundStats &tag = stats.cells[m][f][TAG_CELL];
+            if (tag.count) cout << setw(7) << statsMean(tag);
+            else cout << setw(7) << "-";
+            cout << setw(9) << stats.earlierChanged[m][f] << endl;
+        }
+    }
+    if (stats.tagChecked) {
+        cout << "GCM tampered ciphertexts rejected: " << stats.tagRejected << " of " << stats.tagChecked
+             << " (" << 100.0 * stats.tagRejected / stats.tagChecked << "%)" << endl;
+    }
+}
+
+
+int main(int argc, char *argv[]) {
+    cout << "=============================" << endl;
+    cout << " AES-128 Mode Avalanche " << endl;
+    cout << "=============================" << endl;
+
+    unsigned long long numSamples = 20000;
+    unsigned long long seed = 1;
+    int blocks = 16;
+    int numThreads = (int) thread::hardware_concurrency();
+    string outputPath = "mode_avalanche.csv";
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-n") == 0) numSamples = strtoull(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-b") == 0) blocks = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-t") == 0) numThreads = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-s") == 0) seed = strtoull(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-o") == 0) outputPath = argv[i + 1];
+        else {
+            cout << "Unknown option " << argv[i] << endl;
+            return 1;
+        }
+    }
+    if (numThreads < 1) numThreads = 1;
+    if (blocks < 1 || blocks > MAX_BLOCKS) {
+        cout << "Blocks per message must be between 1 and " << MAX_BLOCKS << endl;
+        return 1;
+    }
+
+    cout << "Self test:" << endl;
+    if (!selfTest()) {
+        cout << "Self test failed" << endl;
+        return 1;
+    }
+    cout << endl;
+
+    cout << "Running " << numSamples << " messages of " << blocks << " blocks x " << NUM_CHAINING_MODES
+         << " modes on " << numThreads << " threads" << endl;
+    ModeStats *stats = new ModeStats;
+    resetStats(*stats);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    runSamples(seed, numSamples, blocks, numThreads, *stats);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (seconds > 0) {
+        cout << "Messages per second: " << (unsigned long long) (numSamples / seconds) << endl;
+    }
+    cout << endl;
+
+    printSummary(*stats, blocks);
+    writeResults(outputPath, *stats, blocks);
+    cout << "Wrote results to " << outputPath << endl;
+
+    delete stats;
+    return 0;
+}
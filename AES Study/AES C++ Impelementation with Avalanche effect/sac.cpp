@@ -0,0 +1,380 @@
+/*
+    Strict Avalanche Criterion (SAC) and Bit Independence Criterion (BIC) analysis
+
+    - Flips every input bit i (plaintext, or key with -k) over many random samples.
+    - SAC: for every round and every output bit j, the probability that flipping i flips j (128x128 per round).
+    - BIC: for every round and every pair of output bits (j, k), the largest |correlation| between
+      the changes of j and k over all input bits i (128x128 per round).
+    - Counts are gathered with bit-sliced counters: one 128-bit difference vector is added to
+      128 counters at once with a chain of carry-save adders, so no per-bit branches are taken.
+    - Writes the matrices to "sac_bic.bin" (layout below).
+
+    Usage: sac [-n samples] [-t threads] [-s seed] [-k] [-b 0|1] [-o output file]
+    Build: g++ -O2 -msse2 -pthread sac.cpp -o sac.exe
+
+    Output file layout (little-endian):
+        char[4]  "SACB"
+        uint32   version (1)
+        uint32   flags (bit 0: key bits flipped, bit 1: BIC present)
+        uint32   rounds (11)
+        uint64   samples
+        float32  sac[rounds][128 input bits][128 output bits]
+        float32  bic[rounds][128][128]      (only when flag bit 1 is set; NaN where no
+                                             input bit gave a defined correlation)
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <chrono>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "avalanche.h"
+
+using namespace std;
+
+
+const int NUM_BITS = 128;
+const int NUM_ROUNDS = 11;      // round 0 is the initial AddRoundKey
+
+
+/*
+    128-bit vector of per-bit flags (one bit per output bit).
+    SSE2 when available, two 64-bit words otherwise.
+*/
+#ifdef __SSE2__
+typedef __m128i Bits128;
+inline Bits128 bitsLoad(const unsigned char *p) { return _mm_loadu_si128((const __m128i *) p); }
+inline Bits128 bitsXor(Bits128 a, Bits128 b) { return _mm_xor_si128(a, b); }
+inline Bits128 bitsAnd(Bits128 a, Bits128 b) { return _mm_and_si128(a, b); }
+inline Bits128 bitsZero() { return _mm_setzero_si128(); }
+inline void bitsStore(unsigned char *p, Bits128 v) { _mm_storeu_si128((__m128i *) p, v); }
+#else
+struct Bits128 { unsigned long long w[2]; };
+inline Bits128 bitsLoad(const unsigned char *p) { Bits128 v; memcpy(v.w, p, 16); return v; }
+inline Bits128 bitsXor(Bits128 a, Bits128 b) { a.w[0] ^= b.w[0]; a.w[1] ^= b.w[1]; return a; }
+inline Bits128 bitsAnd(Bits128 a, Bits128 b) { a.w[0] &= b.w[0]; a.w[1] &= b.w[1]; return a; }
+inline Bits128 bitsZero() { Bits128 v = { { 0, 0 } }; return v; }
+inline void bitsStore(unsigned char *p, Bits128 v) { memcpy(p, v.w, 16); }
+#endif
+
+
+/*
+    Bit-sliced counter: plane p holds bit p of all 128 counts.
+    Adding a vector ripples a carry through the planes with half adders (carry-save form).
+    A count never exceeds the number of additions, so only the planes that can be
+    non-zero (depth = bit length of the additions so far) have to be touched.
+*/
+inline void counterAdd(Bits128 *planes, Bits128 v, int depth) {
+    Bits128 carry = v;
+    for (int p = 0; p < depth; p++) {
+        Bits128 sum = bitsXor(planes[p], carry);
+        carry = bitsAnd(planes[p], carry);
+        planes[p] = sum;
+    }
+}
+
+// Reads the 128 counts back out of the planes
+void counterRead(const Bits128 *planes, int numPlanes, unsigned long long counts[128]) {
+    for (int j = 0; j < 128; j++) {
+        counts[j] = 0;
+    }
+    for (int p = 0; p < numPlanes; p++) {
+        unsigned long long words[2];
+        bitsStore(reinterpret_cast<unsigned char*>(words), planes[p]);
+        for (int w = 0; w < 2; w++) {
+            unsigned long long bits = words[w];
+            while (bits) {
+                int j = __builtin_ctzll(bits);
+                counts[w * 64 + j] += 1ULL << p;
+                bits &= bits - 1;
+            }
+        }
+    }
+}
+
+
+/*
+    Counter storage for the whole run.
+    With BIC enabled there is one counter row per (round, input bit i, output bit j) that counts,
+    over the samples where j flipped, how often every output bit k flipped as well.
+    Its diagonal (k == j) is the SAC count, so SAC needs no counters of its own.
+    Without BIC only one SAC row per (round, input bit) is kept.
+*/
+struct SacEngine {
+    bool flipKey;
+    bool withBic;
+    int numPlanes;
+    Bits128 *planes;
+
+    size_t rowIndex(int round, int inBit, int outBit) const {
+        size_t rowsPerInput = withBic ? NUM_BITS : 1;
+        return ((size_t) (round * NUM_BITS + inBit) * rowsPerInput + outBit) * numPlanes;
+    }
+};
+
+int bitLength(unsigned long long x) {
+    int n = 0;
+    while (x) {
+        n++;
+        x >>= 1;
+    }
+    return n;
+}
+
+
+/*
+    Worker: handles input bits [firstBit, lastBit) over every sample.
+    The input bits own disjoint counter rows, so the threads never share memory
+    and nothing has to be merged.
+*/
+void runInputBits(SacEngine &engine, unsigned long long seed, unsigned long long numSamples, int firstBit, int lastBit) {
+    unsigned char plaintext[16], key[16], ciphertext[16];
+    unsigned char expandedKey[176], flippedExpandedKey[176];
+    unsigned char baseStates[NUM_ROUNDS][16], flippedStates[NUM_ROUNDS][16];
+
+    for (unsigned long long n = 0; n < numSamples; n++) {
+        makeSample(seed, n, plaintext, key);
+        KeyExpansion(key, expandedKey);
+        AESEncryptWithAvalanche(plaintext, expandedKey, ciphertext, baseStates);
+
+        int depth = bitLength(n + 1);
+
+        for (int i = firstBit; i < lastBit; i++) {
+            if (engine.flipKey) {
+                unsigned char flippedKey[16];
+                memcpy(flippedKey, key, 16);
+                flipBit(flippedKey, i);
+                KeyExpansion(flippedKey, flippedExpandedKey);
+                AESEncryptWithAvalanche(plaintext, flippedExpandedKey, ciphertext, flippedStates);
+            } else {
+                unsigned char flipped[16];
+                memcpy(flipped, plaintext, 16);
+                flipBit(flipped, i);
+                AESEncryptWithAvalanche(flipped, expandedKey, ciphertext, flippedStates);
+            }
+
+            for (int r = 0; r < NUM_ROUNDS; r++) {
+                Bits128 diff = bitsXor(bitsLoad(baseStates[r]), bitsLoad(flippedStates[r]));
+
+                if (!engine.withBic) {
+                    counterAdd(&engine.planes[engine.rowIndex(r, i, 0)], diff, depth);
+                    continue;
+                }
+
+                // add the difference vector to the row of every output bit that flipped
+                unsigned long long words[2];
+                bitsStore(reinterpret_cast<unsigned char*>(words), diff);
+                for (int w = 0; w < 2; w++) {
+                    unsigned long long bits = words[w];
+                    while (bits) {
+                        int j = w * 64 + __builtin_ctzll(bits);
+                        counterAdd(&engine.planes[engine.rowIndex(r, i, j)], diff, depth);
+                        bits &= bits - 1;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+/*
+    Turns the counters into the SAC probabilities and the BIC max |correlation| matrices.
+    For input bit i and output bits j, k with counts a = n_j, b = n_k, c = n_jk over N samples:
+    corr = (N*c - a*b) / sqrt(a*(N-a) * b*(N-b))
+    When j or k always or never flips the correlation is undefined: that input bit is skipped
+    for the pair and counted in degenerate[round]. A cell with no defined correlation is NaN.
+*/
+void buildMatrices(const SacEngine &engine, unsigned long long numSamples, vector<float> &sac, vector<float> &bic,
+                   vector<unsigned long long> &degenerate) {
+    sac.assign((size_t) NUM_ROUNDS * NUM_BITS * NUM_BITS, 0.0f);
+    degenerate.assign(NUM_ROUNDS, 0);
+    if (engine.withBic) {
+        bic.assign((size_t) NUM_ROUNDS * NUM_BITS * NUM_BITS, NAN);
+    }
+
+    double N = (double) numSamples;
+    vector<unsigned long long> pairCounts((size_t) NUM_BITS * NUM_BITS);
+
+    for (int r = 0; r < NUM_ROUNDS; r++) {
+        for (int i = 0; i < NUM_BITS; i++) {
+            float *sacRow = &sac[((size_t) r * NUM_BITS + i) * NUM_BITS];
+
+            if (!engine.withBic) {
+                unsigned long long counts[128];
+                counterRead(&engine.planes[engine.rowIndex(r, i, 0)], engine.numPlanes, counts);
+                for (int j = 0; j < NUM_BITS; j++) {
+                    sacRow[j] = (float) (counts[j] / N);
+                }
+                continue;
+            }
+
+            for (int j = 0; j < NUM_BITS; j++) {
+                counterRead(&engine.planes[engine.rowIndex(r, i, j)], engine.numPlanes, &pairCounts[(size_t) j * NUM_BITS]);
+            }
+            for (int j = 0; j < NUM_BITS; j++) {
+                sacRow[j] = (float) (pairCounts[(size_t) j * NUM_BITS + j] / N);
+            }
+
+            float *bicRound = &bic[(size_t) r * NUM_BITS * NUM_BITS];
+            for (int j = 0; j < NUM_BITS; j++) {
+                double a = (double) pairCounts[(size_t) j * NUM_BITS + j];
+                for (int k = j + 1; k < NUM_BITS; k++) {
+                    double b = (double) pairCounts[(size_t) k * NUM_BITS + k];
+                    double c = (double) pairCounts[(size_t) j * NUM_BITS + k];
+                    double denominator = a * (N - a) * b * (N - b);
+                    if (denominator <= 0) {
+                        degenerate[r]++;
+                        continue;
+                    }
+                    double corr = fabs(N * c - a * b) / sqrt(denominator);
+                    float &cell = bicRound[(size_t) j * NUM_BITS + k];
+                    if (std::isnan(cell) || (float) corr > cell) {
+                        cell = (float) corr;
+                        bicRound[(size_t) k * NUM_BITS + j] = (float) corr;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+bool writeMatrices(const string &path, const SacEngine &engine, unsigned long long numSamples, const vector<float> &sac, const vector<float> &bic) {
+    ofstream out(path.c_str(), ios::out | ios::binary | ios::trunc);
+    if (!out) {
+        return false;
+    }
+    unsigned int version = 1;
+    unsigned int flags = (engine.flipKey ? 1u : 0u) | (engine.withBic ? 2u : 0u);
+    unsigned int rounds = NUM_ROUNDS;
+    out.write("SACB", 4);
+    out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    out.write(reinterpret_cast<const char*>(&flags), sizeof(flags));
+    out.write(reinterpret_cast<const char*>(&rounds), sizeof(rounds));
+    out.write(reinterpret_cast<const char*>(&numSamples), sizeof(numSamples));
+    out.write(reinterpret_cast<const char*>(&sac[0]), sac.size() * sizeof(float));
+    if (engine.withBic) {
+        out.write(reinterpret_cast<const char*>(&bic[0]), bic.size() * sizeof(float));
+    }
+    out.close();
+    return !out.fail();
+}
+
+
+/*
+    Per round: mean and worst deviation of the SAC probabilities from 0.5, the worst BIC
+    correlation over the defined cells, and how many (input bit, output pair) correlations
+    were undefined because an output bit always or never flipped (out of 128 * 128 * 127 / 2).
+*/
+void printSummary(const SacEngine &engine, const vector<float> &sac, const vector<float> &bic, const vector<unsigned long long> &degenerate) {
+    cout << fixed << setprecision(4);
+    cout << "Round  SAC mean  SAC max |p-0.5|" << (engine.withBic ? "  BIC max |corr|  BIC undefined" : "") << endl;
+    for (int r = 0; r < NUM_ROUNDS; r++) {
+        double sum = 0, worst = 0, worstCorr = 0;
+        bool anyDefined = false;
+        for (int n = 0; n < NUM_BITS * NUM_BITS; n++) {
+            double p = sac[(size_t) r * NUM_BITS * NUM_BITS + n];
+            sum += p;
+            if (fabs(p - 0.5) > worst) worst = fabs(p - 0.5);
+            if (engine.withBic) {
+                float corr = bic[(size_t) r * NUM_BITS * NUM_BITS + n];
+                if (std::isnan(corr)) continue;
+                anyDefined = true;
+                if (corr > worstCorr) worstCorr = corr;
+            }
+        }
+        cout << setw(5) << r << setw(10) << sum / (NUM_BITS * NUM_BITS) << setw(17) << worst;
+        if (engine.withBic) {
+            if (anyDefined) {
+                cout << setw(17) << worstCorr;
+            } else {
+                cout << setw(17) << "-";
+            }
+            cout << setw(15) << degenerate[r];
+        }
+        cout << endl;
+    }
+}
+
+
+int main(int argc, char *argv[]) {
+    cout << "=============================" << endl;
+    cout << " AES-128 SAC / BIC Analysis " << endl;
+    cout << "=============================" << endl;
+
+    unsigned long long numSamples = 4096;
+    unsigned long long seed = 1;
+    int numThreads = (int) thread::hardware_concurrency();
+    string outputPath = "sac_bic.bin";
+
+    SacEngine engine;
+    engine.flipKey = false;
+    engine.withBic = true;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-k") == 0) engine.flipKey = true;
+        else if (i + 1 >= argc) {
+            cout << "Missing value for " << argv[i] << endl;
+            return 1;
+        }
+        else if (strcmp(argv[i], "-n") == 0) numSamples = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-t") == 0) numThreads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0) seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-b") == 0) engine.withBic = atoi(argv[++i]) != 0;
+        else if (strcmp(argv[i], "-o") == 0) outputPath = argv[++i];
+        else {
+            cout << "Unknown option " << argv[i] << endl;
+            return 1;
+        }
+    }
+    if (numSamples < 1) numSamples = 1;
+    if (numThreads < 1) numThreads = 1;
+    if (numThreads > NUM_BITS) numThreads = NUM_BITS;
+
+    engine.numPlanes = bitLength(numSamples);
+    size_t rows = (size_t) NUM_ROUNDS * NUM_BITS * (engine.withBic ? NUM_BITS : 1);
+    engine.planes = new Bits128[rows * engine.numPlanes];
+    for (size_t n = 0; n < rows * engine.numPlanes; n++) {
+        engine.planes[n] = bitsZero();
+    }
+
+    cout << "Flipping " << (engine.flipKey ? "key" : "plaintext") << " bits over " << numSamples
+         << " samples on " << numThreads << " threads (" << (rows * engine.numPlanes * 16 >> 20) << " MB of counters)" << endl;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    vector<thread> workers;
+    for (int t = 0; t < numThreads; t++) {
+        int firstBit = NUM_BITS * t / numThreads;
+        int lastBit = NUM_BITS * (t + 1) / numThreads;
+        workers.push_back(thread(runInputBits, ref(engine), seed, numSamples, firstBit, lastBit));
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Gathered in " << setprecision(2) << fixed << seconds << " s" << endl << endl;
+
+    vector<float> sac, bic;
+    vector<unsigned long long> degenerate;
+    buildMatrices(engine, numSamples, sac, bic, degenerate);
+    printSummary(engine, sac, bic, degenerate);
+
+    if (writeMatrices(outputPath, engine, numSamples, sac, bic)) {
+        cout << "Wrote matrices to " << outputPath << endl;
+    } else {
+        cout << "Unable to write " << outputPath << endl;
+    }
+
+    delete[] engine.planes;
+    return 0;
+}
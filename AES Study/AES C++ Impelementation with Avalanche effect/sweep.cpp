@@ -0,0 +1,350 @@
+/*
+    AES Avalanche Sweep (batch mode)
+
+    - Flips every plaintext bit and every key bit (0-127), one at a time.
+    - Repeats every flip over many random plaintext/key samples.
+    - Spreads the samples over all cores.
+    - Reports per-round mean, variance, min and max of changed bits.
+    - Writes the per-bit results to "avalanche_sweep.csv".
+    - Saves progress to "avalanche_sweep.ckpt" so a long sweep can be resumed.
+    - Optionally (-T) writes every distance to a binary trace (see trace.h):
+      run = target * 128 + bit (target 0 = plaintext, 1 = key), block = sample index.
+
+    Usage: sweep [-n samples] [-t threads] [-s seed] [-i checkpoint interval] [-c checkpoint file] [-o output file] [-T trace file]
+    Build: g++ -O2 -pthread sweep.cpp -o sweep.exe
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include "avalanche.h"
+#include "trace.h"
+
+using namespace std;
+
+
+const int NUM_TARGETS = 2;      // 0 = plaintext bit flipped, 1 = key bit flipped
+const int NUM_BITS = 128;
+const int NUM_ROUNDS = 11;      // round 0 is the initial AddRoundKey
+
+const unsigned int CHECKPOINT_MAGIC = 0x53574550; // "SWEP"
+
+
+/*
+    Running statistics of the changed bits for one (target, bit, round) cell.
+    Sums are kept as integers so that merging the threads and resuming from a checkpoint are exact.
+*/
+struct RoundStats {
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long sumSquares;
+    int min;
+    int max;
+};
+
+struct SweepStats {
+    RoundStats cells[NUM_TARGETS][NUM_BITS][NUM_ROUNDS];
+};
+
+
+void resetStats(SweepStats &stats) {
+    for (int t = 0; t < NUM_TARGETS; t++) {
+        for (int b = 0; b < NUM_BITS; b++) {
+            for (int r = 0; r < NUM_ROUNDS; r++) {
+                RoundStats &cell = stats.cells[t][b][r];
+                cell.count = 0;
+                cell.sum = 0;
+                cell.sumSquares = 0;
+                cell.min = 128;
+                cell.max = 0;
+            }
+        }
+    }
+}
+
+void addSample(RoundStats &cell, int changedBits) {
+    cell.count++;
+    cell.sum += changedBits;
+    cell.sumSquares += (unsigned long long) changedBits * changedBits;
+    if (changedBits < cell.min) cell.min = changedBits;
+    if (changedBits > cell.max) cell.max = changedBits;
+}
+
+void mergeStats(SweepStats &into, const SweepStats &from) {
+    for (int t = 0; t < NUM_TARGETS; t++) {
+        for (int b = 0; b < NUM_BITS; b++) {
+            for (int r = 0; r < NUM_ROUNDS; r++) {
+                RoundStats &dst = into.cells[t][b][r];
+                const RoundStats &src = from.cells[t][b][r];
+                dst.count += src.count;
+                dst.sum += src.sum;
+                dst.sumSquares += src.sumSquares;
+                if (src.min < dst.min) dst.min = src.min;
+                if (src.max > dst.max) dst.max = src.max;
+            }
+        }
+    }
+}
+
+double statsMean(const RoundStats &cell) {
+    return cell.count ? (double) cell.sum / cell.count : 0.0;
+}
+
+// Population variance from the integer sums
+double statsVariance(const RoundStats &cell) {
+    if (cell.count == 0) return 0.0;
+    double mean = statsMean(cell);
+    return (double) cell.sumSquares / cell.count - mean * mean;
+}
+
+
+// Runs every plaintext and key bit flip for one sample and adds the per-round distances to stats
+// (and to the trace chunk, when tracing)
+void sweepSample(unsigned long long seed, unsigned long long sampleIndex, SweepStats &stats, TraceChunk *trace) {
+    unsigned char plaintext[16], key[16];
+    makeSample(seed, sampleIndex, plaintext, key);
+
+    unsigned char expandedKey[176];
+    KeyExpansion(key, expandedKey);
+
+    unsigned char ciphertext[16];
+    unsigned char baseStates[NUM_ROUNDS][16];
+    unsigned char flippedStates[NUM_ROUNDS][16];
+    AESEncryptWithAvalanche(plaintext, expandedKey, ciphertext, baseStates);
+
+    // plaintext bits: same key, one bit of the message flipped
+    for (int bit = 0; bit < NUM_BITS; bit++) {
+        unsigned char flipped[16];
+        memcpy(flipped, plaintext, 16);
+        flipBit(flipped, bit);
+        AESEncryptWithAvalanche(flipped, expandedKey, ciphertext, flippedStates);
+        for (int r = 0; r < NUM_ROUNDS; r++) {
+            int changedBits = countChangedBits(baseStates[r], flippedStates[r], 16);
+            addSample(stats.cells[0][bit][r], changedBits);
+            if (trace) trace->add(bit, (unsigned int) sampleIndex, r, changedBits);
+        }
+    }
+
+    // key bits: same message, one bit of the key flipped and the key re-expanded
+    for (int bit = 0; bit < NUM_BITS; bit++) {
+        unsigned char flippedKey[16];
+        unsigned char flippedExpandedKey[176];
+        memcpy(flippedKey, key, 16);
+        flipBit(flippedKey, bit);
+        KeyExpansion(flippedKey, flippedExpandedKey);
+        AESEncryptWithAvalanche(plaintext, flippedExpandedKey, ciphertext, flippedStates);
+        for (int r = 0; r < NUM_ROUNDS; r++) {
+            int changedBits = countChangedBits(baseStates[r], flippedStates[r], 16);
+            addSample(stats.cells[1][bit][r], changedBits);
+            if (trace) trace->add(NUM_BITS + bit, (unsigned int) sampleIndex, r, changedBits);
+        }
+    }
+}
+
+
+/*
+    Checkpoint file layout (native byte order):
+    magic, seed, samples done, then the raw SweepStats.
+    It is written to a temporary file first and renamed, so a crash never leaves a half-written checkpoint.
+*/
+bool saveCheckpoint(const string &path, unsigned long long seed, unsigned long long samplesDone, const SweepStats &stats) {
+    string tmpPath = path + ".tmp";
+    ofstream out(tmpPath.c_str(), ios::out | ios::binary | ios::trunc);
+    if (!out) {
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(&CHECKPOINT_MAGIC), sizeof(CHECKPOINT_MAGIC));
+    out.write(reinterpret_cast<const char*>(&seed), sizeof(seed));
+    out.write(reinterpret_cast<const char*>(&samplesDone), sizeof(samplesDone));
+    out.write(reinterpret_cast<const char*>(&stats), sizeof(stats));
+    out.close();
+    if (!out) {
+        return false;
+    }
+    remove(path.c_str());
+    return rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+bool loadCheckpoint(const string &path, unsigned long long seed, unsigned long long &samplesDone, SweepStats &stats) {
+    ifstream in(path.c_str(), ios::in | ios::binary);
+    if (!in) {
+        return false;
+    }
+    unsigned int magic = 0;
+    unsigned long long savedSeed = 0;
+    in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    in.read(reinterpret_cast<char*>(&savedSeed), sizeof(savedSeed));
+    in.read(reinterpret_cast<char*>(&samplesDone), sizeof(samplesDone));
+    in.read(reinterpret_cast<char*>(&stats), sizeof(stats));
+    if (!in || magic != CHECKPOINT_MAGIC) {
+        cout << "Ignoring unreadable checkpoint " << path << endl;
+        return false;
+    }
+    if (savedSeed != seed) {
+        cout << "Ignoring checkpoint " << path << " (it was made with seed " << savedSeed << ")" << endl;
+        return false;
+    }
+    return true;
+}
+
+
+// Runs samples [first, last) split evenly over the worker threads and merges the results into stats.
+// When a trace writer is given, each thread fills its own chunk and hands it over when full.
+void runSamples(unsigned long long seed, unsigned long long first, unsigned long long last, int numThreads, SweepStats &stats, TraceWriter *traceWriter) {
+    vector<SweepStats> partial(numThreads);
+    vector<thread> workers;
+
+    for (int t = 0; t < numThreads; t++) {
+        workers.push_back(thread([&, t]() {
+            resetStats(partial[t]);
+            TraceChunk *trace = traceWriter ? new TraceChunk : NULL;
+            for (unsigned long long n = first + t; n < last; n += numThreads) {
+                sweepSample(seed, n, partial[t], trace);
+                if (trace && trace->size() + 2 * NUM_BITS * NUM_ROUNDS > TRACE_CHUNK_ROWS) {
+                    traceWriter->writeChunk(*trace);
+                }
+            }
+            if (trace) {
+                traceWriter->writeChunk(*trace);
+                delete trace;
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+    for (int t = 0; t < numThreads; t++) {
+        mergeStats(stats, partial[t]);
+    }
+}
+
+
+void writeResults(const string &path, const SweepStats &stats) {
+    ofstream out(path.c_str());
+    out << "Target,Bit,Round,Samples,Mean,Variance,Min,Max\n";
+    out << fixed << setprecision(4);
+    for (int t = 0; t < NUM_TARGETS; t++) {
+        for (int b = 0; b < NUM_BITS; b++) {
+            for (int r = 0; r < NUM_ROUNDS; r++) {
+                const RoundStats &cell = stats.cells[t][b][r];
+                out << (t == 0 ? "plaintext" : "key") << "," << b << "," << r << "," << cell.count << ","
+                    << statsMean(cell) << "," << statsVariance(cell) << "," << cell.min << "," << cell.max << "\n";
+            }
+        }
+    }
+}
+
+// Prints the per-round summary over all 128 bits of each target
+void printSummary(const SweepStats &stats) {
+    cout << fixed << setprecision(3);
+    for (int t = 0; t < NUM_TARGETS; t++) {
+        cout << (t == 0 ? "Plaintext" : "Key") << " bit flips:" << endl;
+        cout << "Round      Mean  Variance  Min  Max" << endl;
+        for (int r = 0; r < NUM_ROUNDS; r++) {
+            RoundStats total = { 0, 0, 0, 128, 0 };
+            for (int b = 0; b < NUM_BITS; b++) {
+                const RoundStats &cell = stats.cells[t][b][r];
+                total.count += cell.count;
+                total.sum += cell.sum;
+                total.sumSquares += cell.sumSquares;
+                if (cell.min < total.min) total.min = cell.min;
+                if (cell.max > total.max) total.max = cell.max;
+            }
+            cout << setw(5) << r << setw(10) << statsMean(total) << setw(10) << statsVariance(total)
+                 << setw(5) << total.min << setw(5) << total.max << endl;
+        }
+        cout << endl;
+    }
+}
+
+
+int main(int argc, char *argv[]) {
+    cout << "=============================" << endl;
+    cout << " AES-128 Avalanche Sweep " << endl;
+    cout << "=============================" << endl;
+
+    unsigned long long numSamples = 10000;
+    unsigned long long seed = 1;
+    unsigned long long checkpointInterval = 1000;
+    int numThreads = (int) thread::hardware_concurrency();
+    string checkpointPath = "avalanche_sweep.ckpt";
+    string outputPath = "avalanche_sweep.csv";
+    string tracePath;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-n") == 0) numSamples = strtoull(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-t") == 0) numThreads = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-s") == 0) seed = strtoull(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-i") == 0) checkpointInterval = strtoull(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-c") == 0) checkpointPath = argv[i + 1];
+        else if (strcmp(argv[i], "-o") == 0) outputPath = argv[i + 1];
+        else if (strcmp(argv[i], "-T") == 0) tracePath = argv[i + 1];
+        else {
+            cout << "Unknown option " << argv[i] << endl;
+            return 1;
+        }
+    }
+    if (numThreads < 1) numThreads = 1;
+    if (checkpointInterval < 1) checkpointInterval = 1;
+
+    SweepStats *stats = new SweepStats;
+    resetStats(*stats);
+
+    unsigned long long samplesDone = 0;
+    if (loadCheckpoint(checkpointPath, seed, samplesDone, *stats)) {
+        cout << "Resuming from checkpoint after " << samplesDone << " samples" << endl;
+    }
+
+    // The trace covers the samples run by this invocation; a resumed sweep starts a new trace file
+    TraceWriter traceWriter;
+    if (!tracePath.empty() && !traceWriter.open(tracePath)) {
+        cout << "Unable to open trace file " << tracePath << endl;
+        return 1;
+    }
+
+    cout << "Sweeping " << numSamples << " samples x 256 bit flips on " << numThreads << " threads" << endl;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    unsigned long long startSamples = samplesDone;
+
+    while (samplesDone < numSamples) {
+        unsigned long long last = samplesDone + checkpointInterval;
+        if (last > numSamples) last = numSamples;
+
+        runSamples(seed, samplesDone, last, numThreads, *stats, tracePath.empty() ? NULL : &traceWriter);
+        samplesDone = last;
+
+        if (!saveCheckpoint(checkpointPath, seed, samplesDone, *stats)) {
+            cout << "Unable to write checkpoint " << checkpointPath << endl;
+        }
+        cout << "  " << samplesDone << " / " << numSamples << " samples" << endl;
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (seconds > 0 && samplesDone > startSamples) {
+        cout << "Encryptions per second: " << (unsigned long long) ((samplesDone - startSamples) * 257 / seconds) << endl;
+    }
+    cout << endl;
+
+    if (traceWriter.isOpen()) {
+        if (!traceWriter.close()) {
+            cout << "Unable to write trace file " << tracePath << endl;
+            delete stats;
+            return 1;
+        }
+        cout << "Wrote trace to " << tracePath << endl;
+    }
+
+    printSummary(*stats);
+    writeResults(outputPath, *stats);
+    cout << "Wrote per-bit results to " << outputPath << endl;
+
+    delete stats;
+    return 0;
+}
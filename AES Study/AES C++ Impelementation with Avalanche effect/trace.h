@@ -0,0 +1,164 @@
+/*
+ * trace.h - Binary columnar trace of avalanche distances.
+ *
+ * One row per (run id, block, round) with the number of changed bits.
+ * Rows are gathered in large chunks and every chunk is written column by column,
+ * so writing costs one large write per chunk and readers that only need some
+ * columns (e.g. round and distance for histograms) can skip the others.
+ *
+ * File layout (native byte order, little-endian on x86):
+ *     char[4]  "AVTR"
+ *     uint32   version (1)
+ *     then chunks until end of file:
+ *         uint32   rows
+ *         uint32   run[rows]
+ *         uint32   block[rows]
+ *         uint8    round[rows]
+ *         uint8    distance[rows]
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <mutex>
+
+const unsigned int TRACE_VERSION = 1;
+const size_t TRACE_CHUNK_ROWS = 1 << 20;   // about 10 MB per chunk
+
+
+// Column buffers of one chunk
+struct TraceChunk {
+    std::vector<unsigned int> runs;
+    std::vector<unsigned int> blocks;
+    std::vector<unsigned char> rounds;
+    std::vector<unsigned char> distances;
+
+    TraceChunk() {
+        runs.reserve(TRACE_CHUNK_ROWS);
+        blocks.reserve(TRACE_CHUNK_ROWS);
+        rounds.reserve(TRACE_CHUNK_ROWS);
+        distances.reserve(TRACE_CHUNK_ROWS);
+    }
+
+    size_t size() const { return runs.size(); }
+    bool full() const { return runs.size() >= TRACE_CHUNK_ROWS; }
+
+    void clear() {
+        runs.clear();
+        blocks.clear();
+        rounds.clear();
+        distances.clear();
+    }
+
+    void add(unsigned int run, unsigned int block, int round, int distance) {
+        runs.push_back(run);
+        blocks.push_back(block);
+        rounds.push_back((unsigned char) round);
+        distances.push_back((unsigned char) distance);
+    }
+
+    // Adds the 11 per-round distances of one block
+    void addBlock(unsigned int run, unsigned int block, const int distances[11]) {
+        for (int round = 0; round < 11; round++) {
+            add(run, block, round, distances[round]);
+        }
+    }
+};
+
+
+/*
+    Writes chunks to a trace file.
+    Several threads may share one writer: each fills its own TraceChunk and
+    hands it over with writeChunk(), which is the only locked step.
+*/
+class TraceWriter {
+public:
+    bool open(const std::string &path) {
+        out.open(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out) {
+            return false;
+        }
+        out.write("AVTR", 4);
+        out.write(reinterpret_cast<const char*>(&TRACE_VERSION), sizeof(TRACE_VERSION));
+        return !out.fail();
+    }
+
+    bool isOpen() const { return out.is_open(); }
+
+    // Writes the chunk and clears it for reuse
+    void writeChunk(TraceChunk &chunk) {
+        unsigned int rows = (unsigned int) chunk.size();
+        if (rows > 0) {
+            std::lock_guard<std::mutex> lock(writeMutex);
+            out.write(reinterpret_cast<const char*>(&rows), sizeof(rows));
+            out.write(reinterpret_cast<const char*>(&chunk.runs[0]), rows * sizeof(unsigned int));
+            out.write(reinterpret_cast<const char*>(&chunk.blocks[0]), rows * sizeof(unsigned int));
+            out.write(reinterpret_cast<const char*>(&chunk.rounds[0]), rows);
+            out.write(reinterpret_cast<const char*>(&chunk.distances[0]), rows);
+        }
+        chunk.clear();
+    }
+
+    bool close() {
+        out.close();
+        return !out.fail();
+    }
+
+private:
+    std::ofstream out;
+    std::mutex writeMutex;
+};
+
+
+/*
+    Reads a trace chunk by chunk.
+    Columns that are not asked for (NULL) are skipped with a seek instead of being read.
+*/
+class TraceReader {
+public:
+    bool open(const std::string &path) {
+        in.open(path.c_str(), std::ios::in | std::ios::binary);
+        if (!in) {
+            return false;
+        }
+        char magic[4];
+        unsigned int version = 0;
+        in.read(magic, 4);
+        in.read(reinterpret_cast<char*>(&version), sizeof(version));
+        return in && magic[0] == 'A' && magic[1] == 'V' && magic[2] == 'T' && magic[3] == 'R' && version == TRACE_VERSION;
+    }
+
+    // Returns false at the end of the file
+    bool readChunk(std::vector<unsigned int> *runs, std::vector<unsigned int> *blocks,
+                   std::vector<unsigned char> *rounds, std::vector<unsigned char> *distances) {
+        unsigned int rows = 0;
+        if (!in.read(reinterpret_cast<char*>(&rows), sizeof(rows))) {
+            return false;
+        }
+        readColumn(runs, rows);
+        readColumn(blocks, rows);
+        readColumn(rounds, rows);
+        readColumn(distances, rows);
+        return !in.fail();
+    }
+
+private:
+    std::ifstream in;
+
+    template <class T>
+    void readColumn(std::vector<T> *column, unsigned int rows) {
+        if (column == NULL) {
+            in.seekg((std::streamoff) rows * sizeof(T), std::ios::cur);
+            return;
+        }
+        column->resize(rows);
+        if (rows > 0) {
+            in.read(reinterpret_cast<char*>(&(*column)[0]), (std::streamsize) rows * sizeof(T));
+        }
+    }
+};
+
+#endif /* TRACE_H */
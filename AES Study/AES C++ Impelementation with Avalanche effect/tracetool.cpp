@@ -0,0 +1,121 @@
+/*
+    Avalanche Trace Tool
+
+    - Reads the binary traces written by encrypt.cpp and sweep.cpp (see trace.h).
+    - hist: per-round histogram of changed bits (only the round and distance columns are read).
+    - csv:  offline export of every row as "Run,Block,Round,Changed Bits".
+
+    Usage: tracetool hist <trace file> [histogram csv]
+           tracetool csv <trace file> <csv file>
+    Build: g++ -O2 tracetool.cpp -o tracetool.exe
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <cstring>
+#include <vector>
+#include "trace.h"
+
+using namespace std;
+
+
+const int NUM_ROUNDS = 11;
+const int MAX_DISTANCE = 128;
+
+
+int makeHistogram(const string &tracePath, const string &outputPath) {
+    TraceReader reader;
+    if (!reader.open(tracePath)) {
+        cout << "Unable to read trace " << tracePath << endl;
+        return 1;
+    }
+
+    // histogram[round][changed bits]
+    vector<unsigned long long> histogram(NUM_ROUNDS * (MAX_DISTANCE + 1), 0);
+    vector<unsigned char> rounds, distances;
+    unsigned long long rows = 0;
+
+    while (reader.readChunk(NULL, NULL, &rounds, &distances)) {
+        for (size_t n = 0; n < rounds.size(); n++) {
+            if (rounds[n] < NUM_ROUNDS && distances[n] <= MAX_DISTANCE) {
+                histogram[rounds[n] * (MAX_DISTANCE + 1) + distances[n]]++;
+            }
+        }
+        rows += rounds.size();
+    }
+
+    cout << "Read " << rows << " rows from " << tracePath << endl;
+    cout << "Round     Count      Mean  Min  Max" << endl;
+    cout << fixed << setprecision(3);
+    for (int r = 0; r < NUM_ROUNDS; r++) {
+        unsigned long long count = 0, sum = 0;
+        int min = -1, max = -1;
+        for (int d = 0; d <= MAX_DISTANCE; d++) {
+            unsigned long long n = histogram[r * (MAX_DISTANCE + 1) + d];
+            if (n == 0) continue;
+            if (min < 0) min = d;
+            max = d;
+            count += n;
+            sum += n * d;
+        }
+        if (count == 0) continue;
+        cout << setw(5) << r << setw(10) << count << setw(10) << (double) sum / count
+             << setw(5) << min << setw(5) << max << endl;
+    }
+
+    if (!outputPath.empty()) {
+        ofstream out(outputPath.c_str());
+        out << "Round,Changed Bits,Count\n";
+        for (int r = 0; r < NUM_ROUNDS; r++) {
+            for (int d = 0; d <= MAX_DISTANCE; d++) {
+                unsigned long long n = histogram[r * (MAX_DISTANCE + 1) + d];
+                if (n > 0) {
+                    out << r << "," << d << "," << n << "\n";
+                }
+            }
+        }
+        cout << "Wrote histogram to " << outputPath << endl;
+    }
+    return 0;
+}
+
+
+int exportCsv(const string &tracePath, const string &outputPath) {
+    TraceReader reader;
+    if (!reader.open(tracePath)) {
+        cout << "Unable to read trace " << tracePath << endl;
+        return 1;
+    }
+    ofstream out(outputPath.c_str());
+    if (!out) {
+        cout << "Unable to open " << outputPath << endl;
+        return 1;
+    }
+
+    out << "Run,Block,Round,Changed Bits\n";
+    vector<unsigned int> runs, blocks;
+    vector<unsigned char> rounds, distances;
+    unsigned long long rows = 0;
+    while (reader.readChunk(&runs, &blocks, &rounds, &distances)) {
+        for (size_t n = 0; n < runs.size(); n++) {
+            out << runs[n] << "," << blocks[n] << "," << (int) rounds[n] << "," << (int) distances[n] << "\n";
+        }
+        rows += runs.size();
+    }
+    cout << "Wrote " << rows << " rows to " << outputPath << endl;
+    return 0;
+}
+
+
+int main(int argc, char *argv[]) {
+    if (argc >= 3 && strcmp(argv[1], "hist") == 0) {
+        return makeHistogram(argv[2], argc >= 4 ? argv[3] : "");
+    }
+    if (argc >= 4 && strcmp(argv[1], "csv") == 0) {
+        return exportCsv(argv[2], argv[3]);
+    }
+    cout << "Usage: tracetool hist <trace file> [histogram csv]" << endl;
+    cout << "       tracetool csv <trace file> <csv file>" << endl;
+    return 1;
+}
@@ -0,0 +1,325 @@
+/*
+ * aes.h - AES-128 block encryption and decryption.
+ *
+ * The round functions of encrypt.cpp and decrypt.cpp, shared so that one program can
+ * use both directions. The decryption steps carry an Inv prefix where their names
+ * would clash with the encryption steps (InvShiftRows, InvSubBytes, InvRound).
+ * Each program is compiled as a single translation unit, like structures.h.
+ */
+
+#ifndef AES_H
+#define AES_H
+
+#include <cstddef>
+
+#include "structures.h"
+
+
+// --------------------------------------------------------
+// Encryption
+// --------------------------------------------------------
+
+/*
+    XORs each byte of the state with the corresponding round key byte.
+    serves as the initial round during encryption
+    AddRoundKey is simplye an XOR of a 128-bit block with the 128-bit key.
+    the AddRoundKey step is one of the four main transformations in each AES round. it ensures that the encryption is securely linked to the secret key, making brute-force attacks difficult.
+*/
+void AddRoundKey(unsigned char* state, unsigned char* roundKey)
+{
+    for(int i = 0; i < 16; i++)
+    {
+        state[i] ^= roundKey[i];
+    }
+}
+
+
+/*
+    Perform substitution to each of the 16 bytes 
+    uses S-box as lookup table
+
+*/
+
+void subBytes(unsigned char * state){
+    for(int i = 0 ; i < 16 ; i++){
+        state[i] = s[state[i]];
+    }
+}
+
+
+// Shifts rows to the left for diffusion.
+void ShiftRows(unsigned char * state){
+    unsigned char temp[16];
+
+    // first column
+    temp[0] = state[0];
+    temp[1] = state[5];
+    temp[2] = state[10];
+    temp[3] = state[15];
+
+    // second column
+    temp[4] = state[4];
+    temp[5] = state[9];
+    temp[6] = state[14];
+    temp[7] = state[3];
+    // third column
+    temp[8] = state[8];
+    temp[9] = state[13];
+    temp[10] = state[2];
+    temp[11] = state[7];
+    // fourth column
+    temp[12] = state[12];   
+    temp[13] = state[1];
+    temp[14] = state[6];
+    temp[15] = state[11];
+
+    for(int i = 0 ; i < 16 ; i++){
+        state[i] = temp[i];
+    }
+}
+
+
+/* MixColumns uses mul2, mul3 look-up tables
+  * Source of diffusion
+  */
+ void MixColumns(unsigned char * state) {
+	unsigned char tmp[16];
+
+	tmp[0] = (unsigned char) mul2[state[0]] ^ mul3[state[1]] ^ state[2] ^ state[3];
+	tmp[1] = (unsigned char) state[0] ^ mul2[state[1]] ^ mul3[state[2]] ^ state[3];
+	tmp[2] = (unsigned char) state[0] ^ state[1] ^ mul2[state[2]] ^ mul3[state[3]];
+	tmp[3] = (unsigned char) mul3[state[0]] ^ state[1] ^ state[2] ^ mul2[state[3]];
+
+	tmp[4] = (unsigned char)mul2[state[4]] ^ mul3[state[5]] ^ state[6] ^ state[7];
+	tmp[5] = (unsigned char)state[4] ^ mul2[state[5]] ^ mul3[state[6]] ^ state[7];
+	tmp[6] = (unsigned char)state[4] ^ state[5] ^ mul2[state[6]] ^ mul3[state[7]];
+	tmp[7] = (unsigned char)mul3[state[4]] ^ state[5] ^ state[6] ^ mul2[state[7]];
+
+	tmp[8] = (unsigned char)mul2[state[8]] ^ mul3[state[9]] ^ state[10] ^ state[11];
+	tmp[9] = (unsigned char)state[8] ^ mul2[state[9]] ^ mul3[state[10]] ^ state[11];
+	tmp[10] = (unsigned char)state[8] ^ state[9] ^ mul2[state[10]] ^ mul3[state[11]];
+	tmp[11] = (unsigned char)mul3[state[8]] ^ state[9] ^ state[10] ^ mul2[state[11]];
+
+	tmp[12] = (unsigned char)mul2[state[12]] ^ mul3[state[13]] ^ state[14] ^ state[15];
+	tmp[13] = (unsigned char)state[12] ^ mul2[state[13]] ^ mul3[state[14]] ^ state[15];
+	tmp[14] = (unsigned char)state[12] ^ state[13] ^ mul2[state[14]] ^ mul3[state[15]];
+	tmp[15] = (unsigned char)mul3[state[12]] ^ state[13] ^ state[14] ^ mul2[state[15]];
+
+	for (int i = 0; i < 16; i++) {
+		state[i] = tmp[i];
+	}
+}
+
+
+/* Each round operates on 128 bits at a time 
+    the number of rounds is defined in AESEncrypt()
+*/
+
+void Round(unsigned char * state, unsigned char * key){
+    subBytes(state);
+    ShiftRows(state);
+    MixColumns(state);
+    AddRoundKey(state,key);
+}
+
+
+// same as Round() except it doesn't mix columns
+void FinalRound(unsigned char * state, unsigned char * key){
+    subBytes(state);
+    ShiftRows(state);
+    AddRoundKey(state,key);
+}
+
+
+// The AES ecryption function organizes the confusion and diffusion steps into one function
+void AESEncrypt(unsigned char * message, unsigned char * expandedKey, unsigned char * enctypedMessage){
+
+    unsigned char state[16]; // stores the first 16 bytes of orginal message
+
+    for(int i =0 ; i< 16 ; i++){
+        state[i] = message[i];
+    }
+
+    int numberOfRounds = 9;
+
+    AddRoundKey(state, expandedKey); // initial round
+
+    for(int i = 0 ; i< numberOfRounds; i++){
+        Round(state, expandedKey + (16 * (i+1)));
+    }
+
+    FinalRound(state , expandedKey + 160);
+
+    // Copy encrypted state to buffer
+    for(int i = 0 ; i< 16 ; i++){
+        enctypedMessage[i] = state[i];
+    }
+
+}
+
+
+// --------------------------------------------------------
+// Decryption
+// --------------------------------------------------------
+
+/*
+    InverseMixColumns - Reverses the MixColumns step of AES encryption.
+    Uses precomputed multiplication lookup tables (mul9, mul11, mul13, mul14).
+    This function ensures that the diffusion effect introduced during encryption is reversed.
+*/
+
+void InverseMixColumns(unsigned char * state){
+    unsigned char tmp[16];
+    
+    // Perform matrix multiplication in GF(2^8)
+    tmp[0] = (unsigned char) mul14[state[0]] ^ mul11[state[1]] ^ mul13[state[2]] ^ mul9[state[3]];
+    tmp[1] = (unsigned char) mul9[state[0]] ^ mul14[state[1]] ^ mul11[state[2]] ^ mul13[state[3]];
+    tmp[2] = (unsigned char) mul13[state[0]] ^ mul9[state[1]] ^ mul14[state[2]] ^ mul11[state[3]];
+    tmp[3] = (unsigned char) mul11[state[0]] ^ mul13[state[1]] ^ mul9[state[2]] ^ mul14[state[3]];
+
+    tmp[4] = (unsigned char) mul14[state[4]] ^ mul11[state[5]] ^ mul13[state[6]] ^ mul9[state[7]];
+    tmp[5] = (unsigned char) mul9[state[4]] ^ mul14[state[5]] ^ mul11[state[6]] ^ mul13[state[7]];
+    tmp[6] = (unsigned char) mul13[state[4]] ^ mul9[state[5]] ^ mul14[state[6]] ^ mul11[state[7]];
+    tmp[7] = (unsigned char) mul11[state[4]] ^ mul13[state[5]] ^ mul9[state[6]] ^ mul14[state[7]];
+
+    tmp[8] = (unsigned char) mul14[state[8]] ^ mul11[state[9]] ^ mul13[state[10]] ^ mul9[state[11]];
+    tmp[9] = (unsigned char) mul9[state[8]] ^ mul14[state[9]] ^ mul11[state[10]] ^ mul13[state[11]];
+    tmp[10] = (unsigned char) mul13[state[8]] ^ mul9[state[9]] ^ mul14[state[10]] ^ mul11[state[11]];
+    tmp[11] = (unsigned char) mul11[state[8]] ^ mul13[state[9]] ^ mul9[state[10]] ^ mul14[state[11]];
+
+    tmp[12] = (unsigned char) mul14[state[12]] ^ mul11[state[13]] ^ mul13[state[14]] ^ mul9[state[15]];
+    tmp[13] = (unsigned char) mul9[state[12]] ^ mul14[state[13]] ^ mul11[state[14]] ^ mul13[state[15]];
+    tmp[14] = (unsigned char) mul13[state[12]] ^ mul9[state[13]] ^ mul14[state[14]] ^ mul11[state[15]];
+    tmp[15] = (unsigned char) mul11[state[12]] ^ mul13[state[13]] ^ mul9[state[14]] ^ mul14[state[15]];
+
+
+    // Copy results back to state
+    for(int i = 0 ; i< 16 ; i++){
+        state[i] = tmp[i];
+    }
+    
+}
+
+/*
+    InvShiftRows - Performs the inverse of the ShiftRows transformation.
+    This undoes the shifting performed during encryption.
+*/
+void InvShiftRows(unsigned char * state){
+    unsigned char tmp[16];
+
+    // First row remains unchanged
+    tmp[0] = state[0];
+    tmp[1] = state[13];
+    tmp[2] = state[10];
+    tmp[3] = state[7];
+
+    // second column
+    tmp[4] = state[4];
+    tmp[5] = state[1];
+	tmp[6] = state[14];
+	tmp[7] = state[11];
+
+	// third column
+	tmp[8] = state[8];
+	tmp[9] = state[5];
+	tmp[10] = state[2];
+	tmp[11] = state[15];
+
+	// fourth column
+	tmp[12] = state[12];
+	tmp[13] = state[9];
+	tmp[14] = state[6];
+	tmp[15] = state[3];
+
+
+    // Copy results back to state
+    for (int i = 0; i < 16; i++)
+    {
+        state[i] = tmp[i];
+    }
+    
+}
+
+
+/*
+    InvSubBytes - Applies the inverse S-Box to each byte of the state.
+    This reverses the byte substitution step in encryption.
+*/
+void InvSubBytes(unsigned char * state){
+    for(int i = 0 ;  i < 16 ; i++){ 
+        state[i] = inv_s[state[i]]; // inv_s is the inverse S-Box lookup table
+    }
+}
+
+
+/*
+    InvRound - Performs one full round of AES decryption.
+    Each round includes AddRoundKey, InverseMixColumns, InvShiftRows, and InvSubBytes.
+*/
+
+void InvRound(unsigned char * state, unsigned char * key) {
+	AddRoundKey(state, key);
+	InverseMixColumns(state);
+	InvShiftRows(state);
+	InvSubBytes(state);
+}
+
+/*
+    InitialRound - The first round of AES decryption (excludes InverseMixColumns).
+*/
+void InitialRound(unsigned char * state , unsigned char * key){
+    AddRoundKey(state, key);
+    InvShiftRows(state);
+	InvSubBytes(state);
+}
+
+/*
+    AESDecrypt - Main decryption function.
+    Decrypts a 16-byte block of encrypted data using AES-128.
+*/
+void AESDecrypt( unsigned char * encryptedMessage, unsigned char * expandedKey, unsigned char * decryptedMessage){
+    unsigned char state[16];  // stores the first 16 bytes of encrypted message
+
+    // Copy encrypted message into state
+    for(int i = 0 ; i< 16 ; i++){
+        state[i] = encryptedMessage[i];
+    }
+
+
+    // Perform Initial Round with the last round key
+    InitialRound(state, expandedKey+160); // Last round key is used first
+
+   // Perform 9 main rounds (AES-128 has 10 rounds total)
+    for(int i = 8 ; i >=0 ; i--){
+        InvRound(state, expandedKey + (16 * (i + 1)));
+    }
+
+    // Final round (only AddRoundKey step)
+    AddRoundKey(state, expandedKey); 
+
+    // Copy decrypted state to output buffer
+    for(int i= 0; i< 16 ;i ++){
+        decryptedMessage[i] = state[i];
+    }
+}
+
+
+// --------------------------------------------------------
+// Multi-block (ECB) helpers
+// --------------------------------------------------------
+
+// Encrypts length bytes (a multiple of 16) block by block; in and out may be the same buffer
+void AESEncryptBlocks(unsigned char * in, size_t length, unsigned char * expandedKey, unsigned char * out){
+    for(size_t i = 0 ; i < length ; i += 16){
+        AESEncrypt(in + i, expandedKey, out + i);
+    }
+}
+
+// Decrypts length bytes (a multiple of 16) block by block; in and out may be the same buffer
+void AESDecryptBlocks(unsigned char * in, size_t length, unsigned char * expandedKey, unsigned char * out){
+    for(size_t i = 0 ; i < length ; i += 16){
+        AESDecrypt(in + i, expandedKey, out + i);
+    }
+}
+
+#endif /* AES_H */
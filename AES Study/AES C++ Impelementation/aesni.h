@@ -0,0 +1,134 @@
+/*
+ * aesni.h - AES-128 with the x86 AES-NI instructions.
+ *
+ * Uses the same 176-byte expanded key as KeyExpansion() in structures.h.
+ * Bulk calls keep 8 independent blocks in flight, so the pipelined AESENC unit
+ * is kept busy instead of waiting on one block's round-to-round latency.
+ *
+ * The functions are compiled for AES-NI with a target attribute, so no extra
+ * compiler flags are needed; callers must check AESNIAvailable() first.
+ * On other architectures AESNIAvailable() returns false and the functions do nothing.
+ */
+
+#ifndef AESNI_H
+#define AESNI_H
+
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <wmmintrin.h>
+#include <emmintrin.h>
+#define HAVE_AESNI 1
+#define AESNI_TARGET __attribute__((target("aes,sse2")))
+#endif
+
+
+bool AESNIAvailable(){
+#ifdef HAVE_AESNI
+    return __builtin_cpu_supports("aes");
+#else
+    return false;
+#endif
+}
+
+
+#ifdef HAVE_AESNI
+
+AESNI_TARGET inline void AESNILoadKeys(const unsigned char * expandedKey, __m128i roundKeys[11]){
+    for(int r = 0 ; r < 11 ; r++){
+        roundKeys[r] = _mm_loadu_si128((const __m128i *) (expandedKey + 16 * r));
+    }
+}
+
+// Decryption keys for AESDEC (equivalent inverse cipher): reversed order, InvMixColumns applied to the middle keys
+AESNI_TARGET inline void AESNILoadDecryptKeys(const unsigned char * expandedKey, __m128i roundKeys[11]){
+    roundKeys[0] = _mm_loadu_si128((const __m128i *) (expandedKey + 160));
+    for(int r = 1 ; r < 10 ; r++){
+        roundKeys[r] = _mm_aesimc_si128(_mm_loadu_si128((const __m128i *) (expandedKey + 16 * (10 - r))));
+    }
+    roundKeys[10] = _mm_loadu_si128((const __m128i *) expandedKey);
+}
+
+AESNI_TARGET inline __m128i AESNIEncryptBlock(__m128i block, const __m128i roundKeys[11]){
+    block = _mm_xor_si128(block, roundKeys[0]);
+    for(int r = 1 ; r < 10 ; r++){
+        block = _mm_aesenc_si128(block, roundKeys[r]);
+    }
+    return _mm_aesenclast_si128(block, roundKeys[10]);
+}
+
+AESNI_TARGET inline __m128i AESNIDecryptBlock(__m128i block, const __m128i roundKeys[11]){
+    block = _mm_xor_si128(block, roundKeys[0]);
+    for(int r = 1 ; r < 10 ; r++){
+        block = _mm_aesdec_si128(block, roundKeys[r]);
+    }
+    return _mm_aesdeclast_si128(block, roundKeys[10]);
+}
+
+// Runs 8 blocks through the rounds side by side
+AESNI_TARGET inline void AESNIEncrypt8(__m128i b[8], const __m128i roundKeys[11]){
+    for(int i = 0 ; i < 8 ; i++) b[i] = _mm_xor_si128(b[i], roundKeys[0]);
+    for(int r = 1 ; r < 10 ; r++){
+        for(int i = 0 ; i < 8 ; i++) b[i] = _mm_aesenc_si128(b[i], roundKeys[r]);
+    }
+    for(int i = 0 ; i < 8 ; i++) b[i] = _mm_aesenclast_si128(b[i], roundKeys[10]);
+}
+
+AESNI_TARGET inline void AESNIDecrypt8(__m128i b[8], const __m128i roundKeys[11]){
+    for(int i = 0 ; i < 8 ; i++) b[i] = _mm_xor_si128(b[i], roundKeys[0]);
+    for(int r = 1 ; r < 10 ; r++){
+        for(int i = 0 ; i < 8 ; i++) b[i] = _mm_aesdec_si128(b[i], roundKeys[r]);
+    }
+    for(int i = 0 ; i < 8 ; i++) b[i] = _mm_aesdeclast_si128(b[i], roundKeys[10]);
+}
+
+#endif /* HAVE_AESNI */
+
+
+// Encrypts length bytes (a multiple of 16); in and out may be the same buffer
+#ifdef HAVE_AESNI
+AESNI_TARGET
+#endif
+void AESNIEncryptBlocks(const unsigned char * in, size_t length, const unsigned char * expandedKey, unsigned char * out){
+#ifdef HAVE_AESNI
+    __m128i roundKeys[11];
+    AESNILoadKeys(expandedKey, roundKeys);
+
+    size_t i = 0;
+    for(; i + 128 <= length ; i += 128){
+        __m128i b[8];
+        for(int j = 0 ; j < 8 ; j++) b[j] = _mm_loadu_si128((const __m128i *) (in + i + 16 * j));
+        AESNIEncrypt8(b, roundKeys);
+        for(int j = 0 ; j < 8 ; j++) _mm_storeu_si128((__m128i *) (out + i + 16 * j), b[j]);
+    }
+    for(; i < length ; i += 16){
+        __m128i block = _mm_loadu_si128((const __m128i *) (in + i));
+        _mm_storeu_si128((__m128i *) (out + i), AESNIEncryptBlock(block, roundKeys));
+    }
+#endif
+}
+
+// Decrypts length bytes (a multiple of 16); in and out may be the same buffer
+#ifdef HAVE_AESNI
+AESNI_TARGET
+#endif
+void AESNIDecryptBlocks(const unsigned char * in, size_t length, const unsigned char * expandedKey, unsigned char * out){
+#ifdef HAVE_AESNI
+    __m128i roundKeys[11];
+    AESNILoadDecryptKeys(expandedKey, roundKeys);
+
+    size_t i = 0;
+    for(; i + 128 <= length ; i += 128){
+        __m128i b[8];
+        for(int j = 0 ; j < 8 ; j++) b[j] = _mm_loadu_si128((const __m128i *) (in + i + 16 * j));
+        AESNIDecrypt8(b, roundKeys);
+        for(int j = 0 ; j < 8 ; j++) _mm_storeu_si128((__m128i *) (out + i + 16 * j), b[j]);
+    }
+    for(; i < length ; i += 16){
+        __m128i block = _mm_loadu_si128((const __m128i *) (in + i));
+        _mm_storeu_si128((__m128i *) (out + i), AESNIDecryptBlock(block, roundKeys));
+    }
+#endif
+}
+
+#endif /* AESNI_H */
@@ -0,0 +1,283 @@
+/*
+ * aesstream.h - std::streambuf adaptors that encrypt on write and decrypt on read.
+ *
+ * AESOutputBuf wraps any std::streambuf (a file, a string, a socket buffer...) and
+ * encrypts whatever is written through it; AESInputBuf wraps one and decrypts as it is
+ * read. AESOStream / AESIStream put them behind a normal std::ostream / std::istream, so
+ * existing serialization code with << and >> works unchanged.
+ *
+ * The stream format is the one of the pipe mode (pipeio.h): a 16-byte random initial
+ * counter, then AES-128 CTR. A file written with AESOStream can be decrypted with
+ * "decrypt --pipe" and the other way round.
+ *
+ * Bytes are collected in a STREAM_BUFFER-sized area and encrypted in bulk when it fills,
+ * so single-character writes cost a pointer increment, not a virtual call. Writes and
+ * reads larger than the buffer bypass it and are encrypted straight through.
+ * Memory use is bounded by the buffer; nothing is read ahead beyond one buffer.
+ */
+
+#ifndef AESSTREAM_H
+#define AESSTREAM_H
+
+#include <streambuf>
+#include <istream>
+#include <ostream>
+#include <vector>
+#include <cstring>
+
+#include "modes.h"
+#include "drbg.h"
+
+const size_t STREAM_BUFFER = 1 << 16;
+
+
+/*
+    CTR keystream that can stop and resume at any byte: the unused part of the last
+    keystream block is kept for the next call.
+*/
+class CtrKeystream {
+public:
+    CtrKeystream() : backend(&BestBackend()), used(16) {}
+
+    ~CtrKeystream(){
+        memset(expandedKey, 0, sizeof(expandedKey));
+        memset(block, 0, sizeof(block));
+    }
+
+    void init(const unsigned char key[16], const unsigned char initialCounter[16]){
+        KeyExpansion(const_cast<unsigned char*>(key), expandedKey);
+        memcpy(counter, initialCounter, 16);
+        used = 16;
+    }
+
+    void crypt(const unsigned char * in, size_t length, unsigned char * out){
+        // rest of the current keystream block
+        while(length > 0 && used < 16){
+            *out++ = *in++ ^ block[used++];
+            length--;
+        }
+        // whole blocks in bulk
+        size_t whole = length & ~(size_t) 15;
+        AESCryptCTR(*backend, in, whole, expandedKey, counter, out);
+        in += whole;
+        out += whole;
+        length -= whole;
+        // start a new keystream block for the tail
+        if(length > 0){
+            backend->encryptBlocks(counter, 16, expandedKey, block);
+            incrementCounter(counter);
+            for(used = 0 ; used < length ; used++){
+                out[used] = in[used] ^ block[used];
+            }
+        }
+    }
+
+private:
+    const CipherBackend *backend;
+    unsigned char expandedKey[176];
+    unsigned char counter[16];
+    unsigned char block[16];
+    size_t used;
+};
+
+
+class AESOutputBuf : public std::streambuf {
+public:
+    AESOutputBuf(std::streambuf * sink, const unsigned char key[16], size_t bufferSize = STREAM_BUFFER)
+        : sink(sink), buffer(bufferSize), scratch(bufferSize), headerWritten(false), failed(false) {
+        ThreadDrbg().generate(initialCounter, 16);
+        keystream.init(key, initialCounter);
+        setp(&buffer[0], &buffer[0] + buffer.size());
+    }
+
+    ~AESOutputBuf(){
+        sync();
+    }
+
+protected:
+    int_type overflow(int_type c){
+        if(!flushBuffer()){
+            return traits_type::eof();
+        }
+        if(!traits_type::eq_int_type(c, traits_type::eof())){
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char * data, std::streamsize count){
+        if((size_t) count < buffer.size()){
+            return std::streambuf::xsputn(data, count);
+        }
+        // large write: empty the buffer, then encrypt straight from the caller's data
+        if(!flushBuffer()){
+            return 0;
+        }
+        std::streamsize done = 0;
+        while(done < count){
+            size_t n = (size_t) (count - done) < scratch.size() ? (size_t) (count - done) : scratch.size();
+            if(!encryptAndWrite(reinterpret_cast<const unsigned char*>(data + done), n)){
+                return done;
+            }
+            done += n;
+        }
+        return done;
+    }
+
+    int sync(){
+        if(!flushBuffer()){
+            return -1;
+        }
+        return sink->pubsync();
+    }
+
+private:
+    std::streambuf *sink;
+    std::vector<char> buffer;
+    std::vector<unsigned char> scratch;
+    CtrKeystream keystream;
+    unsigned char initialCounter[16];
+    bool headerWritten;
+    bool failed;
+
+    bool writeHeader(){
+        if(!headerWritten){
+            headerWritten = true;
+            if(sink->sputn(reinterpret_cast<const char*>(initialCounter), 16) != 16){
+                failed = true;
+            }
+        }
+        return !failed;
+    }
+
+    bool encryptAndWrite(const unsigned char * data, size_t length){
+        if(!writeHeader()){
+            return false;
+        }
+        keystream.crypt(data, length, &scratch[0]);
+        if(sink->sputn(reinterpret_cast<const char*>(&scratch[0]), length) != (std::streamsize) length){
+            failed = true;
+        }
+        return !failed;
+    }
+
+    // Encrypts and writes what is in the put area; the header goes out even for an empty stream
+    bool flushBuffer(){
+        size_t length = pptr() - pbase();
+        bool ok = length > 0 ? encryptAndWrite(reinterpret_cast<const unsigned char*>(pbase()), length) : writeHeader();
+        setp(&buffer[0], &buffer[0] + buffer.size());
+        return ok;
+    }
+
+    AESOutputBuf(const AESOutputBuf &);
+    AESOutputBuf &operator=(const AESOutputBuf &);
+};
+
+
+class AESInputBuf : public std::streambuf {
+public:
+    AESInputBuf(std::streambuf * source, const unsigned char key[16], size_t bufferSize = STREAM_BUFFER)
+        : source(source), buffer(bufferSize), headerRead(false), failed(false) {
+        memcpy(this->key, key, 16);
+        setg(&buffer[0], &buffer[0], &buffer[0]);
+    }
+
+    ~AESInputBuf(){
+        memset(key, 0, sizeof(key));
+    }
+
+    // true when the stream was shorter than its 16-byte header
+    bool badHeader() const { return failed; }
+
+protected:
+    int_type underflow(){
+        if(gptr() < egptr()){
+            return traits_type::to_int_type(*gptr());
+        }
+        if(!readHeader()){
+            return traits_type::eof();
+        }
+        std::streamsize n = source->sgetn(&buffer[0], buffer.size());
+        if(n <= 0){
+            return traits_type::eof();
+        }
+        unsigned char *bytes = reinterpret_cast<unsigned char*>(&buffer[0]);
+        keystream.crypt(bytes, (size_t) n, bytes);
+        setg(&buffer[0], &buffer[0], &buffer[0] + n);
+        return traits_type::to_int_type(*gptr());
+    }
+
+    std::streamsize xsgetn(char * data, std::streamsize count){
+        // whatever is already decrypted first
+        std::streamsize done = egptr() - gptr();
+        if(done > count) done = count;
+        memcpy(data, gptr(), (size_t) done);
+        gbump((int) done);
+        if(done == count){
+            return done;
+        }
+        if((size_t) (count - done) < buffer.size()){
+            return done + std::streambuf::xsgetn(data + done, count - done);
+        }
+        // large read: decrypt in place in the caller's buffer
+        if(!readHeader()){
+            return done;
+        }
+        std::streamsize n = source->sgetn(data + done, count - done);
+        if(n > 0){
+            unsigned char *bytes = reinterpret_cast<unsigned char*>(data + done);
+            keystream.crypt(bytes, (size_t) n, bytes);
+            done += n;
+        }
+        return done;
+    }
+
+private:
+    std::streambuf *source;
+    std::vector<char> buffer;
+    CtrKeystream keystream;
+    unsigned char key[16];
+    bool headerRead;
+    bool failed;
+
+    bool readHeader(){
+        if(!headerRead){
+            headerRead = true;
+            unsigned char initialCounter[16];
+            if(source->sgetn(reinterpret_cast<char*>(initialCounter), 16) != 16){
+                failed = true;
+            } else {
+                keystream.init(key, initialCounter);
+            }
+            memset(key, 0, sizeof(key));
+        }
+        return !failed;
+    }
+
+    AESInputBuf(const AESInputBuf &);
+    AESInputBuf &operator=(const AESInputBuf &);
+};
+
+
+// An ostream that encrypts everything written to it into sink
+class AESOStream : public std::ostream {
+public:
+    AESOStream(std::ostream & sink, const unsigned char key[16]) : std::ostream(NULL), buffer(sink.rdbuf(), key) {
+        rdbuf(&buffer);
+    }
+private:
+    AESOutputBuf buffer;
+};
+
+// An istream that decrypts what it reads from source
+class AESIStream : public std::istream {
+public:
+    AESIStream(std::istream & source, const unsigned char key[16]) : std::istream(NULL), buffer(source.rdbuf(), key) {
+        rdbuf(&buffer);
+    }
+private:
+    AESInputBuf buffer;
+};
+
+#endif /* AESSTREAM_H */
@@ -0,0 +1,225 @@
+/*
+    AES Chunked Container Tool
+
+    - pack: encrypts a file into a chunked container (container.h): AES-128 CTR,
+      one tag per chunk, and an index at the end of the file.
+    - read: decrypts only the byte range asked for. Just the chunks that overlap the
+      range are read and authenticated, so a few bytes out of a large archive cost
+      at most two chunks of work.
+    - unpack: decrypts the whole container.
+    - info: prints the header and index without the key.
+    - The key is read from "keyfile" (hex bytes, as for the encryption tool) unless -k is given.
+    - When read writes the data to stdout (no -o), the banner and status messages go to
+      stderr so the output can be piped.
+
+    Usage: archive pack <file> <container> [-c chunk KB] [-k keyfile]
+           archive read <container> <offset> <length> [-o file] [-k keyfile]
+           archive unpack <container> <file> [-k keyfile]
+           archive info <container>
+    Build: g++ -O2 archive.cpp -o archive.exe
+*/
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "container.h"
+#include "hexcodec.h"
+
+using namespace std;
+
+
+const size_t IO_BUFFER = 1 << 20;
+const long MAX_CHUNK_KB = 1 << 20;     // a chunk is held in memory while it is encrypted
+
+// Banner, errors and timings; stderr when the decrypted data itself goes to stdout
+ostream *status = &cout;
+
+
+// Reads a key written as 16 hex bytes, the format used by "keyfile"
+bool readKeyFile(const string & path, unsigned char key[16]){
+    ifstream infile(path.c_str(), ios::in | ios::binary);
+    if(!infile.is_open()){
+        *status << "Unable to open file " << path << endl;
+        return false;
+    }
+    string str;
+    getline(infile, str);
+    if(!ParseHexKey(str, key)){
+        *status << "Key in " << path << " must have 16 hex bytes" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Value of an option such as -k, or the default when it is absent
+string option(int argc, char *argv[], int first, const char *name, const string & fallback){
+    for(int i = first ; i + 1 < argc ; i += 2){
+        if(strcmp(argv[i], name) == 0) return argv[i + 1];
+    }
+    return fallback;
+}
+
+double secondsSince(chrono::steady_clock::time_point start){
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+
+int pack(const string & inPath, const string & outPath, const unsigned char key[16], unsigned int chunkSize){
+    ifstream in(inPath.c_str(), ios::in | ios::binary);
+    if(!in.is_open()){
+        *status << "Unable to open file " << inPath << endl;
+        return 1;
+    }
+    ContainerWriter writer;
+    if(!writer.open(outPath, key, chunkSize)){
+        *status << "Unable to create container: " << writer.error << endl;
+        return 1;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<char> buffer(IO_BUFFER);
+    unsigned long long total = 0;
+    while(in){
+        in.read(&buffer[0], buffer.size());
+        size_t n = (size_t) in.gcount();
+        if(n == 0) break;
+        if(!writer.write(reinterpret_cast<unsigned char*>(&buffer[0]), n)){
+            *status << "Unable to write container: " << writer.error << endl;
+            return 1;
+        }
+        total += n;
+    }
+    if(!writer.close()){
+        *status << "Unable to write container: " << writer.error << endl;
+        return 1;
+    }
+    double seconds = secondsSince(start);
+    *status << "Packed " << total << " bytes into " << outPath << " in " << seconds << " s ("
+         << (seconds > 0 ? total / seconds / 1e6 : 0) << " MB/s)" << endl;
+    return 0;
+}
+
+// Decrypts [offset, offset + length) to out, one I/O buffer at a time
+int extract(ContainerReader & reader, unsigned long long offset, unsigned long long length, ostream & out){
+    vector<unsigned char> buffer(IO_BUFFER);
+    while(length > 0){
+        size_t n = length < buffer.size() ? (size_t) length : buffer.size();
+        if(!reader.read(offset, &buffer[0], n)){
+            *status << "Unable to decrypt: " << reader.error << endl;
+            return 1;
+        }
+        out.write(reinterpret_cast<const char*>(&buffer[0]), n);
+        offset += n;
+        length -= n;
+    }
+    return 0;
+}
+
+int info(const string & path){
+    ifstream in(path.c_str(), ios::in | ios::binary);
+    unsigned char bytes[CONTAINER_HEADER_SIZE];
+    if(!in.read(reinterpret_cast<char*>(bytes), sizeof(bytes)) || memcmp(bytes, "AESC", 4) != 0){
+        cout << "Unable to read container " << path << endl;
+        return 1;
+    }
+    unsigned long long length = getLE(bytes + 24, 8);
+    unsigned int chunkSize = (unsigned int) getLE(bytes + 12, 4);
+    cout << "version:      " << getLE(bytes + 4, 4) << endl;
+    cout << "mode:         " << (getLE(bytes + 8, 4) == CONTAINER_MODE_CTR ? "CTR" : "unknown") << endl;
+    cout << "chunk size:   " << chunkSize << endl;
+    cout << "key ID:       " << hex << getLE(bytes + 16, 8) << dec << endl;
+    cout << "length:       " << length << endl;
+    cout << "chunks:       " << (chunkSize ? (length + chunkSize - 1) / chunkSize : 0) << endl;
+    cout << "index offset: " << getLE(bytes + 32, 8) << endl;
+    return 0;
+}
+
+
+int main(int argc, char *argv[]){
+    if(argc > 4 && strcmp(argv[1], "read") == 0 && option(argc, argv, 5, "-o", "").empty()){
+        status = &cerr;
+    }
+    *status << "=============================" << endl;
+    *status << "  AES Chunked Container Tool " << endl;
+    *status << "=============================" << endl;
+
+    if(argc < 3){
+        *status << "Usage: archive pack <file> <container> [-c chunk KB] [-k keyfile]" << endl;
+        *status << "       archive read <container> <offset> <length> [-o file] [-k keyfile]" << endl;
+        *status << "       archive unpack <container> <file> [-k keyfile]" << endl;
+        *status << "       archive info <container>" << endl;
+        return 1;
+    }
+    string command = argv[1];
+
+    if(command == "info"){
+        return info(argv[2]);
+    }
+
+    unsigned char key[16];
+    int firstOption = command == "read" ? 5 : 4;
+    if(argc < firstOption || !readKeyFile(option(argc, argv, firstOption, "-k", "keyfile"), key)){
+        return 1;
+    }
+
+    if(command == "pack"){
+        string chunkOption = option(argc, argv, firstOption, "-c", "1024");
+        char *end;
+        long chunkKB = strtol(chunkOption.c_str(), &end, 10);
+        if(*end != '\0' || chunkKB < 1 || chunkKB > MAX_CHUNK_KB){
+            *status << "Chunk size must be between 1 and " << MAX_CHUNK_KB << " KB" << endl;
+            return 1;
+        }
+        return pack(argv[2], argv[3], key, (unsigned int) chunkKB * 1024);
+    }
+
+    ContainerReader reader;
+    if(!reader.open(argv[2], key)){
+        *status << "Unable to open container: " << reader.error << endl;
+        return 1;
+    }
+
+    if(command == "read"){
+        unsigned long long offset = strtoull(argv[3], NULL, 10);
+        unsigned long long length = strtoull(argv[4], NULL, 10);
+        string outPath = option(argc, argv, firstOption, "-o", "");
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        int result;
+        if(outPath.empty()){
+            result = extract(reader, offset, length, cout);
+            cout.flush();
+        } else {
+            ofstream out(outPath.c_str(), ios::out | ios::binary);
+            if(!out.is_open()){
+                *status << "Unable to open file " << outPath << endl;
+                return 1;
+            }
+            result = extract(reader, offset, length, out);
+        }
+        if(result == 0){
+            *status << "Read " << length << " bytes at offset " << offset << " in " << secondsSince(start) * 1e3 << " ms" << endl;
+        }
+        return result;
+    }
+
+    if(command == "unpack"){
+        ofstream out(argv[3], ios::out | ios::binary);
+        if(!out.is_open()){
+            *status << "Unable to open file " << argv[3] << endl;
+            return 1;
+        }
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        int result = extract(reader, 0, reader.size(), out);
+        if(result == 0){
+            *status << "Unpacked " << reader.size() << " bytes in " << secondsSince(start) << " s" << endl;
+        }
+        return result;
+    }
+
+    *status << "Unknown command " << command << endl;
+    return 1;
+}
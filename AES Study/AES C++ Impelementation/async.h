@@ -0,0 +1,289 @@
+/*
+ * async.h - Awaitable AES-128 CTR for C++20 coroutine event loops.
+ *
+ *     CipherPool pool(threads, &loop);          // loop: a CipherResumer, see below
+ *     AsyncCipher aes(key, pool);
+ *     CipherResult r = co_await aes.encryptAsync(buffer, length, counter);
+ *
+ * - Jobs up to inlineLimit bytes (ASYNC_INLINE_LIMIT by default) run inline in
+ *   await_ready(): handing them to a thread would cost more than the cipher.
+ * - Larger jobs go to the pool's cipher threads and the coroutine is suspended. The job
+ *   lives in the awaitable, which lives in the coroutine frame, and the queues link jobs
+ *   through it, so an await allocates nothing.
+ * - When a job is done, its coroutine is handed to the CipherResumer given to the pool,
+ *   normally the event loop, which resumes it on the I/O thread. A worker that finished
+ *   several jobs hands all of them over in one call, so the loop is woken once per batch,
+ *   not once per job. Without a resumer, coroutines resume on the cipher thread.
+ * - Batching: a worker takes up to ASYNC_BATCH_JOBS queued jobs (at most ASYNC_BATCH_BYTES)
+ *   per wakeup, under one lock acquisition.
+ * - Backpressure: at most maxQueuedBytes are admitted to the cipher threads at a time. Further
+ *   jobs are parked, still without blocking anybody, and admitted as space frees; queuedBytes()
+ *   tells the server when to stop reading from its sockets.
+ * - Cancellation: a CancelToken passed to encryptAsync() stops the job before it starts, or
+ *   between ASYNC_CHUNK-byte chunks of a large job. The coroutine is still resumed, with
+ *   CipherResult::cancelled set; the buffer is then partly processed and must be discarded.
+ *
+ * Build with -std=c++20 -pthread.
+ */
+
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include <coroutine>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <cstring>
+
+#include "modes.h"
+
+const size_t ASYNC_INLINE_LIMIT = 16 << 10;
+const size_t ASYNC_CHUNK = 256 << 10;
+const size_t ASYNC_BATCH_JOBS = 32;
+const size_t ASYNC_BATCH_BYTES = 1 << 20;
+const size_t ASYNC_MAX_QUEUED_BYTES = 64 << 20;
+
+
+// Receives the coroutines of finished jobs, from a cipher thread; must be thread-safe
+class CipherResumer {
+public:
+    virtual void resume(const std::coroutine_handle<> * handles, size_t count) = 0;
+    virtual ~CipherResumer(){}
+};
+
+// Shared between the coroutine and whoever may cancel it, e.g. a connection's close handler
+class CancelToken {
+public:
+    void cancel(){ flag.store(true, std::memory_order_relaxed); }
+    bool cancelled() const { return flag.load(std::memory_order_relaxed); }
+private:
+    std::atomic<bool> flag{false};
+};
+
+struct CipherResult {
+    size_t bytes;           // bytes processed
+    bool cancelled;
+    bool inlined;           // ran in await_ready, without suspending
+};
+
+
+// One queued request; the fields are owned by the awaitable
+struct CipherJob {
+    unsigned char *buffer;
+    size_t length;
+    const unsigned char *expandedKey;
+    unsigned char counter[16];
+    const CancelToken *cancel;
+    std::coroutine_handle<> handle;
+    CipherResult result;
+    CipherJob *next;
+};
+
+// A singly linked FIFO of jobs
+struct CipherJobList {
+    CipherJob *head = nullptr, *tail = nullptr;
+    bool empty() const { return head == nullptr; }
+    void push(CipherJob *job){
+        job->next = nullptr;
+        if(tail) tail->next = job;
+        else head = job;
+        tail = job;
+    }
+    CipherJob *pop(){
+        CipherJob *job = head;
+        head = job->next;
+        if(!head) tail = nullptr;
+        return job;
+    }
+};
+
+// In-place CTR on a job, chunk by chunk so a cancellation is seen within one chunk
+inline void runCipherJob(const CipherBackend & backend, CipherJob & job){
+    job.result.bytes = 0;
+    job.result.cancelled = false;
+    while(job.result.bytes < job.length){
+        if(job.cancel && job.cancel->cancelled()){
+            job.result.cancelled = true;
+            return;
+        }
+        size_t n = job.length - job.result.bytes < ASYNC_CHUNK ? job.length - job.result.bytes : ASYNC_CHUNK;
+        unsigned char *p = job.buffer + job.result.bytes;
+        AESCryptCTR(backend, p, n, job.expandedKey, job.counter, p);
+        job.result.bytes += n;
+    }
+}
+
+
+class CipherPool {
+public:
+    explicit CipherPool(int numThreads, CipherResumer * resumer = nullptr, size_t maxQueuedBytes = ASYNC_MAX_QUEUED_BYTES)
+        : resumer(resumer), maxQueued(maxQueuedBytes), backend(BestBackend()){
+        if(numThreads < 1) numThreads = 1;
+        for(int t = 0 ; t < numThreads ; t++){
+            workers.push_back(std::thread(&CipherPool::worker, this));
+        }
+    }
+
+    // Finishes the admitted and parked jobs, then stops the threads
+    ~CipherPool(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(size_t t = 0 ; t < workers.size() ; t++){
+            workers[t].join();
+        }
+    }
+
+    void submit(CipherJob * job){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            // a job larger than the whole limit is still admitted when nothing else is queued
+            if(parked.empty() && (queued + job->length <= maxQueued || queued == 0)){
+                admitted.push(job);
+                queued += job->length;
+            } else {
+                parked.push(job);
+                parkedBytes += job->length;
+            }
+        }
+        wake.notify_one();
+    }
+
+    // Bytes handed to the cipher threads, and those plus the parked ones
+    size_t admittedBytes() const { return queued; }
+    size_t queuedBytes() const { return queued + parkedBytes; }
+    const CipherBackend & cipherBackend() const { return backend; }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    CipherJobList admitted, parked;
+    std::atomic<size_t> queued{0}, parkedBytes{0};
+    bool stopping = false;
+    CipherResumer *resumer;
+    size_t maxQueued;
+    const CipherBackend &backend;
+
+    void worker(){
+        CipherJob *batch[ASYNC_BATCH_JOBS];
+        std::coroutine_handle<> handles[ASYNC_BATCH_JOBS];
+        for(;;){
+            size_t count = 0, bytes = 0;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]{ return stopping || !admitted.empty(); });
+                if(admitted.empty()) return;
+                while(!admitted.empty() && count < ASYNC_BATCH_JOBS && (count == 0 || bytes + admitted.head->length <= ASYNC_BATCH_BYTES)){
+                    batch[count] = admitted.pop();
+                    bytes += batch[count++]->length;
+                }
+                // leave the rest to the other threads
+                if(!admitted.empty()) wake.notify_one();
+            }
+
+            for(size_t i = 0 ; i < count ; i++){
+                runCipherJob(backend, *batch[i]);
+                handles[i] = batch[i]->handle;
+            }
+
+            bool admittedMore = false;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queued -= bytes;
+                while(!parked.empty() && (queued + parked.head->length <= maxQueued || queued == 0)){
+                    CipherJob *job = parked.pop();
+                    parkedBytes -= job->length;
+                    queued += job->length;
+                    admitted.push(job);
+                    admittedMore = true;
+                }
+            }
+            if(admittedMore) wake.notify_all();
+
+            // the jobs belong to their coroutines from here on: do not touch them again
+            if(resumer){
+                resumer->resume(handles, count);
+            } else {
+                for(size_t i = 0 ; i < count ; i++) handles[i].resume();
+            }
+        }
+    }
+};
+
+
+/*
+    The awaitable returned by AsyncCipher::encryptAsync(). CTR runs in place: buffer is
+    encrypted (or decrypted) and counter advanced past the blocks used, as by AESCryptCTR.
+*/
+class CipherAwaitable {
+public:
+    CipherAwaitable(CipherPool & pool, const unsigned char * expandedKey, unsigned char * buffer, size_t length,
+                    unsigned char counter[16], const CancelToken * cancel, size_t inlineLimit)
+        : pool(pool), counter(counter), inlineLimit(inlineLimit){
+        job.buffer = buffer;
+        job.length = length;
+        job.expandedKey = expandedKey;
+        memcpy(job.counter, counter, 16);
+        job.cancel = cancel;
+        job.result.inlined = false;
+    }
+
+    bool await_ready(){
+        if(job.length > inlineLimit) return false;
+        runCipherJob(pool.cipherBackend(), job);
+        job.result.inlined = true;
+        return true;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle){
+        job.handle = handle;
+        pool.submit(&job);
+    }
+
+    CipherResult await_resume(){
+        memcpy(counter, job.counter, 16);
+        return job.result;
+    }
+
+private:
+    CipherPool &pool;
+    unsigned char *counter;
+    size_t inlineLimit;
+    CipherJob job;
+};
+
+
+// A key bound to a pool; cheap to keep one per connection
+class AsyncCipher {
+public:
+    AsyncCipher(const unsigned char key[16], CipherPool & pool, size_t inlineLimit = ASYNC_INLINE_LIMIT)
+        : pool(pool), inlineLimit(inlineLimit){
+        KeyExpansion(const_cast<unsigned char*>(key), expandedKey);
+    }
+
+    ~AsyncCipher(){
+        volatile unsigned char *p = expandedKey;
+        for(size_t i = 0 ; i < sizeof(expandedKey) ; i++) p[i] = 0;
+    }
+
+    CipherAwaitable encryptAsync(unsigned char * buffer, size_t length, unsigned char counter[16], const CancelToken * cancel = nullptr){
+        return CipherAwaitable(pool, expandedKey, buffer, length, counter, cancel, inlineLimit);
+    }
+
+    // CTR decryption is the same operation
+    CipherAwaitable decryptAsync(unsigned char * buffer, size_t length, unsigned char counter[16], const CancelToken * cancel = nullptr){
+        return encryptAsync(buffer, length, counter, cancel);
+    }
+
+private:
+    CipherPool &pool;
+    size_t inlineLimit;
+    unsigned char expandedKey[176];
+};
+
+#endif /* ASYNC_H */
@@ -0,0 +1,242 @@
+/*
+    AES-128 Coroutine Demo
+
+    - Runs a small single-threaded event loop with many simulated connections. Every
+      connection encrypts and then decrypts requests of random size (16 B up to -s bytes)
+      with co_await on the awaitable API of async.h, and checks that it gets its data back.
+    - Measures how much CPU time each coroutine step, and each cipher call made on the loop
+      thread, takes from the loop: that is what every other connection may have to wait.
+      With the cipher pool the cipher calls on the loop stay at the inline limit; with
+      --sync (the cipher called directly on the loop) they grow with the largest request.
+    - One connection cancels a large request from another coroutine, and the pool is given
+      a small queue limit so that backpressure (parked jobs) is exercised too.
+
+    Usage: asyncdemo [-c connections] [-r requests per connection] [-s max request bytes]
+                     [-t cipher threads] [-q max queued bytes] [--sync 1]
+    Build: g++ -O2 -std=c++20 -pthread asyncdemo.cpp -o asyncdemo.exe
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+#include <ctime>
+#include "async.h"
+
+using namespace std;
+
+
+// Fire-and-forget coroutine: starts at once and frees itself at the end
+struct Task {
+    struct promise_type {
+        Task get_return_object(){ return Task(); }
+        suspend_never initial_suspend(){ return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void(){}
+        void unhandled_exception(){ terminate(); }
+    };
+};
+
+
+// CPU time of the calling thread: what a step costs the loop, without the time the
+// cipher threads take from it when they share a core
+double threadSeconds(){
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+
+/*
+    The event loop: coroutines that yield wait in ready, and the cipher threads hand
+    finished jobs over through resume(), which wakes the loop once per batch.
+*/
+class EventLoop : public CipherResumer {
+public:
+    void resume(const coroutine_handle<> * handles, size_t count) override {
+        {
+            lock_guard<mutex> lock(incomingMutex);
+            incoming.insert(incoming.end(), handles, handles + count);
+            wakeups++;
+        }
+        incomingReady.notify_one();
+    }
+
+    // Awaitable that lets the other coroutines run, like waiting for a socket would
+    struct Yield {
+        EventLoop &loop;
+        bool await_ready(){ return false; }
+        void await_suspend(coroutine_handle<> handle){ loop.ready.push_back(handle); }
+        void await_resume(){}
+    };
+    Yield yield(){ return Yield{*this}; }
+
+    // Runs until running drops to zero
+    void run(const int & running){
+        vector<coroutine_handle<>> batch;
+        while(running > 0){
+            if(ready.empty()){
+                unique_lock<mutex> lock(incomingMutex);
+                incomingReady.wait(lock, [this]{ return !incoming.empty(); });
+                batch.swap(incoming);
+            } else {
+                lock_guard<mutex> lock(incomingMutex);
+                batch.swap(incoming);
+            }
+            ready.insert(ready.end(), batch.begin(), batch.end());
+            batch.clear();
+
+            for(size_t n = ready.size() ; n > 0 ; n--){
+                coroutine_handle<> handle = ready.front();
+                ready.pop_front();
+                double start = threadSeconds();
+                handle.resume();
+                double step = threadSeconds() - start;
+                longestStep = max(longestStep, step);
+                steps++;
+            }
+        }
+    }
+
+    double longestStep = 0;
+    unsigned long long steps = 0, wakeups = 0;
+
+private:
+    deque<coroutine_handle<>> ready;
+    mutex incomingMutex;
+    condition_variable incomingReady;
+    vector<coroutine_handle<>> incoming;
+};
+
+
+struct DemoStats {
+    int running = 0;
+    unsigned long long requests = 0, bytes = 0, inlined = 0, mismatches = 0, cancelled = 0;
+    size_t peakAdmitted = 0, peakQueued = 0;
+    double longestCipher = 0;
+};
+
+unsigned long long nextRandom(unsigned long long & state){
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+Task connection(int id, EventLoop & loop, CipherPool & pool, AsyncCipher & aes, const unsigned char * expandedKey, bool sync,
+                int requests, size_t maxSize, DemoStats & stats){
+    stats.running++;
+    unsigned long long state = 0x9e3779b97f4a7c15ULL * (id + 1);
+    vector<unsigned char> data, original;
+    for(int r = 0 ; r < requests ; r++){
+        co_await loop.yield();      // the request "arrives"
+
+        // mostly small requests, now and then a large one
+        size_t size = nextRandom(state) % 8 == 0 ? 16 + nextRandom(state) % maxSize : 16 + nextRandom(state) % 4096;
+        data.resize(size);
+        for(size_t i = 0 ; i < size ; i += 8){
+            unsigned long long word = nextRandom(state);
+            memcpy(&data[i], &word, min<size_t>(8, size - i));
+        }
+        original = data;
+        unsigned char start[16] = { 0 }, counter[16];
+        memcpy(start + 8, &state, 8);
+
+        for(int pass = 0 ; pass < 2 ; pass++){
+            memcpy(counter, start, 16);
+            double cipherStart = threadSeconds();
+            if(sync){
+                AESCryptCTR(pool.cipherBackend(), data.data(), size, expandedKey, counter, data.data());
+                stats.longestCipher = max(stats.longestCipher, threadSeconds() - cipherStart);
+            } else {
+                CipherResult result = co_await (pass == 0 ? aes.encryptAsync(data.data(), size, counter)
+                                                          : aes.decryptAsync(data.data(), size, counter));
+                stats.inlined += result.inlined;
+                // a suspended await ran on a cipher thread; the loop did other work meanwhile
+                if(result.inlined) stats.longestCipher = max(stats.longestCipher, threadSeconds() - cipherStart);
+            }
+            stats.peakAdmitted = max(stats.peakAdmitted, pool.admittedBytes());
+            stats.peakQueued = max(stats.peakQueued, pool.queuedBytes());
+        }
+        stats.mismatches += data != original;
+        stats.requests++;
+        stats.bytes += 2 * size;
+    }
+    stats.running--;
+}
+
+Task cancelSoon(EventLoop & loop, CancelToken & token){
+    co_await loop.yield();
+    token.cancel();
+}
+
+// Starts an 8 MB request and cancels it from a second coroutine
+Task cancelledRequest(EventLoop & loop, AsyncCipher & aes, DemoStats & stats){
+    stats.running++;
+    CancelToken token;
+    vector<unsigned char> big(8 << 20);
+    unsigned char counter[16] = { 0 };
+    cancelSoon(loop, token);
+    CipherResult result = co_await aes.encryptAsync(big.data(), big.size(), counter, &token);
+    stats.cancelled += result.cancelled;
+    cout << "Cancelled request: " << (result.cancelled ? "cancelled" : "completed") << " after "
+         << result.bytes << " of " << big.size() << " bytes" << endl;
+    stats.running--;
+}
+
+
+int main(int argc, char *argv[]){
+    cout << "=============================" << endl;
+    cout << " AES-128 Coroutine Demo       " << endl;
+    cout << "=============================" << endl;
+
+    int connections = 200, requests = 50;
+    size_t maxSize = 1 << 20, maxQueued = 8 << 20;
+    int numThreads = (int) thread::hardware_concurrency();
+    bool sync = false;
+    for(int i = 1 ; i + 1 < argc ; i += 2){
+        if(strcmp(argv[i], "-c") == 0) connections = atoi(argv[i + 1]);
+        else if(strcmp(argv[i], "-r") == 0) requests = atoi(argv[i + 1]);
+        else if(strcmp(argv[i], "-s") == 0) maxSize = strtoull(argv[i + 1], NULL, 10);
+        else if(strcmp(argv[i], "-t") == 0) numThreads = atoi(argv[i + 1]);
+        else if(strcmp(argv[i], "-q") == 0) maxQueued = strtoull(argv[i + 1], NULL, 10);
+        else if(strcmp(argv[i], "--sync") == 0) sync = atoi(argv[i + 1]) != 0;
+    }
+    if(numThreads < 1) numThreads = 1;
+
+    EventLoop loop;
+    DemoStats stats;
+    unsigned char key[16], expandedKey[176];
+    for(int i = 0 ; i < 16 ; i++) key[i] = (unsigned char) (i * 17 + 1);
+    KeyExpansion(key, expandedKey);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    {
+        CipherPool pool(numThreads, &loop, maxQueued);
+        AsyncCipher aes(key, pool);
+        if(!sync) cancelledRequest(loop, aes, stats);
+        for(int c = 0 ; c < connections ; c++){
+            connection(c, loop, pool, aes, expandedKey, sync, requests, maxSize, stats);
+        }
+        loop.run(stats.running);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << fixed << setprecision(2);
+    cout << "Mode:              " << (sync ? "cipher on the loop thread" : "awaitable, cipher pool") << ", " << numThreads << " cipher thread(s)" << endl;
+    cout << "Requests:          " << stats.requests << " (" << stats.bytes / 1e6 << " MB encrypted and decrypted) in " << seconds << " s" << endl;
+    if(!sync){
+        cout << "Run inline:        " << stats.inlined << " of " << 2 * stats.requests << " awaits" << endl;
+        cout << "Loop wakeups:      " << loop.wakeups << " for " << 2 * stats.requests - stats.inlined << " pool jobs" << endl;
+        cout << "Peak queued:       " << stats.peakAdmitted / 1e6 << " MB admitted (limit " << maxQueued / 1e6 << " MB), "
+             << stats.peakQueued / 1e6 << " MB with the parked jobs" << endl;
+    }
+    cout << "Longest cipher call on the loop: " << stats.longestCipher * 1e3 << " ms" << endl;
+    cout << "Longest loop step: " << loop.longestStep * 1e3 << " ms over " << loop.steps << " steps" << endl;
+    cout << "Mismatches:        " << stats.mismatches << endl;
+    return stats.mismatches == 0 ? 0 : 1;
+}
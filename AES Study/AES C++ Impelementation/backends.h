@@ -0,0 +1,72 @@
+/*
+ * backends.h - The block cipher engines that can run AES-128.
+ *
+ * Every backend takes the 176-byte expanded key from KeyExpansion() and processes
+ * whole 16-byte blocks in bulk. Modes (modes.h), the benchmark and the validation
+ * harness pick engines from cipherBackends[] so a new engine only has to be added here.
+ */
+
+#ifndef BACKENDS_H
+#define BACKENDS_H
+
+#include <cstddef>
+#include <cstring>
+
+#include "aes.h"
+#include "aesni.h"
+
+typedef void (*BlocksFunction)(const unsigned char * in, size_t length, const unsigned char * expandedKey, unsigned char * out);
+
+struct CipherBackend {
+    const char *name;
+    bool (*available)();
+    BlocksFunction encryptBlocks;   // length is a multiple of 16, in and out may be the same buffer
+    BlocksFunction decryptBlocks;
+};
+
+
+// The reference byte-oriented cipher from aes.h
+bool ReferenceAvailable(){
+    return true;
+}
+
+void ReferenceEncryptBlocks(const unsigned char * in, size_t length, const unsigned char * expandedKey, unsigned char * out){
+    AESEncryptBlocks(const_cast<unsigned char*>(in), length, const_cast<unsigned char*>(expandedKey), out);
+}
+
+void ReferenceDecryptBlocks(const unsigned char * in, size_t length, const unsigned char * expandedKey, unsigned char * out){
+    AESDecryptBlocks(const_cast<unsigned char*>(in), length, const_cast<unsigned char*>(expandedKey), out);
+}
+
+
+const CipherBackend cipherBackends[] = {
+    { "reference", ReferenceAvailable, ReferenceEncryptBlocks, ReferenceDecryptBlocks },
+    { "aesni",     AESNIAvailable,     AESNIEncryptBlocks,     AESNIDecryptBlocks },
+};
+const int NUM_BACKENDS = sizeof(cipherBackends) / sizeof(cipherBackends[0]);
+
+const CipherBackend &ReferenceBackend(){
+    return cipherBackends[0];
+}
+
+// Fastest engine this CPU supports (the last available entry of the table)
+const CipherBackend &BestBackend(){
+    for(int i = NUM_BACKENDS - 1 ; i > 0 ; i--){
+        if(cipherBackends[i].available()){
+            return cipherBackends[i];
+        }
+    }
+    return cipherBackends[0];
+}
+
+// Backend by name, or NULL when unknown or not supported on this CPU
+const CipherBackend *FindBackend(const char *name){
+    for(int i = 0 ; i < NUM_BACKENDS ; i++){
+        if(strcmp(cipherBackends[i].name, name) == 0 && cipherBackends[i].available()){
+            return &cipherBackends[i];
+        }
+    }
+    return NULL;
+}
+
+#endif /* BACKENDS_H */
@@ -0,0 +1,443 @@
+/*
+ * batch.h - Encrypting or decrypting many files in one process from a manifest.
+ *
+ *     encrypt --batch <manifest> [--keys keyring] [-t threads]
+ *     decrypt --batch <manifest> [--keys keyring] [-t threads]
+ *
+ * Manifest: one file per line, "input<TAB>output<TAB>key ID" (fields may also be separated
+ * by spaces when the paths have none); empty lines and lines starting with # are skipped.
+ * A key ID names a line "<id> <32 hex digits>" of the keyring, or without --keys (or when
+ * the keyring has no such ID) a keyfile. Each key is read and expanded once, into the
+ * locked buffer pool (bufferpool.h), however many files use it.
+ *
+ * Every output file has the format of the pipe mode: a 16-byte random initial counter,
+ * then AES-128 CTR, so "decrypt --pipe" reads any one of them.
+ *
+ * To make the cost per file close to the cost of its bytes:
+ * - entries are sorted by key, and a worker claims up to BATCH_FILES files with the same
+ *   key at a time; their contents go into one buffer and their counter blocks into one
+ *   keystream buffer, so a whole group is one encryptBlocks() call and one counter draw
+ *   from the DRBG, however small the files are;
+ * - there are more workers than cores (BATCH_THREADS_PER_CORE per core, at most
+ *   BATCH_MAX_THREADS), so while some wait in open/read/write the others encrypt, and the
+ *   disk always has requests queued. Each worker holds two BATCH_BYTES pooled buffers, so
+ *   the cap bounds the locked memory (2 x 4 MB per worker, 128 MB at most);
+ * - files above BATCH_LARGE_FILE are streamed on their own through PipeCrypt. A small
+ *   file that does not fit in what is left of the buffer ends the group: the files
+ *   loaded so far are encrypted and written, and the file starts the next group.
+ *
+ * -t above BATCH_MAX_THREADS is lowered to it with a warning; a value below 1 is an error.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include "modes.h"
+#include "bufferpool.h"
+#include "drbg.h"
+#include "hexcodec.h"
+#include "pipeio.h"
+
+const size_t BATCH_FILES = 64;
+const size_t BATCH_BYTES = 4 << 20;
+const size_t BATCH_LARGE_FILE = 1 << 20;
+const int BATCH_THREADS_PER_CORE = 4;
+const int BATCH_MAX_THREADS = 16;
+
+
+struct BatchEntry {
+    std::string input, output;
+    size_t key;             // index in the keyring
+    bool ok;
+    std::string error;
+};
+
+
+/*
+    Keys by ID, each loaded and expanded once. The raw and expanded keys of all IDs live in
+    one pooled (locked, zeroed on exit) buffer of 192 bytes per key.
+*/
+class BatchKeyring {
+public:
+    // Reads "<id> <hex key>" lines; the hex digits may contain spaces
+    bool load(const std::string & path){
+        std::ifstream file(path.c_str());
+        if(!file.is_open()){
+            error = "unable to open the keyring " + path;
+            return false;
+        }
+        std::string line;
+        int number = 0;
+        while(std::getline(file, line)){
+            number++;
+            size_t start = line.find_first_not_of(" \t\r");
+            if(start == std::string::npos || line[start] == '#') continue;
+            size_t end = line.find_first_of(" \t", start);
+            unsigned char key[16];
+            if(end == std::string::npos || !ParseHexKey(line.substr(end), key)){
+                error = path + " line " + std::to_string(number) + ": expected \"<id> <32 hex digits>\"";
+                return false;
+            }
+            add(line.substr(start, end - start), key);
+            memset(key, 0, sizeof(key));
+        }
+        return true;
+    }
+
+    // The index of a key ID, reading it as a keyfile if the keyring does not have it; -1 if neither works
+    long find(const std::string & id){
+        std::map<std::string, size_t>::iterator known = ids.find(id);
+        if(known != ids.end()){
+            return (long) known->second;
+        }
+        unsigned char key[16];
+        if(!ReadKeyFile(id, key)){
+            return -1;
+        }
+        size_t index = add(id, key);
+        memset(key, 0, sizeof(key));
+        return (long) index;
+    }
+
+    const unsigned char * key(size_t index) const { return storage.data() + 192 * index; }
+    const unsigned char * expandedKey(size_t index) const { return storage.data() + 192 * index + 16; }
+    size_t size() const { return count; }
+
+    std::string error;
+
+private:
+    std::map<std::string, size_t> ids;
+    PooledBuffer storage;
+    size_t count = 0;
+
+    size_t add(const std::string & id, const unsigned char key[16]){
+        if(192 * (count + 1) > storage.size()){
+            // grow by doubling; the old buffer is zeroed when it goes back to the pool
+            PooledBuffer larger(192 * (count < 8 ? 16 : 2 * count));
+            if(count > 0) memcpy(larger.data(), storage.data(), 192 * count);
+            storage = std::move(larger);
+        }
+        unsigned char *slot = storage.data() + 192 * count;
+        memcpy(slot, key, 16);
+        KeyExpansion(slot, slot + 16);
+        ids[id] = count;
+        return count++;
+    }
+};
+
+
+// Reads the manifest; every key ID is resolved (and its key loaded) here, once
+bool LoadManifest(const std::string & path, BatchKeyring & keyring, std::vector<BatchEntry> & entries, std::string & error){
+    std::ifstream file(path.c_str());
+    if(!file.is_open()){
+        error = "unable to open the manifest " + path;
+        return false;
+    }
+    std::string line;
+    int number = 0;
+    while(std::getline(file, line)){
+        number++;
+        if(!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+        if(line.empty() || line[0] == '#') continue;
+
+        std::vector<std::string> fields;
+        const char *separators = line.find('\t') != std::string::npos ? "\t" : " ";
+        size_t start = 0;
+        while(start <= line.size()){
+            size_t end = line.find_first_of(separators, start);
+            if(end == std::string::npos) end = line.size();
+            if(end > start) fields.push_back(line.substr(start, end - start));
+            start = end + 1;
+        }
+        if(fields.size() != 3){
+            error = path + " line " + std::to_string(number) + ": expected \"input<TAB>output<TAB>key ID\"";
+            return false;
+        }
+        long key = keyring.find(fields[2]);
+        if(key < 0){
+            error = path + " line " + std::to_string(number) + ": no key \"" + fields[2] + "\" in the keyring and no such keyfile";
+            return false;
+        }
+        BatchEntry entry;
+        entry.input = fields[0];
+        entry.output = fields[1];
+        entry.key = (size_t) key;
+        entry.ok = false;
+        entries.push_back(entry);
+    }
+    // files with the same key next to each other, so groups can share one key
+    std::stable_sort(entries.begin(), entries.end(), [](const BatchEntry & a, const BatchEntry & b){ return a.key < b.key; });
+    return true;
+}
+
+
+struct BatchStats {
+    size_t files, failed, groups;
+    unsigned long long bytes;
+    double seconds;
+};
+
+
+#ifdef __linux__
+
+class BatchRunner {
+public:
+    BatchRunner(std::vector<BatchEntry> & entries, const BatchKeyring & keyring, bool encrypt)
+        : entries(entries), keyring(keyring), encrypt(encrypt), next(0), groups(0), bytes(0) {}
+
+    BatchStats run(int numThreads){
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for(int t = 0 ; t < numThreads ; t++){
+            threads.push_back(std::thread(&BatchRunner::worker, this));
+        }
+        for(size_t t = 0 ; t < threads.size() ; t++){
+            threads[t].join();
+        }
+        BatchStats stats;
+        stats.files = entries.size();
+        stats.failed = 0;
+        for(size_t i = 0 ; i < entries.size() ; i++){
+            if(!entries[i].ok) stats.failed++;
+        }
+        stats.groups = groups;
+        stats.bytes = bytes;
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return stats;
+    }
+
+private:
+    std::vector<BatchEntry> &entries;
+    const BatchKeyring &keyring;
+    bool encrypt;
+    std::mutex claimLock;
+    size_t next;
+    std::atomic<size_t> groups;
+    std::atomic<unsigned long long> bytes;
+
+    // The next run of up to BATCH_FILES entries that share a key: [first, last)
+    bool claim(size_t & first, size_t & last){
+        std::lock_guard<std::mutex> lock(claimLock);
+        if(next >= entries.size()){
+            return false;
+        }
+        first = next;
+        last = first + 1;
+        while(last < entries.size() && last - first < BATCH_FILES && entries[last].key == entries[first].key){
+            last++;
+        }
+        next = last;
+        return true;
+    }
+
+    void fail(BatchEntry & entry, const std::string & what){
+        entry.ok = false;
+        entry.error = what + ": " + strerror(errno);
+    }
+
+    // A large file on its own, streamed a buffer at a time
+    void streamFile(BatchEntry & entry, int inFd, unsigned long long size){
+        int outFd = open(entry.output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if(outFd < 0){
+            fail(entry, "unable to create " + entry.output);
+            return;
+        }
+        std::string error;
+        entry.ok = PipeCrypt(inFd, outFd, keyring.key(entry.key), encrypt, false, error);
+        if(!entry.ok) entry.error = error;
+        else bytes += encrypt ? size : size - 16;
+        close(outFd);
+    }
+
+    // A worker's buffers; offsets, lengths, loaded and counters are indexed from the claimed run's first entry
+    struct GroupBuffers {
+        PooledBuffer data, keystream;
+        std::vector<size_t> offsets, lengths;
+        std::vector<bool> loaded;
+        std::vector<unsigned char> counters;
+
+        // exactly the 4 MB size class: a group is cut before a file's padded length would pass BATCH_BYTES
+        GroupBuffers() : data(BATCH_BYTES), keystream(BATCH_BYTES), counters(16 * BATCH_FILES) {}
+    };
+
+    void worker(){
+        GroupBuffers group;
+        size_t first, last;
+        while(claim(first, last)){
+            // read the files; they are placed on 16-byte boundaries
+            group.offsets.assign(last - first, 0);
+            group.lengths.assign(last - first, 0);
+            group.loaded.assign(last - first, false);
+            size_t used = 0, from = 0;
+            for(size_t i = first ; i < last ; i++){
+                BatchEntry &entry = entries[i];
+                int fd = open(entry.input.c_str(), O_RDONLY | O_CLOEXEC);
+                struct stat info;
+                if(fd < 0 || fstat(fd, &info) != 0){
+                    fail(entry, "unable to open " + entry.input);
+                    if(fd >= 0) close(fd);
+                    continue;
+                }
+                size_t size = (size_t) info.st_size;
+                size_t header = encrypt ? 0 : 16;
+                if(size > BATCH_LARGE_FILE){
+                    streamFile(entry, fd, size);
+                    close(fd);
+                    continue;
+                }
+                if(used + size + 16 > BATCH_BYTES){
+                    // the buffer is full: finish the files loaded so far and start a new group with this one
+                    flushGroup(group, first, from, i - first, used);
+                    from = i - first;
+                    used = 0;
+                }
+                unsigned char *counter = &group.counters[16 * (i - first)];
+                size_t got = 0, gotHeader = 16;
+                bool ok = (header == 0 || (readFull(fd, counter, 16, gotHeader) && gotHeader == 16)) &&
+                          readFull(fd, group.data.data() + used, size - header, got) && got == size - header;
+                close(fd);
+                if(!ok){
+                    errno = errno ? errno : EIO;
+                    fail(entry, header && gotHeader < 16 ? entry.input + " is too short to hold the 16-byte counter" : "unable to read " + entry.input);
+                    continue;
+                }
+                group.offsets[i - first] = used;
+                group.lengths[i - first] = got;
+                group.loaded[i - first] = true;
+                used += (got + 15) & ~(size_t) 15;
+            }
+            flushGroup(group, first, from, last - first, used);
+        }
+    }
+
+    // Encrypts the loaded files among [from, to) of the run starting at first with one cipher call and writes them
+    void flushGroup(GroupBuffers & group, size_t first, size_t from, size_t to, size_t used){
+        if(std::find(group.loaded.begin() + from, group.loaded.begin() + to, true) == group.loaded.begin() + to){
+            return;
+        }
+        groups++;
+
+        // one DRBG call for the counters, one cipher call for the whole group
+        if(encrypt) ThreadDrbg().generate(&group.counters[16 * from], 16 * (to - from));
+        for(size_t f = from ; f < to ; f++){
+            if(!group.loaded[f] || group.lengths[f] == 0) continue;
+            unsigned char counter[16];
+            memcpy(counter, &group.counters[16 * f], 16);
+            size_t blocks = (group.lengths[f] + 15) / 16;
+            memcpy(group.keystream.data() + group.offsets[f], counter, 16);
+            fillCounterBlocks(group.keystream.data() + group.offsets[f] + 16, counter, blocks - 1);
+        }
+        BestBackend().encryptBlocks(group.keystream.data(), used, keyring.expandedKey(entries[first].key), group.keystream.data());
+        xorBytes(group.data.data(), group.data.data(), group.keystream.data(), used);
+
+        // write every file: the counter in front when encrypting
+        for(size_t f = from ; f < to ; f++){
+            if(!group.loaded[f]) continue;
+            BatchEntry &entry = entries[first + f];
+            int fd = open(entry.output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+            if(fd < 0){
+                fail(entry, "unable to create " + entry.output);
+                continue;
+            }
+            struct iovec parts[2] = {
+                { &group.counters[16 * f], 16 },
+                { group.data.data() + group.offsets[f], group.lengths[f] }
+            };
+            size_t total = (encrypt ? 16 : 0) + group.lengths[f];
+            ssize_t written = writev(fd, encrypt ? parts : parts + 1, encrypt ? 2 : 1);
+            if(written >= 0 && (size_t) written < total){
+                // short write: finish it the slow way
+                size_t headerLeft = encrypt && written < 16 ? 16 - (size_t) written : 0;
+                size_t dataDone = (size_t) written > (encrypt ? 16 : 0) ? (size_t) written - (encrypt ? 16 : 0) : 0;
+                bool ok = (headerLeft == 0 || writeAll(fd, &group.counters[16 * f] + 16 - headerLeft, headerLeft)) &&
+                          writeAll(fd, group.data.data() + group.offsets[f] + dataDone, group.lengths[f] - dataDone);
+                written = ok ? (ssize_t) total : -1;
+            }
+            if(written < 0 || close(fd) != 0){
+                fail(entry, "unable to write " + entry.output);
+                continue;
+            }
+            entry.ok = true;
+            bytes += group.lengths[f];
+        }
+    }
+};
+
+#endif /* __linux__ */
+
+
+/*
+    Entry point of the batch mode shared by the encryption and decryption tools:
+        tool --batch <manifest> [--keys keyring] [-t threads]
+    Lists the files that failed; returns the exit code.
+*/
+int BatchMain(int argc, char *argv[], bool encrypt){
+    std::string keyringPath;
+    int numThreads = BATCH_THREADS_PER_CORE * (int) std::thread::hardware_concurrency();
+    if(numThreads < 1) numThreads = BATCH_THREADS_PER_CORE;
+    if(numThreads > BATCH_MAX_THREADS) numThreads = BATCH_MAX_THREADS;
+    for(int i = 3 ; i + 1 < argc ; i += 2){
+        if(strcmp(argv[i], "--keys") == 0) keyringPath = argv[i + 1];
+        else if(strcmp(argv[i], "-t") == 0){
+            char *end;
+            long requested = strtol(argv[i + 1], &end, 10);
+            if(*end != '\0' || requested < 1){
+                std::cout << "-t needs a number of threads of at least 1, not " << argv[i + 1] << std::endl;
+                return 1;
+            }
+            if(requested > BATCH_MAX_THREADS){
+                std::cout << "Warning: -t " << requested << " is above the limit of " << BATCH_MAX_THREADS
+                          << " workers (locked buffer memory), using " << BATCH_MAX_THREADS << std::endl;
+                requested = BATCH_MAX_THREADS;
+            }
+            numThreads = (int) requested;
+        }
+    }
+
+    BatchKeyring keyring;
+    if(!keyringPath.empty() && !keyring.load(keyringPath)){
+        std::cout << "Unable to load keys: " << keyring.error << std::endl;
+        return 1;
+    }
+    std::vector<BatchEntry> entries;
+    std::string error;
+    if(!LoadManifest(argv[2], keyring, entries, error)){
+        std::cout << "Unable to load the manifest: " << error << std::endl;
+        return 1;
+    }
+#ifdef __linux__
+    BatchRunner runner(entries, keyring, encrypt);
+    BatchStats stats = runner.run(numThreads);
+    for(size_t i = 0 ; i < entries.size() ; i++){
+        if(!entries[i].ok) std::cout << "Failed: " << entries[i].input << ": " << entries[i].error << std::endl;
+    }
+    std::cout << (encrypt ? "Encrypted " : "Decrypted ") << stats.files - stats.failed << " of " << stats.files << " files ("
+              << stats.bytes << " bytes, " << keyring.size() << " key(s), " << stats.groups << " groups) in "
+              << stats.seconds << " s: " << (size_t) (stats.files / (stats.seconds > 0 ? stats.seconds : 1)) << " files/s" << std::endl;
+    return stats.failed == 0 ? 0 : 1;
+#else
+    std::cout << "Batch mode is only available on Linux" << std::endl;
+    return 1;
+#endif
+}
+
+#endif /* BATCH_H */
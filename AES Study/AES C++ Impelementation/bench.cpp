@@ -0,0 +1,339 @@
+/*
+    AES Benchmark
+
+    - Measures cycles/byte and GB/s of every backend and mode in the table below.
+    - Sweeps message sizes from 16 B up to 1 GB (x4 per step) and thread counts (1, 2, 4, ... up to all cores).
+    - Measures the key setup (KeyExpansion) on its own.
+    - Measures AES-CMAC (cmac.h) as one chain and as CMAC_LANES interleaved chains.
+    - Runs small messages both with warm lookup tables and with the tables flushed from the cache (cold).
+    - Prints the results as JSON so that builds can be compared.
+
+    Cycles are read from the time stamp counter where available (x86), so they are
+    reference cycles at the nominal clock; GB/s comes from the wall clock.
+
+    Usage: bench [-m max bytes] [-t max threads] [-r min seconds per measurement] [-o output file]
+    Build: g++ -O2 -pthread bench.cpp -o bench.exe
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+#include "modes.h"
+#include "cmac.h"
+
+using namespace std;
+
+
+/*
+    A benchmarked path: processes length bytes (a multiple of 16) in place.
+    New backends and modes are added to the table in main().
+*/
+typedef void (*CipherPath)(unsigned char * buffer, size_t length, unsigned char * expandedKey);
+
+struct BenchCase {
+    const char *backend;
+    const char *mode;
+    const char *operation;
+    CipherPath run;
+};
+
+void referenceEcbEncrypt(unsigned char * buffer, size_t length, unsigned char * expandedKey){
+    AESEncryptBlocks(buffer, length, expandedKey, buffer);
+}
+
+void referenceEcbDecrypt(unsigned char * buffer, size_t length, unsigned char * expandedKey){
+    AESDecryptBlocks(buffer, length, expandedKey, buffer);
+}
+
+void referenceCbcEncrypt(unsigned char * buffer, size_t length, unsigned char * expandedKey){
+    unsigned char iv[16] = { 0 };
+    AESEncryptCBC(ReferenceBackend(), buffer, length, expandedKey, iv, buffer);
+}
+
+void referenceCbcDecrypt(unsigned char * buffer, size_t length, unsigned char * expandedKey){
+    unsigned char iv[16] = { 0 };
+    AESDecryptCBC(ReferenceBackend(), buffer, length, expandedKey, iv, buffer);
+}
+
+void referenceCtr(unsigned char * buffer, size_t length, unsigned char * expandedKey){
+    unsigned char counter[16] = { 0 };
+    AESCryptCTR(ReferenceBackend(), buffer, length, expandedKey, counter, buffer);
+}
+
+void aesniEcbEncrypt(unsigned char * buffer, size_t length, unsigned char * expandedKey){
+    AESNIEncryptBlocks(buffer, length, expandedKey, buffer);
+}
+
+void aesniEcbDecrypt(unsigned char * buffer, size_t length, unsigned char * expandedKey){
+    AESNIDecryptBlocks(buffer, length, expandedKey, buffer);
+}
+
+void aesniCbcEncrypt(unsigned char * buffer, size_t length, unsigned char * expandedKey){
+    unsigned char iv[16] = { 0 };
+    AESEncryptCBC(*FindBackend("aesni"), buffer, length, expandedKey, iv, buffer);
+}
+
+void aesniCbcDecrypt(unsigned char * buffer, size_t length, unsigned char * expandedKey){
+    unsigned char iv[16] = { 0 };
+    AESDecryptCBC(*FindBackend("aesni"), buffer, length, expandedKey, iv, buffer);
+}
+
+void aesniCtr(unsigned char * buffer, size_t length, unsigned char * expandedKey){
+    unsigned char counter[16] = { 0 };
+    AESCryptCTR(*FindBackend("aesni"), buffer, length, expandedKey, counter, buffer);
+}
+
+// CMAC of the whole buffer: one serial chain. The subkeys are set up once, on the first call,
+// from the first 16 bytes of the expanded key (the key itself), since every case uses the same key.
+void cmacChain(unsigned char * buffer, size_t length, unsigned char * expandedKey){
+    static CMACKey key(expandedKey);
+    unsigned char tag[16];
+    AESCMAC(key, buffer, length, tag);
+    buffer[0] ^= tag[0];
+}
+
+// The buffer as CMAC_LANES messages MACed side by side by AESCMACMany
+void cmacLanes(unsigned char * buffer, size_t length, unsigned char * expandedKey){
+    static CMACKey key(expandedKey);
+    const unsigned char *messages[CMAC_LANES];
+    size_t lengths[CMAC_LANES];
+    unsigned char tags[16 * CMAC_LANES];
+    for(int i = 0 ; i < CMAC_LANES ; i++){
+        messages[i] = buffer + length / CMAC_LANES * i;
+        lengths[i] = length / CMAC_LANES;
+    }
+    AESCMACMany(key, messages, lengths, CMAC_LANES, tags);
+    buffer[0] ^= tags[0];
+}
+
+
+inline unsigned long long readCycles() {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+inline double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+
+// Evicts the S-box and multiplication tables from every cache level
+void flushTables() {
+#ifdef HAVE_TSC
+    const unsigned char *tables[] = { s, mul2, mul3, rcon, inv_s, mul9, mul11, mul13, mul14 };
+    for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++) {
+        for (int offset = 0; offset < 256; offset += 64) {
+            _mm_clflush(tables[t] + offset);
+        }
+    }
+    _mm_mfence();
+#endif
+}
+
+
+struct Measurement {
+    unsigned long long reps;
+    double seconds;
+    unsigned long long cycles;
+};
+
+/*
+    Runs one case on length bytes split evenly over numThreads threads (each thread owns a
+    slice of the buffer and repeats over it), until at least minSeconds have passed.
+*/
+Measurement measure(const BenchCase &c, unsigned char * buffer, size_t length, unsigned char * expandedKey, int numThreads, double minSeconds) {
+    Measurement m = { 0, 0.0, 0 };
+    size_t blocks = length / 16;
+
+    // one untimed pass to fault in the pages and warm the tables
+    c.run(buffer, length, expandedKey);
+
+    unsigned long long reps = 1;
+    while (true) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        unsigned long long startCycles = readCycles();
+
+        if (numThreads == 1) {
+            for (unsigned long long r = 0; r < reps; r++) {
+                c.run(buffer, length, expandedKey);
+            }
+        } else {
+            vector<thread> workers;
+            for (int t = 0; t < numThreads; t++) {
+                size_t first = blocks * t / numThreads * 16;
+                size_t last = blocks * (t + 1) / numThreads * 16;
+                workers.push_back(thread([&, first, last]() {
+                    for (unsigned long long r = 0; r < reps; r++) {
+                        c.run(buffer + first, last - first, expandedKey);
+                    }
+                }));
+            }
+            for (size_t t = 0; t < workers.size(); t++) {
+                workers[t].join();
+            }
+        }
+
+        m.cycles = readCycles() - startCycles;
+        m.seconds = secondsSince(start);
+        m.reps = reps;
+        if (m.seconds >= minSeconds || reps >= (1ULL << 40)) {
+            return m;
+        }
+        // aim a little past the target so the next attempt is usually the last
+        double scale = m.seconds > 0 ? minSeconds / m.seconds * 1.2 : 16;
+        reps = scale > 16 ? reps * 16 : (unsigned long long) (reps * scale) + 1;
+    }
+}
+
+// Single pass with the lookup tables flushed first
+Measurement measureCold(const BenchCase &c, unsigned char * buffer, size_t length, unsigned char * expandedKey) {
+    Measurement m = { 1, 0.0, 0 };
+    flushTables();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    unsigned long long startCycles = readCycles();
+    c.run(buffer, length, expandedKey);
+    m.cycles = readCycles() - startCycles;
+    m.seconds = secondsSince(start);
+    return m;
+}
+
+
+string jsonResult(const BenchCase &c, size_t length, int numThreads, const char *cache, const Measurement &m) {
+    double bytes = (double) length * m.reps;
+    ostringstream out;
+    out << fixed << setprecision(4);
+    out << "    {\"backend\": \"" << c.backend << "\", \"mode\": \"" << c.mode << "\", \"operation\": \"" << c.operation
+        << "\", \"bytes\": " << length << ", \"threads\": " << numThreads << ", \"cache\": \"" << cache
+        << "\", \"reps\": " << m.reps << ", \"seconds\": " << m.seconds;
+#ifdef HAVE_TSC
+    out << ", \"cycles_per_byte\": " << m.cycles / bytes;
+#else
+    out << ", \"cycles_per_byte\": null";
+#endif
+    out << ", \"gb_per_s\": " << (m.seconds > 0 ? bytes / m.seconds / 1e9 : 0.0) << "}";
+    return out.str();
+}
+
+
+int main(int argc, char *argv[]) {
+    size_t maxBytes = 1ULL << 30;
+    int maxThreads = (int) thread::hardware_concurrency();
+    double minSeconds = 0.2;
+    string outputPath;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-m") == 0) maxBytes = strtoull(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "-t") == 0) maxThreads = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-r") == 0) minSeconds = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "-o") == 0) outputPath = argv[i + 1];
+        else {
+            cerr << "Unknown option " << argv[i] << endl;
+            return 1;
+        }
+    }
+    if (maxThreads < 1) maxThreads = 1;
+    if (maxBytes < 16) maxBytes = 16;
+
+    BenchCase cases[] = {
+        { "reference", "ecb", "encrypt", referenceEcbEncrypt },
+        { "reference", "ecb", "decrypt", referenceEcbDecrypt },
+        { "reference", "cbc", "encrypt", referenceCbcEncrypt },
+        { "reference", "cbc", "decrypt", referenceCbcDecrypt },
+        { "reference", "ctr", "encrypt", referenceCtr },
+        { "aesni",     "ecb", "encrypt", aesniEcbEncrypt },
+        { "aesni",     "ecb", "decrypt", aesniEcbDecrypt },
+        { "aesni",     "cbc", "encrypt", aesniCbcEncrypt },
+        { "aesni",     "cbc", "decrypt", aesniCbcDecrypt },
+        { "aesni",     "ctr", "encrypt", aesniCtr },
+        { "aesni",     "cmac", "mac", cmacChain },
+        { "aesni",     "cmac-lanes", "mac", cmacLanes },
+    };
+    const int numCases = sizeof(cases) / sizeof(cases[0]);
+
+    unsigned char key[16];
+    for (int i = 0; i < 16; i++) {
+        key[i] = (unsigned char) (i * 17 + 1);
+    }
+    unsigned char expandedKey[176];
+
+    // Key setup on its own
+    unsigned long long keyIterations = 0;
+    chrono::steady_clock::time_point keyStart = chrono::steady_clock::now();
+    unsigned long long keyStartCycles = readCycles();
+    while (secondsSince(keyStart) < minSeconds) {
+        for (int i = 0; i < 1024; i++) {
+            key[0] ^= (unsigned char) i;
+            KeyExpansion(key, expandedKey);
+        }
+        keyIterations += 1024;
+    }
+    double keySeconds = secondsSince(keyStart);
+    unsigned long long keyCycles = readCycles() - keyStartCycles;
+    KeyExpansion(key, expandedKey);
+
+    unsigned char *buffer = new unsigned char[maxBytes];
+    memset(buffer, 0x5a, maxBytes);
+
+    vector<string> results;
+    for (size_t length = 16; length <= maxBytes; length *= 4) {
+        for (int c = 0; c < numCases; c++) {
+            if (FindBackend(cases[c].backend) == NULL) continue;
+            for (int threads = 1; threads <= maxThreads; threads *= 2) {
+                // a slice per thread needs at least one block
+                if ((size_t) threads > length / 16) break;
+                Measurement m = measure(cases[c], buffer, length, expandedKey, threads, minSeconds);
+                results.push_back(jsonResult(cases[c], length, threads, "warm", m));
+                cerr << cases[c].backend << " " << cases[c].mode << " " << cases[c].operation << " " << length
+                     << " B x" << threads << ": " << fixed << setprecision(3) << length * m.reps / m.seconds / 1e9 << " GB/s" << endl;
+            }
+            if (length <= 65536) {
+                Measurement m = measureCold(cases[c], buffer, length, expandedKey);
+                results.push_back(jsonResult(cases[c], length, 1, "cold", m));
+            }
+        }
+    }
+    delete[] buffer;
+
+    ostringstream json;
+    json << fixed << setprecision(4);
+    json << "{\n";
+    json << "  \"tool\": \"aes-bench\",\n";
+    json << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+    json << "  \"hardware_threads\": " << thread::hardware_concurrency() << ",\n";
+    json << "  \"tsc\": " << (readCycles() ? "true" : "false") << ",\n";
+    json << "  \"key_setup\": {\"iterations\": " << keyIterations << ", \"ns_per_key\": " << keySeconds * 1e9 / keyIterations;
+#ifdef HAVE_TSC
+    json << ", \"cycles_per_key\": " << (double) keyCycles / keyIterations;
+#else
+    json << ", \"cycles_per_key\": null";
+#endif
+    json << "},\n";
+    json << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        json << results[i] << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    json << "  ]\n}\n";
+
+    if (outputPath.empty()) {
+        cout << json.str();
+    } else {
+        ofstream out(outputPath.c_str());
+        out << json.str();
+        cerr << "Wrote results to " << outputPath << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,286 @@
+/*
+ * bufferpool.h - Pooled, locked, huge-page memory for plaintext, ciphertext and keys.
+ *
+ * Buffers come from 2 MB arenas that are
+ * - backed by huge pages: explicit ones (MAP_HUGETLB) when the system has them reserved,
+ *   otherwise 2 MB-aligned memory marked MADV_HUGEPAGE for transparent huge pages,
+ *   so large buffers need one TLB entry per 2 MB instead of one per 4 KB;
+ * - locked with mlock() so plaintext and key material are never written to swap,
+ *   and excluded from core dumps (MADV_DONTDUMP);
+ * - zeroed when a buffer is returned, so nothing secret stays behind and every buffer
+ *   handed out starts as zeros;
+ * - reused: returned buffers go on a free list per power-of-two size class, so a loop
+ *   over many messages does not call the allocator or fault in new pages.
+ *
+ * Small buffers are carved from shared arenas; buffers of 2 MB and more get arenas of
+ * their own. Those are only kept up to POOL_MAX_FREE_LARGE per size class: the rest are
+ * unmapped on release, so a burst of large buffers does not stay locked for the life of
+ * the process. (Small free lists never hold more than the shared arenas already carved.)
+ * mlock() is limited by RLIMIT_MEMLOCK (ulimit -l): arenas beyond it stay
+ * usable but unlocked, which stats() reports. Allocate key material first so it lands
+ * in the first, locked arena.
+ *
+ * PooledBuffer is the RAII handle: it returns its memory to the pool when it goes away.
+ * On systems without mmap the pool falls back to zeroed heap memory.
+ */
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <cstddef>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <mutex>
+#include <new>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+const size_t POOL_ARENA = 2 << 20;
+const size_t POOL_MIN_CLASS = 64;
+const int POOL_NUM_CLASSES = 32;
+const size_t POOL_MAX_FREE_LARGE = 4;       // free dedicated arenas kept per size class
+
+
+// memset that the compiler may not remove even though the memory is not read again
+inline void secureZero(void * p, size_t length){
+    memset(p, 0, length);
+    __asm__ __volatile__("" : : "r"(p) : "memory");
+}
+
+
+struct PoolStats {
+    size_t arenas;          // mappings made
+    size_t hugeArenas;      // of which backed by explicit huge pages
+    size_t lockedArenas;    // arenas mapped and locked in memory right now
+    size_t bytesMapped;     // mapped right now
+    size_t unmapped;        // dedicated arenas given back on release
+    size_t reused;          // buffers served from a free list
+    size_t carved;          // buffers that needed new space
+};
+
+
+class BufferPool {
+public:
+    BufferPool() : bump(NULL), bumpLeft(0) {
+        memset(&counters, 0, sizeof(counters));
+    }
+
+    ~BufferPool(){
+        for(size_t i = 0 ; i < mappings.size() ; i++){
+            secureZero(mappings[i].region, mappings[i].bytes);
+            unmapRegion(mappings[i].region, mappings[i].bytes);
+        }
+    }
+
+    // A zeroed buffer of at least size bytes; capacity is set to its real size.
+    // Throws std::bad_alloc for sizes beyond the largest class.
+    unsigned char * acquire(size_t size, size_t & capacity){
+        if(size > (POOL_MIN_CLASS << (POOL_NUM_CLASSES - 1))){
+            throw std::bad_alloc();
+        }
+        int sizeClass = classOf(size);
+        capacity = POOL_MIN_CLASS << sizeClass;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!freeLists[sizeClass].empty()){
+            unsigned char *buffer = freeLists[sizeClass].back();
+            freeLists[sizeClass].pop_back();
+            counters.reused++;
+            return buffer;
+        }
+        counters.carved++;
+        if(capacity >= POOL_ARENA){
+            return mapRegion(capacity);
+        }
+        if(bumpLeft < capacity){
+            // the rest of the old arena is too small for this class, leave it
+            bump = mapRegion(POOL_ARENA);
+            bumpLeft = POOL_ARENA;
+        }
+        unsigned char *buffer = bump;
+        bump += capacity;
+        bumpLeft -= capacity;
+        return buffer;
+    }
+
+    // Zeroes the buffer and keeps it for the next acquire() of the same size class,
+    // or unmaps it if it is a dedicated arena and its free list is full
+    void release(unsigned char * buffer, size_t capacity){
+        if(buffer == NULL){
+            return;
+        }
+        secureZero(buffer, capacity);
+        std::lock_guard<std::mutex> lock(mutex);
+        int sizeClass = classOf(capacity);
+        if(capacity >= POOL_ARENA && freeLists[sizeClass].size() >= POOL_MAX_FREE_LARGE){
+            for(size_t i = 0 ; i < mappings.size() ; i++){
+                if(mappings[i].region == buffer){
+                    if(mappings[i].locked) counters.lockedArenas--;
+                    mappings[i] = mappings.back();
+                    mappings.pop_back();
+                    break;
+                }
+            }
+            unmapRegion(buffer, capacity);
+            counters.unmapped++;
+            counters.bytesMapped -= capacity;
+            return;
+        }
+        freeLists[sizeClass].push_back(buffer);
+    }
+
+    PoolStats stats(){
+        std::lock_guard<std::mutex> lock(mutex);
+        return counters;
+    }
+
+private:
+    struct Mapping {
+        unsigned char *region;
+        size_t bytes;
+        bool locked;
+    };
+
+    std::mutex mutex;
+    std::vector<unsigned char*> freeLists[POOL_NUM_CLASSES];
+    std::vector<Mapping> mappings;
+    unsigned char *bump;
+    size_t bumpLeft;
+    PoolStats counters;
+
+    static int classOf(size_t size){
+        int sizeClass = 0;
+        while(sizeClass < POOL_NUM_CLASSES - 1 && (POOL_MIN_CLASS << sizeClass) < size){
+            sizeClass++;
+        }
+        return sizeClass;
+    }
+
+    // Maps bytes (a multiple of POOL_ARENA) of huge-page, locked memory; called with the lock held
+    unsigned char * mapRegion(size_t bytes){
+        unsigned char *region = NULL;
+        bool huge = false, locked = false;
+#ifdef __linux__
+        void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(p != MAP_FAILED){
+            huge = true;
+            region = (unsigned char *) p;
+        } else {
+            // no reserved huge pages: over-map, trim to 2 MB alignment and ask for transparent ones
+            size_t padded = bytes + POOL_ARENA;
+            p = mmap(NULL, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(p == MAP_FAILED){
+                throw std::bad_alloc();
+            }
+            unsigned char *start = (unsigned char *) p;
+            unsigned char *aligned = (unsigned char *) (((size_t) start + POOL_ARENA - 1) & ~(POOL_ARENA - 1));
+            if(aligned > start) munmap(start, aligned - start);
+            if(aligned + bytes < start + padded) munmap(aligned + bytes, start + padded - (aligned + bytes));
+            region = aligned;
+#ifdef MADV_HUGEPAGE
+            madvise(region, bytes, MADV_HUGEPAGE);
+#endif
+        }
+#ifdef MADV_DONTDUMP
+        madvise(region, bytes, MADV_DONTDUMP);
+#endif
+        if(mlock(region, bytes) == 0){
+            locked = true;
+            counters.lockedArenas++;
+        }
+#else
+        region = (unsigned char *) calloc(1, bytes);
+        if(region == NULL){
+            throw std::bad_alloc();
+        }
+#endif
+        Mapping mapping = { region, bytes, locked };
+        mappings.push_back(mapping);
+        counters.arenas++;
+        if(huge) counters.hugeArenas++;
+        counters.bytesMapped += bytes;
+        return region;
+    }
+
+    static void unmapRegion(unsigned char * region, size_t bytes){
+#ifdef __linux__
+        munlock(region, bytes);
+        munmap(region, bytes);
+#else
+        (void) bytes;
+        free(region);
+#endif
+    }
+
+    BufferPool(const BufferPool &);
+    BufferPool &operator=(const BufferPool &);
+};
+
+
+// The pool shared by the tools for cipher buffers and key schedules
+BufferPool &CipherBufferPool(){
+    static BufferPool pool;
+    return pool;
+}
+
+
+/*
+    A buffer from a BufferPool, returned (and zeroed) when the handle is destroyed.
+    Move-only, like a unique_ptr.
+*/
+class PooledBuffer {
+public:
+    PooledBuffer() : pool(NULL), buffer(NULL), length(0), capacity(0) {}
+
+    explicit PooledBuffer(size_t size, BufferPool & pool = CipherBufferPool()) : pool(&pool), length(size) {
+        buffer = pool.acquire(size, capacity);
+    }
+
+    PooledBuffer(PooledBuffer && other) : pool(other.pool), buffer(other.buffer), length(other.length), capacity(other.capacity) {
+        other.buffer = NULL;
+        other.length = other.capacity = 0;
+    }
+
+    PooledBuffer &operator=(PooledBuffer && other){
+        if(this != &other){
+            reset();
+            pool = other.pool;
+            buffer = other.buffer;
+            length = other.length;
+            capacity = other.capacity;
+            other.buffer = NULL;
+            other.length = other.capacity = 0;
+        }
+        return *this;
+    }
+
+    ~PooledBuffer(){
+        reset();
+    }
+
+    void reset(){
+        if(buffer){
+            pool->release(buffer, capacity);
+            buffer = NULL;
+            length = capacity = 0;
+        }
+    }
+
+    unsigned char * data() { return buffer; }
+    const unsigned char * data() const { return buffer; }
+    size_t size() const { return length; }
+    unsigned char &operator[](size_t i) { return buffer[i]; }
+
+private:
+    BufferPool *pool;
+    unsigned char *buffer;
+    size_t length;
+    size_t capacity;
+
+    PooledBuffer(const PooledBuffer &);
+    PooledBuffer &operator=(const PooledBuffer &);
+};
+
+#endif /* BUFFERPOOL_H */
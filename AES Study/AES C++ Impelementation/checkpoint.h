@@ -0,0 +1,554 @@
+/*
+ * checkpoint.h - Resumable encryption of large files with a checkpoint journal.
+ *
+ *     encrypt --job <keyfile> <input> <output> [--checkpoint MB] [--journal path]
+ *     decrypt --job <keyfile> <input> <output> [--checkpoint MB] [--journal path]
+ *
+ * The output has the format of the pipe mode (pipeio.h): a 16-byte initial counter, then
+ * AES-128 CTR. CTR is seekable: the data at offset o uses counter IV + o / 16, so a job
+ * can continue at any checkpoint without recomputing anything before it.
+ *
+ * Every CHECKPOINT bytes the output is flushed to disk (fdatasync) and then a record is
+ * appended to the journal (and flushed):
+ *   uint64  bytes done
+ *   uint32  CRC-32C of the input and of the output of this interval
+ *   uint32  CRC-32C of the input and of the output from the start to here
+ *   char[4] "AESR"
+ *   uint32  CRC-32C of the record itself, so a torn last record is recognised
+ * after a header that ties the journal to its job: direction, input size and modification
+ * time, checkpoint interval, key check value and initial counter.
+ *
+ * A restarted job reads the journal, takes the last record whose interval still matches
+ * the CRCs of both files (one interval is read back, not the whole file), truncates the
+ * output there and continues from it. A journal of a different job (other input, key or
+ * interval) is refused rather than overwritten. When the job is done the journal is
+ * removed and the CRCs of the whole input and output are printed.
+ *
+ * CRC-32C uses the SSE 4.2 CRC32 instruction when there is one: it guards against torn
+ * writes, truncation and files changed between runs, not against deliberate tampering.
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <iostream>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "modes.h"
+#include "container.h"
+#include "bufferpool.h"
+#include "drbg.h"
+#include "metrics.h"
+#include "pipeio.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define HAVE_CRC32C_INSTRUCTION 1
+#endif
+
+const unsigned int JOURNAL_VERSION = 1;
+const unsigned int JOURNAL_HEADER_SIZE = 64;
+const unsigned int JOURNAL_RECORD_SIZE = 32;
+const size_t JOB_CHUNK = 4 << 20;
+const unsigned long long DEFAULT_CHECKPOINT = 256ULL << 20;
+
+
+// --------------------------------------------------------
+// CRC-32C (Castagnoli)
+// --------------------------------------------------------
+
+unsigned int crc32cTable[256];
+
+void initCrc32cTable(){
+    for(unsigned int i = 0 ; i < 256 ; i++){
+        unsigned int crc = i;
+        for(int b = 0 ; b < 8 ; b++){
+            crc = (crc >> 1) ^ (0x82F63B78U & (0U - (crc & 1)));
+        }
+        crc32cTable[i] = crc;
+    }
+}
+
+#ifdef HAVE_CRC32C_INSTRUCTION
+__attribute__((target("sse4.2")))
+unsigned int crc32cHardware(unsigned int crc, const unsigned char * data, size_t length){
+    unsigned long long c = crc;
+    for(; length >= 8 ; length -= 8, data += 8){
+        unsigned long long word;
+        memcpy(&word, data, 8);
+        c = _mm_crc32_u64(c, word);
+    }
+    crc = (unsigned int) c;
+    for(; length > 0 ; length--){
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+#endif
+
+// Continues a CRC-32C: Crc32c(Crc32c(0, a), b) is the CRC of a followed by b
+unsigned int Crc32c(unsigned int crc, const unsigned char * data, size_t length){
+    crc = ~crc;
+#ifdef HAVE_CRC32C_INSTRUCTION
+    if(__builtin_cpu_supports("sse4.2")){
+        return ~crc32cHardware(crc, data, length);
+    }
+#endif
+    if(crc32cTable[1] == 0) initCrc32cTable();
+    for(size_t i = 0 ; i < length ; i++){
+        crc = crc32cTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+
+// --------------------------------------------------------
+// Journal
+// --------------------------------------------------------
+
+struct JournalHeader {
+    unsigned int encrypt;
+    unsigned long long inputSize;
+    unsigned long long inputModified;   // nanoseconds since the epoch
+    unsigned long long interval;
+    unsigned long long keyId;
+    unsigned char counter[16];          // initial counter of the output
+};
+
+struct JournalRecord {
+    unsigned long long done;
+    unsigned int intervalInput, intervalOutput;
+    unsigned int runningInput, runningOutput;
+};
+
+void encodeJournalHeader(const JournalHeader & header, unsigned char bytes[JOURNAL_HEADER_SIZE]){
+    memset(bytes, 0, JOURNAL_HEADER_SIZE);
+    memcpy(bytes, "AESJ", 4);
+    putLE(bytes + 4, JOURNAL_VERSION, 4);
+    putLE(bytes + 8, header.encrypt, 4);
+    putLE(bytes + 12, header.inputSize, 8);
+    putLE(bytes + 20, header.inputModified, 8);
+    putLE(bytes + 28, header.interval, 8);
+    putLE(bytes + 36, header.keyId, 8);
+    memcpy(bytes + 44, header.counter, 16);
+    putLE(bytes + 60, Crc32c(0, bytes, 60), 4);
+}
+
+bool decodeJournalHeader(const unsigned char bytes[JOURNAL_HEADER_SIZE], JournalHeader & header){
+    if(memcmp(bytes, "AESJ", 4) != 0 || getLE(bytes + 4, 4) != JOURNAL_VERSION || getLE(bytes + 60, 4) != Crc32c(0, bytes, 60)){
+        return false;
+    }
+    header.encrypt = (unsigned int) getLE(bytes + 8, 4);
+    header.inputSize = getLE(bytes + 12, 8);
+    header.inputModified = getLE(bytes + 20, 8);
+    header.interval = getLE(bytes + 28, 8);
+    header.keyId = getLE(bytes + 36, 8);
+    memcpy(header.counter, bytes + 44, 16);
+    return true;
+}
+
+void encodeJournalRecord(const JournalRecord & record, unsigned char bytes[JOURNAL_RECORD_SIZE]){
+    putLE(bytes, record.done, 8);
+    putLE(bytes + 8, record.intervalInput, 4);
+    putLE(bytes + 12, record.intervalOutput, 4);
+    putLE(bytes + 16, record.runningInput, 4);
+    putLE(bytes + 20, record.runningOutput, 4);
+    memcpy(bytes + 24, "AESR", 4);
+    putLE(bytes + 28, Crc32c(0, bytes, 28), 4);
+}
+
+bool decodeJournalRecord(const unsigned char bytes[JOURNAL_RECORD_SIZE], JournalRecord & record){
+    if(memcmp(bytes + 24, "AESR", 4) != 0 || getLE(bytes + 28, 4) != Crc32c(0, bytes, 28)){
+        return false;
+    }
+    record.done = getLE(bytes, 8);
+    record.intervalInput = (unsigned int) getLE(bytes + 8, 4);
+    record.intervalOutput = (unsigned int) getLE(bytes + 12, 4);
+    record.runningInput = (unsigned int) getLE(bytes + 16, 4);
+    record.runningOutput = (unsigned int) getLE(bytes + 20, 4);
+    return true;
+}
+
+
+#ifdef __linux__
+
+bool preadFull(int fd, unsigned char * buffer, size_t length, unsigned long long offset){
+    while(length > 0){
+        ssize_t n = pread(fd, buffer, length, (off_t) offset);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        buffer += n;
+        length -= (size_t) n;
+        offset += (unsigned long long) n;
+    }
+    return true;
+}
+
+bool pwriteAll(int fd, const unsigned char * buffer, size_t length, unsigned long long offset){
+    while(length > 0){
+        ssize_t n = pwrite(fd, buffer, length, (off_t) offset);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        buffer += n;
+        length -= (size_t) n;
+        offset += (unsigned long long) n;
+    }
+    return true;
+}
+
+// CRC-32C of length bytes of a file from offset on
+bool crcOfRange(int fd, unsigned long long offset, unsigned long long length, unsigned char * buffer, size_t bufferSize, unsigned int & crc){
+    crc = 0;
+    while(length > 0){
+        size_t n = length < bufferSize ? (size_t) length : bufferSize;
+        if(!preadFull(fd, buffer, n, offset)){
+            return false;
+        }
+        crc = Crc32c(crc, buffer, n);
+        offset += n;
+        length -= n;
+    }
+    return true;
+}
+
+
+/*
+    One encryption or decryption job of a file into another, resumable from its journal.
+    run() returns false with error set; resumedAt tells where a restarted job continued.
+*/
+class CheckpointedJob {
+public:
+    CheckpointedJob(const std::string & inputPath, const std::string & outputPath, const std::string & journalPath,
+                    const unsigned char key[16], bool encrypt, unsigned long long interval)
+        : resumedAt(0), canResume(true), inputPath(inputPath), outputPath(outputPath), journalPath(journalPath), encrypt(encrypt),
+          interval(interval), inputFd(-1), outputFd(-1), journalFd(-1),
+          keySchedule(176), input(JOB_CHUNK), output(JOB_CHUNK) {
+        KeyExpansion(const_cast<unsigned char*>(key), keySchedule.data());
+    }
+
+    ~CheckpointedJob(){
+        if(inputFd >= 0) close(inputFd);
+        if(outputFd >= 0) close(outputFd);
+        if(journalFd >= 0) close(journalFd);
+    }
+
+    bool run(){
+        if(!openFiles()){
+            return false;
+        }
+        // the ciphertext side has the 16-byte counter in front of the data
+        unsigned long long inputOffset = encrypt ? 0 : 16, outputOffset = encrypt ? 16 : 0;
+        unsigned long long total = header.inputSize - inputOffset;
+        unsigned char counter[16];
+        memcpy(counter, header.counter, 16);
+        addCounter(counter, last.done / 16);
+
+        const CipherBackend &backend = BestBackend();
+        unsigned long long done = last.done;
+        unsigned int intervalInput = 0, intervalOutput = 0;
+        while(done < total){
+            unsigned long long intervalEnd = (done / interval + 1) * interval;
+            if(intervalEnd > total) intervalEnd = total;
+            size_t n = intervalEnd - done < JOB_CHUNK ? (size_t) (intervalEnd - done) : JOB_CHUNK;
+            bool ok;
+            {
+                PhaseTimer timer(PHASE_READ, n);
+                errno = 0;
+                ok = preadFull(inputFd, input.data(), n, inputOffset + done);
+            }
+            if(!ok){
+                error = "unable to read " + inputPath + ": " + (errno ? strerror(errno) : "file is shorter than when the job started");
+                return false;
+            }
+            {
+                PhaseTimer timer(PHASE_BLOCKS, n);
+                AESCryptCTR(backend, input.data(), n, keySchedule.data(), counter, output.data());
+            }
+            intervalInput = Crc32c(intervalInput, input.data(), n);
+            intervalOutput = Crc32c(intervalOutput, output.data(), n);
+            {
+                PhaseTimer timer(PHASE_WRITE, n);
+                ok = pwriteAll(outputFd, output.data(), n, outputOffset + done);
+            }
+            if(!ok){
+                error = "unable to write " + outputPath + ": " + strerror(errno);
+                return false;
+            }
+            done += n;
+
+            if(done == intervalEnd){
+                JournalRecord record;
+                record.done = done;
+                record.intervalInput = intervalInput;
+                record.intervalOutput = intervalOutput;
+                record.runningInput = crc32cCombine(last.runningInput, intervalInput, done - last.done);
+                record.runningOutput = crc32cCombine(last.runningOutput, intervalOutput, done - last.done);
+                if(!checkpoint(record)){
+                    return false;
+                }
+                last = record;
+                intervalInput = intervalOutput = 0;
+            }
+        }
+        unlink(journalPath.c_str());
+        return true;
+    }
+
+    unsigned long long resumedAt;
+    bool canResume;         // false when running the job again would fail the same way
+    JournalRecord last;
+    std::string error;
+
+private:
+    std::string inputPath, outputPath, journalPath;
+    bool encrypt;
+    unsigned long long interval;
+    int inputFd, outputFd, journalFd;
+    JournalHeader header;
+    PooledBuffer keySchedule, input, output;
+
+    /*
+        CRC of a followed by b from the CRCs of both and the length of b, as zlib's
+        crc32_combine does it: the CRC of a is run through length zero bytes with the
+        matrix of one zero bit squared up as needed, then XORed with the CRC of b.
+    */
+    static unsigned int crc32cCombine(unsigned int crcA, unsigned int crcB, unsigned long long lengthB){
+        return gf2Shift(crcA, lengthB) ^ crcB;
+    }
+
+    static unsigned int gf2Shift(unsigned int crc, unsigned long long length){
+        unsigned int odd[32], even[32];
+        odd[0] = 0x82F63B78U;
+        unsigned int row = 1;
+        for(int n = 1 ; n < 32 ; n++){
+            odd[n] = row;
+            row <<= 1;
+        }
+        gf2Square(even, odd);   // two zero bits
+        gf2Square(odd, even);   // four zero bits
+        do {
+            gf2Square(even, odd);
+            if(length & 1) crc = gf2Times(even, crc);
+            length >>= 1;
+            if(length == 0) break;
+            gf2Square(odd, even);
+            if(length & 1) crc = gf2Times(odd, crc);
+            length >>= 1;
+        } while(length != 0);
+        return crc;
+    }
+
+    static unsigned int gf2Times(const unsigned int * matrix, unsigned int vector){
+        unsigned int sum = 0;
+        for(; vector ; vector >>= 1, matrix++){
+            if(vector & 1) sum ^= *matrix;
+        }
+        return sum;
+    }
+
+    static void gf2Square(unsigned int * square, const unsigned int * matrix){
+        for(int n = 0 ; n < 32 ; n++){
+            square[n] = gf2Times(matrix, matrix[n]);
+        }
+    }
+
+    static unsigned long long modifiedTime(const struct stat & info){
+        return (unsigned long long) info.st_mtim.tv_sec * 1000000000ULL + (unsigned long long) info.st_mtim.tv_nsec;
+    }
+
+    bool openFiles(){
+        inputFd = open(inputPath.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info;
+        if(inputFd < 0 || fstat(inputFd, &info) != 0){
+            error = "unable to open " + inputPath + ": " + strerror(errno);
+            return false;
+        }
+        JournalHeader current;
+        current.encrypt = encrypt ? 1 : 0;
+        current.inputSize = (unsigned long long) info.st_size;
+        current.inputModified = modifiedTime(info);
+        current.interval = interval;
+        current.keyId = ContainerKeyId(keySchedule.data());
+        if(!encrypt){
+            if(current.inputSize < 16 || !preadFull(inputFd, current.counter, 16, 0)){
+                error = inputPath + " is too short to hold the 16-byte counter";
+                return false;
+            }
+        }
+
+        memset(&last, 0, sizeof(last));
+        if(access(journalPath.c_str(), F_OK) == 0){
+            if(!resume(current)){
+                return false;
+            }
+        } else {
+            if(encrypt) ThreadDrbg().generate(current.counter, 16);
+            header = current;
+            if(!startFresh()){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool startFresh(){
+        outputFd = open(outputPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        journalFd = open(journalPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if(outputFd < 0 || journalFd < 0){
+            error = "unable to create " + (outputFd < 0 ? outputPath : journalPath) + ": " + strerror(errno);
+            return false;
+        }
+        unsigned char bytes[JOURNAL_HEADER_SIZE];
+        encodeJournalHeader(header, bytes);
+        if((encrypt && !pwriteAll(outputFd, header.counter, 16, 0)) ||
+           !pwriteAll(journalFd, bytes, JOURNAL_HEADER_SIZE, 0) || fdatasync(outputFd) != 0 || fdatasync(journalFd) != 0){
+            error = std::string("unable to start the job: ") + strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    // Picks up where the journal says the job got to, after checking both files agree
+    bool resume(const JournalHeader & current){
+        journalFd = open(journalPath.c_str(), O_RDWR | O_CLOEXEC);
+        outputFd = open(outputPath.c_str(), O_RDWR | O_CLOEXEC);
+        unsigned char bytes[JOURNAL_HEADER_SIZE];
+        if(journalFd < 0 || !preadFull(journalFd, bytes, JOURNAL_HEADER_SIZE, 0) || !decodeJournalHeader(bytes, header)){
+            error = "unable to read the journal " + journalPath + "; remove it to start over";
+            canResume = false;
+            return false;
+        }
+        if(header.encrypt != current.encrypt || header.inputSize != current.inputSize ||
+           header.inputModified != current.inputModified || header.interval != current.interval ||
+           header.keyId != current.keyId || (!encrypt && memcmp(header.counter, current.counter, 16) != 0)){
+            error = "the journal " + journalPath + " belongs to another job (input, key or interval differ); remove it to start over";
+            canResume = false;
+            return false;
+        }
+        if(outputFd < 0){
+            // output gone: nothing to resume, but the journal is ours
+            close(journalFd);
+            journalFd = -1;
+            return startFresh();
+        }
+
+        // the valid records, up to the first torn or out-of-order one
+        std::vector<JournalRecord> records;
+        unsigned char recordBytes[JOURNAL_RECORD_SIZE];
+        unsigned long long previous = 0;
+        while(preadFull(journalFd, recordBytes, JOURNAL_RECORD_SIZE, JOURNAL_HEADER_SIZE + JOURNAL_RECORD_SIZE * records.size())){
+            JournalRecord record;
+            if(!decodeJournalRecord(recordBytes, record) || record.done <= previous) break;
+            records.push_back(record);
+            previous = record.done;
+        }
+
+        // the newest checkpoint whose last interval still reads back the same from both files
+        unsigned long long inputOffset = encrypt ? 0 : 16, outputOffset = encrypt ? 16 : 0;
+        unsigned char storedCounter[16];
+        bool counterOk = !encrypt || (preadFull(outputFd, storedCounter, 16, 0) && memcmp(storedCounter, header.counter, 16) == 0);
+        size_t keep = 0;
+        for(size_t i = records.size() ; counterOk && i > 0 ; i--){
+            unsigned long long start = i > 1 ? records[i - 2].done : 0, length = records[i - 1].done - start;
+            unsigned int inputCrc, outputCrc;
+            if(crcOfRange(inputFd, inputOffset + start, length, input.data(), JOB_CHUNK, inputCrc) &&
+               crcOfRange(outputFd, outputOffset + start, length, output.data(), JOB_CHUNK, outputCrc) &&
+               inputCrc == records[i - 1].intervalInput && outputCrc == records[i - 1].intervalOutput){
+                keep = i;
+                break;
+            }
+        }
+        if(keep == 0){
+            close(journalFd);
+            close(outputFd);
+            journalFd = outputFd = -1;
+            return startFresh();
+        }
+
+        last = records[keep - 1];
+        resumedAt = last.done;
+        if(ftruncate(journalFd, JOURNAL_HEADER_SIZE + JOURNAL_RECORD_SIZE * keep) != 0 ||
+           ftruncate(outputFd, (off_t) (outputOffset + last.done)) != 0){
+            error = std::string("unable to roll back to the checkpoint: ") + strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    // Output on disk first, then the record that vouches for it
+    bool checkpoint(const JournalRecord & record){
+        unsigned char bytes[JOURNAL_RECORD_SIZE];
+        encodeJournalRecord(record, bytes);
+        off_t size = lseek(journalFd, 0, SEEK_END);
+        if(fdatasync(outputFd) != 0 || size < 0 || !pwriteAll(journalFd, bytes, JOURNAL_RECORD_SIZE, (unsigned long long) size) ||
+           fdatasync(journalFd) != 0){
+            error = std::string("unable to write a checkpoint: ") + strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    CheckpointedJob(const CheckpointedJob &);
+    CheckpointedJob &operator=(const CheckpointedJob &);
+};
+
+#endif /* __linux__ */
+
+
+/*
+    Entry point of the job mode shared by the encryption and decryption tools:
+        tool --job <keyfile> <input> <output> [--checkpoint MB] [--journal path]
+    Returns the exit code.
+*/
+int JobMain(int argc, char *argv[], bool encrypt){
+    if(argc < 5){
+        std::cout << "Usage: " << argv[0] << " --job <keyfile> <input> <output> [--checkpoint MB] [--journal path]" << std::endl;
+        return 1;
+    }
+    unsigned char key[16];
+    if(!ReadKeyFile(argv[2], key)){
+        std::cout << "Unable to read the key from " << argv[2] << " (16 hex bytes expected)" << std::endl;
+        return 1;
+    }
+    std::string inputPath = argv[3], outputPath = argv[4], journalPath = outputPath + ".journal";
+    unsigned long long interval = DEFAULT_CHECKPOINT;
+    for(int i = 5 ; i + 1 < argc ; i += 2){
+        if(strcmp(argv[i], "--checkpoint") == 0) interval = strtoull(argv[i + 1], NULL, 10) << 20;
+        else if(strcmp(argv[i], "--journal") == 0) journalPath = argv[i + 1];
+    }
+    if(interval == 0){
+        std::cout << "The checkpoint interval must be at least 1 MB" << std::endl;
+        return 1;
+    }
+#ifdef __linux__
+    CheckpointedJob job(inputPath, outputPath, journalPath, key, encrypt, interval);
+    memset(key, 0, sizeof(key));
+    bool ok = job.run();
+    if(!ok){
+        std::cout << (encrypt ? "Encryption" : "Decryption") << " job stopped: " << job.error << std::endl;
+        if(job.canResume){
+            std::cout << "Run the same command again to continue from the last checkpoint." << std::endl;
+        }
+        return 1;
+    }
+    if(job.resumedAt > 0){
+        std::cout << "Resumed at byte " << job.resumedAt << " from " << journalPath << std::endl;
+    }
+    std::cout << "Done: " << job.last.done << " bytes, CRC-32C input " << std::hex << job.last.runningInput
+              << ", output " << job.last.runningOutput << std::dec << std::endl;
+    return 0;
+#else
+    std::cout << "Job mode is only available on Linux" << std::endl;
+    return 1;
+#endif
+}
+
+#endif /* CHECKPOINT_H */
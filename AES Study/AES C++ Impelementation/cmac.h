@@ -0,0 +1,326 @@
+/*
+ * cmac.h - AES-CMAC (NIST SP 800-38B, RFC 4493) with the AES-128 of this project.
+ *
+ * CMACKey expands the key with KeyExpansion() and derives the subkeys K1 and K2 from it.
+ * AESCMAC() MACs one message; every block has to wait for the previous one, so one chain
+ * runs at the latency of AESENC, not its throughput.
+ *
+ * AESCMACMany() MACs many independent messages at once: each of CMAC_LANES lanes carries
+ * one message's chain, and every step encrypts one block of every lane side by side
+ * (like AESNIEncrypt8 in aesni.h), so the AES unit stays busy although each chain is
+ * serial. When a lane's message ends its tag is stored and the lane takes the next
+ * message, so messages of different lengths do not leave lanes idle. The longest messages
+ * start first, and once no message is left to take, the chains still running stay
+ * interleaved: first with idle lanes riding along, then on kernels of half the width.
+ * The gain grows with the message length: separate AESCMAC() calls on records of a block
+ * or two already overlap in the out-of-order core, since no call waits for the last one.
+ * Without AES-NI both fall back to AESEncrypt() one block at a time.
+ */
+
+#ifndef CMAC_H
+#define CMAC_H
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "aes.h"
+#include "aesni.h"
+
+const int CMAC_LANES = 8;
+
+
+// Doubling in GF(2^128) with the polynomial x^128 + x^7 + x^2 + x + 1 (SP 800-38B 6.1)
+inline void cmacDouble(const unsigned char in[16], unsigned char out[16]){
+    unsigned char carry = in[0] >> 7;
+    for(int i = 0 ; i < 15 ; i++){
+        out[i] = (unsigned char) ((in[i] << 1) | (in[i + 1] >> 7));
+    }
+    out[15] = (unsigned char) ((in[15] << 1) ^ (carry ? 0x87 : 0));
+}
+
+
+// The expanded key and the two subkeys
+struct CMACKey {
+    unsigned char expandedKey[176];
+    unsigned char k1[16], k2[16];
+
+    explicit CMACKey(const unsigned char key[16]){
+        unsigned char zero[16] = { 0 }, l[16];
+        KeyExpansion(const_cast<unsigned char*>(key), expandedKey);
+        AESEncrypt(zero, expandedKey, l);
+        cmacDouble(l, k1);
+        cmacDouble(k1, k2);
+        memset(l, 0, sizeof(l));
+    }
+
+    ~CMACKey(){
+        volatile unsigned char *p = expandedKey;
+        for(size_t i = 0 ; i < sizeof(expandedKey) ; i++) p[i] = 0;
+    }
+};
+
+
+// Blocks in a message: an empty message still has one (padded) block
+inline size_t cmacBlocks(size_t length){
+    return length == 0 ? 1 : (length + 15) / 16;
+}
+
+// The last block of a message, XORed with K1 if it is complete or padded with 10..0 and XORed with K2
+inline void cmacLastBlock(const CMACKey & key, const unsigned char * message, size_t length, unsigned char last[16]){
+    size_t start = 16 * (cmacBlocks(length) - 1);
+    size_t rest = length - start;
+    if(rest == 16){
+        for(int i = 0 ; i < 16 ; i++) last[i] = message[start + i] ^ key.k1[i];
+    } else {
+        memset(last, 0, 16);
+        if(rest > 0) memcpy(last, message + start, rest);
+        last[rest] = 0x80;
+        for(int i = 0 ; i < 16 ; i++) last[i] ^= key.k2[i];
+    }
+}
+
+
+// One chain through AESEncrypt
+void referenceCMAC(const CMACKey & key, const unsigned char * message, size_t length, unsigned char tag[16]){
+    unsigned char state[16] = { 0 }, last[16];
+    size_t blocks = cmacBlocks(length);
+    for(size_t b = 0 ; b + 1 < blocks ; b++){
+        for(int i = 0 ; i < 16 ; i++) state[i] ^= message[16 * b + i];
+        AESEncrypt(state, const_cast<unsigned char*>(key.expandedKey), state);
+    }
+    cmacLastBlock(key, message, length, last);
+    for(int i = 0 ; i < 16 ; i++) state[i] ^= last[i];
+    AESEncrypt(state, const_cast<unsigned char*>(key.expandedKey), tag);
+}
+
+
+#ifdef HAVE_AESNI
+
+// Continues a chain: left full blocks from block, then the prepared last block
+AESNI_TARGET inline __m128i aesniCMACFinish(__m128i state, const unsigned char * block, size_t left, __m128i last,
+                                            const __m128i roundKeys[11]){
+    for(size_t b = 0 ; b < left ; b++){
+        state = AESNIEncryptBlock(_mm_xor_si128(state, _mm_loadu_si128((const __m128i *) (block + 16 * b))), roundKeys);
+    }
+    return AESNIEncryptBlock(_mm_xor_si128(state, last), roundKeys);
+}
+
+AESNI_TARGET inline __m128i aesniCMACLast(const CMACKey & key, const unsigned char * message, size_t length){
+    unsigned char last[16];
+    cmacLastBlock(key, message, length, last);
+    return _mm_loadu_si128((const __m128i *) last);
+}
+
+AESNI_TARGET void aesniCMAC(const CMACKey & key, const unsigned char * message, size_t length, unsigned char tag[16]){
+    __m128i roundKeys[11];
+    AESNILoadKeys(key.expandedKey, roundKeys);
+    __m128i state = aesniCMACFinish(_mm_setzero_si128(), message, cmacBlocks(length) - 1,
+                                    aesniCMACLast(key, message, length), roundKeys);
+    _mm_storeu_si128((__m128i *) tag, state);
+}
+
+// One chain of the interleaved engine
+struct CMACLane {
+    __m128i state, last;            // chaining value; last block XORed with its subkey
+    const unsigned char *block;     // next full block
+    size_t left;                    // full blocks left before the last one
+    size_t message;                 // index of the message, or count when the lane is idle
+};
+
+AESNI_TARGET inline void aesniCMACStart(const CMACKey & key, const unsigned char * const * messages, const size_t * lengths,
+                                        size_t m, CMACLane & lane){
+    lane.message = m;
+    lane.block = messages[m];
+    lane.left = cmacBlocks(lengths[m]) - 1;
+    lane.last = aesniCMACLast(key, messages[m], lengths[m]);
+    lane.state = _mm_setzero_si128();
+}
+
+/*
+    LANES chains side by side; lanes [0, active) of the array hold running chains. Every
+    running lane has at least as many full blocks left as the shortest, so that many steps
+    run without any bookkeeping; then one step gives the lanes that have reached their last
+    block its padded block, stores their tags and refills them from order[next...].
+    Once there is nothing left to refill with, a lane goes idle: it keeps encrypting a copy
+    of a running lane's blocks, so the others stay interleaved. When half the lanes or more
+    are idle, the running chains move on to the kernel with half as many lanes; the last
+    chain is finished on its own.
+*/
+template<int LANES>
+AESNI_TARGET void aesniCMACLanes(const CMACKey & key, const __m128i roundKeys[11], const unsigned char * const * messages,
+                                 const size_t * lengths, const size_t * order, size_t count, size_t & next,
+                                 CMACLane * lanes, int active, unsigned char * tags){
+    __m128i state[LANES], last[LANES];
+    const unsigned char *block[LANES];
+    size_t left[LANES], message[LANES];
+    for(int l = 0 ; l < LANES ; l++){
+        if(l < active){
+            state[l] = lanes[l].state;
+            last[l] = lanes[l].last;
+            block[l] = lanes[l].block;
+            left[l] = lanes[l].left;
+            message[l] = lanes[l].message;
+        } else {
+            state[l] = last[l] = _mm_setzero_si128();
+            block[l] = NULL;
+            left[l] = 0;
+            message[l] = count;
+        }
+    }
+
+    while(active > LANES / 2){
+        size_t steps = (size_t) -1;
+        const unsigned char *running = NULL;
+        for(int l = 0 ; l < LANES ; l++){
+            if(message[l] == count) continue;
+            if(left[l] < steps) steps = left[l];
+            running = block[l];
+        }
+        // idle lanes read the blocks of a running lane; their result is never stored
+        for(int l = 0 ; l < LANES ; l++){
+            if(message[l] == count) block[l] = running;
+        }
+        for(size_t s = 0 ; s < steps ; s++){
+            __m128i b[LANES];
+            for(int l = 0 ; l < LANES ; l++){
+                b[l] = _mm_xor_si128(_mm_xor_si128(state[l], _mm_loadu_si128((const __m128i *) (block[l] + 16 * s))), roundKeys[0]);
+            }
+            for(int r = 1 ; r < 10 ; r++){
+                for(int l = 0 ; l < LANES ; l++) b[l] = _mm_aesenc_si128(b[l], roundKeys[r]);
+            }
+            for(int l = 0 ; l < LANES ; l++) state[l] = _mm_aesenclast_si128(b[l], roundKeys[10]);
+        }
+
+        // one more step: the next full block, or the last block for the lanes that are done
+        // (idle lanes have left 0 and a zero last block)
+        __m128i b[LANES];
+        for(int l = 0 ; l < LANES ; l++){
+            if(message[l] != count){
+                block[l] += 16 * steps;
+                left[l] -= steps;
+            }
+            b[l] = left[l] > 0 ? _mm_loadu_si128((const __m128i *) block[l]) : last[l];
+            b[l] = _mm_xor_si128(_mm_xor_si128(state[l], b[l]), roundKeys[0]);
+        }
+        for(int r = 1 ; r < 10 ; r++){
+            for(int l = 0 ; l < LANES ; l++) b[l] = _mm_aesenc_si128(b[l], roundKeys[r]);
+        }
+        for(int l = 0 ; l < LANES ; l++) state[l] = _mm_aesenclast_si128(b[l], roundKeys[10]);
+
+        for(int l = 0 ; l < LANES ; l++){
+            if(message[l] == count) continue;
+            if(left[l] > 0){
+                left[l]--;
+                block[l] += 16;
+                continue;
+            }
+            _mm_storeu_si128((__m128i *) (tags + 16 * message[l]), state[l]);
+            if(next < count){
+                CMACLane lane;
+                aesniCMACStart(key, messages, lengths, order[next++], lane);
+                state[l] = lane.state;
+                last[l] = lane.last;
+                block[l] = lane.block;
+                left[l] = lane.left;
+                message[l] = lane.message;
+            } else {
+                message[l] = count;
+                left[l] = 0;
+                last[l] = _mm_setzero_si128();
+                active--;
+            }
+        }
+    }
+
+    // at most LANES / 2 chains left: move them to the front
+    int running = 0;
+    for(int l = 0 ; l < LANES ; l++){
+        if(message[l] == count) continue;
+        lanes[running].state = state[l];
+        lanes[running].last = last[l];
+        lanes[running].block = block[l];
+        lanes[running].left = left[l];
+        lanes[running].message = message[l];
+        running++;
+    }
+    if(running == 0){
+        return;
+    }
+    if(LANES <= 2){
+        _mm_storeu_si128((__m128i *) (tags + 16 * lanes[0].message),
+                         aesniCMACFinish(lanes[0].state, lanes[0].block, lanes[0].left, lanes[0].last, roundKeys));
+        return;
+    }
+    aesniCMACLanes<(LANES > 2 ? LANES / 2 : 2)>(key, roundKeys, messages, lengths, order, count, next, lanes, running, tags);
+}
+
+/*
+    Starts the longest messages first, so the chains still running when the queue is empty
+    are the short ones, then runs the LANES-wide kernel.
+*/
+template<int LANES>
+AESNI_TARGET void aesniCMACMany(const CMACKey & key, const unsigned char * const * messages, const size_t * lengths,
+                                size_t count, unsigned char * tags){
+    if(count == 0){
+        return;
+    }
+    __m128i roundKeys[11];
+    AESNILoadKeys(key.expandedKey, roundKeys);
+
+    std::vector<size_t> order(count);
+    for(size_t m = 0 ; m < count ; m++) order[m] = m;
+    std::stable_sort(order.begin(), order.end(), [lengths](size_t a, size_t b){ return lengths[a] > lengths[b]; });
+
+    CMACLane lanes[LANES];
+    size_t next = 0;
+    int active = 0;
+    while(active < LANES && next < count){
+        aesniCMACStart(key, messages, lengths, order[next++], lanes[active++]);
+    }
+    aesniCMACLanes<LANES>(key, roundKeys, messages, lengths, order.data(), count, next, lanes, active, tags);
+}
+
+#endif /* HAVE_AESNI */
+
+
+// The CMAC tag of one message
+void AESCMAC(const CMACKey & key, const unsigned char * message, size_t length, unsigned char tag[16]){
+#ifdef HAVE_AESNI
+    if(AESNIAvailable()){
+        aesniCMAC(key, message, length, tag);
+        return;
+    }
+#endif
+    referenceCMAC(key, message, length, tag);
+}
+
+/*
+    The tags of count independent messages: tag i (16 bytes at tags + 16 * i) belongs to
+    messages[i], which is lengths[i] bytes long. lanes is the number of chains interleaved,
+    4 or CMAC_LANES (8); 8 suits CPUs whose AESENC latency is several times its throughput.
+*/
+void AESCMACMany(const CMACKey & key, const unsigned char * const * messages, const size_t * lengths,
+                 size_t count, unsigned char * tags, int lanes = CMAC_LANES){
+#ifdef HAVE_AESNI
+    if(AESNIAvailable()){
+        if(lanes == 4) aesniCMACMany<4>(key, messages, lengths, count, tags);
+        else aesniCMACMany<CMAC_LANES>(key, messages, lengths, count, tags);
+        return;
+    }
+#endif
+    (void) lanes;
+    for(size_t i = 0 ; i < count ; i++){
+        referenceCMAC(key, messages[i], lengths[i], tags + 16 * i);
+    }
+}
+
+// Compares a received tag with the expected one in constant time
+bool CMACVerify(const unsigned char expected[16], const unsigned char received[16]){
+    unsigned char difference = 0;
+    for(int i = 0 ; i < 16 ; i++) difference |= expected[i] ^ received[i];
+    return difference == 0;
+}
+
+#endif /* CMAC_H */
@@ -0,0 +1,250 @@
+/*
+ * compress.h - Fast LZ77 block compression for the stage ahead of encryption.
+ *
+ * Ciphertext does not compress, so data has to be compressed before it is encrypted.
+ * This is a byte-oriented LZ77 codec in the style of LZ4: greedy matching through a
+ * hash table of 4-byte sequences, no entropy coding, so both directions run at hundreds
+ * of MB/s and it does well on repetitive data such as logs.
+ *
+ * Block format, a list of sequences:
+ *   token      high nibble: literal count, low nibble: match length - 4 (15 = more follows)
+ *   [bytes]    extra literal count, 255 per byte until a byte below 255
+ *   literals
+ *   offset     uint16 little-endian, distance back to the match (1..65535)
+ *   [bytes]    extra match length, as for literals
+ * The last sequence has literals only: the decoder stops when it has produced the raw length.
+ *
+ * Data is compressed in independent chunks of COMPRESS_CHUNK bytes, so chunks can be
+ * compressed and decompressed on several threads (CompressChunks / DecompressChunks).
+ */
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <thread>
+
+const size_t COMPRESS_CHUNK = 1 << 20;
+const int LZ_HASH_BITS = 16;
+const size_t LZ_MIN_MATCH = 4;
+const size_t LZ_END_LITERALS = 5;       // the last bytes of a block are always literals
+const size_t LZ_MAX_OFFSET = 65535;
+
+
+inline size_t LZCompressBound(size_t length){
+    return length + length / 255 + 16;
+}
+
+inline unsigned int load32(const unsigned char * p){
+    unsigned int value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+inline unsigned int lzHash(unsigned int sequence){
+    return (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// Index of the first byte that differs in two little-endian words (difference is their XOR, not 0)
+inline size_t lowestDifferingByte(unsigned long long difference){
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return (size_t) __builtin_ctzll(difference) >> 3;
+#else
+    size_t n = 0;
+    while((difference & 0xff) == 0){
+        difference >>= 8;
+        n++;
+    }
+    return n;
+#endif
+}
+
+// 15 in a nibble means the rest of the count follows in bytes of 255 and a final smaller byte
+inline unsigned char * writeLength(unsigned char * out, size_t length){
+    for(; length >= 255 ; length -= 255){
+        *out++ = 255;
+    }
+    *out++ = (unsigned char) length;
+    return out;
+}
+
+inline unsigned char * writeSequence(unsigned char * out, const unsigned char * literals, size_t literalCount,
+                                     size_t offset, size_t matchLength){
+    size_t matchCode = matchLength - LZ_MIN_MATCH;
+    unsigned char *token = out++;
+    *token = (unsigned char) ((literalCount < 15 ? literalCount : 15) << 4);
+    if(literalCount >= 15) out = writeLength(out, literalCount - 15);
+    if(literalCount) memcpy(out, literals, literalCount);
+    out += literalCount;
+    if(matchLength == 0){
+        return out;
+    }
+    *token |= (unsigned char) (matchCode < 15 ? matchCode : 15);
+    *out++ = (unsigned char) offset;
+    *out++ = (unsigned char) (offset >> 8);
+    if(matchCode >= 15) out = writeLength(out, matchCode - 15);
+    return out;
+}
+
+
+/*
+    Compresses length bytes into out, which needs LZCompressBound(length) bytes.
+    Returns the compressed size.
+*/
+size_t LZCompress(const unsigned char * in, size_t length, unsigned char * out){
+    std::vector<unsigned int> table(1 << LZ_HASH_BITS, 0);
+    unsigned char *op = out;
+    size_t anchor = 0, pos = 0;
+    size_t matchLimit = length > LZ_END_LITERALS ? length - LZ_END_LITERALS : 0;
+    size_t searchLimit = length > 12 ? length - 12 : 0;
+    unsigned int misses = 0;
+
+    while(pos < searchLimit){
+        unsigned int sequence = load32(in + pos);
+        unsigned int hash = lzHash(sequence);
+        size_t candidate = table[hash];
+        table[hash] = (unsigned int) pos;
+
+        if(candidate < pos && pos - candidate <= LZ_MAX_OFFSET && load32(in + candidate) == sequence){
+            size_t matchLength = LZ_MIN_MATCH;
+            // compare 8 bytes at a time; the first differing byte is the lowest set bit of the XOR
+            while(pos + matchLength + 8 <= matchLimit){
+                unsigned long long a, b;
+                memcpy(&a, in + candidate + matchLength, 8);
+                memcpy(&b, in + pos + matchLength, 8);
+                if(a != b){
+                    matchLength += lowestDifferingByte(a ^ b);
+                    goto matched;
+                }
+                matchLength += 8;
+            }
+            while(pos + matchLength < matchLimit && in[candidate + matchLength] == in[pos + matchLength]){
+                matchLength++;
+            }
+        matched:
+            op = writeSequence(op, in + anchor, pos - anchor, pos - candidate, matchLength);
+            pos += matchLength;
+            anchor = pos;
+            if(pos - 2 < searchLimit){
+                table[lzHash(load32(in + pos - 2))] = (unsigned int) (pos - 2);
+            }
+            misses = 0;
+        } else {
+            // skip faster through data that does not match, as LZ4 does
+            pos += 1 + (misses++ >> 6);
+        }
+    }
+    op = writeSequence(op, in + anchor, length - anchor, 0, 0);
+    return (size_t) (op - out);
+}
+
+inline bool readLength(const unsigned char * & ip, const unsigned char * end, size_t & length){
+    unsigned char byte;
+    do {
+        if(ip >= end) return false;
+        byte = *ip++;
+        length += byte;
+    } while(byte == 255);
+    return true;
+}
+
+/*
+    Decompresses a block into exactly rawLength bytes. Returns false for input that is
+    malformed or does not produce exactly rawLength bytes; never reads or writes out of bounds.
+*/
+bool LZDecompress(const unsigned char * in, size_t length, unsigned char * out, size_t rawLength){
+    const unsigned char *ip = in, *end = in + length;
+    size_t op = 0;
+    while(true){
+        if(ip >= end) return false;
+        unsigned char token = *ip++;
+
+        size_t literalCount = token >> 4;
+        if(literalCount == 15 && !readLength(ip, end, literalCount)) return false;
+        if(literalCount > (size_t) (end - ip) || literalCount > rawLength - op) return false;
+        // short runs: one fixed 16-byte copy when both buffers have room for it
+        if(literalCount <= 16 && end - ip >= 16 && rawLength - op >= 16) memcpy(out + op, ip, 16);
+        else if(literalCount) memcpy(out + op, ip, literalCount);
+        ip += literalCount;
+        op += literalCount;
+        if(op == rawLength){
+            return ip == end;
+        }
+
+        if(end - ip < 2) return false;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if(offset == 0 || offset > op) return false;
+        size_t matchLength = token & 15;
+        if(matchLength == 15 && !readLength(ip, end, matchLength)) return false;
+        matchLength += LZ_MIN_MATCH;
+        if(matchLength > rawLength - op) return false;
+
+        unsigned char *match = out + op - offset;
+        if(matchLength <= 16 && offset >= 16 && rawLength - op >= 16){
+            memcpy(out + op, match, 16);
+        } else if(offset >= matchLength){
+            memcpy(out + op, match, matchLength);
+        } else {
+            // overlapping copy repeats the last offset bytes; 8 at a time when they are that far back
+            size_t i = 0;
+            if(offset >= 8){
+                for(; i + 8 <= matchLength ; i += 8) memcpy(out + op + i, match + i, 8);
+            }
+            for(; i < matchLength ; i++) out[op + i] = match[i];
+        }
+        op += matchLength;
+    }
+}
+
+
+// One chunk on its way through the compression stage
+struct CompressedChunk {
+    std::vector<unsigned char> raw;
+    std::vector<unsigned char> packed;
+    bool compressed;    // false: packed holds the raw bytes, compression did not help
+    bool valid;         // after DecompressChunks: the block decoded correctly
+};
+
+// Compresses every chunk, spread over numThreads threads; incompressible chunks are stored
+void CompressChunks(std::vector<CompressedChunk> & chunks, int numThreads){
+    auto work = [&](size_t first){
+        for(size_t i = first ; i < chunks.size() ; i += numThreads){
+            CompressedChunk &chunk = chunks[i];
+            chunk.packed.resize(LZCompressBound(chunk.raw.size()));
+            size_t n = LZCompress(chunk.raw.data(), chunk.raw.size(), chunk.packed.data());
+            chunk.compressed = n < chunk.raw.size();
+            if(chunk.compressed) chunk.packed.resize(n);
+            else chunk.packed = chunk.raw;
+        }
+    };
+    if(numThreads < 1) numThreads = 1;
+    std::vector<std::thread> threads;
+    for(int t = 1 ; t < numThreads ; t++) threads.push_back(std::thread(work, t));
+    work(0);
+    for(size_t t = 0 ; t < threads.size() ; t++) threads[t].join();
+}
+
+// Restores raw from packed for every chunk (raw must already have its final size)
+void DecompressChunks(std::vector<CompressedChunk> & chunks, int numThreads){
+    auto work = [&](size_t first){
+        for(size_t i = first ; i < chunks.size() ; i += numThreads){
+            CompressedChunk &chunk = chunks[i];
+            if(chunk.compressed){
+                chunk.valid = LZDecompress(chunk.packed.data(), chunk.packed.size(), chunk.raw.data(), chunk.raw.size());
+            } else {
+                chunk.valid = chunk.packed.size() == chunk.raw.size();
+                if(chunk.valid) chunk.raw = chunk.packed;
+            }
+        }
+    };
+    if(numThreads < 1) numThreads = 1;
+    std::vector<std::thread> threads;
+    for(int t = 1 ; t < numThreads ; t++) threads.push_back(std::thread(work, t));
+    work(0);
+    for(size_t t = 0 ; t < threads.size() ; t++) threads[t].join();
+}
+
+#endif /* COMPRESS_H */
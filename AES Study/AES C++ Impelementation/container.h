@@ -0,0 +1,510 @@
+/*
+ * container.h - Chunked AES container with an index for random-access decryption.
+ *
+ * The plaintext is split into fixed-size chunks. The whole file is one CTR keystream
+ * (chunk i starts at counter IV + i * chunkSize / 16), every chunk carries a tag, and an
+ * index at the end of the file records where each chunk is stored. Reading a byte range
+ * only reads, verifies and decrypts the chunks that overlap it.
+ *
+ * File layout (all integers little-endian):
+ *
+ *   Header, 64 bytes
+ *     char[4]   "AESC"
+ *     uint32    version (2)
+ *     uint32    mode (1 = CTR)
+ *     uint32    chunk size in bytes (multiple of 16)
+ *     uint64    key ID (first 8 bytes of AES_K(0^128), the usual key check value)
+ *     uint64    original plaintext length
+ *     uint64    index offset (0 until the container is closed)
+ *     uint8[16] IV / initial counter
+ *     uint8[8]  reserved (zero)
+ *
+ *   Chunks, one after another: stored bytes of each chunk
+ *
+ *   Index, one 32-byte entry per chunk
+ *     uint64    offset of the chunk in the file
+ *     uint32    stored length
+ *     uint32    plaintext length
+ *     uint8[16] tag
+ *
+ *   Trailer, 32 bytes
+ *     uint64    number of chunks
+ *     uint8[16] index tag
+ *     char[4]   "AESI"
+ *     uint32    version (2)
+ *
+ * The chunk tag is a CBC-MAC under a key derived from the container key (AES_K of a fixed
+ * block), over: IV | (chunk index, plaintext length, stored length) | stored bytes zero-padded.
+ * The second block fixes the message length, so the encoding is prefix-free as CBC-MAC needs.
+ *
+ * Chunk tags alone do not show where the file ends: dropping the last chunks and rewriting
+ * the length, the index and the chunk count to match would leave every remaining tag valid.
+ * The index tag closes that: a CBC-MAC under a second derived key over
+ * (number of chunks, plaintext length) | header | index, checked before the index is used.
+ * Its first block fixes the message length again.
+ */
+
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <random>
+
+#include "modes.h"
+
+const unsigned int CONTAINER_VERSION = 2;
+const unsigned int CONTAINER_MODE_CTR = 1;
+const unsigned int CONTAINER_HEADER_SIZE = 64;
+const unsigned int CONTAINER_INDEX_ENTRY_SIZE = 32;
+const unsigned int CONTAINER_TRAILER_SIZE = 32;
+const unsigned int CONTAINER_DEFAULT_CHUNK = 1 << 20;
+
+
+struct ContainerHeader {
+    unsigned int mode;
+    unsigned int chunkSize;
+    unsigned long long keyId;
+    unsigned long long length;
+    unsigned long long indexOffset;
+    unsigned char iv[16];
+};
+
+struct ContainerChunk {
+    unsigned long long offset;
+    unsigned int storedLength;
+    unsigned int plainLength;
+    unsigned char tag[16];
+};
+
+
+// --------------------------------------------------------
+// Little-endian field helpers
+// --------------------------------------------------------
+
+inline void putLE(unsigned char * p, unsigned long long value, int bytes){
+    for(int i = 0 ; i < bytes ; i++){
+        p[i] = (unsigned char) (value >> (8 * i));
+    }
+}
+
+inline unsigned long long getLE(const unsigned char * p, int bytes){
+    unsigned long long value = 0;
+    for(int i = bytes - 1 ; i >= 0 ; i--){
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+
+// --------------------------------------------------------
+// Keys and tags
+// --------------------------------------------------------
+
+// Key check value: the first 8 bytes of the encryption of the zero block
+unsigned long long ContainerKeyId(const unsigned char * expandedKey){
+    unsigned char zero[16] = { 0 }, out[16];
+    AESEncrypt(zero, const_cast<unsigned char*>(expandedKey), out);
+    return getLE(out, 8);
+}
+
+// Purposes of the derived MAC keys, the last byte of the label block
+const unsigned char CONTAINER_CHUNK_TAG_KEY = 1;
+const unsigned char CONTAINER_INDEX_TAG_KEY = 2;
+
+// MAC key: the encryption of a fixed block under the container key, expanded
+void ContainerMacKey(const unsigned char * expandedKey, unsigned char macExpandedKey[176], unsigned char purpose = CONTAINER_CHUNK_TAG_KEY){
+    unsigned char label[16] = { 'A', 'E', 'S', 'C', ' ', 'c', 'h', 'u', 'n', 'k', ' ', 't', 'a', 'g', 0, purpose };
+    unsigned char macKey[16];
+    AESEncrypt(label, const_cast<unsigned char*>(expandedKey), macKey);
+    KeyExpansion(macKey, macExpandedKey);
+    memset(macKey, 0, sizeof(macKey));
+}
+
+void ContainerChunkTag(const CipherBackend &backend, const unsigned char * macExpandedKey, const unsigned char iv[16],
+                       unsigned long long chunkIndex, const ContainerChunk &chunk, const unsigned char * stored, unsigned char tag[16]){
+    unsigned char state[16], block[16];
+
+    backend.encryptBlocks(iv, 16, macExpandedKey, state);
+
+    putLE(block, chunkIndex, 8);
+    putLE(block + 8, chunk.plainLength, 4);
+    putLE(block + 12, chunk.storedLength, 4);
+    xorBytes(state, state, block, 16);
+    backend.encryptBlocks(state, 16, macExpandedKey, state);
+
+    for(unsigned int i = 0 ; i < chunk.storedLength ; i += 16){
+        unsigned int n = chunk.storedLength - i < 16 ? chunk.storedLength - i : 16;
+        memset(block, 0, 16);
+        memcpy(block, stored + i, n);
+        xorBytes(state, state, block, 16);
+        backend.encryptBlocks(state, 16, macExpandedKey, state);
+    }
+    memcpy(tag, state, 16);
+}
+
+// CBC-MAC over (chunk count, length) | the 64 header bytes | the index entries
+void ContainerIndexTag(const CipherBackend &backend, const unsigned char * indexExpandedKey, const unsigned char * header,
+                       unsigned long long numChunks, unsigned long long length, const unsigned char * index, unsigned char tag[16]){
+    unsigned char state[16];
+
+    putLE(state, numChunks, 8);
+    putLE(state + 8, length, 8);
+    backend.encryptBlocks(state, 16, indexExpandedKey, state);
+
+    for(unsigned int i = 0 ; i < CONTAINER_HEADER_SIZE ; i += 16){
+        xorBytes(state, state, header + i, 16);
+        backend.encryptBlocks(state, 16, indexExpandedKey, state);
+    }
+    for(unsigned long long i = 0 ; i < numChunks * CONTAINER_INDEX_ENTRY_SIZE ; i += 16){
+        xorBytes(state, state, index + i, 16);
+        backend.encryptBlocks(state, 16, indexExpandedKey, state);
+    }
+    memcpy(tag, state, 16);
+}
+
+// Constant-time tag comparison
+bool ContainerTagsEqual(const unsigned char * a, const unsigned char * b){
+    unsigned char diff = 0;
+    for(int i = 0 ; i < 16 ; i++){
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+
+// --------------------------------------------------------
+// Writer
+// --------------------------------------------------------
+
+/*
+    Streams plaintext into a new container. write() may be called with any amount of data;
+    close() encrypts the last chunk, appends the index and fills in the header.
+*/
+class ContainerWriter {
+public:
+    ContainerWriter() : backend(&BestBackend()), chunkIndex(0) {}
+
+    bool open(const std::string & path, const unsigned char key[16], unsigned int chunkSize = CONTAINER_DEFAULT_CHUNK){
+        if(chunkSize == 0 || chunkSize % 16 != 0){
+            error = "chunk size must be a non-zero multiple of 16";
+            return false;
+        }
+        out.open(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if(!out){
+            error = "unable to create " + path;
+            return false;
+        }
+
+        KeyExpansion(const_cast<unsigned char*>(key), expandedKey);
+        ContainerMacKey(expandedKey, macExpandedKey);
+
+        header.mode = CONTAINER_MODE_CTR;
+        header.chunkSize = chunkSize;
+        header.keyId = ContainerKeyId(expandedKey);
+        header.length = 0;
+        header.indexOffset = 0;
+        std::random_device random;
+        for(int i = 0 ; i < 16 ; i += 4){
+            putLE(header.iv + i, random(), 4);
+        }
+
+        pending.reserve(chunkSize);
+        chunks.clear();
+        chunkIndex = 0;
+        return writeHeader();
+    }
+
+    bool write(const unsigned char * data, size_t length){
+        while(length > 0){
+            size_t room = header.chunkSize - pending.size();
+            size_t n = length < room ? length : room;
+            pending.insert(pending.end(), data, data + n);
+            data += n;
+            length -= n;
+            header.length += n;
+            if(pending.size() == header.chunkSize && !flushChunk()){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool close(){
+        if(!pending.empty() && !flushChunk()){
+            return false;
+        }
+
+        header.indexOffset = (unsigned long long) out.tellp();
+        std::vector<unsigned char> index(chunks.size() * CONTAINER_INDEX_ENTRY_SIZE);
+        for(size_t i = 0 ; i < chunks.size() ; i++){
+            unsigned char *entry = &index[i * CONTAINER_INDEX_ENTRY_SIZE];
+            putLE(entry, chunks[i].offset, 8);
+            putLE(entry + 8, chunks[i].storedLength, 4);
+            putLE(entry + 12, chunks[i].plainLength, 4);
+            memcpy(entry + 16, chunks[i].tag, 16);
+        }
+        if(!index.empty()){
+            out.write(reinterpret_cast<const char*>(&index[0]), index.size());
+        }
+
+        // the index tag covers the final header, so it is computed now that the header is complete
+        unsigned char headerBytes[CONTAINER_HEADER_SIZE], indexExpandedKey[176];
+        encodeHeader(headerBytes);
+        ContainerMacKey(expandedKey, indexExpandedKey, CONTAINER_INDEX_TAG_KEY);
+
+        unsigned char trailer[CONTAINER_TRAILER_SIZE];
+        putLE(trailer, chunks.size(), 8);
+        ContainerIndexTag(*backend, indexExpandedKey, headerBytes, chunks.size(), header.length, index.empty() ? NULL : &index[0], trailer + 8);
+        memcpy(trailer + 24, "AESI", 4);
+        putLE(trailer + 28, CONTAINER_VERSION, 4);
+        out.write(reinterpret_cast<const char*>(trailer), sizeof(trailer));
+
+        out.seekp(0);
+        bool ok = writeHeader();
+        out.close();
+        memset(expandedKey, 0, sizeof(expandedKey));
+        memset(macExpandedKey, 0, sizeof(macExpandedKey));
+        memset(indexExpandedKey, 0, sizeof(indexExpandedKey));
+        if(!ok || out.fail()){
+            error = "write failed";
+            return false;
+        }
+        return true;
+    }
+
+    std::string error;
+
+private:
+    const CipherBackend *backend;
+    std::ofstream out;
+    ContainerHeader header;
+    unsigned char expandedKey[176];
+    unsigned char macExpandedKey[176];
+    std::vector<unsigned char> pending;
+    std::vector<ContainerChunk> chunks;
+    unsigned long long chunkIndex;
+
+    void encodeHeader(unsigned char bytes[CONTAINER_HEADER_SIZE]) const {
+        memset(bytes, 0, CONTAINER_HEADER_SIZE);
+        memcpy(bytes, "AESC", 4);
+        putLE(bytes + 4, CONTAINER_VERSION, 4);
+        putLE(bytes + 8, header.mode, 4);
+        putLE(bytes + 12, header.chunkSize, 4);
+        putLE(bytes + 16, header.keyId, 8);
+        putLE(bytes + 24, header.length, 8);
+        putLE(bytes + 32, header.indexOffset, 8);
+        memcpy(bytes + 40, header.iv, 16);
+    }
+
+    bool writeHeader(){
+        unsigned char bytes[CONTAINER_HEADER_SIZE];
+        encodeHeader(bytes);
+        out.write(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+        return !out.fail();
+    }
+
+    // Encrypts the pending chunk in place at its counter position, tags it and appends it
+    bool flushChunk(){
+        ContainerChunk chunk;
+        chunk.offset = (unsigned long long) out.tellp();
+        chunk.plainLength = (unsigned int) pending.size();
+        chunk.storedLength = chunk.plainLength;
+
+        unsigned char counter[16];
+        memcpy(counter, header.iv, 16);
+        addCounter(counter, chunkIndex * (header.chunkSize / 16));
+        AESCryptCTR(*backend, &pending[0], pending.size(), expandedKey, counter, &pending[0]);
+
+        ContainerChunkTag(*backend, macExpandedKey, header.iv, chunkIndex, chunk, &pending[0], chunk.tag);
+        out.write(reinterpret_cast<const char*>(&pending[0]), pending.size());
+        if(out.fail()){
+            error = "write failed";
+            return false;
+        }
+        chunks.push_back(chunk);
+        chunkIndex++;
+        pending.clear();
+        return true;
+    }
+};
+
+
+// --------------------------------------------------------
+// Reader
+// --------------------------------------------------------
+
+/*
+    Opens a container and decrypts any byte range of the original plaintext.
+    Only the header, the index and the chunks overlapping the range are read.
+*/
+class ContainerReader {
+public:
+    ContainerReader() : backend(&BestBackend()), loadedChunk(NO_CHUNK) {}
+
+    bool open(const std::string & path, const unsigned char key[16]){
+        in.open(path.c_str(), std::ios::in | std::ios::binary);
+        loadedChunk = NO_CHUNK;
+        if(!in){
+            error = "unable to open " + path;
+            return false;
+        }
+
+        unsigned char bytes[CONTAINER_HEADER_SIZE];
+        if(!in.read(reinterpret_cast<char*>(bytes), sizeof(bytes)) || memcmp(bytes, "AESC", 4) != 0){
+            error = "not an AES container";
+            return false;
+        }
+        if(getLE(bytes + 4, 4) != CONTAINER_VERSION || getLE(bytes + 8, 4) != CONTAINER_MODE_CTR){
+            error = "unsupported container version or mode";
+            return false;
+        }
+        header.mode = (unsigned int) getLE(bytes + 8, 4);
+        header.chunkSize = (unsigned int) getLE(bytes + 12, 4);
+        header.keyId = getLE(bytes + 16, 8);
+        header.length = getLE(bytes + 24, 8);
+        header.indexOffset = getLE(bytes + 32, 8);
+        memcpy(header.iv, bytes + 40, 16);
+        if(header.indexOffset == 0 || header.chunkSize == 0 || header.chunkSize % 16 != 0){
+            error = "container was not closed properly";
+            return false;
+        }
+
+        KeyExpansion(const_cast<unsigned char*>(key), expandedKey);
+        if(ContainerKeyId(expandedKey) != header.keyId){
+            error = "wrong key for this container";
+            return false;
+        }
+        ContainerMacKey(expandedKey, macExpandedKey);
+
+        unsigned char trailer[CONTAINER_TRAILER_SIZE];
+        in.seekg(-(std::streamoff) CONTAINER_TRAILER_SIZE, std::ios::end);
+        if(!in.read(reinterpret_cast<char*>(trailer), sizeof(trailer)) || memcmp(trailer + 24, "AESI", 4) != 0
+           || getLE(trailer + 28, 4) != CONTAINER_VERSION){
+            error = "missing container index";
+            return false;
+        }
+        unsigned long long numChunks = getLE(trailer, 8);
+        if(numChunks != (header.length + header.chunkSize - 1) / header.chunkSize){
+            error = "index does not match the header";
+            return false;
+        }
+
+        std::vector<unsigned char> index(numChunks * CONTAINER_INDEX_ENTRY_SIZE);
+        in.seekg((std::streamoff) header.indexOffset);
+        if(numChunks > 0 && !in.read(reinterpret_cast<char*>(&index[0]), index.size())){
+            error = "truncated container index";
+            return false;
+        }
+
+        unsigned char indexExpandedKey[176], tag[16];
+        ContainerMacKey(expandedKey, indexExpandedKey, CONTAINER_INDEX_TAG_KEY);
+        ContainerIndexTag(*backend, indexExpandedKey, bytes, numChunks, header.length, numChunks > 0 ? &index[0] : NULL, tag);
+        memset(indexExpandedKey, 0, sizeof(indexExpandedKey));
+        if(!ContainerTagsEqual(tag, trailer + 8)){
+            error = "container index failed authentication";
+            return false;
+        }
+
+        chunks.resize(numChunks);
+        for(unsigned long long i = 0 ; i < numChunks ; i++){
+            const unsigned char *entry = &index[i * CONTAINER_INDEX_ENTRY_SIZE];
+            chunks[i].offset = getLE(entry, 8);
+            chunks[i].storedLength = (unsigned int) getLE(entry + 8, 4);
+            chunks[i].plainLength = (unsigned int) getLE(entry + 12, 4);
+            memcpy(chunks[i].tag, entry + 16, 16);
+        }
+        return true;
+    }
+
+    unsigned long long size() const { return header.length; }
+    unsigned int chunkSize() const { return header.chunkSize; }
+    unsigned long long chunkCount() const { return chunks.size(); }
+    unsigned long long keyId() const { return header.keyId; }
+
+    /*
+        Decrypts plaintext bytes [offset, offset + length) into out.
+        Every chunk touched is verified against its tag before any of it is returned.
+        The last chunk verified is kept, so small reads in one chunk do not read and MAC it again.
+    */
+    bool read(unsigned long long offset, unsigned char * out, size_t length){
+        if(offset > header.length || length > header.length - offset){
+            error = "range is past the end of the container";
+            return false;
+        }
+        while(length > 0){
+            unsigned long long chunkIndex = offset / header.chunkSize;
+            unsigned int inChunk = (unsigned int) (offset % header.chunkSize);
+            const ContainerChunk &chunk = chunks[chunkIndex];
+            size_t n = chunk.plainLength - inChunk;
+            if(n > length) n = length;
+
+            if(!loadChunk(chunkIndex)){
+                return false;
+            }
+
+            // decrypt from the block that holds the first wanted byte
+            unsigned int firstBlock = inChunk / 16;
+            unsigned int skip = inChunk % 16;
+            unsigned char counter[16];
+            memcpy(counter, header.iv, 16);
+            addCounter(counter, chunkIndex * (header.chunkSize / 16) + firstBlock);
+            if(skip == 0){
+                AESCryptCTR(*backend, &chunkBuffer[inChunk], n, expandedKey, counter, out);
+            } else {
+                unsigned char head[16];
+                size_t headLength = n < 16 - skip ? n : 16 - skip;
+                AESCryptCTR(*backend, &chunkBuffer[firstBlock * 16], skip + headLength, expandedKey, counter, head);
+                memcpy(out, head + skip, headLength);
+                AESCryptCTR(*backend, &chunkBuffer[inChunk + headLength], n - headLength, expandedKey, counter, out + headLength);
+            }
+
+            offset += n;
+            out += n;
+            length -= n;
+        }
+        return true;
+    }
+
+    std::string error;
+
+private:
+    const CipherBackend *backend;
+    std::ifstream in;
+    ContainerHeader header;
+    unsigned char expandedKey[176];
+    unsigned char macExpandedKey[176];
+    std::vector<ContainerChunk> chunks;
+    std::vector<unsigned char> chunkBuffer;
+    unsigned long long loadedChunk;     // the chunk in chunkBuffer, verified, or NO_CHUNK
+
+    static const unsigned long long NO_CHUNK = ~0ULL;
+
+    // Reads one chunk's stored bytes into chunkBuffer and checks its tag
+    bool loadChunk(unsigned long long chunkIndex){
+        if(chunkIndex == loadedChunk){
+            return true;
+        }
+        loadedChunk = NO_CHUNK;
+        const ContainerChunk &chunk = chunks[chunkIndex];
+        chunkBuffer.resize(chunk.storedLength);
+        in.clear();
+        in.seekg((std::streamoff) chunk.offset);
+        if(chunk.storedLength > 0 && !in.read(reinterpret_cast<char*>(&chunkBuffer[0]), chunk.storedLength)){
+            error = "truncated chunk";
+            return false;
+        }
+        unsigned char tag[16];
+        ContainerChunkTag(*backend, macExpandedKey, header.iv, chunkIndex, chunk, chunkBuffer.empty() ? NULL : &chunkBuffer[0], tag);
+        if(!ContainerTagsEqual(tag, chunk.tag)){
+            error = "chunk " + std::to_string(chunkIndex) + " failed authentication";
+            return false;
+        }
+        loadedChunk = chunkIndex;
+        return true;
+    }
+};
+
+#endif /* CONTAINER_H */
@@ -0,0 +1,233 @@
+/*
+ * drbg.h - Deterministic random bit generator in the style of NIST SP 800-90A CTR_DRBG.
+ *
+ * AES-128 CTR_DRBG without a derivation function: the state is a key and a 128-bit
+ * counter V, seed material is 32 bytes (key length + block length), every Generate call
+ * returns at most DRBG_MAX_REQUEST bytes and is followed by the Update step, so earlier
+ * output cannot be recomputed from a captured state.
+ *
+ * The output blocks of one request are independent encryptions of V+1, V+2, ..., so
+ * they are handed to the backend in bulk and run at close to bulk AES speed.
+ *
+ * Seeding:
+ * - seedFromSystem() takes 32 bytes from std::random_device (for nonces and keys).
+ * - seedDeterministic(seed, stream) derives the seed material from two integers, so
+ *   research runs can be repeated exactly. That output is only as secret as the seed.
+ *
+ * DrbgFill() fills large buffers on several threads. The buffer is cut into fixed regions
+ * and region r comes from its own instance seeded with (seed, r), so the bytes depend only
+ * on the seed, never on the number of threads.
+ */
+
+#ifndef DRBG_H
+#define DRBG_H
+
+#include <cstring>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+#include "modes.h"
+
+const size_t DRBG_SEED_LENGTH = 32;                         // seedlen: key + block
+const size_t DRBG_MAX_REQUEST = 1 << 16;                    // 2^19 bits per Generate call
+const unsigned long long DRBG_RESEED_INTERVAL = 1ULL << 48;
+const size_t DRBG_FILL_REGION = 1 << 24;                    // bytes per DrbgFill instance
+
+
+class CtrDrbg {
+public:
+    CtrDrbg(const CipherBackend &backend = BestBackend()) : backend(&backend), reseedCounter(0), systemSeeded(false) {
+        memset(key, 0, sizeof(key));
+        memset(V, 0, sizeof(V));
+    }
+
+    ~CtrDrbg(){
+        memset(key, 0, sizeof(key));
+        memset(V, 0, sizeof(V));
+        memset(expandedKey, 0, sizeof(expandedKey));
+    }
+
+    // Instantiate: Key = 0, V = 0, then Update(entropy XOR personalization)
+    void instantiate(const unsigned char entropy[DRBG_SEED_LENGTH], const unsigned char * personalization = NULL, size_t personalizationLength = 0){
+        unsigned char seedMaterial[DRBG_SEED_LENGTH];
+        padded(personalization, personalizationLength, seedMaterial);
+        xorBytes(seedMaterial, seedMaterial, entropy, DRBG_SEED_LENGTH);
+
+        memset(key, 0, sizeof(key));
+        memset(V, 0, sizeof(V));
+        KeyExpansion(key, expandedKey);
+        update(seedMaterial);
+        reseedCounter = 1;
+    }
+
+    void reseed(const unsigned char entropy[DRBG_SEED_LENGTH], const unsigned char * additional = NULL, size_t additionalLength = 0){
+        unsigned char seedMaterial[DRBG_SEED_LENGTH];
+        padded(additional, additionalLength, seedMaterial);
+        xorBytes(seedMaterial, seedMaterial, entropy, DRBG_SEED_LENGTH);
+        update(seedMaterial);
+        reseedCounter = 1;
+    }
+
+    void seedFromSystem(){
+        unsigned char entropy[DRBG_SEED_LENGTH];
+        systemEntropy(entropy);
+        instantiate(entropy);
+        systemSeeded = true;
+    }
+
+    // Reproducible instance: the seed material is the two integers, little-endian, zero-padded
+    void seedDeterministic(unsigned long long seed, unsigned long long stream = 0){
+        unsigned char entropy[DRBG_SEED_LENGTH] = { 0 };
+        unsigned char personalization[8];
+        for(int i = 0 ; i < 8 ; i++){
+            entropy[i] = (unsigned char) (seed >> (8 * i));
+            personalization[i] = (unsigned char) (stream >> (8 * i));
+        }
+        instantiate(entropy, personalization, sizeof(personalization));
+        systemSeeded = false;
+    }
+
+    /*
+        Writes length random bytes to out. Longer requests are split into Generate calls
+        of at most DRBG_MAX_REQUEST bytes; additional input (at most 32 bytes) goes into the first.
+    */
+    void generate(unsigned char * out, size_t length, const unsigned char * additional = NULL, size_t additionalLength = 0){
+        do {
+            size_t n = length < DRBG_MAX_REQUEST ? length : DRBG_MAX_REQUEST;
+            generateRequest(out, n, additional, additionalLength);
+            additional = NULL;
+            additionalLength = 0;
+            out += n;
+            length -= n;
+        } while(length > 0);
+    }
+
+    unsigned long long uniform64(){
+        unsigned char bytes[8];
+        generate(bytes, sizeof(bytes));
+        unsigned long long value = 0;
+        for(int i = 0 ; i < 8 ; i++){
+            value = (value << 8) | bytes[i];
+        }
+        return value;
+    }
+
+    unsigned long long requestsSinceReseed() const { return reseedCounter; }
+
+private:
+    const CipherBackend *backend;
+    unsigned char key[16];
+    unsigned char V[16];
+    unsigned char expandedKey[176];
+    unsigned long long reseedCounter;
+    bool systemSeeded;
+
+    static void systemEntropy(unsigned char entropy[DRBG_SEED_LENGTH]){
+        std::random_device random;
+        for(size_t i = 0 ; i < DRBG_SEED_LENGTH ; i += 4){
+            unsigned int word = random();
+            memcpy(entropy + i, &word, 4);
+        }
+    }
+
+    static void padded(const unsigned char * data, size_t length, unsigned char out[DRBG_SEED_LENGTH]){
+        memset(out, 0, DRBG_SEED_LENGTH);
+        if(data){
+            memcpy(out, data, length < DRBG_SEED_LENGTH ? length : DRBG_SEED_LENGTH);
+        }
+    }
+
+    // CTR_DRBG_Update: two blocks of E(Key, V+1), E(Key, V+2) XOR providedData become the new Key and V
+    void update(const unsigned char providedData[DRBG_SEED_LENGTH]){
+        unsigned char temp[DRBG_SEED_LENGTH];
+        incrementCounter(V);
+        memcpy(temp, V, 16);
+        incrementCounter(V);
+        memcpy(temp + 16, V, 16);
+        backend->encryptBlocks(temp, DRBG_SEED_LENGTH, expandedKey, temp);
+        xorBytes(temp, temp, providedData, DRBG_SEED_LENGTH);
+
+        memcpy(key, temp, 16);
+        memcpy(V, temp + 16, 16);
+        KeyExpansion(key, expandedKey);
+        memset(temp, 0, sizeof(temp));
+    }
+
+    void generateRequest(unsigned char * out, size_t length, const unsigned char * additional, size_t additionalLength){
+        if(reseedCounter > DRBG_RESEED_INTERVAL && systemSeeded){
+            unsigned char entropy[DRBG_SEED_LENGTH];
+            systemEntropy(entropy);
+            reseed(entropy);
+        }
+
+        unsigned char additionalInput[DRBG_SEED_LENGTH];
+        padded(additional, additionalLength, additionalInput);
+        if(additional && additionalLength > 0){
+            update(additionalInput);
+        }
+
+        // whole blocks: write the counters into the output and encrypt them in place
+        size_t whole = length & ~(size_t) 15;
+        fillCounterBlocks(out, V, whole / 16);
+        backend->encryptBlocks(out, whole, expandedKey, out);
+        if(whole < length){
+            unsigned char block[16];
+            incrementCounter(V);
+            backend->encryptBlocks(V, 16, expandedKey, block);
+            memcpy(out + whole, block, length - whole);
+        }
+
+        update(additionalInput);
+        reseedCounter++;
+    }
+
+    CtrDrbg(const CtrDrbg &);
+    CtrDrbg &operator=(const CtrDrbg &);
+};
+
+
+// One system-seeded generator per thread, for nonces and keys
+CtrDrbg &ThreadDrbg(){
+    thread_local CtrDrbg drbg;
+    thread_local bool seeded = false;
+    if(!seeded){
+        drbg.seedFromSystem();
+        seeded = true;
+    }
+    return drbg;
+}
+
+
+/*
+    Fills buffer with reproducible random bytes on numThreads threads.
+    Region r (DRBG_FILL_REGION bytes) comes from an instance seeded with (seed, r).
+*/
+void DrbgFill(unsigned char * buffer, size_t length, unsigned long long seed, int numThreads){
+    size_t numRegions = (length + DRBG_FILL_REGION - 1) / DRBG_FILL_REGION;
+    std::atomic<size_t> nextRegion(0);
+
+    auto worker = [&](){
+        CtrDrbg drbg;
+        size_t r;
+        while((r = nextRegion++) < numRegions){
+            size_t offset = r * DRBG_FILL_REGION;
+            size_t n = length - offset < DRBG_FILL_REGION ? length - offset : DRBG_FILL_REGION;
+            drbg.seedDeterministic(seed, r);
+            drbg.generate(buffer + offset, n);
+        }
+    };
+
+    if(numThreads < 1) numThreads = 1;
+    std::vector<std::thread> threads;
+    for(int t = 1 ; t < numThreads ; t++){
+        threads.push_back(std::thread(worker));
+    }
+    worker();
+    for(size_t t = 0 ; t < threads.size() ; t++){
+        threads[t].join();
+    }
+}
+
+#endif /* DRBG_H */
@@ -6,169 +6,75 @@
     - Pads the input message to a multiple of 16 bytes.
     - Performs 10 rounds of AES encryption.
     - Writes the encrypted message to "message.aes".
+    - Keeps the message, ciphertext and key in locked, huge-page pool memory (bufferpool.h)
+      that is zeroed when the program is done with it.
+    - Times key loading, key expansion, the block loop and the file write (metrics.h);
+      "encrypt --metrics <file | unix:socket>" exports them in Prometheus format.
+
+    Pipe mode streams stdin to stdout instead (AES-128 CTR, see pipeio.h):
+        encrypt --pipe <keyfile> [--vmsplice] [--compress] [--nist] [--metrics <target>] < input > output
+    --compress compresses the data before encrypting it (compress.h); decrypt it with --compress too.
+    --nist runs the SP 800-22 style randomness tests of randomness.h over the ciphertext as it
+    is written and prints their P-values to stderr.
+
+    Job mode encrypts a large file with checkpoints and continues after an interruption
+    when run again (checkpoint.h):
+        encrypt --job <keyfile> <input> <output> [--checkpoint MB] [--journal path]
+
+    Batch mode encrypts every file listed in a manifest in one process, many small files
+    per cipher call (batch.h):
+        encrypt --batch <manifest> [--keys keyring] [-t threads]
 */
 
 #include <iostream>
 #include <cstring>
 #include <fstream>
-#include <sstream>
 #include <ctime>
 
-#include "structures.h"
+#include "aes.h"
+#include "bufferpool.h"
+#include "hexcodec.h"
+#include "metrics.h"
+#include "pipeio.h"
+#include "checkpoint.h"
+#include "batch.h"
 
 
 
 using namespace std;
 
 
-/*
-    XORs each byte of the state with the corresponding round key byte.
-    serves as the initial round during encryption
-    AddRoundKey is simplye an XOR of a 128-bit block with the 128-bit key.
-    the AddRoundKey step is one of the four main transformations in each AES round. it ensures that the encryption is securely linked to the secret key, making brute-force attacks difficult.
-*/
-void AddRoundKey(unsigned char* state, unsigned char* roundKey)
-{
-    for(int i = 0; i < 16; i++)
-    {
-        state[i] ^= roundKey[i];
-    }
-}
-
-
-/*
-    Perform substitution to each of the 16 bytes 
-    uses S-box as lookup table
-
-*/
-
-void subBytes(unsigned char * state){
-    for(int i = 0 ; i < 16 ; i++){
-        state[i] = s[state[i]];
-    }
-}
-
-
-// Shifts rows to the left for diffusion.
-void ShiftRows(unsigned char * state){
-    unsigned char temp[16];
-
-    // first column
-    temp[0] = state[0];
-    temp[1] = state[5];
-    temp[2] = state[10];
-    temp[3] = state[15];
-
-    // second column
-    temp[4] = state[4];
-    temp[5] = state[9];
-    temp[6] = state[14];
-    temp[7] = state[3];
-    // third column
-    temp[8] = state[8];
-    temp[9] = state[13];
-    temp[10] = state[2];
-    temp[11] = state[7];
-    // fourth column
-    temp[12] = state[12];   
-    temp[13] = state[1];
-    temp[14] = state[6];
-    temp[15] = state[11];
-
-    for(int i = 0 ; i < 16 ; i++){
-        state[i] = temp[i];
-    }
-}
-
-
-/* MixColumns uses mul2, mul3 look-up tables
-  * Source of diffusion
-  */
- void MixColumns(unsigned char * state) {
-	unsigned char tmp[16];
-
-	tmp[0] = (unsigned char) mul2[state[0]] ^ mul3[state[1]] ^ state[2] ^ state[3];
-	tmp[1] = (unsigned char) state[0] ^ mul2[state[1]] ^ mul3[state[2]] ^ state[3];
-	tmp[2] = (unsigned char) state[0] ^ state[1] ^ mul2[state[2]] ^ mul3[state[3]];
-	tmp[3] = (unsigned char) mul3[state[0]] ^ state[1] ^ state[2] ^ mul2[state[3]];
-
-	tmp[4] = (unsigned char)mul2[state[4]] ^ mul3[state[5]] ^ state[6] ^ state[7];
-	tmp[5] = (unsigned char)state[4] ^ mul2[state[5]] ^ mul3[state[6]] ^ state[7];
-	tmp[6] = (unsigned char)state[4] ^ state[5] ^ mul2[state[6]] ^ mul3[state[7]];
-	tmp[7] = (unsigned char)mul3[state[4]] ^ state[5] ^ state[6] ^ mul2[state[7]];
-
-	tmp[8] = (unsigned char)mul2[state[8]] ^ mul3[state[9]] ^ state[10] ^ state[11];
-	tmp[9] = (unsigned char)state[8] ^ mul2[state[9]] ^ mul3[state[10]] ^ state[11];
-	tmp[10] = (unsigned char)state[8] ^ state[9] ^ mul2[state[10]] ^ mul3[state[11]];
-	tmp[11] = (unsigned char)mul3[state[8]] ^ state[9] ^ state[10] ^ mul2[state[11]];
-
-	tmp[12] = (unsigned char)mul2[state[12]] ^ mul3[state[13]] ^ state[14] ^ state[15];
-	tmp[13] = (unsigned char)state[12] ^ mul2[state[13]] ^ mul3[state[14]] ^ state[15];
-	tmp[14] = (unsigned char)state[12] ^ state[13] ^ mul2[state[14]] ^ mul3[state[15]];
-	tmp[15] = (unsigned char)mul3[state[12]] ^ state[13] ^ state[14] ^ mul2[state[15]];
-
-	for (int i = 0; i < 16; i++) {
-		state[i] = tmp[i];
-	}
-}
-
-
-/* Each round operates on 128 bits at a time 
-    the number of rounds is defined in AESEncrypt()
-*/
-
-void Round(unsigned char * state, unsigned char * key){
-    subBytes(state);
-    ShiftRows(state);
-    MixColumns(state);
-    AddRoundKey(state,key);
-}
-
-
-// same as Round() except it doesn't mix columns
-void FinalRound(unsigned char * state, unsigned char * key){
-    subBytes(state);
-    ShiftRows(state);
-    AddRoundKey(state,key);
-}
-
-
-// The AES ecryption function organizes the confusion and diffusion steps into one function
-void AESEncrypt(unsigned char * message, unsigned char * expandedKey, unsigned char * enctypedMessage){
-
-    unsigned char state[16]; // stores the first 16 bytes of orginal message
-
-    for(int i =0 ; i< 16 ; i++){
-        state[i] = message[i];
+int main(int argc, char *argv[]) {
+    if(argc >= 3 && strcmp(argv[1], "--pipe") == 0){
+        return PipeMain(argc, argv, true);
     }
-
-    int numberOfRounds = 9;
-
-    AddRoundKey(state, expandedKey); // initial round
-
-    for(int i = 0 ; i< numberOfRounds; i++){
-        Round(state, expandedKey + (16 * (i+1)));
+    if(argc >= 2 && strcmp(argv[1], "--job") == 0){
+        return JobMain(argc, argv, true);
     }
-
-    FinalRound(state , expandedKey + 160);
-
-    // Copy encrypted state to buffer
-    for(int i = 0 ; i< 16 ; i++){
-        enctypedMessage[i] = state[i];
+    if(argc >= 3 && strcmp(argv[1], "--batch") == 0){
+        return BatchMain(argc, argv, true);
     }
 
-}
-
-int main() {
     cout << "=============================" << endl;
 	cout << " 128-bit AES Encryption Tool   " << endl;
 	cout << "=============================" << endl;
 
+    MetricsExporter exporter;
+    if(argc >= 3 && strcmp(argv[1], "--metrics") == 0 && !exporter.start(argv[2])){
+        cout << "Unable to export metrics: " << exporter.error << endl;
+        return 1;
+    }
+
+    // key material first, so it is sure to land in the first (locked) arena of the pool
+    PooledBuffer keyMaterial(16 + 176);
+    unsigned char *key = keyMaterial.data();
+    unsigned char *expandedKey = keyMaterial.data() + 16;
 
-    char message[1024];
+    PooledBuffer messageBuffer(1024);
+    char *message = (char *) messageBuffer.data();
 
     cout << "Enter the message to encrpyt: " ;
-    cin.getline(message, sizeof(message));
+    cin.getline(message, messageBuffer.size());
     cout << message << endl;
 
 
@@ -181,7 +87,8 @@ int main() {
         paddedMessageLen = (paddedMessageLen / 16 + 1) * 16;
     }
 
-    unsigned char * paddedMessage = new unsigned char[paddedMessageLen];  // dynamically alocates memory for padded message
+    PooledBuffer paddedBuffer(paddedMessageLen);  // padded message, from the pool
+    unsigned char * paddedMessage = paddedBuffer.data();
 	for (int i = 0; i < paddedMessageLen; i++) {
 		if (i >= originalLen) {
 			paddedMessage[i] = 0; // pads remaining bytes with 0x00(zero padding).
@@ -192,68 +99,70 @@ int main() {
 	}
 
     // make the encrypted message the same size as output
-    unsigned char * encryptedMessage = new unsigned char[paddedMessageLen];
+    PooledBuffer encryptedBuffer(paddedMessageLen);
+    unsigned char * encryptedMessage = encryptedBuffer.data();
 
     // getting key from keyfile
     string str;
-    ifstream infile;
-    infile.open("keyfile", ios::in | ios::binary); // open file in binary mode
-
-    if(infile.is_open()){
-        getline(infile,str);  // reads the key from file as hexadecimal string
-        infile.close();
-    } else {
-        cout << "Unable to open file";
+    bool keyRead;
+    {
+        PhaseTimer timer(PHASE_KEY_LOAD, 16);
+        ifstream infile;
+        infile.open("keyfile", ios::in | ios::binary); // open file in binary mode
+
+        if(infile.is_open()){
+            getline(infile,str);  // reads the key from file as hexadecimal string
+            infile.close();
+        } else {
+            cout << "Unable to open file";
+        }
+
+        // convert the hex key to bytes
+        keyRead = ParseHexKey(str, key);
     }
-
-    // convert the hex key to bytes
-    istringstream hex_chars_stream(str);
-    unsigned char key[16];
-    int i = 0 ;
-    unsigned int c;
-    while(hex_chars_stream >> hex >> c){
-        key[i] = c;
-        i++;
+    if(!keyRead){
+        cout << "Unable to read the key: keyfile must hold 16 hex bytes" << endl;
+        return 1;
     }
 
     // expand the key (AES-128 requires 176 bytes(44 words) of expanded key)
-    unsigned char expandedKey[176];
-
-    KeyExpansion(key, expandedKey);
+    {
+        PhaseTimer timer(PHASE_KEY_EXPANSION);
+        KeyExpansion(key, expandedKey);
+    }
 
     // Encrypt the message : each 16-byte block 
     // paddedMessage + i : pointer to current 16-byte block
     // encryptedMessage + i : stores to current 16-byte block
-    for(int i = 0 ; i < paddedMessageLen; i +=16){
-        AESEncrypt(paddedMessage+i, expandedKey, encryptedMessage + i);
+    {
+        PhaseTimer timer(PHASE_BLOCKS, paddedMessageLen);
+        for(int i = 0 ; i < paddedMessageLen; i +=16){
+            AESEncrypt(paddedMessage+i, expandedKey, encryptedMessage + i);
+        }
     }
 
     cout << "Encrypted message in hex:" << endl;
-	for (int i = 0; i < paddedMessageLen; i++) {
-		cout << hex << (int) encryptedMessage[i];
-		cout << " ";
-	}
-
-    cout << endl;
+    cout << HexEncode(encryptedMessage, paddedMessageLen) << endl;
 
 
     // Write encrypted message to file "message.aes"
-    ofstream outfile;
-    outfile.open("message.aes", ios::out | ios::binary);
-    if(outfile.is_open()){
-        outfile << encryptedMessage;
-        outfile.close();
-        cout << "Wrote encrypted message to file message.aes" << endl;
-    } else {
-        cout << "Unable to open file";
+    {
+        PhaseTimer timer(PHASE_WRITE, paddedMessageLen);
+        ofstream outfile;
+        outfile.open("message.aes", ios::out | ios::binary);
+        if(outfile.is_open()){
+            outfile.write((const char *) encryptedMessage, paddedMessageLen);
+            outfile.close();
+            cout << "Wrote encrypted message to file message.aes" << endl;
+        } else {
+            cout << "Unable to open file";
+        }
     }
 
 
-    // Free Memory dynamically allocated memory to prevent memory leaks
-    delete[] paddedMessage;
-    delete[] encryptedMessage;
+    // The pooled buffers are zeroed and returned to the pool when they go out of scope
+    str.assign(str.size(), 0);
 
-    
 
     return 0;
 
@@ -0,0 +1,327 @@
+/*
+ * hexcodec.h - Hex and base64 encoding and decoding for keys and ciphertext.
+ *
+ * Every function converts a whole buffer in one call. On x86 CPUs with SSSE3 the bulk
+ * of the buffer goes through 16-byte SIMD loops (nibble lookups with PSHUFB for hex,
+ * the Mula/Lemire shuffles for base64); the rest, and other CPUs, use table-driven
+ * scalar code that gives the same results.
+ *
+ * Decoding is strict: hex input must be an even number of digits (upper or lower case)
+ * with nothing else in between; base64 input must be the standard alphabet, padded to a
+ * multiple of 4 with '=' and with the unused bits of the last group zero. Anything else
+ * makes the decoder return false.
+ *
+ * Encoders write lower-case hex and never drop leading zeros: 0x0a is "0a".
+ */
+
+#ifndef HEXCODEC_H
+#define HEXCODEC_H
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define HAVE_SSSE3_CODEC 1
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+#endif
+
+const char hexDigits[] = "0123456789abcdef";
+const char base64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+bool CodecSIMDAvailable(){
+#ifdef HAVE_SSSE3_CODEC
+    static const bool available = __builtin_cpu_supports("ssse3");
+    return available;
+#else
+    return false;
+#endif
+}
+
+// Value of a hex digit, or -1
+inline int hexValue(char c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Value of a base64 character, or -1
+inline int base64Value(char c){
+    if(c >= 'A' && c <= 'Z') return c - 'A';
+    if(c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if(c >= '0' && c <= '9') return c - '0' + 52;
+    if(c == '+') return 62;
+    if(c == '/') return 63;
+    return -1;
+}
+
+
+#ifdef HAVE_SSSE3_CODEC
+
+// 16 bytes -> 32 hex digits
+SSSE3_TARGET inline void hexEncode16(const unsigned char * in, char * out){
+    const __m128i digits = _mm_loadu_si128((const __m128i *) hexDigits);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i bytes = _mm_loadu_si128((const __m128i *) in);
+    __m128i high = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(bytes, 4), mask));
+    __m128i low = _mm_shuffle_epi8(digits, _mm_and_si128(bytes, mask));
+    _mm_storeu_si128((__m128i *) out, _mm_unpacklo_epi8(high, low));
+    _mm_storeu_si128((__m128i *) (out + 16), _mm_unpackhi_epi8(high, low));
+}
+
+// 16 hex digits -> 8 nibble pairs as 16-bit words; valid is cleared if any digit is not hex
+SSSE3_TARGET inline __m128i hexNibblePairs(__m128i chars, __m128i &valid){
+    __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), chars));
+    __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+    __m128i isLetter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower));
+    valid = _mm_and_si128(valid, _mm_or_si128(isDigit, isLetter));
+
+    __m128i digitValues = _mm_and_si128(isDigit, _mm_sub_epi8(chars, _mm_set1_epi8('0')));
+    __m128i letterValues = _mm_andnot_si128(isDigit, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10)));
+    __m128i nibbles = _mm_or_si128(digitValues, letterValues);
+    // even digit * 16 + odd digit
+    return _mm_maddubs_epi16(nibbles, _mm_set1_epi16(0x0110));
+}
+
+// 32 hex digits -> 16 bytes; false if any digit is not hex
+SSSE3_TARGET inline bool hexDecode32(const char * in, unsigned char * out){
+    __m128i valid = _mm_set1_epi8(-1);
+    __m128i first = hexNibblePairs(_mm_loadu_si128((const __m128i *) in), valid);
+    __m128i second = hexNibblePairs(_mm_loadu_si128((const __m128i *) (in + 16)), valid);
+    _mm_storeu_si128((__m128i *) out, _mm_packus_epi16(first, second));
+    return _mm_movemask_epi8(valid) == 0xffff;
+}
+
+// 12 bytes (16 are read) -> 16 base64 characters
+SSSE3_TARGET inline void base64Encode12(const unsigned char * in, char * out){
+    __m128i bytes = _mm_loadu_si128((const __m128i *) in);
+    bytes = _mm_shuffle_epi8(bytes, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+    // split each 3 bytes into four 6-bit indices, one per byte
+    __m128i t0 = _mm_and_si128(bytes, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(bytes, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    __m128i indices = _mm_or_si128(t1, t3);
+
+    // index -> character: add an offset chosen by which range the index falls in
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    __m128i belowLowercase = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    range = _mm_or_si128(range, _mm_and_si128(belowLowercase, _mm_set1_epi8(13)));
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    _mm_storeu_si128((__m128i *) out, _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range)));
+}
+
+// 16 base64 characters -> 12 bytes (16 are written); false if any character is outside the alphabet
+SSSE3_TARGET inline bool base64Decode16(const char * in, unsigned char * out){
+    __m128i chars = _mm_loadu_si128((const __m128i *) in);
+    __m128i high = _mm_and_si128(_mm_srli_epi32(chars, 4), _mm_set1_epi8(0x0f));
+    __m128i low = _mm_and_si128(chars, _mm_set1_epi8(0x0f));
+
+    // a character is valid when its high- and low-nibble classes share no bit
+    const __m128i lowClasses = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i highClasses = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    __m128i clash = _mm_and_si128(_mm_shuffle_epi8(lowClasses, low), _mm_shuffle_epi8(highClasses, high));
+    if(_mm_movemask_epi8(_mm_cmpeq_epi8(clash, _mm_setzero_si128())) != 0xffff){
+        return false;
+    }
+
+    const __m128i rolls = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m128i isSlash = _mm_cmpeq_epi8(chars, _mm_set1_epi8('/'));
+    __m128i values = _mm_add_epi8(chars, _mm_shuffle_epi8(rolls, _mm_add_epi8(isSlash, high)));
+
+    // four 6-bit values -> three bytes
+    __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    __m128i groups = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    groups = _mm_shuffle_epi8(groups, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    _mm_storeu_si128((__m128i *) out, groups);
+    return true;
+}
+
+#endif /* HAVE_SSSE3_CODEC */
+
+
+// --------------------------------------------------------
+// Hex
+// --------------------------------------------------------
+
+// Writes 2 * length hex digits to out (no terminator)
+void HexEncode(const unsigned char * in, size_t length, char * out){
+    size_t i = 0;
+#ifdef HAVE_SSSE3_CODEC
+    if(CodecSIMDAvailable()){
+        for(; i + 16 <= length ; i += 16){
+            hexEncode16(in + i, out + 2 * i);
+        }
+    }
+#endif
+    for(; i < length ; i++){
+        out[2 * i] = hexDigits[in[i] >> 4];
+        out[2 * i + 1] = hexDigits[in[i] & 0x0f];
+    }
+}
+
+std::string HexEncode(const unsigned char * in, size_t length){
+    std::string text(2 * length, '\0');
+    if(length > 0){
+        HexEncode(in, length, &text[0]);
+    }
+    return text;
+}
+
+// Decodes length hex digits into length / 2 bytes; false on an odd length or a non-hex character
+bool HexDecode(const char * in, size_t length, unsigned char * out){
+    if(length % 2 != 0){
+        return false;
+    }
+    size_t i = 0;
+#ifdef HAVE_SSSE3_CODEC
+    if(CodecSIMDAvailable()){
+        for(; i + 32 <= length ; i += 32){
+            if(!hexDecode32(in + i, out + i / 2)){
+                return false;
+            }
+        }
+    }
+#endif
+    for(; i < length ; i += 2){
+        int high = hexValue(in[i]), low = hexValue(in[i + 1]);
+        if(high < 0 || low < 0){
+            return false;
+        }
+        out[i / 2] = (unsigned char) (high << 4 | low);
+    }
+    return true;
+}
+
+/*
+    Parses a 128-bit key written as hex, e.g. the "keyfile" format "54 68 61 74 ...".
+    Tokens are separated by whitespace and each must be one byte (2 hex digits), or the
+    whole key is one token of 32 hex digits; "5 468 61..." is rejected, not re-paired.
+*/
+bool ParseHexKey(const std::string & text, unsigned char key[16]){
+    char digits[32];
+    size_t n = 0;
+    for(size_t i = 0 ; i < text.size() ; ){
+        char c = text[i];
+        if(c == ' ' || c == '\t' || c == '\r' || c == '\n'){
+            i++;
+            continue;
+        }
+        size_t start = i;
+        while(i < text.size() && text[i] != ' ' && text[i] != '\t' && text[i] != '\r' && text[i] != '\n'){
+            i++;
+        }
+        size_t length = i - start;
+        if((length != 2 && length != sizeof(digits)) || n + length > sizeof(digits)){
+            return false;
+        }
+        memcpy(digits + n, text.data() + start, length);
+        n += length;
+    }
+    return n == sizeof(digits) && HexDecode(digits, n, key);
+}
+
+
+// --------------------------------------------------------
+// Base64
+// --------------------------------------------------------
+
+inline size_t Base64EncodedLength(size_t length){
+    return 4 * ((length + 2) / 3);
+}
+
+// Largest number of bytes that length base64 characters can decode to
+inline size_t Base64DecodedMaxLength(size_t length){
+    return length / 4 * 3;
+}
+
+// Writes Base64EncodedLength(length) characters to out, padded with '='
+void Base64Encode(const unsigned char * in, size_t length, char * out){
+    size_t i = 0, o = 0;
+#ifdef HAVE_SSSE3_CODEC
+    if(CodecSIMDAvailable()){
+        // 16 bytes are loaded for every 12 used
+        for(; i + 16 <= length ; i += 12, o += 16){
+            base64Encode12(in + i, out + o);
+        }
+    }
+#endif
+    for(; i + 3 <= length ; i += 3, o += 4){
+        unsigned int group = in[i] << 16 | in[i + 1] << 8 | in[i + 2];
+        out[o] = base64Alphabet[group >> 18];
+        out[o + 1] = base64Alphabet[(group >> 12) & 0x3f];
+        out[o + 2] = base64Alphabet[(group >> 6) & 0x3f];
+        out[o + 3] = base64Alphabet[group & 0x3f];
+    }
+    if(i < length){
+        unsigned int group = in[i] << 16 | (i + 1 < length ? in[i + 1] << 8 : 0);
+        out[o] = base64Alphabet[group >> 18];
+        out[o + 1] = base64Alphabet[(group >> 12) & 0x3f];
+        out[o + 2] = i + 1 < length ? base64Alphabet[(group >> 6) & 0x3f] : '=';
+        out[o + 3] = '=';
+    }
+}
+
+std::string Base64Encode(const unsigned char * in, size_t length){
+    std::string text(Base64EncodedLength(length), '\0');
+    if(length > 0){
+        Base64Encode(in, length, &text[0]);
+    }
+    return text;
+}
+
+/*
+    Decodes length base64 characters into out (room for Base64DecodedMaxLength(length) bytes)
+    and sets outLength. false on a bad length, a character outside the alphabet, misplaced
+    padding or non-zero unused bits in the last group.
+*/
+bool Base64Decode(const char * in, size_t length, unsigned char * out, size_t & outLength){
+    outLength = 0;
+    if(length % 4 != 0){
+        return false;
+    }
+    if(length == 0){
+        return true;
+    }
+    size_t padding = in[length - 1] == '=' ? (in[length - 2] == '=' ? 2 : 1) : 0;
+    size_t full = length - 4;   // the last group may carry padding, it is always done below
+
+    size_t i = 0, o = 0;
+#ifdef HAVE_SSSE3_CODEC
+    if(CodecSIMDAvailable()){
+        // 16 bytes are stored for every 12 decoded, so leave room before the last group
+        for(; i + 16 <= full && o + 16 <= Base64DecodedMaxLength(length) ; i += 16, o += 12){
+            if(!base64Decode16(in + i, out + o)){
+                return false;
+            }
+        }
+    }
+#endif
+    for(; i < length ; i += 4, o += 3){
+        bool last = (i + 4 == length);
+        int values[4];
+        for(int j = 0 ; j < 4 ; j++){
+            values[j] = (last && j >= 4 - (int) padding) ? 0 : base64Value(in[i + j]);
+            if(values[j] < 0){
+                return false;
+            }
+        }
+        unsigned int group = values[0] << 18 | values[1] << 12 | values[2] << 6 | values[3];
+        // the bits the padding leaves unused must be zero, so every byte string has one encoding
+        if(last && ((padding == 2 && (group & 0xffff)) || (padding == 1 && (group & 0xff)))){
+            return false;
+        }
+        out[o] = (unsigned char) (group >> 16);
+        if(!last || padding < 2) out[o + 1] = (unsigned char) (group >> 8);
+        if(!last || padding < 1) out[o + 2] = (unsigned char) group;
+    }
+    outLength = Base64DecodedMaxLength(length) - padding;
+    return true;
+}
+
+#endif /* HEXCODEC_H */
@@ -0,0 +1,156 @@
+/*
+    AES-128 Partial Key Search
+
+    - Recovers a key of which only some bits are unknown from a known plaintext and its
+      ciphertext, e.g. the message typed into encrypt and the message.aes it wrote.
+    - The known bits come from a keyfile; the unknown ones are the lowest -u bits of the
+      key, or the bits set in a -m hex mask. Their value in the keyfile is ignored.
+    - Searches on all cores with the multi-key AES-NI engine of keysearch.h, rejecting
+      candidates after the first block, and prints keys/s next to the plain loop of
+      KeyExpansion and AESEncrypt per candidate.
+
+    Usage: keysearch -p "plaintext" | -x plaintext-hex
+                     [-k keyfile] [-c ciphertext file] [-u unknown bits | -m mask-hex] [-t threads]
+    Build: g++ -O2 -pthread keysearch.cpp -o keysearch.exe
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include "keysearch.h"
+#include "hexcodec.h"
+#include "pipeio.h"
+
+using namespace std;
+
+
+// The key in hex with the unknown nibbles shown as '?'
+string maskedHex(const unsigned char key[16], const unsigned char mask[16]){
+    string hex = HexEncode(key, 16);
+    for(int i = 0 ; i < 32 ; i++){
+        int shift = i % 2 == 0 ? 4 : 0;
+        if((mask[i / 2] >> shift) & 15) hex[i] = '?';
+    }
+    return hex;
+}
+
+// Keys per second of the plain loop: KeyExpansion and AESEncrypt for every candidate
+double referenceRate(const unsigned char * plaintext){
+    unsigned char key[16] = { 0 }, expandedKey[176], out[16];
+    const int count = 1 << 16;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(int i = 0 ; i < count ; i++){
+        key[14] = (unsigned char) (i >> 8);
+        key[15] = (unsigned char) i;
+        KeyExpansion(key, expandedKey);
+        AESEncrypt(const_cast<unsigned char*>(plaintext), expandedKey, out);
+    }
+    return count / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+
+int main(int argc, char *argv[]){
+    cout << "=============================" << endl;
+    cout << " AES-128 Partial Key Search  " << endl;
+    cout << "=============================" << endl;
+
+    string keyPath = "keyfile", cipherPath = "message.aes", plainText, plainHex, maskHex;
+    int unknownBits = 24;
+    int numThreads = (int) thread::hardware_concurrency();
+    for(int i = 1 ; i + 1 < argc ; i += 2){
+        if(strcmp(argv[i], "-k") == 0) keyPath = argv[i + 1];
+        else if(strcmp(argv[i], "-c") == 0) cipherPath = argv[i + 1];
+        else if(strcmp(argv[i], "-p") == 0) plainText = argv[i + 1];
+        else if(strcmp(argv[i], "-x") == 0) plainHex = argv[i + 1];
+        else if(strcmp(argv[i], "-u") == 0) unknownBits = atoi(argv[i + 1]);
+        else if(strcmp(argv[i], "-m") == 0) maskHex = argv[i + 1];
+        else if(strcmp(argv[i], "-t") == 0) numThreads = atoi(argv[i + 1]);
+    }
+    if(numThreads < 1) numThreads = 1;
+
+    // known plaintext, zero padded like the encrypt tool pads the message
+    vector<unsigned char> plaintext;
+    if(!plainHex.empty()){
+        plaintext.resize(plainHex.size() / 2);
+        if(plainHex.size() % 2 != 0 || !HexDecode(plainHex.data(), plainHex.size(), plaintext.data())){
+            cout << "Unable to read the plaintext: -x needs hex digits" << endl;
+            return 1;
+        }
+    } else if(!plainText.empty()){
+        plaintext.assign(plainText.begin(), plainText.end());
+    } else {
+        cout << "Usage: keysearch -p \"plaintext\" | -x plaintext-hex [-k keyfile] [-c ciphertext file]" << endl;
+        cout << "                 [-u unknown bits | -m mask-hex] [-t threads]" << endl;
+        return 1;
+    }
+    plaintext.resize((plaintext.size() + 15) / 16 * 16, 0);
+
+    ifstream cipherFile(cipherPath.c_str(), ios::in | ios::binary);
+    if(!cipherFile.is_open()){
+        cout << "Unable to open file " << cipherPath << endl;
+        return 1;
+    }
+    vector<unsigned char> ciphertext((istreambuf_iterator<char>(cipherFile)), istreambuf_iterator<char>());
+    size_t blocks = min(plaintext.size(), ciphertext.size()) / 16;
+    if(blocks == 0){
+        cout << "Need at least one whole block of plaintext and ciphertext" << endl;
+        return 1;
+    }
+
+    unsigned char keyTemplate[16], mask[16] = { 0 };
+    if(!ReadKeyFile(keyPath, keyTemplate)){
+        cout << "Unable to read the key from " << keyPath << endl;
+        return 1;
+    }
+    if(!maskHex.empty()){
+        if(!ParseHexKey(maskHex, mask)){
+            cout << "Unable to read the mask: -m needs 32 hex digits" << endl;
+            return 1;
+        }
+    } else {
+        if(unknownBits < 1 || unknownBits > 63){
+            cout << "The number of unknown bits must be between 1 and 63" << endl;
+            return 1;
+        }
+        for(int b = 0 ; b < unknownBits ; b++){
+            mask[15 - b / 8] |= (unsigned char) (1 << (b % 8));
+        }
+    }
+
+    KeySearch search(keyTemplate, mask, plaintext.data(), ciphertext.data(), blocks);
+    if(search.unknown() < 1 || search.unknown() > 63){
+        cout << "The mask must leave between 1 and 63 bits unknown" << endl;
+        return 1;
+    }
+    cout << "Known key bits:   " << maskedHex(keyTemplate, mask) << endl;
+    cout << "Unknown bits:     " << search.unknown() << " (" << search.candidates() << " candidates)" << endl;
+    cout << "Blocks to match:  " << blocks << endl;
+    cout << "Engine:           " << (search.multiKey() ? "AES-NI, 8 keys at a time" : "reference KeyExpansion + AESEncrypt")
+         << ", " << numThreads << " thread(s)" << endl;
+
+    double reference = referenceRate(plaintext.data());
+    cout << fixed << setprecision(2);
+    cout << "Reference loop:   " << reference / 1e6 << " Mkeys/s on one thread" << endl << endl;
+
+    KeySearchResult result = search.run(numThreads, [&](unsigned long long tested, double seconds){
+        cout << "  " << setw(6) << setprecision(1) << 100.0 * tested / search.candidates() << "%  "
+             << setprecision(2) << tested / seconds / 1e6 << " Mkeys/s" << endl;
+    });
+
+    cout << endl << "Tested " << result.tested << " keys in " << result.seconds << " s: "
+         << result.keysPerSecond() / 1e6 << " Mkeys/s (" << result.keysPerSecond() / reference << "x the reference loop)" << endl;
+    cout << "First-block matches checked further: " << result.survivors << endl;
+    if(!result.found){
+        cout << "No key found: the known bits, plaintext or ciphertext do not belong together" << endl;
+        return 1;
+    }
+    cout << "Key found:        " << HexEncode(result.key, 16) << endl;
+    return 0;
+}
@@ -0,0 +1,313 @@
+/*
+ * keysearch.h - Known-plaintext search for AES-128 keys with some unknown bits.
+ *
+ * The key is known except for the bits set in a mask (24 to 40 of them in practice).
+ * Every candidate is tried on the first plaintext block; the few that produce the first
+ * ciphertext block are then checked on all blocks, so almost every candidate costs one
+ * block encryption and nothing more.
+ *
+ * Speed comes from the multi-key path (AES-NI and SSSE3):
+ * - 8 candidate keys go through the cipher together, so 8 independent AESENC are in
+ *   flight while each one waits for its latency, as in the bulk functions of aesni.h;
+ * - the key schedule is computed round by round alongside the encryption and never
+ *   stored. SubWord(RotWord(w)) comes from AESENCLAST, which pipelines like AESENC where
+ *   AESKEYGENASSIST would not, and one AESENCLAST serves four keys: their last words
+ *   go into the four columns, pre-shuffled so that its ShiftRows puts them back;
+ * - candidates follow each other by a masked increment, not by rebuilding the key.
+ * Without AES-NI every candidate goes through KeyExpansion and AESEncrypt.
+ *
+ * The candidate space is cut into chunks of SEARCH_CHUNK that the threads take in turn,
+ * so they stay busy to the end and a found key stops all of them within one chunk.
+ */
+
+#ifndef KEYSEARCH_H
+#define KEYSEARCH_H
+
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "aes.h"
+#include "aesni.h"
+#include "backends.h"
+
+#ifdef HAVE_AESNI
+#include <tmmintrin.h>
+#define KEYSEARCH_TARGET __attribute__((target("aes,ssse3")))
+#endif
+
+const unsigned long long SEARCH_CHUNK = 1 << 16;
+const int SEARCH_LANES = 8;
+
+
+struct KeySearchResult {
+    bool found;
+    unsigned char key[16];
+    unsigned long long tested;      // candidates tried
+    unsigned long long survivors;   // candidates that matched the first block
+    double seconds;
+
+    double keysPerSecond() const { return seconds > 0 ? tested / seconds : 0; }
+};
+
+
+// A 128-bit key as two big-endian halves, so the masked increment is plain integer arithmetic
+struct Key128 {
+    unsigned long long high, low;
+};
+
+inline Key128 loadKey128(const unsigned char bytes[16]){
+    Key128 key = { 0, 0 };
+    for(int i = 0 ; i < 8 ; i++){
+        key.high = (key.high << 8) | bytes[i];
+        key.low = (key.low << 8) | bytes[8 + i];
+    }
+    return key;
+}
+
+inline void storeKey128(const Key128 & key, unsigned char bytes[16]){
+    for(int i = 0 ; i < 8 ; i++){
+        bytes[i] = (unsigned char) (key.high >> (56 - 8 * i));
+        bytes[8 + i] = (unsigned char) (key.low >> (56 - 8 * i));
+    }
+}
+
+// The next value inside the mask: add one with the carry skipping the bits outside it
+inline void maskedIncrement(Key128 & value, const Key128 & mask){
+    unsigned long long low = (value.low | ~mask.low) + 1;
+    if(low == 0){
+        value.high = ((value.high | ~mask.high) + 1) & mask.high;
+    }
+    value.low = low & mask.low;
+}
+
+// Spreads the bits of index over the set bits of the mask, lowest first
+inline Key128 depositBits(unsigned long long index, const Key128 & mask){
+    Key128 value = { 0, 0 };
+    for(int half = 0 ; half < 2 ; half++){
+        unsigned long long m = half == 0 ? mask.low : mask.high, out = 0;
+        while(m != 0 && index != 0){
+            unsigned long long bit = m & (0 - m);
+            if(index & 1) out |= bit;
+            index >>= 1;
+            m ^= bit;
+        }
+        if(half == 0) value.low = out;
+        else value.high = out;
+        if(m != 0) break;
+    }
+    return value;
+}
+
+
+#ifdef HAVE_AESNI
+
+// One step of the AES-128 key schedule for four keys: the next round keys from the previous ones
+KEYSEARCH_TARGET inline void nextRoundKeys4(__m128i keys[4], __m128i rcon){
+    // RotWord of word 3 of key c into column c, placed where ShiftRows takes it from
+    const __m128i gather = _mm_setr_epi8(1, 14, 11, 4, 5, 2, 15, 8, 9, 6, 3, 12, 13, 10, 7, 0);
+    __m128i lastWords = _mm_unpackhi_epi64(_mm_unpackhi_epi32(keys[0], keys[1]), _mm_unpackhi_epi32(keys[2], keys[3]));
+    __m128i t = _mm_aesenclast_si128(_mm_shuffle_epi8(lastWords, gather), rcon);
+
+    __m128i key;
+    key = _mm_xor_si128(keys[0], _mm_slli_si128(keys[0], 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 8));
+    keys[0] = _mm_xor_si128(key, _mm_shuffle_epi32(t, 0x00));
+    key = _mm_xor_si128(keys[1], _mm_slli_si128(keys[1], 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 8));
+    keys[1] = _mm_xor_si128(key, _mm_shuffle_epi32(t, 0x55));
+    key = _mm_xor_si128(keys[2], _mm_slli_si128(keys[2], 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 8));
+    keys[2] = _mm_xor_si128(key, _mm_shuffle_epi32(t, 0xaa));
+    key = _mm_xor_si128(keys[3], _mm_slli_si128(keys[3], 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 8));
+    keys[3] = _mm_xor_si128(key, _mm_shuffle_epi32(t, 0xff));
+}
+
+// Encrypts one block under 8 keys at once; the keys are consumed
+KEYSEARCH_TARGET inline void encryptUnder8Keys(__m128i plaintext, __m128i keys[SEARCH_LANES], __m128i out[SEARCH_LANES]){
+    static const unsigned char RCON[10] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+    for(int k = 0 ; k < SEARCH_LANES ; k++){
+        out[k] = _mm_xor_si128(plaintext, keys[k]);
+    }
+    for(int r = 1 ; r <= 10 ; r++){
+        __m128i rcon = _mm_set1_epi32(RCON[r - 1]);
+        for(int k = 0 ; k < SEARCH_LANES ; k += 4){
+            nextRoundKeys4(keys + k, rcon);
+        }
+        if(r < 10){
+            for(int k = 0 ; k < SEARCH_LANES ; k++) out[k] = _mm_aesenc_si128(out[k], keys[k]);
+        } else {
+            for(int k = 0 ; k < SEARCH_LANES ; k++) out[k] = _mm_aesenclast_si128(out[k], keys[k]);
+        }
+    }
+}
+
+#endif /* HAVE_AESNI */
+
+
+class KeySearch {
+public:
+    /*
+        keyTemplate holds the known bits, unknownMask marks the unknown ones (their value
+        in the template does not matter). plaintext and ciphertext are blocks * 16 bytes.
+    */
+    KeySearch(const unsigned char keyTemplate[16], const unsigned char unknownMask[16],
+              const unsigned char * plaintext, const unsigned char * ciphertext, size_t blocks)
+        : plaintext(plaintext, plaintext + 16 * blocks), ciphertext(ciphertext, ciphertext + 16 * blocks),
+          useAESNI(AESNIAvailable() && __builtin_cpu_supports("ssse3")) {
+        mask = loadKey128(unknownMask);
+        base = loadKey128(keyTemplate);
+        base.high &= ~mask.high;
+        base.low &= ~mask.low;
+        unknownBits = __builtin_popcountll(mask.high) + __builtin_popcountll(mask.low);
+    }
+
+    int unknown() const { return unknownBits; }
+    bool multiKey() const { return useAESNI; }
+
+    // Number of candidates; searches are limited to 63 unknown bits
+    unsigned long long candidates() const {
+        return unknownBits >= 63 ? 1ULL << 63 : 1ULL << unknownBits;
+    }
+
+    /*
+        Searches with numThreads threads. progress, if given, is called about once a second
+        on the calling thread with the number of candidates tried so far.
+    */
+    KeySearchResult run(int numThreads, std::function<void(unsigned long long, double)> progress = NULL){
+        if(numThreads < 1) numThreads = 1;
+        nextChunk = 0;
+        tested = 0;
+        survivors = 0;
+        found = false;
+        memset(foundKey, 0, sizeof(foundKey));
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> threads;
+        for(int t = 0 ; t < numThreads ; t++){
+            threads.push_back(std::thread(&KeySearch::worker, this));
+        }
+        unsigned long long total = candidates();
+        double lastReport = 0;
+        while(progress && !found && tested.load() < total){
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if(seconds - lastReport >= 1){
+                progress(tested.load(), seconds);
+                lastReport = seconds;
+            }
+        }
+        for(size_t t = 0 ; t < threads.size() ; t++){
+            threads[t].join();
+        }
+
+        KeySearchResult result;
+        result.found = found;
+        memcpy(result.key, foundKey, 16);
+        result.tested = tested;
+        result.survivors = survivors;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return result;
+    }
+
+    // Whether a key encrypts every plaintext block to its ciphertext block
+    bool verify(const unsigned char key[16]) const {
+        unsigned char expandedKey[176];
+        KeyExpansion(const_cast<unsigned char*>(key), expandedKey);
+        std::vector<unsigned char> out(plaintext.size());
+        BestBackend().encryptBlocks(&plaintext[0], plaintext.size(), expandedKey, &out[0]);
+        return memcmp(&out[0], &ciphertext[0], out.size()) == 0;
+    }
+
+private:
+    std::vector<unsigned char> plaintext, ciphertext;
+    Key128 mask, base;
+    int unknownBits;
+    bool useAESNI;
+
+    std::atomic<unsigned long long> nextChunk, tested, survivors;
+    std::atomic<bool> found;
+    std::mutex foundLock;
+    unsigned char foundKey[16];
+
+    // A first-block match; the rest of the blocks decide
+    void checkSurvivor(const Key128 & candidate){
+        survivors++;
+        unsigned char key[16];
+        storeKey128(candidate, key);
+        if(verify(key)){
+            std::lock_guard<std::mutex> lock(foundLock);
+            if(!found){
+                memcpy(foundKey, key, 16);
+                found = true;
+            }
+        }
+    }
+
+    void worker(){
+        unsigned long long total = candidates();
+        while(!found){
+            unsigned long long first = nextChunk.fetch_add(SEARCH_CHUNK);
+            if(first >= total) break;
+            unsigned long long count = total - first < SEARCH_CHUNK ? total - first : SEARCH_CHUNK;
+            Key128 value = depositBits(first, mask);
+            if(useAESNI) searchMultiKey(value, count);
+            else searchReference(value, count);
+            tested += count;
+        }
+    }
+
+    // count candidates from value on, one KeyExpansion and AESEncrypt each
+    void searchReference(Key128 value, unsigned long long count){
+        unsigned char key[16], expandedKey[176], out[16];
+        for(unsigned long long i = 0 ; i < count ; i++){
+            Key128 candidate = { base.high | value.high, base.low | value.low };
+            storeKey128(candidate, key);
+            KeyExpansion(key, expandedKey);
+            AESEncrypt(&plaintext[0], expandedKey, out);
+            if(memcmp(out, &ciphertext[0], 16) == 0){
+                checkSurvivor(candidate);
+            }
+            maskedIncrement(value, mask);
+        }
+    }
+
+#ifdef HAVE_AESNI
+    KEYSEARCH_TARGET void searchMultiKey(Key128 value, unsigned long long count){
+        const __m128i block = _mm_loadu_si128((const __m128i *) &plaintext[0]);
+        const __m128i target = _mm_loadu_si128((const __m128i *) &ciphertext[0]);
+        Key128 lane[SEARCH_LANES];
+        __m128i keys[SEARCH_LANES], out[SEARCH_LANES];
+        for(unsigned long long i = 0 ; i < count ; i += SEARCH_LANES){
+            for(int k = 0 ; k < SEARCH_LANES ; k++){
+                lane[k].high = base.high | value.high;
+                lane[k].low = base.low | value.low;
+                // the key bytes in memory order: the big-endian halves byte-swapped
+                keys[k] = _mm_set_epi64x((long long) __builtin_bswap64(lane[k].low), (long long) __builtin_bswap64(lane[k].high));
+                maskedIncrement(value, mask);
+            }
+            encryptUnder8Keys(block, keys, out);
+            int lanes = count - i < (unsigned long long) SEARCH_LANES ? (int) (count - i) : SEARCH_LANES;
+            for(int k = 0 ; k < lanes ; k++){
+                if(_mm_movemask_epi8(_mm_cmpeq_epi8(out[k], target)) == 0xffff){
+                    checkSurvivor(lane[k]);
+                }
+            }
+        }
+    }
+#else
+    void searchMultiKey(Key128 value, unsigned long long count){
+        searchReference(value, count);
+    }
+#endif
+
+    KeySearch(const KeySearch &);
+    KeySearch &operator=(const KeySearch &);
+};
+
+#endif /* KEYSEARCH_H */
@@ -0,0 +1,127 @@
+/*
+ * modes.h - Block cipher modes of operation (NIST SP 800-38A) on top of a backend.
+ *
+ * ECB is the backend itself. CBC encryption is serial by definition; CBC decryption
+ * and CTR hand the backend many blocks at once so the multi-block engines stay busy.
+ * All functions accept in == out.
+ */
+
+#ifndef MODES_H
+#define MODES_H
+
+#include <cstddef>
+#include <cstring>
+
+#include "backends.h"
+
+const size_t MODE_CHUNK = 4096;     // bytes handed to the backend per call
+
+
+void xorBytes(unsigned char * out, const unsigned char * a, const unsigned char * b, size_t length){
+    for(size_t i = 0 ; i < length ; i++){
+        out[i] = a[i] ^ b[i];
+    }
+}
+
+// Increments a 128-bit big-endian counter block
+void incrementCounter(unsigned char counter[16]){
+    for(int i = 15 ; i >= 0 ; i--){
+        if(++counter[i] != 0){
+            break;
+        }
+    }
+}
+
+// Adds n to a 128-bit big-endian counter block
+void addCounter(unsigned char counter[16], unsigned long long n){
+    unsigned int carry = 0;
+    for(int i = 15 ; i >= 0 ; i--){
+        unsigned int sum = counter[i] + (unsigned int) (n & 0xff) + carry;
+        counter[i] = (unsigned char) sum;
+        carry = sum >> 8;
+        n >>= 8;
+        if(n == 0 && carry == 0){
+            break;
+        }
+    }
+}
+
+// Writes blocks consecutive counter blocks starting at counter + 1 and leaves counter at the last one.
+// Works on the two 64-bit halves instead of byte by byte, since it runs once per output block.
+void fillCounterBlocks(unsigned char * out, unsigned char counter[16], size_t blocks){
+    unsigned long long high = 0, low = 0;
+    for(int i = 0 ; i < 8 ; i++){
+        high = (high << 8) | counter[i];
+        low = (low << 8) | counter[8 + i];
+    }
+    for(size_t b = 0 ; b < blocks ; b++){
+        if(++low == 0) high++;
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        unsigned long long bigEndian[2] = { __builtin_bswap64(high), __builtin_bswap64(low) };
+        memcpy(out + 16 * b, bigEndian, 16);
+#else
+        for(int i = 0 ; i < 8 ; i++){
+            out[16 * b + i] = (unsigned char) (high >> (56 - 8 * i));
+            out[16 * b + 8 + i] = (unsigned char) (low >> (56 - 8 * i));
+        }
+#endif
+    }
+    for(int i = 0 ; i < 8 ; i++){
+        counter[i] = (unsigned char) (high >> (56 - 8 * i));
+        counter[8 + i] = (unsigned char) (low >> (56 - 8 * i));
+    }
+}
+
+
+/*
+    CBC encryption: each block is XORed with the previous ciphertext block (the IV for the first).
+    length is a multiple of 16. iv is updated to the last ciphertext block, so a message can be
+    encrypted in pieces.
+*/
+void AESEncryptCBC(const CipherBackend &backend, const unsigned char * in, size_t length, const unsigned char * expandedKey,
+                   unsigned char iv[16], unsigned char * out){
+    unsigned char block[16];
+    for(size_t i = 0 ; i < length ; i += 16){
+        xorBytes(block, in + i, iv, 16);
+        backend.encryptBlocks(block, 16, expandedKey, out + i);
+        memcpy(iv, out + i, 16);
+    }
+}
+
+// CBC decryption; iv is updated like in AESEncryptCBC
+void AESDecryptCBC(const CipherBackend &backend, const unsigned char * in, size_t length, const unsigned char * expandedKey,
+                   unsigned char iv[16], unsigned char * out){
+    unsigned char cipherChunk[MODE_CHUNK];
+    for(size_t offset = 0 ; offset < length ; offset += MODE_CHUNK){
+        size_t n = length - offset < MODE_CHUNK ? length - offset : MODE_CHUNK;
+        // keep the ciphertext: with in == out it is overwritten by the plaintext
+        memcpy(cipherChunk, in + offset, n);
+        backend.decryptBlocks(cipherChunk, n, expandedKey, out + offset);
+        xorBytes(out + offset, out + offset, iv, 16);
+        xorBytes(out + offset + 16, out + offset + 16, cipherChunk, n - 16);
+        memcpy(iv, cipherChunk + n - 16, 16);
+    }
+}
+
+
+/*
+    CTR mode: the keystream is the encryption of successive counter blocks (big-endian increment
+    over all 128 bits). Encryption and decryption are the same operation and any length is allowed.
+    counter is advanced past every block used; the unused part of a final partial block is discarded.
+*/
+void AESCryptCTR(const CipherBackend &backend, const unsigned char * in, size_t length, const unsigned char * expandedKey,
+                 unsigned char counter[16], unsigned char * out){
+    unsigned char keystream[MODE_CHUNK];
+    for(size_t offset = 0 ; offset < length ; offset += MODE_CHUNK){
+        size_t n = length - offset < MODE_CHUNK ? length - offset : MODE_CHUNK;
+        size_t blocks = (n + 15) / 16;
+        // the first block is the counter itself, fillCounterBlocks continues from counter + 1
+        memcpy(keystream, counter, 16);
+        fillCounterBlocks(keystream + 16, counter, blocks - 1);
+        incrementCounter(counter);
+        backend.encryptBlocks(keystream, blocks * 16, expandedKey, keystream);
+        xorBytes(out + offset, in + offset, keystream, n);
+    }
+}
+
+#endif /* MODES_H */
@@ -0,0 +1,148 @@
+/*
+ * perfcounters.h - Hardware performance counters for profiling the round functions.
+ *
+ * Opens one counter group with perf_event_open (Linux): cycles, instructions,
+ * L1D read misses and branch misses, counting user space of the calling thread.
+ * The group is read with a single read() call, so reading all four counters costs
+ * one system call; callers amortize it by reading around batches of work.
+ *
+ * When the PMU has fewer counters than the group needs, the kernel time-slices
+ * (multiplexes) the group and it only counts part of the time. Every reading
+ * carries time_enabled and time_running; perfDelta() scales the counts up by
+ * their ratio and perfMultiplexed() tells the caller the figures are estimates.
+ *
+ * On other systems, or when the kernel refuses access (see
+ * /proc/sys/kernel/perf_event_paranoid), available() returns false and every
+ * reading is zero.
+ */
+
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <cstring>
+
+enum PerfCounter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_BRANCH_MISSES,
+    NUM_PERF_COUNTERS
+};
+
+const char * const perfCounterNames[NUM_PERF_COUNTERS] = { "cycles", "instructions", "L1D misses", "branch misses" };
+
+struct PerfReading {
+    unsigned long long values[NUM_PERF_COUNTERS];
+    unsigned long long timeEnabled;     // ns the group was enabled
+    unsigned long long timeRunning;     // ns it was actually on the PMU
+};
+
+
+class PerfCounters {
+public:
+    PerfCounters() : opened(0) {
+        for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+            fds[i] = -1;
+        }
+#ifdef __linux__
+        unsigned int types[NUM_PERF_COUNTERS] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE };
+        unsigned long long configs[NUM_PERF_COUNTERS] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_HW_BRANCH_MISSES
+        };
+
+        for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = types[i];
+            attr.config = configs[i];
+            attr.disabled = (i == 0);          // the leader starts the whole group
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            int groupFd = (i == 0) ? -1 : fds[0];
+            fds[i] = (int) syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+            if (fds[i] < 0) {
+                // a counter this CPU does not have is left out; without the leader nothing works
+                if (i == 0) return;
+                continue;
+            }
+            slot[i] = opened++;
+        }
+        ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    ~PerfCounters() {
+#ifdef __linux__
+        for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+            if (fds[i] >= 0) close(fds[i]);
+        }
+#endif
+    }
+
+    bool available() const { return opened > 0; }
+    bool hasCounter(PerfCounter counter) const { return fds[counter] >= 0; }
+
+    // Current values of every counter (zero for counters that could not be opened)
+    PerfReading read() const {
+        PerfReading reading;
+        memset(&reading, 0, sizeof(reading));
+#ifdef __linux__
+        if (opened > 0) {
+            // layout: nr, time_enabled, time_running, one value per opened counter
+            unsigned long long buffer[3 + NUM_PERF_COUNTERS];
+            if (::read(fds[0], buffer, sizeof(buffer)) > 0) {
+                reading.timeEnabled = buffer[1];
+                reading.timeRunning = buffer[2];
+                for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+                    if (fds[i] >= 0) reading.values[i] = buffer[3 + slot[i]];
+                }
+            }
+        }
+#endif
+        return reading;
+    }
+
+private:
+    int fds[NUM_PERF_COUNTERS];
+    int slot[NUM_PERF_COUNTERS];    // position of each counter in the group read
+    int opened;
+
+    PerfCounters(const PerfCounters &);
+    PerfCounters &operator=(const PerfCounters &);
+};
+
+
+// Counts between two readings, scaled to the whole interval if the group was multiplexed
+inline PerfReading perfDelta(const PerfReading &end, const PerfReading &start) {
+    PerfReading delta;
+    delta.timeEnabled = end.timeEnabled - start.timeEnabled;
+    delta.timeRunning = end.timeRunning - start.timeRunning;
+    double scale = 1.0;
+    if (delta.timeRunning > 0 && delta.timeRunning < delta.timeEnabled) {
+        scale = (double) delta.timeEnabled / delta.timeRunning;
+    }
+    for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+        delta.values[i] = (unsigned long long) ((end.values[i] - start.values[i]) * scale);
+    }
+    return delta;
+}
+
+// True if the group was off the PMU for part of the interval, so the counts are extrapolated
+inline bool perfMultiplexed(const PerfReading &delta) {
+    return delta.timeRunning < delta.timeEnabled;
+}
+
+#endif /* PERFCOUNTERS_H */
@@ -0,0 +1,586 @@
+/*
+ * pipeio.h - Streaming stdin to stdout encryption for shell pipelines.
+ *
+ * Stream format: a 16-byte random initial counter, then the data in AES-128 CTR mode
+ * (modes.h). The output is exactly 16 bytes longer than the input, any length works and
+ * nothing has to be held in memory beyond one buffer.
+ *
+ * Plumbing:
+ * - Data moves in PIPE_BUFFER (4 MB) reads and writes, never byte by byte.
+ * - When stdin or stdout is a pipe it is enlarged with F_SETPIPE_SZ (up to the
+ *   system limit in /proc/sys/fs/pipe-max-size), so fewer context switches are needed.
+ * - With useVmsplice, output to a pipe uses vmsplice(), which hands the pages to the pipe
+ *   instead of copying them. The pipe then references our buffer, so the output cycles
+ *   through buffers that are each at least as large as the pipe: once one buffer has been
+ *   spliced completely, the pipe can no longer hold any page of the previous one.
+ *   This is only safe when the reader copies the data out (read()); a reader that
+ *   splices the pages onwards could see them change, so it is off unless asked for.
+ *
+ * The key schedule and the data buffers of PipeCrypt come from the locked, huge-page
+ * buffer pool (bufferpool.h), so plaintext is not swapped out and is zeroed afterwards.
+ * Buffers handed to vmsplice are the exception: the pipe keeps using their pages.
+ *
+ * Every phase (key load, KeyExpansion, each read, block loop and write) is timed into
+ * the histograms of metrics.h; --metrics <file | unix:socket> exports them.
+ *
+ * With --compress the plaintext is compressed (compress.h) before it is encrypted and
+ * decompressed after decryption, COMPRESS_CHUNK at a time. Inside the CTR stream the
+ * plaintext is then "LZC2" followed by frames of
+ *   uint32 stored length (top bit set when the chunk is compressed), uint32 raw length,
+ *   uint64 frame number, stored bytes, 16-byte tag
+ * and an empty frame marks the end, so a truncated stream is detected. The tag is an
+ * AES-CMAC (cmac.h) over the rest of the frame under a key derived from the stream key;
+ * the frames of a batch are tagged and checked together with AESCMACMany(). A frame is
+ * only written out once its tag and decompression have been checked, so a flipped bit
+ * stops decryption with an error instead of producing wrong output. A batch of chunks
+ * is compressed on all cores while the previous batch is encrypted and written; decryption
+ * does the same the other way round.
+ *
+ * With --nist the ciphertext (the output when encrypting, the input when decrypting; not
+ * the counter) also goes through the streaming randomness tests of randomness.h as it
+ * passes, and their report is printed to stderr at the end. Nothing has to be stored, so
+ * "head -c 1G /dev/zero | encrypt --pipe keyfile --nist > /dev/null" tests 1 GB of
+ * ciphertext. The tests are timed as the "randomness" phase.
+ */
+
+#ifndef PIPEIO_H
+#define PIPEIO_H
+
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <future>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include "modes.h"
+#include "bufferpool.h"
+#include "drbg.h"
+#include "hexcodec.h"
+#include "aesstream.h"
+#include "compress.h"
+#include "cmac.h"
+#include "metrics.h"
+#include "randomness.h"
+
+const size_t PIPE_BUFFER = 1 << 22;
+
+
+#ifdef __linux__
+
+bool isPipe(int fd){
+    struct stat info;
+    return fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode);
+}
+
+// Grows a pipe to the system maximum; returns the resulting size (0 if fd is not a pipe)
+size_t enlargePipe(int fd){
+    if(!isPipe(fd)){
+        return 0;
+    }
+    int size = 1 << 20;
+    std::ifstream limit("/proc/sys/fs/pipe-max-size");
+    limit >> size;
+    while(size >= 4096 && fcntl(fd, F_SETPIPE_SZ, size) < 0){
+        size /= 2;
+    }
+    int result = fcntl(fd, F_GETPIPE_SZ);
+    return result > 0 ? (size_t) result : 0;
+}
+
+// Reads until length bytes or end of input; got is the number read. false on a read error.
+bool readFull(int fd, unsigned char * buffer, size_t length, size_t & got){
+    got = 0;
+    while(got < length){
+        ssize_t n = read(fd, buffer + got, length - got);
+        if(n == 0) break;
+        if(n < 0){
+            if(errno == EINTR) continue;
+            return false;
+        }
+        got += (size_t) n;
+    }
+    return true;
+}
+
+bool writeAll(int fd, const unsigned char * buffer, size_t length){
+    while(length > 0){
+        ssize_t n = write(fd, buffer, length);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            return false;
+        }
+        buffer += n;
+        length -= (size_t) n;
+    }
+    return true;
+}
+
+bool vmspliceAll(int fd, const unsigned char * buffer, size_t length){
+    while(length > 0){
+        struct iovec io = { const_cast<unsigned char*>(buffer), length };
+        ssize_t n = vmsplice(fd, &io, 1, 0);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            return false;
+        }
+        buffer += n;
+        length -= (size_t) n;
+    }
+    return true;
+}
+
+
+/*
+    Output side of the filter. Callers fill buffer() and call emit(); with vmsplice the
+    next buffer() is a different one, as described at the top of the file.
+*/
+class PipeOutput {
+public:
+    PipeOutput(int fd, bool useVmsplice) : fd(fd), current(0) {
+        size_t pipeSize = enlargePipe(fd);
+        splicing = useVmsplice && pipeSize > 0;
+        size_t size = PIPE_BUFFER;
+        if(splicing && size < pipeSize) size = pipeSize;
+        // spliced pages stay referenced by the pipe after we return, so they must not go
+        // back to the pool, where they would be zeroed and reused under the reader
+        if(splicing) spliced.resize(2, std::vector<unsigned char>(size));
+        else pooled = PooledBuffer(size);
+    }
+
+    unsigned char * buffer() { return splicing ? &spliced[current][0] : pooled.data(); }
+    size_t capacity() const { return splicing ? spliced[current].size() : pooled.size(); }
+    bool usesVmsplice() const { return splicing; }
+
+    bool emit(size_t length){
+        bool ok = splicing ? vmspliceAll(fd, buffer(), length) : writeAll(fd, buffer(), length);
+        if(splicing) current = (current + 1) % spliced.size();
+        return ok;
+    }
+
+private:
+    int fd;
+    bool splicing;
+    size_t current;
+    PooledBuffer pooled;
+    std::vector< std::vector<unsigned char> > spliced;
+};
+
+
+// Feeds ciphertext to the randomness tests, if there are any
+inline void testRandomness(RandomnessTests * randomness, const unsigned char * data, size_t length){
+    if(!randomness) return;
+    PhaseTimer timer(PHASE_RANDOMNESS, length);
+    randomness->update(data, length);
+}
+
+/*
+    Encrypts (or decrypts) everything on inFd to outFd. Encryption writes a fresh random
+    counter first; decryption reads it back. Errors are described in error.
+    The ciphertext goes through randomness when it is given.
+*/
+bool PipeCrypt(int inFd, int outFd, const unsigned char key[16], bool encrypt, bool useVmsplice, std::string & error,
+               RandomnessTests * randomness = NULL){
+    const CipherBackend &backend = BestBackend();
+    PooledBuffer keySchedule(176);
+    unsigned char *expandedKey = keySchedule.data();
+    {
+        PhaseTimer timer(PHASE_KEY_EXPANSION);
+        KeyExpansion(const_cast<unsigned char*>(key), expandedKey);
+    }
+
+    enlargePipe(inFd);
+    PipeOutput output(outFd, useVmsplice);
+
+    unsigned char counter[16];
+    size_t got;
+    if(encrypt){
+        ThreadDrbg().generate(counter, 16);
+        if(!writeAll(outFd, counter, 16)){
+            error = "unable to write output";
+            return false;
+        }
+    } else {
+        if(!readFull(inFd, counter, 16, got) || got != 16){
+            error = "input is too short to hold the 16-byte counter";
+            return false;
+        }
+    }
+
+    // one output buffer per read, so every vmsplice hands over a whole buffer
+    PooledBuffer input(output.capacity());
+    while(true){
+        size_t length = input.size();
+        bool ok;
+        {
+            PhaseTimer timer(PHASE_READ);
+            ok = readFull(inFd, input.data(), length, got);
+            timer.setBytes(got);
+        }
+        if(!ok){
+            error = std::string("unable to read input: ") + strerror(errno);
+            return false;
+        }
+        if(got == 0) break;
+        if(!encrypt) testRandomness(randomness, input.data(), got);
+        {
+            PhaseTimer timer(PHASE_BLOCKS, got);
+            AESCryptCTR(backend, input.data(), got, expandedKey, counter, output.buffer());
+        }
+        // before emit(): a spliced buffer belongs to the pipe afterwards
+        if(encrypt) testRandomness(randomness, output.buffer(), got);
+        {
+            PhaseTimer timer(PHASE_WRITE, got);
+            ok = output.emit(got);
+        }
+        if(!ok){
+            error = std::string("unable to write output: ") + strerror(errno);
+            return false;
+        }
+        if(got < length) break;
+    }
+    return true;
+}
+
+const char COMPRESSED_MAGIC[4] = { 'L', 'Z', 'C', '2' };
+const unsigned int FRAME_COMPRESSED = 0x80000000U;
+const size_t FRAME_HEADER = 16;
+const size_t FRAME_TAG = 16;
+
+inline void putFrameHeader(unsigned char * p, unsigned int stored, unsigned int raw, unsigned long long number){
+    for(int i = 0 ; i < 4 ; i++){
+        p[i] = (unsigned char) (stored >> (8 * i));
+        p[4 + i] = (unsigned char) (raw >> (8 * i));
+    }
+    for(int i = 0 ; i < 8 ; i++){
+        p[8 + i] = (unsigned char) (number >> (8 * i));
+    }
+}
+
+inline unsigned int getFrameField(const unsigned char * p){
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+inline unsigned long long getFrameNumber(const unsigned char * p){
+    return getFrameField(p) | ((unsigned long long) getFrameField(p + 4) << 32);
+}
+
+// Frame tag key: the encryption of a fixed block under the stream key
+void FrameTagKey(const unsigned char key[16], unsigned char tagKey[16]){
+    unsigned char label[16] = { 'L', 'Z', 'C', '2', ' ', 'f', 'r', 'a', 'm', 'e', ' ', 't', 'a', 'g', 0, 1 };
+    unsigned char expandedKey[176];
+    KeyExpansion(const_cast<unsigned char*>(key), expandedKey);
+    AESEncrypt(label, expandedKey, tagKey);
+    secureZero(expandedKey, sizeof(expandedKey));
+}
+
+// Tags of a batch of frames; each chunk's packed bytes start with its frame header
+void TagFrames(const CMACKey & tagKey, const std::vector<CompressedChunk> & chunks, std::vector<unsigned char> & tags){
+    std::vector<const unsigned char*> messages(chunks.size());
+    std::vector<size_t> lengths(chunks.size());
+    for(size_t i = 0 ; i < chunks.size() ; i++){
+        messages[i] = chunks[i].packed.data();
+        lengths[i] = chunks[i].packed.size();
+    }
+    tags.resize(FRAME_TAG * chunks.size());
+    AESCMACMany(tagKey, messages.data(), lengths.data(), chunks.size(), tags.data());
+}
+
+// Encrypts and writes plaintext bytes of the compressed stream
+bool writeEncrypted(int fd, CtrKeystream & keystream, const unsigned char * data, size_t length, std::vector<unsigned char> & scratch,
+                    RandomnessTests * randomness){
+    scratch.resize(length);
+    {
+        PhaseTimer timer(PHASE_BLOCKS, length);
+        keystream.crypt(data, length, scratch.data());
+    }
+    testRandomness(randomness, scratch.data(), length);
+    PhaseTimer timer(PHASE_WRITE, length);
+    return writeAll(fd, scratch.data(), length);
+}
+
+// Reads and decrypts exactly length plaintext bytes of the compressed stream
+bool readDecrypted(int fd, CtrKeystream & keystream, unsigned char * data, size_t length, RandomnessTests * randomness){
+    size_t got;
+    {
+        PhaseTimer timer(PHASE_READ, length);
+        if(!readFull(fd, data, length, got) || got != length){
+            return false;
+        }
+    }
+    testRandomness(randomness, data, length);
+    PhaseTimer timer(PHASE_BLOCKS, length);
+    keystream.crypt(data, length, data);
+    return true;
+}
+
+/*
+    Pipe mode with the compression stage. Batches of chunks alternate between two stages:
+    while one batch is compressed (or decompressed) on the worker threads, the main thread
+    encrypts and writes (or reads and decrypts) the neighbouring batch.
+*/
+bool PipeCryptCompressed(int inFd, int outFd, const unsigned char key[16], bool encrypt, std::string & error,
+                         RandomnessTests * randomness = NULL){
+    enlargePipe(inFd);
+    enlargePipe(outFd);
+    int numThreads = (int) std::thread::hardware_concurrency();
+    if(numThreads < 1) numThreads = 1;
+    size_t batchSize = 2 * (size_t) numThreads;
+
+    unsigned char counter[16];
+    CtrKeystream keystream;
+    std::vector<unsigned char> scratch;
+    size_t got;
+    unsigned char tagKeyBytes[16];
+    FrameTagKey(key, tagKeyBytes);
+    CMACKey tagKey(tagKeyBytes);
+    secureZero(tagKeyBytes, sizeof(tagKeyBytes));
+    unsigned long long frameNumber = 0;
+
+    if(encrypt){
+        ThreadDrbg().generate(counter, 16);
+        keystream.init(key, counter);
+        if(!writeAll(outFd, counter, 16) ||
+           !writeEncrypted(outFd, keystream, reinterpret_cast<const unsigned char*>(COMPRESSED_MAGIC), 4, scratch, randomness)){
+            error = "unable to write output";
+            return false;
+        }
+
+        std::vector<CompressedChunk> ready;
+        std::vector<unsigned char> readyTags;
+        bool atEnd = false;
+        while(!atEnd || !ready.empty()){
+            // read the next batch and start compressing it
+            std::vector<CompressedChunk> next;
+            while(!atEnd && next.size() < batchSize){
+                CompressedChunk chunk;
+                chunk.raw.resize(COMPRESS_CHUNK);
+                PhaseTimer timer(PHASE_READ);
+                bool ok = readFull(inFd, chunk.raw.data(), COMPRESS_CHUNK, got);
+                timer.setBytes(got);
+                if(!ok){
+                    error = std::string("unable to read input: ") + strerror(errno);
+                    return false;
+                }
+                chunk.raw.resize(got);
+                if(got < COMPRESS_CHUNK) atEnd = true;
+                if(got > 0) next.push_back(std::move(chunk));
+            }
+            std::vector<unsigned char> nextTags;
+            unsigned long long firstFrame = frameNumber;
+            frameNumber += next.size();
+            std::future<void> compressing = std::async(std::launch::async, [&next, &nextTags, &tagKey, firstFrame, numThreads]{
+                PhaseTimer timer(PHASE_COMPRESS, next.size() * COMPRESS_CHUNK);
+                CompressChunks(next, numThreads);
+                for(size_t i = 0 ; i < next.size() ; i++){
+                    unsigned char header[FRAME_HEADER];
+                    putFrameHeader(header, (unsigned int) next[i].packed.size() | (next[i].compressed ? FRAME_COMPRESSED : 0),
+                                   (unsigned int) next[i].raw.size(), firstFrame + i);
+                    next[i].packed.insert(next[i].packed.begin(), header, header + FRAME_HEADER);
+                }
+                TagFrames(tagKey, next, nextTags);
+            });
+
+            // meanwhile encrypt and write the batch compressed before
+            for(size_t i = 0 ; i < ready.size() ; i++){
+                if(!writeEncrypted(outFd, keystream, ready[i].packed.data(), ready[i].packed.size(), scratch, randomness) ||
+                   !writeEncrypted(outFd, keystream, &readyTags[FRAME_TAG * i], FRAME_TAG, scratch, randomness)){
+                    compressing.wait();
+                    error = std::string("unable to write output: ") + strerror(errno);
+                    return false;
+                }
+            }
+            compressing.wait();
+            ready.swap(next);
+            readyTags.swap(nextTags);
+        }
+
+        unsigned char endFrame[FRAME_HEADER + FRAME_TAG];
+        putFrameHeader(endFrame, 0, 0, frameNumber);
+        AESCMAC(tagKey, endFrame, FRAME_HEADER, endFrame + FRAME_HEADER);
+        if(!writeEncrypted(outFd, keystream, endFrame, sizeof(endFrame), scratch, randomness)){
+            error = "unable to write output";
+            return false;
+        }
+        return true;
+    }
+
+    if(!readFull(inFd, counter, 16, got) || got != 16){
+        error = "input is too short to hold the 16-byte counter";
+        return false;
+    }
+    keystream.init(key, counter);
+    unsigned char magic[4];
+    if(!readDecrypted(inFd, keystream, magic, 4, randomness) || memcmp(magic, COMPRESSED_MAGIC, 4) != 0){
+        error = "not a compressed stream (wrong key, or written without --compress)";
+        return false;
+    }
+
+    std::vector<CompressedChunk> decoded;
+    std::vector<unsigned char> decodedTags, expectedTags;
+    std::future<void> decompressing;
+    bool atEnd = false;
+    while(true){
+        // read and decrypt the next batch of frames
+        std::vector<CompressedChunk> next;
+        std::vector<unsigned char> nextTags;
+        while(!atEnd && next.size() < batchSize){
+            unsigned char header[FRAME_HEADER];
+            if(!readDecrypted(inFd, keystream, header, FRAME_HEADER, randomness)){
+                error = "stream is truncated (no end frame)";
+                return false;
+            }
+            unsigned int stored = getFrameField(header), raw = getFrameField(header + 4);
+            bool compressed = (stored & FRAME_COMPRESSED) != 0;
+            stored &= ~FRAME_COMPRESSED;
+            if(getFrameNumber(header + 8) != frameNumber){
+                error = "frame out of order or corrupt frame header";
+                return false;
+            }
+            if(stored == 0 && raw == 0){
+                unsigned char tag[FRAME_TAG], expected[FRAME_TAG];
+                if(!readDecrypted(inFd, keystream, tag, FRAME_TAG, randomness)){
+                    error = "stream is truncated inside the end frame";
+                    return false;
+                }
+                AESCMAC(tagKey, header, FRAME_HEADER, expected);
+                if(!CMACVerify(expected, tag)){
+                    error = "end frame fails authentication (corrupt or tampered stream)";
+                    return false;
+                }
+                atEnd = true;
+                break;
+            }
+            if(raw > COMPRESS_CHUNK || stored > LZCompressBound(COMPRESS_CHUNK) || (!compressed && stored != raw)){
+                error = "corrupt frame header";
+                return false;
+            }
+            CompressedChunk chunk;
+            chunk.compressed = compressed;
+            chunk.packed.resize(FRAME_HEADER + stored);
+            chunk.raw.resize(raw);
+            memcpy(chunk.packed.data(), header, FRAME_HEADER);
+            nextTags.resize(nextTags.size() + FRAME_TAG);
+            if(!readDecrypted(inFd, keystream, chunk.packed.data() + FRAME_HEADER, stored, randomness) ||
+               !readDecrypted(inFd, keystream, &nextTags[nextTags.size() - FRAME_TAG], FRAME_TAG, randomness)){
+                error = "stream is truncated inside a frame";
+                return false;
+            }
+            next.push_back(std::move(chunk));
+            frameNumber++;
+        }
+
+        // write the batch decompressed meanwhile
+        if(decompressing.valid()){
+            decompressing.wait();
+            for(size_t i = 0 ; i < decoded.size() ; i++){
+                if(!CMACVerify(&expectedTags[FRAME_TAG * i], &decodedTags[FRAME_TAG * i])){
+                    error = "frame fails authentication (corrupt or tampered stream)";
+                    return false;
+                }
+                if(!decoded[i].valid){
+                    error = "corrupt compressed chunk";
+                    return false;
+                }
+                PhaseTimer timer(PHASE_WRITE, decoded[i].raw.size());
+                if(!writeAll(outFd, decoded[i].raw.data(), decoded[i].raw.size())){
+                    error = std::string("unable to write output: ") + strerror(errno);
+                    return false;
+                }
+            }
+        }
+        if(next.empty()){
+            return true;
+        }
+        decoded.swap(next);
+        decodedTags.swap(nextTags);
+        decompressing = std::async(std::launch::async, [&decoded, &expectedTags, &tagKey, numThreads]{
+            PhaseTimer timer(PHASE_COMPRESS, decoded.size() * COMPRESS_CHUNK);
+            TagFrames(tagKey, decoded, expectedTags);
+            for(size_t i = 0 ; i < decoded.size() ; i++){
+                decoded[i].packed.erase(decoded[i].packed.begin(), decoded[i].packed.begin() + FRAME_HEADER);
+            }
+            DecompressChunks(decoded, numThreads);
+        });
+    }
+}
+
+#endif /* __linux__ */
+
+
+// Reads the key from a keyfile (16 hex bytes on the first line)
+bool ReadKeyFile(const std::string & path, unsigned char key[16]){
+    std::ifstream infile(path.c_str(), std::ios::in | std::ios::binary);
+    std::string line;
+    return infile.is_open() && std::getline(infile, line) && ParseHexKey(line, key);
+}
+
+
+/*
+    Entry point of the filter mode shared by the encryption and decryption tools:
+        tool --pipe <keyfile> [--vmsplice] [--compress] [--nist] [--metrics <file | unix:socket>] < input > output
+    stdout carries only data, so messages go to stderr. Returns the exit code; a failed
+    randomness test does not change it, since some tests fail by chance (1% each).
+*/
+int PipeMain(int argc, char *argv[], bool encrypt){
+    unsigned char key[16];
+    bool keyRead;
+    {
+        PhaseTimer timer(PHASE_KEY_LOAD);
+        keyRead = ReadKeyFile(argv[2], key);
+    }
+    if(!keyRead){
+        std::cerr << "Unable to read the key from " << argv[2] << " (16 hex bytes expected)" << std::endl;
+        return 1;
+    }
+    bool useVmsplice = false, compress = false, nist = false;
+    MetricsExporter exporter;
+    for(int i = 3 ; i < argc ; i++){
+        if(strcmp(argv[i], "--vmsplice") == 0) useVmsplice = true;
+        else if(strcmp(argv[i], "--compress") == 0) compress = true;
+        else if(strcmp(argv[i], "--nist") == 0) nist = true;
+        else if(strcmp(argv[i], "--metrics") == 0 && i + 1 < argc){
+            if(!exporter.start(argv[++i])){
+                std::cerr << "Unable to export metrics: " << exporter.error << std::endl;
+                return 1;
+            }
+        }
+        else {
+            std::cerr << "Unknown option " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+#ifdef __linux__
+    std::string error;
+    RandomnessTests *randomness = nist ? new RandomnessTests : NULL;
+    // frames vary in size, so the compressed path always writes with write()
+    bool ok = compress ? PipeCryptCompressed(0, 1, key, encrypt, error, randomness)
+                       : PipeCrypt(0, 1, key, encrypt, useVmsplice, error, randomness);
+    memset(key, 0, sizeof(key));
+    if(randomness){
+        PrintRandomnessReport(std::cerr, randomness->report());
+        delete randomness;
+    }
+    if(!ok){
+        std::cerr << (encrypt ? "Encryption" : "Decryption") << " failed: " << error << std::endl;
+        return 1;
+    }
+    return 0;
+#else
+    (void) useVmsplice;
+    (void) compress;
+    (void) nist;
+    std::cerr << "Pipe mode is only available on Linux" << std::endl;
+    return 1;
+#endif
+}
+
+#endif /* PIPEIO_H */
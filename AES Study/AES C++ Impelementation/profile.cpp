@@ -0,0 +1,298 @@
+/*
+    AES Round Function Profiler
+
+    - Reads hardware counters (cycles, instructions, L1D misses, branch misses) with perf_event_open.
+    - Attributes them to every step of encrypt and decrypt: subBytes, ShiftRows, MixColumns, AddRoundKey,
+      KeyExpansion and the inverse steps InvSubBytes, InvShiftRows, InverseMixColumns.
+    - Each step is run over a batch of states and the counters are read only around the whole batch,
+      so the per-call overhead is a fraction of a cycle. A call-overhead baseline is subtracted.
+    - Prints the cost per call of each step run on its own.
+    - The block breakdown measures the steps in place: a copy of AESEncrypt / AESDecrypt with one
+      kind of step left out is timed, and the difference to the full copy is that step's share.
+      Isolated per-call figures do not add up to a block, because inside the cipher the steps
+      overlap in the out-of-order core. Whatever the in-place figures leave over is reported as
+      unattributed; if they add up to more than the block, the overlap is reported instead.
+    - Counts from a multiplexed counter group are scaled by time enabled / time running and flagged.
+
+    When perf counters are not available only cycles are reported (from the time stamp counter).
+
+    Usage: profile [calls per step]
+    Build: g++ -O2 profile.cpp -o profile.exe
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <random>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+#include "aes.h"
+#include "perfcounters.h"
+
+using namespace std;
+
+
+const int BATCH_STATES = 1024;  // 16 KB of states, stays in L1/L2 next to the tables
+const int BLOCK_REPEATS = 5;    // in-place variants are timed this often, round robin, keeping the fastest
+
+
+// Every step behind the same signature: state is modified in place, expandedKey is the full 176-byte schedule
+typedef void (*StepFunction)(unsigned char * state, unsigned char * expandedKey);
+
+unsigned char scratchExpandedKey[176];
+
+void stepNone(unsigned char *, unsigned char *) {
+    // empty body: measures the loop and indirect call that every step pays
+    __asm__ __volatile__("" ::: "memory");
+}
+void stepSubBytes(unsigned char * state, unsigned char *) { subBytes(state); }
+void stepShiftRows(unsigned char * state, unsigned char *) { ShiftRows(state); }
+void stepMixColumns(unsigned char * state, unsigned char *) { MixColumns(state); }
+void stepAddRoundKey(unsigned char * state, unsigned char * expandedKey) { AddRoundKey(state, expandedKey + 16); }
+void stepKeyExpansion(unsigned char * state, unsigned char *) { KeyExpansion(state, scratchExpandedKey); }
+void stepInvSubBytes(unsigned char * state, unsigned char *) { InvSubBytes(state); }
+void stepInvShiftRows(unsigned char * state, unsigned char *) { InvShiftRows(state); }
+void stepInverseMixColumns(unsigned char * state, unsigned char *) { InverseMixColumns(state); }
+void stepEncryptBlock(unsigned char * state, unsigned char * expandedKey) { AESEncrypt(state, expandedKey, state); }
+void stepDecryptBlock(unsigned char * state, unsigned char * expandedKey) { AESDecrypt(state, expandedKey, state); }
+
+
+// Kinds of step that can be left out of a block; decryption uses the inverse of each
+enum BlockStep { KEEP_ALL, SKIP_SUBBYTES, SKIP_SHIFTROWS, SKIP_MIXCOLUMNS, SKIP_ADDROUNDKEY, NUM_BLOCK_STEPS };
+
+// AESEncrypt with every call of one kind of step removed (KEEP_ALL is the unmodified cipher)
+template<int SKIP>
+void encryptWithout(unsigned char * state, unsigned char * expandedKey) {
+    unsigned char block[16];
+    for (int i = 0; i < 16; i++) block[i] = state[i];
+
+    if (SKIP != SKIP_ADDROUNDKEY) AddRoundKey(block, expandedKey);
+    for (int round = 1; round < 10; round++) {
+        if (SKIP != SKIP_SUBBYTES) subBytes(block);
+        if (SKIP != SKIP_SHIFTROWS) ShiftRows(block);
+        if (SKIP != SKIP_MIXCOLUMNS) MixColumns(block);
+        if (SKIP != SKIP_ADDROUNDKEY) AddRoundKey(block, expandedKey + 16 * round);
+    }
+    if (SKIP != SKIP_SUBBYTES) subBytes(block);
+    if (SKIP != SKIP_SHIFTROWS) ShiftRows(block);
+    if (SKIP != SKIP_ADDROUNDKEY) AddRoundKey(block, expandedKey + 160);
+
+    for (int i = 0; i < 16; i++) state[i] = block[i];
+}
+
+// AESDecrypt with every call of one kind of inverse step removed
+template<int SKIP>
+void decryptWithout(unsigned char * state, unsigned char * expandedKey) {
+    unsigned char block[16];
+    for (int i = 0; i < 16; i++) block[i] = state[i];
+
+    if (SKIP != SKIP_ADDROUNDKEY) AddRoundKey(block, expandedKey + 160);
+    if (SKIP != SKIP_SHIFTROWS) InvShiftRows(block);
+    if (SKIP != SKIP_SUBBYTES) InvSubBytes(block);
+    for (int round = 9; round >= 1; round--) {
+        if (SKIP != SKIP_ADDROUNDKEY) AddRoundKey(block, expandedKey + 16 * round);
+        if (SKIP != SKIP_MIXCOLUMNS) InverseMixColumns(block);
+        if (SKIP != SKIP_SHIFTROWS) InvShiftRows(block);
+        if (SKIP != SKIP_SUBBYTES) InvSubBytes(block);
+    }
+    if (SKIP != SKIP_ADDROUNDKEY) AddRoundKey(block, expandedKey);
+
+    for (int i = 0; i < 16; i++) state[i] = block[i];
+}
+
+
+struct Step {
+    const char *name;
+    StepFunction run;
+    int callsPerEncrypt;    // how often a block encryption calls it
+    int callsPerDecrypt;    // how often a block decryption calls it
+    double perCall[NUM_PERF_COUNTERS];
+};
+
+bool anyMultiplexed = false;
+
+
+inline unsigned long long readCycles() {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/*
+    Runs the step over the batch of states until totalCalls calls have been made and
+    returns the counters per call. Only two counter reads per step.
+*/
+void profileStep(Step &step, PerfCounters &counters, unsigned char * states, unsigned char * expandedKey, long long totalCalls) {
+    long long passes = totalCalls / BATCH_STATES;
+    if (passes < 1) passes = 1;
+
+    // warm up caches and branch predictors
+    for (int i = 0; i < BATCH_STATES; i++) {
+        step.run(states + 16 * i, expandedKey);
+    }
+
+    unsigned long long startCycles = readCycles();
+    PerfReading start = counters.read();
+    for (long long p = 0; p < passes; p++) {
+        for (int i = 0; i < BATCH_STATES; i++) {
+            step.run(states + 16 * i, expandedKey);
+        }
+    }
+    PerfReading delta = perfDelta(counters.read(), start);
+    unsigned long long tscCycles = readCycles() - startCycles;
+    if (counters.available() && perfMultiplexed(delta)) anyMultiplexed = true;
+
+    double calls = (double) passes * BATCH_STATES;
+    for (int c = 0; c < NUM_PERF_COUNTERS; c++) {
+        step.perCall[c] = delta.values[c] / calls;
+    }
+    if (!counters.available()) {
+        step.perCall[PERF_CYCLES] = tscCycles / calls;
+    }
+}
+
+
+int main(int argc, char *argv[]) {
+    cout << "=============================" << endl;
+    cout << " AES Round Function Profiler " << endl;
+    cout << "=============================" << endl;
+
+    long long totalCalls = argc > 1 ? atoll(argv[1]) : (1LL << 22);
+
+    PerfCounters counters;
+    int numShown = NUM_PERF_COUNTERS;
+    if (counters.available()) {
+        cout << "Using perf_event_open counters" << endl;
+    } else {
+        cout << "perf counters unavailable, reporting time stamp counter cycles only" << endl;
+        numShown = 1;
+    }
+
+    // random states and key; the access pattern of the lookup tables is what matters
+    mt19937 rng(2024);
+    unsigned char *states = new unsigned char[16 * BATCH_STATES];
+    for (int i = 0; i < 16 * BATCH_STATES; i++) {
+        states[i] = (unsigned char) rng();
+    }
+    unsigned char key[16], expandedKey[176];
+    for (int i = 0; i < 16; i++) {
+        key[i] = (unsigned char) rng();
+    }
+    KeyExpansion(key, expandedKey);
+
+    Step steps[] = {
+        { "call overhead",     stepNone,              0,  0,  { 0 } },
+        { "subBytes",          stepSubBytes,          10, 0,  { 0 } },
+        { "ShiftRows",         stepShiftRows,         10, 0,  { 0 } },
+        { "MixColumns",        stepMixColumns,        9,  0,  { 0 } },
+        { "AddRoundKey",       stepAddRoundKey,       11, 11, { 0 } },
+        { "InvSubBytes",       stepInvSubBytes,       0,  10, { 0 } },
+        { "InvShiftRows",      stepInvShiftRows,      0,  10, { 0 } },
+        { "InverseMixColumns", stepInverseMixColumns, 0,  9,  { 0 } },
+        { "KeyExpansion",      stepKeyExpansion,      0,  0,  { 0 } },
+        { "AESEncrypt block",  stepEncryptBlock,      0,  0,  { 0 } },
+        { "AESDecrypt block",  stepDecryptBlock,      0,  0,  { 0 } },
+    };
+    const int numSteps = sizeof(steps) / sizeof(steps[0]);
+
+    for (int i = 0; i < numSteps; i++) {
+        profileStep(steps[i], counters, states, expandedKey, totalCalls);
+    }
+
+    // the same cipher with one kind of step left out, for the in-place breakdown
+    Step blockVariants[2][NUM_BLOCK_STEPS] = {
+        {
+            { "full block",   encryptWithout<KEEP_ALL>,         0, 0, { 0 } },
+            { "subBytes",     encryptWithout<SKIP_SUBBYTES>,    0, 0, { 0 } },
+            { "ShiftRows",    encryptWithout<SKIP_SHIFTROWS>,   0, 0, { 0 } },
+            { "MixColumns",   encryptWithout<SKIP_MIXCOLUMNS>,  0, 0, { 0 } },
+            { "AddRoundKey",  encryptWithout<SKIP_ADDROUNDKEY>, 0, 0, { 0 } },
+        },
+        {
+            { "full block",        decryptWithout<KEEP_ALL>,         0, 0, { 0 } },
+            { "InvSubBytes",       decryptWithout<SKIP_SUBBYTES>,    0, 0, { 0 } },
+            { "InvShiftRows",      decryptWithout<SKIP_SHIFTROWS>,   0, 0, { 0 } },
+            { "InverseMixColumns", decryptWithout<SKIP_MIXCOLUMNS>,  0, 0, { 0 } },
+            { "AddRoundKey",       decryptWithout<SKIP_ADDROUNDKEY>, 0, 0, { 0 } },
+        }
+    };
+    int callsPerBlock[NUM_BLOCK_STEPS] = { 0, 10, 10, 9, 11 };
+    // the differences are small next to the block, so one slow run would swamp them
+    for (int direction = 0; direction < 2; direction++) {
+        double fastest[NUM_BLOCK_STEPS][NUM_PERF_COUNTERS];
+        for (int r = 0; r < BLOCK_REPEATS; r++) {
+            for (int k = 0; k < NUM_BLOCK_STEPS; k++) {
+                Step &variant = blockVariants[direction][k];
+                profileStep(variant, counters, states, expandedKey, totalCalls / BLOCK_REPEATS);
+                if (r == 0 || variant.perCall[PERF_CYCLES] < fastest[k][PERF_CYCLES]) {
+                    memcpy(fastest[k], variant.perCall, sizeof(fastest[k]));
+                }
+            }
+        }
+        for (int k = 0; k < NUM_BLOCK_STEPS; k++) {
+            memcpy(blockVariants[direction][k].perCall, fastest[k], sizeof(fastest[k]));
+        }
+    }
+
+    if (anyMultiplexed) {
+        cout << "Warning: the counter group was multiplexed with other events; counts are scaled"
+             << " by time enabled / time running and are estimates" << endl;
+    }
+
+    // subtract the loop and call overhead measured by the empty step
+    for (int i = 1; i < numSteps; i++) {
+        for (int c = 0; c < NUM_PERF_COUNTERS; c++) {
+            steps[i].perCall[c] -= steps[0].perCall[c];
+            if (steps[i].perCall[c] < 0) steps[i].perCall[c] = 0;
+        }
+    }
+
+    cout << endl << "Per call (overhead of " << fixed << setprecision(2) << steps[0].perCall[PERF_CYCLES]
+         << " cycles per call subtracted):" << endl;
+    cout << left << setw(20) << "step" << right;
+    for (int c = 0; c < numShown; c++) {
+        cout << setw(15) << perfCounterNames[c];
+    }
+    cout << endl;
+    for (int i = 1; i < numSteps; i++) {
+        cout << left << setw(20) << steps[i].name << right;
+        for (int c = 0; c < numShown; c++) {
+            cout << setw(15) << steps[i].perCall[c];
+        }
+        cout << endl;
+    }
+
+    // in place: a step costs what leaving it out of the block saves
+    for (int direction = 0; direction < 2; direction++) {
+        const Step *variants = blockVariants[direction];
+        double block = variants[KEEP_ALL].perCall[PERF_CYCLES];
+        cout << endl << (direction == 0 ? "Encrypt" : "Decrypt") << " block breakdown, measured in place (cycles):" << endl;
+
+        double sum = 0;
+        for (int k = 1; k < NUM_BLOCK_STEPS; k++) {
+            double cycles = block - variants[k].perCall[PERF_CYCLES];
+            if (cycles < 0) cycles = 0;     // within noise of nothing
+            sum += cycles;
+            cout << "  " << left << setw(20) << variants[k].name << right << setw(3) << callsPerBlock[k] << " x"
+                 << setw(10) << cycles << setw(8) << (block > 0 ? 100.0 * cycles / block : 0.0) << " %" << endl;
+        }
+        double rest = block - sum;
+        if (rest < 0) rest = 0;
+        cout << "  " << left << setw(25) << "unattributed" << right << setw(10) << rest
+             << setw(8) << (block > 0 ? 100.0 * rest / block : 0.0) << " %" << endl;
+        if (sum > block) {
+            cout << "  (the steps overlap by " << sum - block << " cycles: leaving any one out saves more"
+                 << " than its share of the block)" << endl;
+        }
+        cout << "  " << left << setw(25) << "measured block" << right << setw(10) << block
+             << "  (" << block / 16 << " cycles/byte)" << endl;
+    }
+
+    delete[] states;
+    return 0;
+}
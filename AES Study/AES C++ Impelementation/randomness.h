@@ -0,0 +1,656 @@
+/*
+ * randomness.h - Streaming NIST SP 800-22 style randomness tests over a byte stream.
+ *
+ *     RandomnessTests tests;
+ *     tests.update(ciphertext, length);        // as often as needed, any lengths
+ *     PrintRandomnessReport(std::cerr, tests.report());
+ *
+ * Tests: frequency (monobit), block frequency, runs, longest run of ones in a block,
+ * serial, approximate entropy and cumulative sums (forward and backward). Bits are taken
+ * most significant first from each byte, as the SP 800-22 reference tool reads files.
+ *
+ * Every test is reduced to statistics that can be accumulated in one pass, so nothing is
+ * stored and the stream can be any length:
+ * - Each 8-byte word is loaded big-endian and gives the ones (monobit, block frequency)
+ *   and the bit transitions (runs) with two popcounts.
+ * - A 256-entry table per byte value gives the byte's longest run of ones and its leading
+ *   and trailing ones (longest run), and its ±1 sum with the highest and lowest prefix
+ *   sum inside it (cumulative sums).
+ * - A 65536-entry histogram of consecutive byte pairs holds every overlapping window of up
+ *   to RANDOMNESS_MAX_PATTERN (9) bits: a window starting at bit k of a byte ends in the
+ *   next one. The serial and approximate entropy counts are derived from it once, in
+ *   report(), so a byte costs one increment instead of eight. It is also why those two
+ *   tests use patterns of at most 9 bits, where the SP 800-22 examples go up to 16.
+ *
+ * report() can be called at any time; the windows wrap around the end as SP 800-22
+ * prescribes. Serial and approximate entropy are marked not applicable until the stream
+ * is long enough for their pattern length (m < floor(log2 n) - 2 and - 5: with the
+ * default m, 512 and 2048 bytes).
+ *
+ * referenceRandomnessStatistics() computes the same statistics one bit at a time, from
+ * the definitions, for any bit length: validate.cpp checks both against each other and
+ * against the worked examples of SP 800-22.
+ */
+
+#ifndef RANDOMNESS_H
+#define RANDOMNESS_H
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <ostream>
+#include <iomanip>
+
+const int RANDOMNESS_MAX_PATTERN = 9;
+const double RANDOMNESS_ALPHA = 0.01;       // a P-value below this is a failure
+
+
+struct RandomnessParams {
+    unsigned long long blockFrequencyBits = 8192;   // M; the stream rounds it down to a multiple of 64
+    int longestRunBlock = 10000;                    // M: 8, 128 or 10000 (SP 800-22 2.4.2)
+    int serialLength = 9;                           // m, 2..9
+    int entropyLength = 8;                          // m, 1..8
+};
+
+enum RandomnessResult {
+    RT_MONOBIT,
+    RT_BLOCK_FREQUENCY,
+    RT_RUNS,
+    RT_LONGEST_RUN,
+    RT_SERIAL_1,
+    RT_SERIAL_2,
+    RT_APPROXIMATE_ENTROPY,
+    RT_CUSUM_FORWARD,
+    RT_CUSUM_BACKWARD,
+    NUM_RANDOMNESS_RESULTS
+};
+
+const char * const RANDOMNESS_NAMES[NUM_RANDOMNESS_RESULTS] = {
+    "Frequency (monobit)", "Block frequency", "Runs", "Longest run of ones", "Serial (P1)", "Serial (P2)",
+    "Approximate entropy", "Cumulative sums (fwd)", "Cumulative sums (bwd)" };
+
+struct RandomnessReport {
+    unsigned long long bits;
+    double p[NUM_RANDOMNESS_RESULTS];
+    bool applicable[NUM_RANDOMNESS_RESULTS];    // false: too little data for the test
+};
+
+
+// What the tests need from a sequence of n bits
+struct RandomnessStatistics {
+    unsigned long long bits, ones;
+    unsigned long long runs;                    // V_n: transitions + 1
+    unsigned long long blocks;                  // block frequency: complete blocks and
+    unsigned long long blockDeviation;          // the sum of (2 * ones - M)^2 over them
+    unsigned long long longestRunBlocks, longestRunClasses[7];
+    long long sum, maxSum, minSum;              // S_n and the extremes of S_0..S_n
+    std::vector<unsigned long long> patterns[RANDOMNESS_MAX_PATTERN + 1];  // cyclic window counts by length
+
+    RandomnessStatistics() : bits(0), ones(0), runs(0), blocks(0), blockDeviation(0), longestRunBlocks(0),
+                             sum(0), maxSum(0), minSum(0){
+        memset(longestRunClasses, 0, sizeof(longestRunClasses));
+        for(int l = 1 ; l <= RANDOMNESS_MAX_PATTERN ; l++) patterns[l].assign((size_t) 1 << l, 0);
+    }
+};
+
+
+// --------------------------------------------------------
+// P-values (SP 800-22 section 2 and 3)
+// --------------------------------------------------------
+
+// The regularized upper incomplete gamma function Q(a, x) (igamc of the reference tool)
+inline double incompleteGammaQ(double a, double x){
+    if(x <= 0) return 1.0;
+    double logPrefix = -x + a * log(x) - lgamma(a);
+    if(x < a + 1){
+        // series for P(a, x)
+        double term = 1.0 / a, total = term, ap = a;
+        for(int i = 0 ; i < 100000000 && fabs(term) > fabs(total) * 1e-16 ; i++){
+            ap += 1;
+            term *= x / ap;
+            total += term;
+        }
+        return 1.0 - total * exp(logPrefix);
+    }
+    // continued fraction for Q(a, x), modified Lentz
+    const double tiny = 1e-300;
+    double b = x + 1 - a, c = 1 / tiny, d = 1 / b, h = d;
+    for(int i = 1 ; i < 100000000 ; i++){
+        double an = -i * (i - a);
+        b += 2;
+        d = an * d + b;
+        if(fabs(d) < tiny) d = tiny;
+        c = b + an / c;
+        if(fabs(c) < tiny) c = tiny;
+        d = 1 / d;
+        double delta = d * c;
+        h *= delta;
+        if(fabs(delta - 1) < 1e-16) break;
+    }
+    return exp(logPrefix) * h;
+}
+
+inline double standardNormal(double x){
+    return 0.5 * erfc(-x / sqrt(2.0));
+}
+
+// Longest run classes for M = 8, 128 and 10000 (SP 800-22 2.4.4): runs up to lowest fall in
+// class 0, runs of lowest + classes - 1 and more in the last. The probabilities are exact
+// (from the distribution of the longest run in M fair bits); the M = 10000 ones printed in
+// SP 800-22 are off by up to 0.0016, which fails the test by itself on a gigabyte of blocks.
+struct LongestRunTable {
+    int lowest, classes;
+    const double *probabilities;
+
+    int classOf(int run) const {
+        int c = run - lowest;
+        return c < 0 ? 0 : c >= classes ? classes - 1 : c;
+    }
+};
+
+inline LongestRunTable longestRunTable(int blockBits){
+    static const double p8[] = { 0.21484375, 0.3671875, 0.23046875, 0.1875 };
+    static const double p128[] = { 0.1174035788, 0.2429559593, 0.2493634832, 0.1751770603, 0.1027010713, 0.1123988471 };
+    static const double p10000[] = { 0.0866323111, 0.2082006484, 0.2484185819, 0.1939127867, 0.1214584851, 0.0680110893, 0.0733660975 };
+    if(blockBits == 8) return LongestRunTable{ 1, 4, p8 };
+    if(blockBits == 128) return LongestRunTable{ 4, 6, p128 };
+    return LongestRunTable{ 10, 7, p10000 };
+}
+
+// psi^2_m of the serial test, from the cyclic counts of length m (0 for m = 0)
+inline double serialPsi(const RandomnessStatistics & s, int m){
+    if(m == 0) return 0.0;
+    double expected = (double) s.bits / (1 << m), total = 0;
+    for(size_t i = 0 ; i < s.patterns[m].size() ; i++){
+        double d = s.patterns[m][i] - expected;
+        total += d * d;
+    }
+    return total * (1 << m) / s.bits;
+}
+
+// phi^(m) of the approximate entropy test
+inline double entropyPhi(const RandomnessStatistics & s, int m){
+    if(m == 0) return 0.0;
+    long double total = 0;
+    for(size_t i = 0 ; i < s.patterns[m].size() ; i++){
+        if(s.patterns[m][i] == 0) continue;
+        long double pi = (long double) s.patterns[m][i] / s.bits;
+        total += pi * logl(pi);
+    }
+    return (double) total;
+}
+
+inline double cumulativeSumsP(long long z, unsigned long long bits){
+    if(z == 0) return 1.0;
+    long long n = (long long) bits;
+    double root = sqrt((double) n);
+    double sum1 = 0, sum2 = 0;
+    for(long long k = (-n / z + 1) / 4 ; k <= (n / z - 1) / 4 ; k++){
+        sum1 += standardNormal((4 * k + 1) * z / root) - standardNormal((4 * k - 1) * z / root);
+    }
+    for(long long k = (-n / z - 3) / 4 ; k <= (n / z - 1) / 4 ; k++){
+        sum2 += standardNormal((4 * k + 3) * z / root) - standardNormal((4 * k + 1) * z / root);
+    }
+    return 1.0 - sum1 + sum2;
+}
+
+RandomnessReport EvaluateRandomness(const RandomnessStatistics & s, const RandomnessParams & params){
+    RandomnessReport r;
+    r.bits = s.bits;
+    for(int t = 0 ; t < NUM_RANDOMNESS_RESULTS ; t++){
+        r.p[t] = 0;
+        r.applicable[t] = false;
+    }
+    if(s.bits == 0) return r;
+    double n = (double) s.bits;
+
+    r.p[RT_MONOBIT] = erfc(fabs(2.0 * s.ones - n) / sqrt(2 * n));
+    r.applicable[RT_MONOBIT] = true;
+
+    if(s.blocks > 0){
+        double chi = (double) s.blockDeviation / params.blockFrequencyBits;
+        r.p[RT_BLOCK_FREQUENCY] = incompleteGammaQ(s.blocks / 2.0, chi / 2);
+        r.applicable[RT_BLOCK_FREQUENCY] = true;
+    }
+
+    // the runs test is only meaningful when the frequency is close enough to 1/2; P = 0 otherwise
+    double pi = s.ones / n;
+    r.applicable[RT_RUNS] = true;
+    if(fabs(pi - 0.5) < 2 / sqrt(n)){
+        r.p[RT_RUNS] = erfc(fabs(s.runs - 2 * n * pi * (1 - pi)) / (2 * sqrt(2 * n) * pi * (1 - pi)));
+    }
+
+    if(s.longestRunBlocks > 0){
+        LongestRunTable table = longestRunTable(params.longestRunBlock);
+        double chi = 0;
+        for(int c = 0 ; c < table.classes ; c++){
+            double expected = s.longestRunBlocks * table.probabilities[c];
+            chi += (s.longestRunClasses[c] - expected) * (s.longestRunClasses[c] - expected) / expected;
+        }
+        r.p[RT_LONGEST_RUN] = incompleteGammaQ((table.classes - 1) / 2.0, chi / 2);
+        r.applicable[RT_LONGEST_RUN] = true;
+    }
+
+    // SP 800-22 2.11.7 and 2.12.7: the chi-square approximation needs m < floor(log2 n) - 2
+    // (serial) and m < floor(log2 n) - 5 (approximate entropy); the P-value is still computed
+    // for shorter streams, as in the worked examples, but the test does not count
+    int log2n = 0;
+    while(log2n < 63 && (s.bits >> (log2n + 1)) != 0) log2n++;
+
+    int m = params.serialLength;
+    if(s.bits >= (unsigned long long) m){
+        double psi0 = serialPsi(s, m), psi1 = serialPsi(s, m - 1), psi2 = serialPsi(s, m - 2);
+        r.p[RT_SERIAL_1] = incompleteGammaQ(pow(2.0, m - 2), (psi0 - psi1) / 2);
+        r.p[RT_SERIAL_2] = incompleteGammaQ(pow(2.0, m - 3), (psi0 - 2 * psi1 + psi2) / 2);
+        r.applicable[RT_SERIAL_1] = r.applicable[RT_SERIAL_2] = m < log2n - 2;
+    }
+
+    m = params.entropyLength;
+    if(s.bits > (unsigned long long) m){
+        double apen = entropyPhi(s, m) - entropyPhi(s, m + 1);
+        double chi = 2 * n * (log(2.0) - apen);
+        r.p[RT_APPROXIMATE_ENTROPY] = incompleteGammaQ(pow(2.0, m - 1), chi / 2);
+        r.applicable[RT_APPROXIMATE_ENTROPY] = m < log2n - 5;
+    }
+
+    long long forward = s.maxSum > -s.minSum ? s.maxSum : -s.minSum;
+    long long backward = s.sum - s.minSum > s.maxSum - s.sum ? s.sum - s.minSum : s.maxSum - s.sum;
+    r.p[RT_CUSUM_FORWARD] = cumulativeSumsP(forward, s.bits);
+    r.p[RT_CUSUM_BACKWARD] = cumulativeSumsP(backward, s.bits);
+    r.applicable[RT_CUSUM_FORWARD] = r.applicable[RT_CUSUM_BACKWARD] = true;
+    return r;
+}
+
+
+// --------------------------------------------------------
+// Reference: one bit at a time
+// --------------------------------------------------------
+
+// The statistics of bits[0..n) (one bit per element, 0 or 1), straight from the definitions
+RandomnessStatistics referenceRandomnessStatistics(const std::vector<unsigned char> & bits, const RandomnessParams & params){
+    RandomnessStatistics s;
+    size_t n = bits.size();
+    s.bits = n;
+    for(size_t i = 0 ; i < n ; i++){
+        s.ones += bits[i];
+        if(i == 0 || bits[i] != bits[i - 1]) s.runs++;
+        s.sum += bits[i] ? 1 : -1;
+        if(s.sum > s.maxSum) s.maxSum = s.sum;
+        if(s.sum < s.minSum) s.minSum = s.sum;
+    }
+
+    size_t m = (size_t) params.blockFrequencyBits;
+    for(size_t b = 0 ; m > 0 && (b + 1) * m <= n ; b++){
+        long long ones = 0;
+        for(size_t i = b * m ; i < (b + 1) * m ; i++) ones += bits[i];
+        long long deviation = 2 * ones - (long long) m;
+        s.blocks++;
+        s.blockDeviation += (unsigned long long) (deviation * deviation);
+    }
+
+    m = (size_t) params.longestRunBlock;
+    LongestRunTable table = longestRunTable(params.longestRunBlock);
+    for(size_t b = 0 ; (b + 1) * m <= n ; b++){
+        int longest = 0, run = 0;
+        for(size_t i = b * m ; i < (b + 1) * m ; i++){
+            run = bits[i] ? run + 1 : 0;
+            if(run > longest) longest = run;
+        }
+        s.longestRunClasses[table.classOf(longest)]++;
+        s.longestRunBlocks++;
+    }
+
+    for(int l = 1 ; l <= RANDOMNESS_MAX_PATTERN && n > 0 ; l++){
+        for(size_t i = 0 ; i < n ; i++){
+            size_t pattern = 0;
+            for(int k = 0 ; k < l ; k++) pattern = (pattern << 1) | bits[(i + k) % n];
+            s.patterns[l][pattern]++;
+        }
+    }
+    return s;
+}
+
+
+// --------------------------------------------------------
+// Streaming
+// --------------------------------------------------------
+
+// Per byte value: the longest run of ones and the ones at either end (longest run test),
+// and the +-1 sum with its highest and lowest prefix (cumulative sums)
+struct RandomnessByte {
+    unsigned char inner, leading, trailing;
+    signed char sum, maxPrefix, minPrefix;
+};
+
+struct RandomnessTables {
+    RandomnessByte bytes[256];
+    RandomnessTables(){
+        for(int v = 0 ; v < 256 ; v++){
+            RandomnessByte &b = bytes[v];
+            int run = 0, inner = 0, sum = 0, high = -8, low = 8;
+            for(int k = 7 ; k >= 0 ; k--){
+                int bit = (v >> k) & 1;
+                run = bit ? run + 1 : 0;
+                if(run > inner) inner = run;
+                sum += bit ? 1 : -1;
+                if(sum > high) high = sum;
+                if(sum < low) low = sum;
+            }
+            int leading = 0, trailing = 0;
+            while(leading < 8 && ((v >> (7 - leading)) & 1)) leading++;
+            while(trailing < 8 && ((v >> trailing) & 1)) trailing++;
+            b.inner = (unsigned char) inner;
+            b.leading = (unsigned char) leading;
+            b.trailing = (unsigned char) trailing;
+            b.sum = (signed char) sum;
+            b.maxPrefix = (signed char) high;
+            b.minPrefix = (signed char) low;
+        }
+    }
+};
+
+inline const RandomnessTables & randomnessTables(){
+    static const RandomnessTables tables;
+    return tables;
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_POPCNT_TARGET 1
+#define POPCNT_TARGET __attribute__((target("popcnt")))
+#endif
+
+class RandomnessTests {
+public:
+    explicit RandomnessTests(const RandomnessParams & params = RandomnessParams())
+        : params(params), tables(randomnessTables()), pairs(65536, 0), pairTotals(65536, 0){
+        // the word kernel adds 64 bits at a time to a block
+        this->params.blockFrequencyBits -= this->params.blockFrequencyBits % 64;
+        if(this->params.blockFrequencyBits == 0) this->params.blockFrequencyBits = 64;
+        longestRunBytes = (unsigned long long) params.longestRunBlock / 8;
+        longestRuns = longestRunTable(params.longestRunBlock);
+        longest = longestRuns.lowest;
+#ifdef HAVE_POPCNT_TARGET
+        usePopcnt = __builtin_cpu_supports("popcnt");
+#endif
+    }
+
+    void update(const unsigned char * data, size_t length){
+        // complete a word left over from the last call
+        if(pendingBytes > 0){
+            while(pendingBytes < 8 && length > 0){
+                pending[pendingBytes++] = *data++;
+                length--;
+            }
+            if(pendingBytes < 8) return;
+            words(pending, 1);
+            pendingBytes = 0;
+        }
+        size_t count = length / 8;
+        while(count > 0){
+            // counts for one pair stay below 2^32 within one flush interval
+            size_t n = count < PAIR_FLUSH_WORDS - wordsSinceFlush ? count : PAIR_FLUSH_WORDS - wordsSinceFlush;
+            words(data, n);
+            data += 8 * n;
+            length -= 8 * n;
+            count -= n;
+            wordsSinceFlush += n;
+            if(wordsSinceFlush == PAIR_FLUSH_WORDS) flushPairs();
+        }
+        memcpy(pending, data, length);
+        pendingBytes = length;
+    }
+
+    unsigned long long bytes() const { return stats.bits / 8 + pendingBytes; }
+
+    // The statistics so far, with the windows wrapped around from the last byte to the first
+    RandomnessStatistics statistics() const {
+        RandomnessTests tail(*this);
+        for(size_t i = 0 ; i < pendingBytes ; i++) tail.byte(pending[i]);
+        tail.flushPairs();
+
+        RandomnessStatistics s = tail.stats;
+        if(s.bits == 0) return s;
+        // the first byte was paired with a zero byte that is not there, and the last byte
+        // pairs with the first, so the windows wrap around
+        unsigned long long first = (unsigned long long) tail.firstByte;
+        s.runs = tail.transitions - (first >> 7) + 1;
+        tail.pairTotals[first]--;
+        tail.pairTotals[(tail.previous << 8) | first]++;
+
+        // a pair holds the 9-bit windows starting at each bit of its first byte
+        std::vector<unsigned long long> &windows = s.patterns[RANDOMNESS_MAX_PATTERN];
+        for(size_t pair = 0 ; pair < 65536 ; pair++){
+            unsigned long long count = tail.pairTotals[pair];
+            if(count == 0) continue;
+            for(int k = 0 ; k < 8 ; k++){
+                windows[(pair >> (16 - RANDOMNESS_MAX_PATTERN - k)) & ((1 << RANDOMNESS_MAX_PATTERN) - 1)] += count;
+            }
+        }
+        // cyclic: every shorter window is the prefix of exactly one longer one
+        for(int l = RANDOMNESS_MAX_PATTERN - 1 ; l >= 1 ; l--){
+            for(size_t p = 0 ; p < s.patterns[l].size() ; p++){
+                s.patterns[l][p] = s.patterns[l + 1][2 * p] + s.patterns[l + 1][2 * p + 1];
+            }
+        }
+        return s;
+    }
+
+    RandomnessReport report() const {
+        return EvaluateRandomness(statistics(), params);
+    }
+
+private:
+    static const size_t PAIR_FLUSH_WORDS = (size_t) 1 << 28;   // 2 GB
+
+    RandomnessParams params;
+    const RandomnessTables &tables;
+    RandomnessStatistics stats;
+    unsigned long long transitions = 0;
+    unsigned long long blockBits = 0, blockOnes = 0;
+    unsigned long long longestRunBytes, runBytes = 0;
+    // not unsigned int, so the compiler need not reload them after every pair increment
+    LongestRunTable longestRuns;
+    unsigned long long run = 0, longest;
+    // the byte before the stream counts as zero; statistics() takes it out again
+    unsigned long long previous = 0;
+    long long firstByte = -1;
+    std::vector<unsigned int> pairs;
+    std::vector<unsigned long long> pairTotals;
+    size_t wordsSinceFlush = 0;
+    unsigned char pending[8];
+    size_t pendingBytes = 0;
+    bool usePopcnt = false;
+
+    void flushPairs(){
+        for(size_t i = 0 ; i < 65536 ; i++){
+            pairTotals[i] += pairs[i];
+            pairs[i] = 0;
+        }
+        wordsSinceFlush = 0;
+    }
+
+    // Longest run of ones: one byte, ending the block when it is full
+    inline void runByte(unsigned int v){
+        const RandomnessByte &b = tables.bytes[v];
+        if(v == 0xff){
+            run += 8;
+        } else {
+            unsigned int candidate = run + b.leading > b.inner ? run + b.leading : b.inner;
+            longest = candidate > longest ? candidate : longest;
+            run = b.trailing;
+        }
+        if(++runBytes == longestRunBytes) endRunBlock();
+    }
+
+    // Longest run of ones: a whole word of the current block. Only runs up to the highest
+    // class matter, and a run inside the word is looked for only if it is longer than the
+    // longest so far, which random data rarely has.
+    inline void runWord(unsigned long long x){
+        if(x == ~0ULL){
+            run += 64;
+        } else {
+            unsigned int leading = (unsigned int) __builtin_clzll(~x);
+            if(run + leading > longest) longest = run + leading;
+            run = (unsigned int) __builtin_ctzll(~x);
+            unsigned long long highest = longestRuns.lowest + longestRuns.classes - 1;
+            while(longest < highest && hasRun(x, longest + 1)) longest++;
+        }
+        runBytes += 8;
+        if(runBytes == longestRunBytes) endRunBlock();
+    }
+
+    // Whether x has length consecutive ones: doubling the run length with each shift
+    static inline bool hasRun(unsigned long long x, unsigned int length){
+        unsigned int have = 1;
+        while(2 * have <= length){
+            x &= x << have;
+            have *= 2;
+        }
+        if(length > have) x &= x << (length - have);
+        return x != 0;
+    }
+
+    void endRunBlock(){
+        if(run > longest) longest = run;
+        stats.longestRunClasses[longestRuns.classOf((int) longest)]++;
+        stats.longestRunBlocks++;
+        // shorter runs are all in class 0
+        run = 0;
+        longest = longestRuns.lowest;
+        runBytes = 0;
+    }
+
+    // Cumulative sums: one byte
+    inline void sumByte(unsigned int v){
+        const RandomnessByte &b = tables.bytes[v];
+        if(stats.sum + b.maxPrefix > stats.maxSum) stats.maxSum = stats.sum + b.maxPrefix;
+        if(stats.sum + b.minPrefix < stats.minSum) stats.minSum = stats.sum + b.minPrefix;
+        stats.sum += b.sum;
+    }
+
+    inline void addBlockOnes(unsigned long long ones, unsigned long long bits){
+        blockOnes += ones;
+        blockBits += bits;
+        if(blockBits == params.blockFrequencyBits){
+            long long deviation = 2 * (long long) blockOnes - (long long) blockBits;
+            stats.blockDeviation += (unsigned long long) (deviation * deviation);
+            stats.blocks++;
+            blockOnes = blockBits = 0;
+        }
+    }
+
+    // A byte of the tail, without the word kernel
+    void byte(unsigned int v){
+        if(firstByte < 0) firstByte = (int) v;
+        unsigned int ones = 0;
+        for(int k = 0 ; k < 8 ; k++) ones += (v >> k) & 1;
+        unsigned int inside = (v ^ (v >> 1)) & 0x7f;
+        for(int k = 0 ; k < 7 ; k++) transitions += (inside >> k) & 1;
+        transitions += (previous & 1) ^ (v >> 7);
+        stats.ones += ones;
+        stats.bits += 8;
+        addBlockOnes(ones, 8);
+        pairs[(previous << 8) | v]++;
+        previous = v;
+        runByte(v);
+        sumByte(v);
+    }
+
+    // The word kernel; compiled twice, so that the popcounts become POPCNT where the CPU has it.
+    // The running values are kept in locals: the compiler could not keep members in registers
+    // across the pair increments.
+    __attribute__((always_inline)) inline void wordsBody(const unsigned char * data, size_t count){
+        if(count > 0 && firstByte < 0) firstByte = data[0];
+        unsigned long long ones = 0, changes = 0, last = previous;
+        unsigned long long blockCount = blockOnes, blockSize = blockBits, blockLimit = params.blockFrequencyBits;
+        long long sum = stats.sum, maxSum = stats.maxSum, minSum = stats.minSum;
+        unsigned int *p = &pairs[0];
+        for(size_t w = 0 ; w < count ; w++){
+            unsigned long long x;
+            memcpy(&x, data + 8 * w, 8);
+            x = __builtin_bswap64(x);       // bit 63 is the first bit of the word
+            unsigned long long wordOnes = (unsigned long long) __builtin_popcountll(x);
+            ones += wordOnes;
+            changes += (unsigned long long) __builtin_popcountll((x ^ (x >> 1)) & 0x7fffffffffffffffULL) + ((last & 1) ^ (x >> 63));
+
+            blockCount += wordOnes;
+            blockSize += 64;
+            if(blockSize == blockLimit){
+                long long deviation = 2 * (long long) blockCount - (long long) blockSize;
+                stats.blockDeviation += (unsigned long long) (deviation * deviation);
+                stats.blocks++;
+                blockCount = blockSize = 0;
+            }
+
+            // byte pairs, the first one with the last byte of the previous word
+            p[(last << 8) | (x >> 56)]++;
+            for(int k = 48 ; k >= 0 ; k -= 8) p[(x >> k) & 0xffff]++;
+            last = x & 0xff;
+
+            if(runBytes + 8 <= longestRunBytes) runWord(x);
+            else for(int k = 56 ; k >= 0 ; k -= 8) runByte((unsigned int) (x >> k) & 0xff);
+
+            // a prefix sum inside the word stays within 64 of the sum before it, so the
+            // extremes can only move when the walk is that close to one of them
+            if(sum + 64 > maxSum || sum - 64 < minSum){
+                for(int k = 56 ; k >= 0 ; k -= 8){
+                    const RandomnessByte &b = tables.bytes[(x >> k) & 0xff];
+                    if(sum + b.maxPrefix > maxSum) maxSum = sum + b.maxPrefix;
+                    if(sum + b.minPrefix < minSum) minSum = sum + b.minPrefix;
+                    sum += b.sum;
+                }
+            } else {
+                sum += 2 * (long long) wordOnes - 64;
+            }
+        }
+        stats.ones += ones;
+        stats.bits += 64 * count;
+        transitions += changes;
+        previous = last;
+        blockOnes = blockCount;
+        blockBits = blockSize;
+        stats.sum = sum;
+        stats.maxSum = maxSum;
+        stats.minSum = minSum;
+    }
+
+#ifdef HAVE_POPCNT_TARGET
+    POPCNT_TARGET void wordsPopcnt(const unsigned char * data, size_t count){ wordsBody(data, count); }
+#endif
+    void wordsPortable(const unsigned char * data, size_t count){ wordsBody(data, count); }
+
+    void words(const unsigned char * data, size_t count){
+#ifdef HAVE_POPCNT_TARGET
+        if(usePopcnt){
+            wordsPopcnt(data, count);
+            return;
+        }
+#endif
+        wordsPortable(data, count);
+    }
+};
+
+
+// One line per test: P-value and pass/fail at RANDOMNESS_ALPHA
+void PrintRandomnessReport(std::ostream & out, const RandomnessReport & report){
+    out << "Randomness tests over " << report.bits / 8 << " bytes (" << report.bits << " bits), alpha " << RANDOMNESS_ALPHA << ":" << std::endl;
+    std::ios::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(6);
+    for(int t = 0 ; t < NUM_RANDOMNESS_RESULTS ; t++){
+        out << "  " << std::left << std::setw(24) << RANDOMNESS_NAMES[t] << std::right;
+        if(!report.applicable[t]) out << "       n/a  (too little data)" << std::endl;
+        else out << std::setw(10) << report.p[t] << "  " << (report.p[t] >= RANDOMNESS_ALPHA ? "pass" : "FAIL") << std::endl;
+    }
+    out.flags(flags);
+}
+
+// True when every applicable test passed
+bool RandomnessPassed(const RandomnessReport & report){
+    for(int t = 0 ; t < NUM_RANDOMNESS_RESULTS ; t++){
+        if(report.applicable[t] && report.p[t] < RANDOMNESS_ALPHA) return false;
+    }
+    return true;
+}
+
+#endif /* RANDOMNESS_H */
@@ -0,0 +1,174 @@
+/*
+    AES CTR Keystream Reservoir Demo
+
+    - Simulates a request handler: requests of a fixed size arrive with an idle gap between them.
+    - First encrypts every request on the critical path (AESCryptCTR), then again through a
+      KeystreamReservoir (reservoir.h) whose filler threads precompute keystream in the gaps.
+    - Prints the latency distribution of both runs, the reservoir hit and miss counters,
+      and checks every reservoir ciphertext by decrypting it with AESCryptCTR.
+    - Repeats shorter runs with a zero low watermark and a one-segment high watermark, and
+      fails if the fillers stop refilling there (hit rate under 90 %).
+
+    Usage: reservoir [-n requests] [-s request bytes] [-g gap us] [-t fillers]
+                     [-m high watermark KB] [-l low watermark KB] [-b backend]
+    Build: g++ -O2 -pthread reservoir.cpp -o reservoir.exe
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <random>
+#include "reservoir.h"
+
+using namespace std;
+
+
+typedef chrono::steady_clock Clock;
+
+double microseconds(Clock::time_point start, Clock::time_point end){
+    return chrono::duration<double, micro>(end - start).count();
+}
+
+void printLatencies(const char *name, vector<double> &latencies){
+    sort(latencies.begin(), latencies.end());
+    size_t n = latencies.size();
+    double sum = 0;
+    for(size_t i = 0 ; i < n ; i++) sum += latencies[i];
+    cout << left << setw(14) << name << right << fixed << setprecision(2)
+         << " mean " << setw(9) << sum / n
+         << "  p50 " << setw(9) << latencies[n / 2]
+         << "  p99 " << setw(9) << latencies[n * 99 / 100]
+         << "  max " << setw(9) << latencies[n - 1] << "  us" << endl;
+}
+
+
+// Hit rate of requests run through a reservoir with the given watermarks
+double watermarkHitRate(const unsigned char key[16], const unsigned char counter[16], size_t highBytes, size_t lowBytes,
+                        int numFillers, const CipherBackend & backend, int numRequests, size_t requestBytes, int gapMicroseconds){
+    vector<unsigned char> payload(requestBytes, 0x5a), cipher(requestBytes);
+    KeystreamReservoir reservoir(key, counter, highBytes, lowBytes, numFillers, backend);
+    reservoir.waitUntilFull();
+    for(int r = 0 ; r < numRequests ; r++){
+        this_thread::sleep_for(chrono::microseconds(gapMicroseconds));
+        unsigned char startCounter[16];
+        reservoir.crypt(&payload[0], requestBytes, &cipher[0], startCounter);
+    }
+    return reservoir.stats().hitRate();
+}
+
+
+int main(int argc, char *argv[]){
+    cout << "=============================" << endl;
+    cout << " AES CTR Keystream Reservoir " << endl;
+    cout << "=============================" << endl;
+
+    int numRequests = 10000;
+    size_t requestBytes = 1024;
+    int gapMicroseconds = 50;
+    int numFillers = 1;
+    size_t highKB = 1024, lowKB = 256;
+    const CipherBackend *backend = &BestBackend();
+    for(int i = 1 ; i + 1 < argc ; i += 2){
+        if(strcmp(argv[i], "-n") == 0) numRequests = atoi(argv[i + 1]);
+        else if(strcmp(argv[i], "-s") == 0) requestBytes = strtoul(argv[i + 1], NULL, 10);
+        else if(strcmp(argv[i], "-g") == 0) gapMicroseconds = atoi(argv[i + 1]);
+        else if(strcmp(argv[i], "-t") == 0) numFillers = atoi(argv[i + 1]);
+        else if(strcmp(argv[i], "-m") == 0) highKB = strtoul(argv[i + 1], NULL, 10);
+        else if(strcmp(argv[i], "-l") == 0) lowKB = strtoul(argv[i + 1], NULL, 10);
+        else if(strcmp(argv[i], "-b") == 0){
+            backend = FindBackend(argv[i + 1]);
+            if(backend == NULL){
+                cout << "Backend " << argv[i + 1] << " is not available" << endl;
+                return 1;
+            }
+        }
+    }
+    if(numRequests < 1) numRequests = 1;
+    cout << numRequests << " requests of " << requestBytes << " bytes, " << gapMicroseconds << " us apart, backend "
+         << backend->name << ", " << numFillers << " filler thread(s), watermarks " << lowKB << " / " << highKB << " KB" << endl;
+
+    mt19937 rng(2024);
+    unsigned char key[16], counter[16];
+    for(int i = 0 ; i < 16 ; i++){
+        key[i] = (unsigned char) rng();
+        counter[i] = (unsigned char) rng();
+    }
+    vector<unsigned char> payload(requestBytes), cipher(requestBytes), check(requestBytes);
+    for(size_t i = 0 ; i < requestBytes ; i++){
+        payload[i] = (unsigned char) rng();
+    }
+
+    // critical path: key already expanded, the keystream is computed when the payload arrives
+    unsigned char expandedKey[176];
+    KeyExpansion(key, expandedKey);
+    vector<double> direct(numRequests);
+    unsigned char directCounter[16];
+    memcpy(directCounter, counter, 16);
+    for(int r = 0 ; r < numRequests ; r++){
+        this_thread::sleep_for(chrono::microseconds(gapMicroseconds));
+        Clock::time_point start = Clock::now();
+        AESCryptCTR(*backend, &payload[0], requestBytes, expandedKey, directCounter, &cipher[0]);
+        direct[r] = microseconds(start, Clock::now());
+    }
+
+    // reservoir: the same requests are an XOR against precomputed keystream
+    vector<double> reserved(numRequests);
+    ReservoirStats stats;
+    int failures = 0;
+    {
+        KeystreamReservoir reservoir(key, counter, highKB * 1024, lowKB * 1024, numFillers, *backend);
+        reservoir.waitUntilFull();
+        for(int r = 0 ; r < numRequests ; r++){
+            this_thread::sleep_for(chrono::microseconds(gapMicroseconds));
+            unsigned char startCounter[16];
+            Clock::time_point start = Clock::now();
+            reservoir.crypt(&payload[0], requestBytes, &cipher[0], startCounter);
+            reserved[r] = microseconds(start, Clock::now());
+
+            AESCryptCTR(*backend, &cipher[0], requestBytes, expandedKey, startCounter, &check[0]);
+            if(memcmp(&check[0], &payload[0], requestBytes) != 0) failures++;
+        }
+        stats = reservoir.stats();
+    }
+
+    cout << endl << "Latency per request:" << endl;
+    printLatencies("on demand", direct);
+    printLatencies("reservoir", reserved);
+
+    cout << endl << "Reservoir:" << endl;
+    cout << "  hit rate          " << setprecision(2) << 100.0 * stats.hitRate() << " % of bytes" << endl;
+    cout << "  hit requests      " << stats.hitRequests << endl;
+    cout << "  miss requests     " << stats.missRequests << endl;
+    cout << "  segments filled   " << stats.segmentsFilled << endl;
+    cout << "  segments wasted   " << stats.segmentsDiscarded << endl;
+    cout << "  ready at the end  " << stats.readyBytes / 1024 << " KB" << endl;
+
+    // edge watermarks: the fillers must keep refilling even with nothing to refill below
+    const size_t edgeWatermarks[][2] = { { highKB * 1024, 0 }, { KEYSTREAM_SEGMENT, 0 }, { KEYSTREAM_SEGMENT, KEYSTREAM_SEGMENT } };
+    int lowHitRates = 0;
+    cout << endl << "Edge watermarks:" << endl;
+    for(int w = 0 ; w < 3 ; w++){
+        double rate = watermarkHitRate(key, counter, edgeWatermarks[w][0], edgeWatermarks[w][1], numFillers, *backend,
+                                       min(numRequests, 2000), requestBytes, gapMicroseconds);
+        bool ok = rate >= 0.9;
+        lowHitRates += !ok;
+        cout << "  " << setw(5) << edgeWatermarks[w][1] / 1024 << " / " << setw(5) << edgeWatermarks[w][0] / 1024 << " KB  hit rate "
+             << setw(6) << 100.0 * rate << " %  " << (ok ? "ok" : "FAILED") << endl;
+    }
+
+    if(failures){
+        cout << failures << " requests did not decrypt correctly" << endl;
+        return 1;
+    }
+    cout << "All requests decrypt correctly" << endl;
+    if(lowHitRates){
+        cout << lowHitRates << " watermark settings stopped refilling" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,310 @@
+/*
+ * reservoir.h - Precomputed CTR keystream for latency-critical requests.
+ *
+ * In CTR mode the keystream only depends on the key and the counter, not on the data.
+ * KeystreamReservoir runs background threads that encrypt upcoming counter blocks ahead
+ * of time, so encrypting a request is an XOR against keystream that is already there.
+ *
+ * Requests take consecutive counter ranges: each request uses whole blocks starting at
+ * the next unused counter and gets that starting counter back, which is what the receiver
+ * needs to decrypt (AESCryptCTR with the same key and counter).
+ *
+ * - Memory is bounded: keystream lives in segments from a fixed pool, at most
+ *   highWatermark bytes ready plus one segment per filler thread being computed.
+ * - Refill watermarks: fillers sleep once highWatermark bytes are ready and wake when
+ *   the ready keystream drops to or below lowWatermark (at least one segment, so that a
+ *   zero or tiny low watermark still refills).
+ * - When a request arrives before its keystream is ready (a miss) the missing blocks are
+ *   computed on the caller's thread, so correctness never depends on the fillers.
+ * - Hit and miss counters are kept per byte and per request (stats()).
+ * - On Linux the filler threads run at the lowest priority so they use idle cycles.
+ *   Whether that lowers request latency depends on having idle cores: on a single
+ *   core the fillers compete with the requests and the tail latency was measured
+ *   worse than computing on demand, so check with reservoir.cpp on the target.
+ * - Keystream is wiped as soon as a segment goes back to the free pool, so used or
+ *   discarded keystream does not stay in memory until the segment is refilled.
+ */
+
+#ifndef RESERVOIR_H
+#define RESERVOIR_H
+
+#include <cstring>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "modes.h"
+#include "bufferpool.h"
+
+const size_t KEYSTREAM_SEGMENT = 16384;                     // bytes per segment
+const size_t KEYSTREAM_SEGMENT_BLOCKS = KEYSTREAM_SEGMENT / 16;
+
+
+struct ReservoirStats {
+    unsigned long long hitBytes;            // bytes served from precomputed keystream
+    unsigned long long missBytes;           // bytes whose keystream was computed by the caller
+    unsigned long long hitRequests;         // requests served entirely from the reservoir
+    unsigned long long missRequests;        // requests with at least one missing block
+    unsigned long long segmentsFilled;
+    unsigned long long segmentsDiscarded;   // filled too late, the requests had already passed them
+    unsigned long long readyBytes;          // keystream ready right now
+
+    double hitRate() const {
+        unsigned long long total = hitBytes + missBytes;
+        return total ? (double) hitBytes / total : 0.0;
+    }
+};
+
+
+class KeystreamReservoir {
+public:
+    /*
+        key: 16-byte AES key. counter: first counter block.
+        highWatermark / lowWatermark: bytes of ready keystream to fill up to / to refill at.
+    */
+    KeystreamReservoir(const unsigned char key[16], const unsigned char counter[16], size_t highWatermark, size_t lowWatermark,
+                       int numFillers = 1, const CipherBackend &backend = BestBackend())
+        : backend(backend), nextBlock(0), fillBlock(0), inFlight(0), refilling(true), running(true) {
+        KeyExpansion(const_cast<unsigned char*>(key), expandedKey);
+        memcpy(baseCounter, counter, 16);
+        memset(&counters, 0, sizeof(counters));
+
+        highSegments = highWatermark / KEYSTREAM_SEGMENT;
+        if(highSegments < 1) highSegments = 1;
+        lowSegments = lowWatermark / KEYSTREAM_SEGMENT;
+        if(lowSegments >= highSegments) lowSegments = highSegments - 1;
+        // the segment being read still counts as ready, so refill no later than at one
+        if(lowSegments < 1) lowSegments = 1;
+        if(numFillers < 1) numFillers = 1;
+
+        pool.resize(highSegments + numFillers);
+        for(size_t i = 0 ; i < pool.size() ; i++){
+            pool[i].users = 0;
+            pool[i].retired = false;
+            freeSegments.push_back(&pool[i]);
+        }
+        for(int i = 0 ; i < numFillers ; i++){
+            fillers.push_back(std::thread(&KeystreamReservoir::fill, this));
+        }
+    }
+
+    ~KeystreamReservoir(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        refill.notify_all();
+        for(size_t i = 0 ; i < fillers.size() ; i++){
+            fillers[i].join();
+        }
+        secureZero(expandedKey, sizeof(expandedKey));
+        for(size_t i = 0 ; i < pool.size() ; i++){
+            secureZero(pool[i].bytes, KEYSTREAM_SEGMENT);
+        }
+    }
+
+    /*
+        Encrypts (or decrypts) length bytes with the next unused counter blocks.
+        The first counter block used is written to startCounter.
+        Safe to call from several threads; each call gets its own counter range.
+    */
+    void crypt(const unsigned char * in, size_t length, unsigned char * out, unsigned char startCounter[16]){
+        unsigned long long blocks = (length + 15) / 16;
+        std::vector<Piece> pieces;
+        unsigned long long first;
+
+        // claim the counter range and the segments that already cover it
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            first = nextBlock;
+            nextBlock += blocks;
+
+            unsigned long long block = first;
+            while(block < nextBlock){
+                unsigned long long segmentStart = block - block % KEYSTREAM_SEGMENT_BLOCKS;
+                unsigned long long segmentEnd = segmentStart + KEYSTREAM_SEGMENT_BLOCKS;
+                unsigned long long end = segmentEnd < nextBlock ? segmentEnd : nextBlock;
+                Piece piece = { block, end, NULL };
+                std::map<unsigned long long, Segment*>::iterator it = ready.find(segmentStart);
+                if(it != ready.end()){
+                    piece.segment = it->second;
+                    piece.segment->users++;
+                }
+                pieces.push_back(piece);
+                block = end;
+            }
+            retirePassedSegments();
+        }
+        blockCounter(first, startCounter);
+
+        // XOR outside the lock; blocks without ready keystream are computed here
+        bool missed = false;
+        unsigned long long hit = 0, miss = 0;
+        size_t done = 0;
+        for(size_t p = 0 ; p < pieces.size() ; p++){
+            size_t bytes = (size_t) (pieces[p].end - pieces[p].first) * 16;
+            if(bytes > length - done) bytes = length - done;
+            if(pieces[p].segment){
+                const unsigned char *keystream = pieces[p].segment->bytes + (pieces[p].first % KEYSTREAM_SEGMENT_BLOCKS) * 16;
+                xorBytes(out + done, in + done, keystream, bytes);
+                hit += bytes;
+            } else {
+                unsigned char counter[16];
+                blockCounter(pieces[p].first, counter);
+                AESCryptCTR(backend, in + done, bytes, expandedKey, counter, out + done);
+                miss += bytes;
+                missed = true;
+            }
+            done += bytes;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for(size_t p = 0 ; p < pieces.size() ; p++){
+                Segment *segment = pieces[p].segment;
+                if(segment && --segment->users == 0 && segment->retired){
+                    release(segment);
+                }
+            }
+            counters.hitBytes += hit;
+            counters.missBytes += miss;
+            if(missed) counters.missRequests++;
+            else counters.hitRequests++;
+
+            if(!refilling && ready.size() <= lowSegments){
+                refilling = true;
+                refill.notify_all();
+            }
+        }
+    }
+
+    ReservoirStats stats(){
+        std::lock_guard<std::mutex> lock(mutex);
+        ReservoirStats result = counters;
+        result.readyBytes = 0;
+        for(std::map<unsigned long long, Segment*>::iterator it = ready.begin() ; it != ready.end() ; ++it){
+            unsigned long long end = it->first + KEYSTREAM_SEGMENT_BLOCKS;
+            unsigned long long start = it->first > nextBlock ? it->first : nextBlock;
+            if(end > start) result.readyBytes += (end - start) * 16;
+        }
+        return result;
+    }
+
+    // Blocks until the fillers have reached the high watermark (for warm starts and tests)
+    void waitUntilFull(){
+        std::unique_lock<std::mutex> lock(mutex);
+        filled.wait(lock, [this]{ return (!refilling && inFlight == 0) || !running; });
+    }
+
+private:
+    struct Segment {
+        unsigned long long firstBlock;
+        int users;          // requests reading it right now
+        bool retired;       // taken out of ready; goes back to the pool when users reaches 0
+        unsigned char bytes[KEYSTREAM_SEGMENT];
+    };
+
+    struct Piece {
+        unsigned long long first, end;  // block range of the request inside one segment
+        Segment *segment;               // NULL when the keystream was not ready
+    };
+
+    const CipherBackend &backend;
+    unsigned char expandedKey[176];
+    unsigned char baseCounter[16];
+
+    std::mutex mutex;
+    std::condition_variable refill;     // wakes the fillers
+    std::condition_variable filled;     // signalled when the high watermark is reached
+    std::vector<Segment> pool;
+    std::vector<Segment*> freeSegments;
+    std::map<unsigned long long, Segment*> ready;   // by first block
+    std::vector<std::thread> fillers;
+    size_t highSegments, lowSegments;
+    unsigned long long nextBlock;       // next counter block a request will use
+    unsigned long long fillBlock;       // next segment start a filler will compute
+    size_t inFlight;
+    bool refilling;
+    bool running;
+    ReservoirStats counters;
+
+    void blockCounter(unsigned long long block, unsigned char counter[16]) const {
+        memcpy(counter, baseCounter, 16);
+        addCounter(counter, block);
+    }
+
+    // Wipes the keystream and returns the segment to the pool (called with the lock held)
+    void release(Segment *segment){
+        secureZero(segment->bytes, KEYSTREAM_SEGMENT);
+        segment->retired = false;
+        freeSegments.push_back(segment);
+        refill.notify_one();
+    }
+
+    // Moves segments that requests have completely passed out of ready (called with the lock held)
+    void retirePassedSegments(){
+        while(!ready.empty() && ready.begin()->first + KEYSTREAM_SEGMENT_BLOCKS <= nextBlock){
+            Segment *segment = ready.begin()->second;
+            ready.erase(ready.begin());
+            if(segment->users == 0) release(segment);
+            else segment->retired = true;
+        }
+    }
+
+    void fill(){
+#ifdef __linux__
+        setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), 19);
+#endif
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true){
+            refill.wait(lock, [this]{ return !running || (refilling && !freeSegments.empty()); });
+            if(!running) break;
+
+            // never compute keystream for counters that requests have already used
+            unsigned long long firstUseful = nextBlock - nextBlock % KEYSTREAM_SEGMENT_BLOCKS;
+            if(fillBlock < firstUseful) fillBlock = firstUseful;
+
+            Segment *segment = freeSegments.back();
+            freeSegments.pop_back();
+            segment->firstBlock = fillBlock;
+            fillBlock += KEYSTREAM_SEGMENT_BLOCKS;
+            inFlight++;
+            if(ready.size() + inFlight >= highSegments){
+                refilling = false;
+            }
+
+            lock.unlock();
+            unsigned char *bytes = segment->bytes;
+            unsigned char counter[16];
+            blockCounter(segment->firstBlock, counter);
+            memcpy(bytes, counter, 16);
+            fillCounterBlocks(bytes + 16, counter, KEYSTREAM_SEGMENT_BLOCKS - 1);
+            backend.encryptBlocks(bytes, KEYSTREAM_SEGMENT, expandedKey, bytes);
+            lock.lock();
+
+            inFlight--;
+            if(segment->firstBlock + KEYSTREAM_SEGMENT_BLOCKS <= nextBlock){
+                counters.segmentsDiscarded++;
+                release(segment);
+            } else {
+                counters.segmentsFilled++;
+                ready[segment->firstBlock] = segment;
+            }
+            if(!refilling && inFlight == 0){
+                filled.notify_all();
+            }
+        }
+    }
+
+    KeystreamReservoir(const KeystreamReservoir &);
+    KeystreamReservoir &operator=(const KeystreamReservoir &);
+};
+
+#endif /* RESERVOIR_H */
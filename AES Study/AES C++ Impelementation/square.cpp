@@ -0,0 +1,84 @@
+/*
+    Square Attack on 4-Round AES-128
+
+    - Shows the integral property: a Λ-set (256 plaintexts, one byte taking every value)
+      stays balanced (every byte XORs to zero) for 3 rounds and loses it in the 4th.
+    - Recovers the key of a 4-round AES-128 from chosen plaintexts with the Square attack
+      of square.h, for the key in the keyfile and then for -n random keys, and reports
+      the Λ-sets and time each key took.
+
+    Usage: square [-k keyfile] [-n random keys]
+    Build: g++ -O2 square.cpp -o square.exe
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include "square.h"
+#include "hexcodec.h"
+#include "drbg.h"
+#include "pipeio.h"
+
+using namespace std;
+
+
+int main(int argc, char *argv[]){
+    cout << "=============================" << endl;
+    cout << "  Square Attack, 4-Round AES " << endl;
+    cout << "=============================" << endl;
+
+    string keyPath = "keyfile";
+    int numKeys = 100;
+    const int rounds = 4;
+    for(int i = 1 ; i + 1 < argc ; i += 2){
+        if(strcmp(argv[i], "-k") == 0) keyPath = argv[i + 1];
+        else if(strcmp(argv[i], "-n") == 0) numKeys = atoi(argv[i + 1]);
+    }
+    unsigned char key[16];
+    if(!ReadKeyFile(keyPath, key)){
+        cout << "Unable to read the key from " << keyPath << endl;
+        return 1;
+    }
+
+    cout << "Balanced bytes of a Λ-set after r rounds:" << endl;
+    for(int r = 1 ; r <= 5 ; r++){
+        SquareOracle oracle(key, r);
+        cout << "  " << r << " round" << (r > 1 ? "s" : " ") << "  " << setw(2) << BalancedBytes(oracle) << " / 16" << endl;
+    }
+    cout << endl;
+
+    SquareOracle oracle(key, rounds);
+    SquareResult result = SquareAttack(oracle);
+    cout << "Key in " << keyPath << ":  " << HexEncode(key, 16) << endl;
+    cout << "Recovered key:        " << (result.found ? HexEncode(result.key, 16) : string("none")) << endl;
+    cout << fixed << setprecision(3);
+    cout << "Λ-sets: " << result.lambdaSets << ", chosen plaintexts: " << oracle.queries
+         << ", time: " << result.milliseconds << " ms" << endl << endl;
+    bool ok = result.found && memcmp(result.key, key, 16) == 0;
+
+    // random keys
+    vector<double> times;
+    int recovered = 0, totalSets = 0;
+    CtrDrbg &random = ThreadDrbg();
+    for(int n = 0 ; n < numKeys ; n++){
+        unsigned char randomKey[16];
+        random.generate(randomKey, 16);
+        SquareOracle randomOracle(randomKey, rounds);
+        SquareResult attempt = SquareAttack(randomOracle, (unsigned int) n + 2);
+        if(attempt.found && memcmp(attempt.key, randomKey, 16) == 0) recovered++;
+        totalSets += attempt.lambdaSets;
+        times.push_back(attempt.milliseconds);
+    }
+    if(numKeys > 0){
+        sort(times.begin(), times.end());
+        cout << "Random keys recovered: " << recovered << " / " << numKeys << endl;
+        cout << "Λ-sets per key:        " << setprecision(2) << (double) totalSets / numKeys << " on average" << endl;
+        cout << "Time per key:          " << setprecision(3) << times[times.size() / 2] << " ms median, "
+             << times.back() << " ms max" << endl;
+    }
+    return (ok && recovered == numKeys) ? 0 : 1;
+}
@@ -0,0 +1,295 @@
+/*
+ * square.h - The Square (integral) attack on AES-128 reduced to 4 rounds.
+ *
+ * A Λ-set is 256 plaintexts that take every value in one byte and agree in the other 15.
+ * After three rounds every byte of such a set still XORs to zero ("balanced"), whatever
+ * the key. The fourth round is a final round (SubBytes, ShiftRows, AddRoundKey), so for a
+ * guess k of one byte of the last round key, inv_s[c ^ k] undoes that round for the byte
+ * and has to XOR to zero over the set. A wrong guess passes with probability 1/256, so a
+ * few Λ-sets leave one value per byte: the round-4 key. Running the key schedule
+ * backwards (InvertKeySchedule) gives the cipher key.
+ *
+ * Vectorized check: one AESDECLAST of (ciphertext ^ guess), with its InvShiftRows undone
+ * beforehand, is inv_s of all 16 bytes at once, so a guess is tested for the 16 positions
+ * together: 256 guesses x 256 ciphertexts = 65536 AESDECLAST per Λ-set. Without AES-NI
+ * the same sums are taken with the inv_s table.
+ *
+ * The reduced-round cipher (ReducedEncryptBlocks) is the normal one stopped early:
+ * AddRoundKey, rounds - 1 times Round, then FinalRound with round key number rounds.
+ *
+ * Only 4 rounds are attacked. The 5-round attack uses the same 256-plaintext Λ-sets with
+ * one more round peeled off at the end: reaching one byte before round 4 takes a guess of
+ * the 4 round-5 key bytes of a column (through InvShiftRows) plus one byte of
+ * InvMixColumns(k4), 2^40 guesses per column, each summed over the set. That is about 2^48
+ * inv_s lookups per column and Λ-set, or 2^43 AESDECLAST with the vectorized check and the
+ * parity of the 256 intermediate values: hours per key on one core, against milliseconds
+ * for 4 rounds, so it is left out. (2^32-plaintext structures are for the 6-round extension.)
+ */
+
+#ifndef SQUARE_H
+#define SQUARE_H
+
+#include <cstring>
+#include <vector>
+#include <chrono>
+
+#include "aes.h"
+#include "aesni.h"
+
+#ifdef HAVE_AESNI
+#include <tmmintrin.h>
+#define SQUARE_TARGET __attribute__((target("aes,ssse3")))
+#endif
+
+const int LAMBDA_SET = 256;
+
+
+// The cipher with the given number of rounds (1 to 10), block by block through Round/FinalRound
+void ReducedEncryptReference(const unsigned char * in, size_t length, const unsigned char * expandedKey, int rounds, unsigned char * out){
+    unsigned char *keys = const_cast<unsigned char*>(expandedKey);
+    for(size_t b = 0 ; b < length ; b += 16){
+        unsigned char state[16];
+        memcpy(state, in + b, 16);
+        AddRoundKey(state, keys);
+        for(int r = 1 ; r < rounds ; r++){
+            Round(state, keys + 16 * r);
+        }
+        FinalRound(state, keys + 16 * rounds);
+        memcpy(out + b, state, 16);
+    }
+}
+
+#ifdef HAVE_AESNI
+SQUARE_TARGET void ReducedEncryptAESNI(const unsigned char * in, size_t length, const unsigned char * expandedKey, int rounds, unsigned char * out){
+    __m128i roundKeys[11];
+    AESNILoadKeys(expandedKey, roundKeys);
+    for(size_t b = 0 ; b < length ; b += 16){
+        __m128i block = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (in + b)), roundKeys[0]);
+        for(int r = 1 ; r < rounds ; r++){
+            block = _mm_aesenc_si128(block, roundKeys[r]);
+        }
+        _mm_storeu_si128((__m128i *) (out + b), _mm_aesenclast_si128(block, roundKeys[rounds]));
+    }
+}
+#endif
+
+void ReducedEncryptBlocks(const unsigned char * in, size_t length, const unsigned char * expandedKey, int rounds, unsigned char * out){
+#ifdef HAVE_AESNI
+    if(AESNIAvailable()){
+        ReducedEncryptAESNI(in, length, expandedKey, rounds, out);
+        return;
+    }
+#endif
+    ReducedEncryptReference(in, length, expandedKey, rounds, out);
+}
+
+
+/*
+    The cipher key from the round key of round `round`: each step of KeyExpansion undone,
+    W[i - 4] = W[i] ^ W[i - 1], with SubWord(RotWord(W[i - 1])) ^ rcon for the first word.
+*/
+void InvertKeySchedule(const unsigned char roundKey[16], int round, unsigned char key[16]){
+    unsigned char w[16];
+    memcpy(w, roundKey, 16);
+    for(int r = round ; r >= 1 ; r--){
+        // words 3, 2, 1 of the previous round key: W[i - 4] = W[i] ^ W[i - 1]
+        for(int j = 15 ; j >= 4 ; j--){
+            w[j] ^= w[j - 4];
+        }
+        // word 0 uses the core of the (now restored) last word
+        unsigned char core[4] = { w[13], w[14], w[15], w[12] };
+        for(int j = 0 ; j < 4 ; j++){
+            w[j] ^= s[core[j]];
+        }
+        w[0] ^= rcon[r];
+    }
+    memcpy(key, w, 16);
+}
+
+
+/*
+    XOR over a set of up to LAMBDA_SET ciphertexts of inv_s[c ^ guess] for every guess,
+    all 16 byte positions at once: sums[16 * guess + j] for position j.
+*/
+void InverseSBoxSumsReference(const unsigned char * ciphertexts, int count, unsigned char sums[256 * 16]){
+    memset(sums, 0, 256 * 16);
+    for(int guess = 0 ; guess < 256 ; guess++){
+        for(int i = 0 ; i < count ; i++){
+            for(int j = 0 ; j < 16 ; j++){
+                sums[16 * guess + j] ^= inv_s[ciphertexts[16 * i + j] ^ guess];
+            }
+        }
+    }
+}
+
+#ifdef HAVE_AESNI
+SQUARE_TARGET void InverseSBoxSumsAESNI(const unsigned char * ciphertexts, int count, unsigned char sums[256 * 16]){
+    // ShiftRows, so that the InvShiftRows of AESDECLAST puts every byte back in place
+    const __m128i shiftRows = _mm_setr_epi8(0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i shifted[LAMBDA_SET];
+    for(int i = 0 ; i < count ; i++){
+        shifted[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (ciphertexts + 16 * i)), shiftRows);
+    }
+    for(int guess = 0 ; guess < 256 ; guess++){
+        // a guess is the same in every byte, so it commutes with the shuffle
+        __m128i k = _mm_set1_epi8((char) guess);
+        __m128i sum0 = zero, sum1 = zero, sum2 = zero, sum3 = zero;
+        int i = 0;
+        for(; i + 4 <= count ; i += 4){
+            sum0 = _mm_xor_si128(sum0, _mm_aesdeclast_si128(_mm_xor_si128(shifted[i], k), zero));
+            sum1 = _mm_xor_si128(sum1, _mm_aesdeclast_si128(_mm_xor_si128(shifted[i + 1], k), zero));
+            sum2 = _mm_xor_si128(sum2, _mm_aesdeclast_si128(_mm_xor_si128(shifted[i + 2], k), zero));
+            sum3 = _mm_xor_si128(sum3, _mm_aesdeclast_si128(_mm_xor_si128(shifted[i + 3], k), zero));
+        }
+        for(; i < count ; i++){
+            sum0 = _mm_xor_si128(sum0, _mm_aesdeclast_si128(_mm_xor_si128(shifted[i], k), zero));
+        }
+        __m128i sum = _mm_xor_si128(_mm_xor_si128(sum0, sum1), _mm_xor_si128(sum2, sum3));
+        _mm_storeu_si128((__m128i *) (sums + 16 * guess), sum);
+    }
+}
+#endif
+
+void InverseSBoxSums(const unsigned char * ciphertexts, int count, unsigned char sums[256 * 16]){
+#ifdef HAVE_AESNI
+    if(AESNIAvailable() && __builtin_cpu_supports("ssse3")){
+        InverseSBoxSumsAESNI(ciphertexts, count, sums);
+        return;
+    }
+#endif
+    InverseSBoxSumsReference(ciphertexts, count, sums);
+}
+
+
+// The attacked cipher: a secret key behind a chosen-plaintext interface
+class SquareOracle {
+public:
+    SquareOracle(const unsigned char key[16], int rounds) : rounds(rounds), queries(0) {
+        KeyExpansion(const_cast<unsigned char*>(key), expandedKey);
+    }
+
+    ~SquareOracle(){
+        memset(expandedKey, 0, sizeof(expandedKey));
+    }
+
+    void encrypt(const unsigned char * in, size_t length, unsigned char * out){
+        ReducedEncryptBlocks(in, length, expandedKey, rounds, out);
+        queries += length / 16;
+    }
+
+    int rounds;
+    unsigned long long queries;
+
+private:
+    unsigned char expandedKey[176];
+};
+
+
+struct SquareResult {
+    bool found;
+    unsigned char key[16];
+    int lambdaSets;             // Λ-sets needed to leave one guess per byte
+    double milliseconds;
+};
+
+
+/*
+    Recovers the key of a 4-round oracle. Λ-sets (active byte 0, the other bytes from
+    the seed) are added until every byte of the last round key has one surviving guess;
+    the key is then checked on a plaintext outside the sets.
+    With 3 rounds every byte before the last round runs through all 256 values, so every
+    guess sums to zero and the attack cannot tell them apart; other round counts, 5 included
+    (see the cost above), are refused.
+*/
+SquareResult SquareAttack(SquareOracle & oracle, unsigned int seed = 1, int maxSets = 8){
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    SquareResult result;
+    result.found = false;
+    memset(result.key, 0, 16);
+    result.lambdaSets = 0;
+    result.milliseconds = 0;
+    if(oracle.rounds != 4){
+        return result;
+    }
+
+    // candidates[j][g]: guess g for byte j of the round-4 key is still possible
+    bool candidates[16][256];
+    memset(candidates, 1, sizeof(candidates));
+
+    std::vector<unsigned char> plaintexts(16 * LAMBDA_SET), ciphertexts(16 * LAMBDA_SET);
+    unsigned char sums[256 * 16];
+    unsigned int state = seed;
+    int sets = 0;
+    bool unique = false;
+    while(!unique && sets < maxSets){
+        // constant bytes of this set from a small LCG; byte 0 runs through all values
+        unsigned char constant[16];
+        for(int j = 0 ; j < 16 ; j++){
+            state = state * 1103515245U + 12345U;
+            constant[j] = (unsigned char) (state >> 16);
+        }
+        for(int i = 0 ; i < LAMBDA_SET ; i++){
+            memcpy(&plaintexts[16 * i], constant, 16);
+            plaintexts[16 * i] = (unsigned char) i;
+        }
+        oracle.encrypt(plaintexts.data(), plaintexts.size(), ciphertexts.data());
+        sets++;
+
+        InverseSBoxSums(ciphertexts.data(), LAMBDA_SET, sums);
+        unique = true;
+        for(int j = 0 ; j < 16 ; j++){
+            int left = 0;
+            for(int g = 0 ; g < 256 ; g++){
+                if(sums[16 * g + j] != 0) candidates[j][g] = false;
+                if(candidates[j][g]) left++;
+            }
+            if(left != 1) unique = false;
+        }
+    }
+    result.lambdaSets = sets;
+
+    if(unique){
+        unsigned char roundKey[16];
+        for(int j = 0 ; j < 16 ; j++){
+            for(int g = 0 ; g < 256 ; g++){
+                if(candidates[j][g]) roundKey[j] = (unsigned char) g;
+            }
+        }
+        InvertKeySchedule(roundKey, oracle.rounds, result.key);
+
+        // confirm on a fresh plaintext
+        unsigned char expandedKey[176], probe[16], expected[16], actual[16];
+        for(int j = 0 ; j < 16 ; j++) probe[j] = (unsigned char) (0xa5 ^ (j * 17));
+        oracle.encrypt(probe, 16, expected);
+        KeyExpansion(result.key, expandedKey);
+        ReducedEncryptBlocks(probe, 16, expandedKey, oracle.rounds, actual);
+        result.found = memcmp(expected, actual, 16) == 0;
+    }
+    result.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+
+/*
+    The distinguisher behind the attack: for one Λ-set through `rounds` rounds, the number
+    of ciphertext bytes that XOR to zero (16 up to 3 rounds, about 16/256 after that).
+*/
+int BalancedBytes(SquareOracle & oracle, unsigned char constant = 0x3c){
+    std::vector<unsigned char> plaintexts(16 * LAMBDA_SET, constant), ciphertexts(16 * LAMBDA_SET);
+    for(int i = 0 ; i < LAMBDA_SET ; i++){
+        plaintexts[16 * i] = (unsigned char) i;
+    }
+    oracle.encrypt(plaintexts.data(), plaintexts.size(), ciphertexts.data());
+    unsigned char sum[16] = { 0 };
+    for(int i = 0 ; i < LAMBDA_SET ; i++){
+        for(int j = 0 ; j < 16 ; j++) sum[j] ^= ciphertexts[16 * i + j];
+    }
+    int balanced = 0;
+    for(int j = 0 ; j < 16 ; j++){
+        if(sum[j] == 0) balanced++;
+    }
+    return balanced;
+}
+
+#endif /* SQUARE_H */
@@ -0,0 +1,574 @@
+/*
+    AES Cross-Backend Validation Harness
+
+    - Checks every available backend (backends.h) against the FIPS-197 and
+      NIST SP 800-38A (ECB, CBC, CTR) known-answer vectors, and AES-CMAC (cmac.h)
+      against the RFC 4493 ones, one message at a time and interleaved.
+    - Checks the randomness tests (randomness.h) against the worked examples of
+      SP 800-22, and the streaming version against the bit-by-bit reference.
+    - Then runs random keys, IVs, messages and lengths through every backend and mode
+      on all cores, compares each output against the reference AESEncrypt/AESDecrypt,
+      and checks that decryption gives back the plaintext. Each case also MACs up to
+      17 prefixes of its plaintext with AESCMACMany (4 and 8 lanes) and referenceCMAC.
+    - Stops at the first divergence and prints what is needed to reproduce it:
+      the seed and case number (replay with -s and -c), key, IV, length and the first
+      block that differs.
+
+    Usage: validate [-d seconds] [-n cases] [-t threads] [-s seed] [-c case to replay]
+    Build: g++ -O2 -pthread validate.cpp -o validate.exe
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include "modes.h"
+#include "cmac.h"
+#include "randomness.h"
+
+using namespace std;
+
+
+enum Mode { MODE_ECB, MODE_CBC, MODE_CTR, NUM_MODES };
+const char * const modeNames[NUM_MODES] = { "ECB", "CBC", "CTR" };
+
+const size_t MAX_CASE_BLOCKS = 512;     // random messages are 1..512 blocks (8 KB)
+
+
+// --------------------------------------------------------
+// Hex helpers
+// --------------------------------------------------------
+
+vector<unsigned char> fromHex(const char *hex){
+    vector<unsigned char> bytes;
+    for(size_t i = 0 ; hex[i] && hex[i + 1] ; i += 2){
+        unsigned int value;
+        sscanf(hex + i, "%2x", &value);
+        bytes.push_back((unsigned char) value);
+    }
+    return bytes;
+}
+
+string toHex(const unsigned char *bytes, size_t length){
+    ostringstream out;
+    out << hex << setfill('0');
+    for(size_t i = 0 ; i < length ; i++){
+        out << setw(2) << (int) bytes[i];
+    }
+    return out.str();
+}
+
+
+// Runs one mode on a backend; iv is the IV (CBC) or initial counter (CTR) and is not modified
+void runMode(const CipherBackend &backend, Mode mode, bool encrypt, const unsigned char *in, size_t length,
+             const unsigned char *expandedKey, const unsigned char iv[16], unsigned char *out){
+    unsigned char chain[16];
+    memcpy(chain, iv, 16);
+    switch(mode){
+    case MODE_ECB:
+        (encrypt ? backend.encryptBlocks : backend.decryptBlocks)(in, length, expandedKey, out);
+        break;
+    case MODE_CBC:
+        if(encrypt) AESEncryptCBC(backend, in, length, expandedKey, chain, out);
+        else AESDecryptCBC(backend, in, length, expandedKey, chain, out);
+        break;
+    default:
+        AESCryptCTR(backend, in, length, expandedKey, chain, out);
+        break;
+    }
+}
+
+
+// --------------------------------------------------------
+// Known-answer tests
+// --------------------------------------------------------
+
+struct KnownAnswer {
+    const char *name;
+    Mode mode;
+    const char *key;
+    const char *iv;
+    const char *plaintext;
+    const char *ciphertext;
+};
+
+const char * const SP800_38A_KEY = "2b7e151628aed2a6abf7158809cf4f3c";
+const char * const SP800_38A_PLAINTEXT =
+    "6bc1bee22e409f96e93d7e117393172a" "ae2d8a571e03ac9c9eb76fac45af8e51"
+    "30c81c46a35ce411e5fbc1191a0a52ef" "f69f2445df4f9b17ad2b417be66c3710";
+
+const KnownAnswer knownAnswers[] = {
+    { "FIPS-197 Appendix B", MODE_ECB, "2b7e151628aed2a6abf7158809cf4f3c", "",
+      "3243f6a8885a308d313198a2e0370734", "3925841d02dc09fbdc118597196a0b32" },
+    { "FIPS-197 Appendix C.1", MODE_ECB, "000102030405060708090a0b0c0d0e0f", "",
+      "00112233445566778899aabbccddeeff", "69c4e0d86a7b0430d8cdb78070b4c55a" },
+    { "SP 800-38A F.1.1 ECB-AES128", MODE_ECB, SP800_38A_KEY, "", SP800_38A_PLAINTEXT,
+      "3ad77bb40d7a3660a89ecaf32466ef97" "f5d3d58503b9699de785895a96fdbaaf"
+      "43b1cd7f598ece23881b00e3ed030688" "7b0c785e27e8ad3f8223207104725dd4" },
+    { "SP 800-38A F.2.1 CBC-AES128", MODE_CBC, SP800_38A_KEY, "000102030405060708090a0b0c0d0e0f", SP800_38A_PLAINTEXT,
+      "7649abac8119b246cee98e9b12e9197d" "5086cb9b507219ee95db113a917678b2"
+      "73bed6b8e3c1743b7116e69e22229516" "3ff1caa1681fac09120eca307586e1a7" },
+    { "SP 800-38A F.5.1 CTR-AES128", MODE_CTR, SP800_38A_KEY, "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff", SP800_38A_PLAINTEXT,
+      "874d6191b620e3261bef6864990db6ce" "9806f66b7970fdff8617187bb9fffdff"
+      "5ae4df3edbd5d35e5b4f09020db03eab" "1e031dda2fbe03d1792170a0f3009cee" },
+};
+
+// Returns the number of failures
+int runKnownAnswers(){
+    int failures = 0;
+    for(size_t k = 0 ; k < sizeof(knownAnswers) / sizeof(knownAnswers[0]) ; k++){
+        const KnownAnswer &kat = knownAnswers[k];
+        vector<unsigned char> key = fromHex(kat.key);
+        vector<unsigned char> iv = fromHex(kat.iv);
+        vector<unsigned char> plaintext = fromHex(kat.plaintext);
+        vector<unsigned char> ciphertext = fromHex(kat.ciphertext);
+        iv.resize(16);
+
+        unsigned char expandedKey[176];
+        KeyExpansion(&key[0], expandedKey);
+
+        for(int b = 0 ; b < NUM_BACKENDS ; b++){
+            const CipherBackend &backend = cipherBackends[b];
+            if(!backend.available()) continue;
+
+            vector<unsigned char> out(plaintext.size());
+            runMode(backend, kat.mode, true, &plaintext[0], plaintext.size(), expandedKey, &iv[0], &out[0]);
+            bool encryptOk = out == ciphertext;
+            runMode(backend, kat.mode, false, &ciphertext[0], ciphertext.size(), expandedKey, &iv[0], &out[0]);
+            bool decryptOk = out == plaintext;
+
+            cout << "  " << left << setw(30) << kat.name << setw(11) << backend.name
+                 << (encryptOk ? "encrypt ok   " : "encrypt FAIL ") << (decryptOk ? "decrypt ok" : "decrypt FAIL") << endl;
+            failures += !encryptOk + !decryptOk;
+        }
+    }
+    cout << right;
+    return failures;
+}
+
+
+// RFC 4493 section 4: subkeys and the tags of 0, 16, 40 and 64 bytes of SP800_38A_PLAINTEXT
+const char * const RFC4493_K1 = "fbeed618357133667c85e08f7236a8de";
+const char * const RFC4493_K2 = "f7ddac306ae266ccf90bc11ee46d513b";
+const size_t rfc4493Lengths[] = { 0, 16, 40, 64 };
+const char * const rfc4493Tags[] = {
+    "bb1d6929e95937287fa37d129b756746", "070a16b46b4d4144f79bdd9dd04a287c",
+    "dfa66747de9ae63030ca32611497c827", "51f0bebf7e3b9d92fc49741779363cfe" };
+
+// Checks the subkeys, then every tag through AESCMAC and through AESCMACMany with 4 and 8
+// lanes (the four messages in one call, so lanes finish at different steps). With only four
+// messages 8 lanes fall back to the serial code, so the tags are also checked with the
+// messages repeated 5 times in rotating order; returns the number of failures
+int runCMACKnownAnswers(){
+    vector<unsigned char> key = fromHex(SP800_38A_KEY);
+    vector<unsigned char> plaintext = fromHex(SP800_38A_PLAINTEXT);
+    CMACKey cmacKey(&key[0]);
+    int failures = 0;
+
+    bool subkeysOk = toHex(cmacKey.k1, 16) == RFC4493_K1 && toHex(cmacKey.k2, 16) == RFC4493_K2;
+    cout << "  " << left << setw(30) << "RFC 4493 subkeys" << setw(11) << "" << (subkeysOk ? "ok" : "FAIL") << endl;
+    failures += !subkeysOk;
+
+    const int count = sizeof(rfc4493Lengths) / sizeof(rfc4493Lengths[0]);
+    const unsigned char *messages[count];
+    unsigned char many4[16 * count], many8[16 * count];
+    for(int m = 0 ; m < count ; m++) messages[m] = &plaintext[0];
+    AESCMACMany(cmacKey, messages, rfc4493Lengths, count, many4, 4);
+    AESCMACMany(cmacKey, messages, rfc4493Lengths, count, many8, 8);
+
+    for(int m = 0 ; m < count ; m++){
+        unsigned char single[16];
+        AESCMAC(cmacKey, &plaintext[0], rfc4493Lengths[m], single);
+        bool singleOk = toHex(single, 16) == rfc4493Tags[m];
+        bool manyOk = toHex(many4 + 16 * m, 16) == rfc4493Tags[m] && toHex(many8 + 16 * m, 16) == rfc4493Tags[m];
+        ostringstream name;
+        name << "RFC 4493 AES-CMAC " << rfc4493Lengths[m] << " bytes";
+        cout << "  " << left << setw(30) << name.str() << setw(11) << (AESNIAvailable() ? "aesni" : "reference")
+             << (singleOk ? "single ok    " : "single FAIL  ") << (manyOk ? "lanes ok" : "lanes FAIL") << endl;
+        failures += !singleOk + !manyOk;
+    }
+
+    // more messages than lanes, mixed lengths, so every lane is refilled mid-run
+    const int repeated = 5 * count;
+    const unsigned char *repeatedMessages[repeated];
+    size_t repeatedLengths[repeated];
+    unsigned char repeated4[16 * repeated], repeated8[16 * repeated];
+    for(int m = 0 ; m < repeated ; m++){
+        repeatedMessages[m] = &plaintext[0];
+        repeatedLengths[m] = rfc4493Lengths[(m + m / count) % count];
+    }
+    AESCMACMany(cmacKey, repeatedMessages, repeatedLengths, repeated, repeated4, 4);
+    AESCMACMany(cmacKey, repeatedMessages, repeatedLengths, repeated, repeated8, 8);
+    bool repeatedOk = true;
+    for(int m = 0 ; m < repeated ; m++){
+        const char *tag = rfc4493Tags[(m + m / count) % count];
+        repeatedOk = repeatedOk && toHex(repeated4 + 16 * m, 16) == tag && toHex(repeated8 + 16 * m, 16) == tag;
+    }
+    cout << "  " << left << setw(30) << "RFC 4493 AES-CMAC x5 mixed" << setw(11) << (AESNIAvailable() ? "aesni" : "reference")
+         << (repeatedOk ? "lanes ok" : "lanes FAIL") << endl;
+    failures += !repeatedOk;
+
+    cout << right;
+    return failures;
+}
+
+
+// --------------------------------------------------------
+// Random differential cases
+// --------------------------------------------------------
+
+// splitmix64: a small, fast generator; every case is seeded from (seed, case) so it can be replayed alone
+unsigned long long splitmix64(unsigned long long &state){
+    unsigned long long z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void fillRandom(unsigned long long &state, unsigned char *buffer, size_t length){
+    size_t i = 0;
+    for(; i + 8 <= length ; i += 8){
+        unsigned long long word = splitmix64(state);
+        memcpy(buffer + i, &word, 8);
+    }
+    if(i < length){
+        unsigned long long word = splitmix64(state);
+        memcpy(buffer + i, &word, length - i);
+    }
+}
+
+struct TestCase {
+    Mode mode;
+    unsigned char key[16];
+    unsigned char iv[16];
+    size_t length;
+};
+
+void makeCase(unsigned long long seed, unsigned long long caseIndex, TestCase &c, unsigned char *plaintext){
+    unsigned long long state = seed ^ (caseIndex * 0xd1b54a32d192ed03ULL);
+    splitmix64(state);
+    c.mode = (Mode) (caseIndex % NUM_MODES);
+    fillRandom(state, c.key, 16);
+    fillRandom(state, c.iv, 16);
+    c.length = (1 + splitmix64(state) % MAX_CASE_BLOCKS) * 16;
+    if(c.mode == MODE_CTR){
+        c.length -= splitmix64(state) % 16;    // CTR also covers partial final blocks
+    }
+    fillRandom(state, plaintext, c.length);
+}
+
+struct Divergence {
+    bool found;
+    unsigned long long caseIndex;
+    string report;
+};
+
+// Describes the first differing block between expected and actual
+string describeMismatch(const char *backend, const char *operation, unsigned long long seed, unsigned long long caseIndex,
+                        const TestCase &c, const unsigned char *expected, const unsigned char *actual){
+    size_t offset = 0;
+    while(offset < c.length && expected[offset] == actual[offset]) offset++;
+    offset -= offset % 16;
+    size_t n = c.length - offset < 16 ? c.length - offset : 16;
+
+    ostringstream out;
+    out << "Divergence: backend " << backend << ", " << modeNames[c.mode] << " " << operation << endl;
+    out << "  replay:   validate -s " << seed << " -c " << caseIndex << endl;
+    out << "  key:      " << toHex(c.key, 16) << endl;
+    out << "  iv/ctr:   " << toHex(c.iv, 16) << endl;
+    out << "  length:   " << c.length << " bytes" << endl;
+    out << "  block:    " << offset / 16 << " (byte offset " << offset << ")" << endl;
+    out << "  expected: " << toHex(expected + offset, n) << endl;
+    out << "  actual:   " << toHex(actual + offset, n) << endl;
+    return out.str();
+}
+
+/*
+    Runs one case through every backend, then MACs prefixes of its plaintext with
+    AESCMACMany and referenceCMAC. Returns the number of blocks checked,
+    or 0 and fills report when a backend disagrees with the reference.
+*/
+unsigned long long runCase(unsigned long long seed, unsigned long long caseIndex, unsigned char *buffers[4], string &report){
+    TestCase c;
+    unsigned char *plaintext = buffers[0], *expected = buffers[1], *actual = buffers[2], *roundTrip = buffers[3];
+    makeCase(seed, caseIndex, c, plaintext);
+
+    unsigned char expandedKey[176];
+    KeyExpansion(c.key, expandedKey);
+
+    runMode(ReferenceBackend(), c.mode, true, plaintext, c.length, expandedKey, c.iv, expected);
+
+    unsigned long long blocks = 0;
+    for(int b = 0 ; b < NUM_BACKENDS ; b++){
+        const CipherBackend &backend = cipherBackends[b];
+        if(!backend.available()) continue;
+
+        if(b != 0){
+            runMode(backend, c.mode, true, plaintext, c.length, expandedKey, c.iv, actual);
+            if(memcmp(expected, actual, c.length) != 0){
+                report = describeMismatch(backend.name, "encrypt", seed, caseIndex, c, expected, actual);
+                return 0;
+            }
+        }
+        runMode(backend, c.mode, false, expected, c.length, expandedKey, c.iv, roundTrip);
+        if(memcmp(plaintext, roundTrip, c.length) != 0){
+            report = describeMismatch(backend.name, "decrypt", seed, caseIndex, c, plaintext, roundTrip);
+            return 0;
+        }
+        blocks += (c.length + 15) / 16;
+    }
+
+    // AES-CMAC of up to 2 * CMAC_LANES + 1 prefixes of the plaintext, 4 and 8 lanes against the reference
+    unsigned long long state = seed ^ (caseIndex * 0x9e3779b97f4a7c15ULL);
+    const size_t numMessages = 1 + caseIndex % (2 * CMAC_LANES + 1);
+    const unsigned char *messages[2 * CMAC_LANES + 1];
+    size_t lengths[2 * CMAC_LANES + 1];
+    for(size_t m = 0 ; m < numMessages ; m++){
+        messages[m] = plaintext;
+        lengths[m] = splitmix64(state) % (c.length + 1);
+    }
+    CMACKey cmacKey(c.key);
+    for(size_t m = 0 ; m < numMessages ; m++){
+        referenceCMAC(cmacKey, messages[m], lengths[m], expected + 16 * m);
+    }
+    for(int lanes = 4 ; lanes <= CMAC_LANES ; lanes += 4){
+        AESCMACMany(cmacKey, messages, lengths, numMessages, actual, lanes);
+        for(size_t m = 0 ; m < numMessages ; m++){
+            if(memcmp(expected + 16 * m, actual + 16 * m, 16) != 0){
+                ostringstream out;
+                out << "Divergence: AESCMACMany with " << lanes << " lanes, message " << m << " of " << numMessages << endl;
+                out << "  replay:   validate -s " << seed << " -c " << caseIndex << endl;
+                out << "  key:      " << toHex(c.key, 16) << endl;
+                out << "  length:   " << lengths[m] << " bytes" << endl;
+                out << "  expected: " << toHex(expected + 16 * m, 16) << endl;
+                out << "  actual:   " << toHex(actual + 16 * m, 16) << endl;
+                report = out.str();
+                return 0;
+            }
+        }
+    }
+    return blocks;
+}
+
+
+// --------------------------------------------------------
+// Randomness tests (randomness.h)
+// --------------------------------------------------------
+
+// The worked examples of SP 800-22 section 2: bits, the parameters that differ from the
+// defaults, the result and its P-value as printed there
+struct RandomnessExample {
+    const char *name;
+    const char *bits;
+    RandomnessResult result;
+    unsigned long long blockBits;
+    int longestRunBlock, length;
+    double p;
+};
+
+const char * const SP800_22_EPSILON_100 =
+    "1100100100001111110110101010001000100001011010001100001000110100110001001100011001100010100010111000";
+
+const RandomnessExample randomnessExamples[] = {
+    { "monobit 2.1.4", "1011010101", RT_MONOBIT, 3, 8, 3, 0.527089 },
+    { "monobit 2.1.8", SP800_22_EPSILON_100, RT_MONOBIT, 3, 8, 3, 0.109599 },
+    { "block freq 2.2.4", "0110011010", RT_BLOCK_FREQUENCY, 3, 8, 3, 0.801252 },
+    { "block freq 2.2.8", SP800_22_EPSILON_100, RT_BLOCK_FREQUENCY, 10, 8, 3, 0.706438 },
+    { "runs 2.3.4", "1001101011", RT_RUNS, 3, 8, 3, 0.147232 },
+    { "runs 2.3.8", SP800_22_EPSILON_100, RT_RUNS, 3, 8, 3, 0.500798 },
+    { "longest run 2.4.8", "11001100000101010110110001001100111000000000001001001101010100010001001111010110"
+                                  "100000001101011111001100111001101101100010110010", RT_LONGEST_RUN, 3, 8, 3, 0.180609 },
+    { "serial 2.11.4 P1", "0011011101", RT_SERIAL_1, 3, 8, 3, 0.808792 },
+    { "serial 2.11.4 P2", "0011011101", RT_SERIAL_2, 3, 8, 3, 0.670320 },
+    { "apen 2.12.4", "0100110101", RT_APPROXIMATE_ENTROPY, 3, 8, 3, 0.261961 },
+    { "apen 2.12.8", SP800_22_EPSILON_100, RT_APPROXIMATE_ENTROPY, 3, 8, 2, 0.235301 },
+    { "cusum 2.13.4", "1011010111", RT_CUSUM_FORWARD, 3, 8, 3, 0.4116588 },
+    { "cusum 2.13.8 fwd", SP800_22_EPSILON_100, RT_CUSUM_FORWARD, 3, 8, 3, 0.219194 },
+    { "cusum 2.13.8 bwd", SP800_22_EPSILON_100, RT_CUSUM_BACKWARD, 3, 8, 3, 0.114866 },
+};
+
+bool sameStatistics(const RandomnessStatistics &a, const RandomnessStatistics &b){
+    bool same = a.bits == b.bits && a.ones == b.ones && a.runs == b.runs && a.blocks == b.blocks &&
+                a.blockDeviation == b.blockDeviation && a.longestRunBlocks == b.longestRunBlocks &&
+                a.sum == b.sum && a.maxSum == b.maxSum && a.minSum == b.minSum;
+    for(int c = 0 ; c < 7 ; c++) same = same && a.longestRunClasses[c] == b.longestRunClasses[c];
+    for(int l = 1 ; l <= RANDOMNESS_MAX_PATTERN ; l++) same = same && a.patterns[l] == b.patterns[l];
+    return same;
+}
+
+// Checks the reference statistics against the SP 800-22 examples, then the streaming tests
+// against the reference on random data fed in pieces of random lengths; returns the number of failures
+int runRandomnessKnownAnswers(){
+    int failures = 0;
+    for(size_t e = 0 ; e < sizeof(randomnessExamples) / sizeof(randomnessExamples[0]) ; e++){
+        const RandomnessExample &example = randomnessExamples[e];
+        RandomnessParams params;
+        params.blockFrequencyBits = example.blockBits;
+        params.longestRunBlock = example.longestRunBlock;
+        params.serialLength = example.length;
+        params.entropyLength = example.length;
+        vector<unsigned char> bits;
+        for(const char *b = example.bits ; *b ; b++) bits.push_back(*b == '1');
+        RandomnessReport report = EvaluateRandomness(referenceRandomnessStatistics(bits, params), params);
+        bool ok = fabs(report.p[example.result] - example.p) < 5e-6;
+        cout << "  " << left << setw(30) << (string("SP 800-22 ") + example.name) << setw(11) << "reference"
+             << (ok ? "ok" : "FAIL") << endl;
+        failures += !ok;
+    }
+
+    unsigned long long state = 1;
+    const int blockSizes[] = { 8, 128, 10000 };
+    for(int b = 0 ; b < 3 ; b++){
+        bool ok = true;
+        const size_t lengths[] = { 1, 7, 9, 1250, 5003, 40000 };
+        for(size_t l = 0 ; l < sizeof(lengths) / sizeof(lengths[0]) ; l++){
+            vector<unsigned char> data(lengths[l]);
+            fillRandom(state, &data[0], data.size());
+            // long runs of ones, so that runs cross words and blocks
+            for(size_t i = 0 ; i < data.size() ; i++){
+                if(splitmix64(state) % 4 == 0) data[i] = 0xff;
+            }
+            RandomnessParams params;
+            params.blockFrequencyBits = 128;
+            params.longestRunBlock = blockSizes[b];
+            RandomnessTests stream(params);
+            for(size_t i = 0 ; i < data.size() ; ){
+                size_t piece = min<size_t>(data.size() - i, 1 + splitmix64(state) % 40);
+                stream.update(&data[i], piece);
+                i += piece;
+            }
+            vector<unsigned char> bits;
+            for(size_t i = 0 ; i < data.size() ; i++){
+                for(int k = 7 ; k >= 0 ; k--) bits.push_back((data[i] >> k) & 1);
+            }
+            ok = ok && sameStatistics(stream.statistics(), referenceRandomnessStatistics(bits, params));
+        }
+        ostringstream name;
+        name << "Streaming tests, M = " << blockSizes[b];
+        cout << "  " << left << setw(30) << name.str() << setw(11) << "stream" << (ok ? "ok" : "FAIL") << endl;
+        failures += !ok;
+    }
+    cout << right;
+    return failures;
+}
+
+
+int main(int argc, char *argv[]){
+    cout << "=============================" << endl;
+    cout << " AES Cross-Backend Validation " << endl;
+    cout << "=============================" << endl;
+
+    double seconds = 10;
+    unsigned long long maxCases = 0;            // 0: run for the given time
+    unsigned long long seed = (unsigned long long) time(NULL);
+    long long replayCase = -1;
+    int numThreads = (int) thread::hardware_concurrency();
+
+    for(int i = 1 ; i + 1 < argc ; i += 2){
+        if(strcmp(argv[i], "-d") == 0) seconds = atof(argv[i + 1]);
+        else if(strcmp(argv[i], "-n") == 0) maxCases = strtoull(argv[i + 1], NULL, 10);
+        else if(strcmp(argv[i], "-t") == 0) numThreads = atoi(argv[i + 1]);
+        else if(strcmp(argv[i], "-s") == 0) seed = strtoull(argv[i + 1], NULL, 10);
+        else if(strcmp(argv[i], "-c") == 0) replayCase = atoll(argv[i + 1]);
+        else {
+            cout << "Unknown option " << argv[i] << endl;
+            return 1;
+        }
+    }
+    if(numThreads < 1) numThreads = 1;
+
+    cout << "Backends:";
+    for(int b = 0 ; b < NUM_BACKENDS ; b++){
+        cout << " " << cipherBackends[b].name << (cipherBackends[b].available() ? "" : " (unavailable)");
+    }
+    cout << endl << endl << "Known-answer tests:" << endl;
+    int failures = runKnownAnswers() + runCMACKnownAnswers() + runRandomnessKnownAnswers();
+    if(failures > 0){
+        cout << failures << " known-answer checks failed" << endl;
+        return 1;
+    }
+
+    if(replayCase >= 0){
+        vector<unsigned char> storage(4 * MAX_CASE_BLOCKS * 16);
+        unsigned char *buffers[4];
+        for(int i = 0 ; i < 4 ; i++) buffers[i] = &storage[i * MAX_CASE_BLOCKS * 16];
+        string report;
+        bool ok = runCase(seed, (unsigned long long) replayCase, buffers, report) > 0;
+        cout << endl << "Case " << replayCase << " of seed " << seed << ": " << (ok ? "all backends agree" : "") << endl << report;
+        return ok ? 0 : 1;
+    }
+
+    cout << endl << "Differential run, seed " << seed << ", " << numThreads << " threads" << endl;
+
+    atomic<unsigned long long> nextCase(0);
+    atomic<unsigned long long> totalBlocks(0);
+    atomic<bool> stop(false);
+    Divergence divergence = { false, 0, "" };
+    mutex divergenceMutex;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    chrono::steady_clock::time_point deadline = start + chrono::microseconds((long long) (seconds * 1e6));
+
+    vector<thread> workers;
+    for(int t = 0 ; t < numThreads ; t++){
+        workers.push_back(thread([&]() {
+            vector<unsigned char> storage(4 * MAX_CASE_BLOCKS * 16);
+            unsigned char *buffers[4];
+            for(int i = 0 ; i < 4 ; i++) buffers[i] = &storage[i * MAX_CASE_BLOCKS * 16];
+
+            unsigned long long blocks = 0;
+            while(!stop.load(memory_order_relaxed)){
+                // claim cases in batches so the shared counter is not contended
+                unsigned long long first = nextCase.fetch_add(64);
+                for(unsigned long long n = first ; n < first + 64 ; n++){
+                    if(maxCases && n >= maxCases){
+                        stop = true;
+                        break;
+                    }
+                    string report;
+                    unsigned long long checked = runCase(seed, n, buffers, report);
+                    if(checked == 0){
+                        lock_guard<mutex> lock(divergenceMutex);
+                        if(!divergence.found || n < divergence.caseIndex){
+                            divergence.found = true;
+                            divergence.caseIndex = n;
+                            divergence.report = report;
+                        }
+                        stop = true;
+                        break;
+                    }
+                    blocks += checked;
+                }
+                if(!maxCases && chrono::steady_clock::now() >= deadline){
+                    stop = true;
+                }
+            }
+            totalBlocks += blocks;
+        }));
+    }
+    for(size_t t = 0 ; t < workers.size() ; t++){
+        workers[t].join();
+    }
+
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    unsigned long long cases = maxCases && nextCase.load() > maxCases ? maxCases : nextCase.load();
+    cout << "  cases:          " << cases << endl;
+    cout << "  blocks checked: " << totalBlocks.load() << endl;
+    cout << "  blocks/hour:    " << scientific << setprecision(3) << totalBlocks.load() / elapsed * 3600 << endl;
+
+    if(divergence.found){
+        cout << endl << divergence.report;
+        return 1;
+    }
+    cout << endl << "All backends agree with the reference" << endl;
+    return 0;
+}